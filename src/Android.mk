@@ -52,25 +52,34 @@ LOCAL_SRC_FILES :=              \
 	i965_avc_bsd.c		\
 	i965_avc_hw_scoreboard.c\
 	i965_avc_ildb.c		\
+	i965_bsd_scheduler.c	\
 	i965_decoder_utils.c	\
 	i965_device_info.c	\
 	i965_drv_video.c	\
 	i965_encoder.c		\
 	i965_encoder_utils.c	\
+	i965_frame_store.c	\
 	i965_media.c		\
 	i965_media_h264.c	\
 	i965_media_mpeg2.c	\
 	i965_gpe_utils.c	\
+	i965_jpeg_huffman.c	\
 	i965_post_processing.c	\
 	gen8_post_processing.c	\
+	i965_record.c		\
 	i965_render.c		\
+	i965_stats.c		\
+	i965_trace.c		\
 	i965_vpp_avs.c		\
+	i965_vpp_compose.c	\
 	gen8_render.c		\
 	gen9_render.c		\
 	intel_batchbuffer.c	\
 	intel_batchbuffer_dump.c\
 	intel_driver.c		\
 	intel_memman.c		\
+	intel_mfc_pak.c		\
+	intel_mock_bufmgr.c	\
 	object_heap.c		\
 	intel_media_common.c		\
 	$(NULL)
@@ -35,6 +35,7 @@
 
 #include "i965_gpe_utils.h"
 #include "i965_encoder.h"
+#include "intel_mfc_pak.h"
 
 struct encode_state;
 
@@ -272,6 +273,7 @@ struct gen6_mfc_context
  
     struct {
         unsigned char *vp8_frame_header;
+        int frame_header_buffer_size;   /* in dwords */
         unsigned int frame_header_bit_count;
         unsigned int frame_header_qindex_update_pos;
         unsigned int frame_header_lf_update_pos;
@@ -304,6 +306,28 @@ struct gen6_mfc_context
     //"buffered_QMatrix" will be used to buffer the QMatrix if the app sends one.
     // Or else, we will load a default QMatrix from the driver for JPEG encode.
     VAQMatrixBufferJPEG buffered_qmatrix;
+
+    //JPEG quantizer tables last derived for MFX_FQM_STATE, index 0 for luma
+    //and 1 for chroma. See gen8_mfc_jpeg_get_dword_qm().
+    struct {
+        unsigned char valid[2];
+        unsigned int quality[2];
+        unsigned char qm[2][64];
+        unsigned char scaled_qm[2][64];
+        uint32_t dword_qm[2][32];
+    } jpeg_fqm_cache;
+
+    //Huffman tables built from the statistics of the current JPEG picture
+    //(VA_INTEL_JPEG_OPTIMIZE_HUFFMAN), and the packed headers carrying them.
+    //See gen8_mfc_jpeg_optimize_huffman().
+    struct {
+        int enabled;
+        int valid;
+        VAHuffmanTableBufferJPEGBaseline huff_buffer;
+        unsigned char *header;
+        unsigned int header_size;
+        unsigned int header_bits;
+    } jpeg_huffman;
     struct i965_gpe_context gpe_context;
     struct i965_buffer_surface mfc_batchbuffer_surface;
     struct intel_batchbuffer *aux_batchbuffer;
@@ -395,4 +419,33 @@ intel_avc_slice_insert_packed_data(VADriverContextP ctx,
 extern
 Bool gen9_mfc_context_init(VADriverContextP ctx, struct intel_encoder_context *encoder_context);
 
+/* Software PAK batch generation across slices */
+#define INTEL_MFC_MAX_SLICE_THREADS             8
+#define INTEL_MFC_MIN_MBS_PER_SLICE_THREAD      1200
+
+/*
+ * Programs one slice into slice_batch, reading the VME output through the
+ * vme_output mapping. It may run on a worker thread, with private copies of
+ * the encoder, MFC and VME contexts, so it must not touch any BO nor keep
+ * anything in those contexts.
+ */
+typedef void (*intel_mfc_slice_programing_func)(VADriverContextP ctx,
+                                                struct encode_state *encode_state,
+                                                struct intel_encoder_context *encoder_context,
+                                                int slice_index,
+                                                unsigned char *vme_output,
+                                                struct intel_batchbuffer *slice_batch);
+
+extern void
+intel_mfc_avc_slice_batchbuffers(VADriverContextP ctx,
+                                 struct encode_state *encode_state,
+                                 struct intel_encoder_context *encoder_context,
+                                 intel_mfc_slice_programing_func slice_programing,
+                                 struct intel_batchbuffer *batch);
+
+/* Appends the VME output of the picture to VA_INTEL_VME_DUMP, if set */
+extern void
+intel_mfc_avc_vme_dump(struct encode_state *encode_state,
+                       struct intel_encoder_context *encoder_context);
+
 #endif	/* _GEN6_MFC_BCS_H_ */
@@ -32,6 +32,8 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "intel_batchbuffer.h"
 #include "i965_defines.h"
@@ -1046,6 +1048,170 @@ static inline int loop_in_bounds(int x_index, int y_index, int first_mb, int num
     return 0;
 }
 
+static void
+intel_vme_batchbuffer_bind(VADriverContextP ctx,
+                           struct gen6_vme_context *vme_context)
+{
+    if (!vme_context->vme_batchbuffer.bo || !vme_context->vme_batchbuffer_binding.enabled)
+        return;
+
+    vme_context->vme_buffer_suface_setup(ctx,
+                                         &vme_context->gpe_context,
+                                         &vme_context->vme_batchbuffer,
+                                         vme_context->vme_batchbuffer_binding.binding_table_offset,
+                                         vme_context->vme_batchbuffer_binding.surface_state_offset);
+}
+
+void
+intel_vme_batchbuffer_setup(VADriverContextP ctx,
+                            struct intel_encoder_context *encoder_context,
+                            int bind,
+                            unsigned long binding_table_offset,
+                            unsigned long surface_state_offset)
+{
+    struct gen6_vme_context *vme_context = encoder_context->vme_context;
+
+    dri_bo_unreference(vme_context->vme_batchbuffer.bo);
+    vme_context->vme_batchbuffer.bo = NULL;
+
+    vme_context->vme_batchbuffer_binding.enabled = bind;
+    vme_context->vme_batchbuffer_binding.binding_table_offset = binding_table_offset;
+    vme_context->vme_batchbuffer_binding.surface_state_offset = surface_state_offset;
+}
+
+void
+intel_vme_batchbuffer_alloc(VADriverContextP ctx,
+                            struct intel_encoder_context *encoder_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct gen6_vme_context *vme_context = encoder_context->vme_context;
+
+    if (vme_context->vme_batchbuffer.bo)
+        return;
+
+    vme_context->vme_batchbuffer.bo = dri_bo_alloc(i965->intel.bufmgr,
+                                                   "VME batchbuffer",
+                                                   vme_context->vme_batchbuffer.num_blocks * vme_context->vme_batchbuffer.size_block,
+                                                   0x1000);
+    intel_vme_batchbuffer_bind(ctx, vme_context);
+}
+
+bool
+intel_vme_walker_batchbuffer_reuse(VADriverContextP ctx,
+                                   struct encode_state *encode_state,
+                                   const unsigned int *params,
+                                   int num_params,
+                                   struct intel_encoder_context *encoder_context)
+{
+    struct gen6_vme_context *vme_context = encoder_context->vme_context;
+    struct gen6_vme_walker_batchbuffer *walker = &vme_context->vme_walker_batchbuffer;
+    int num_slices = encode_state->num_slice_params_ext;
+    int i, size;
+
+    /* the MPEG-2 walker covers the whole frame, whatever the slices */
+    if (encoder_context->codec == CODEC_MPEG2)
+        num_slices = 0;
+
+    size = 1 + num_params + 2 * num_slices;
+    walker->next_key_size = 0;
+
+    if (size > walker->max_key_size) {
+        unsigned int *key, *next_key;
+
+        key = realloc(walker->key, size * sizeof(*key));
+
+        if (key)
+            walker->key = key;
+
+        next_key = realloc(walker->next_key, size * sizeof(*next_key));
+
+        if (next_key)
+            walker->next_key = next_key;
+
+        if (!key || !next_key)
+            goto alloc;
+
+        walker->max_key_size = size;
+    }
+
+    walker->next_key[0] = encoder_context->codec;
+    memcpy(walker->next_key + 1, params, num_params * sizeof(*params));
+
+    for (i = 0; i < num_slices; i++) {
+        unsigned int *slice_key = walker->next_key + 1 + num_params + 2 * i;
+
+        if (encoder_context->codec == CODEC_HEVC) {
+            VAEncSliceParameterBufferHEVC *slice_param = (VAEncSliceParameterBufferHEVC *)encode_state->slice_params_ext[i]->buffer;
+
+            slice_key[0] = slice_param->slice_segment_address;
+            slice_key[1] = slice_param->num_ctu_in_slice;
+        } else {
+            VAEncSliceParameterBufferH264 *slice_param = (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[i]->buffer;
+
+            slice_key[0] = slice_param->macroblock_address;
+            slice_key[1] = slice_param->num_macroblocks;
+        }
+    }
+
+    walker->next_key_size = size;
+
+    /* the kept BO is only taken when its commands are the right ones,
+     * another fill would have to wait for the GPU to be done with it */
+    if (walker->bo &&
+        walker->key_size == size &&
+        memcmp(walker->key, walker->next_key, size * sizeof(*walker->key)) == 0) {
+        dri_bo_unreference(vme_context->vme_batchbuffer.bo);
+        dri_bo_reference(walker->bo);
+        vme_context->vme_batchbuffer.bo = walker->bo;
+        intel_vme_batchbuffer_bind(ctx, vme_context);
+        i965_stats_count(I965_STATS_VME_REUSES, 1);
+
+        return true;
+    }
+
+alloc:
+    intel_vme_batchbuffer_alloc(ctx, encoder_context);
+
+    return false;
+}
+
+void
+intel_vme_walker_batchbuffer_store(VADriverContextP ctx,
+                                   unsigned int *command_ptr,
+                                   struct intel_encoder_context *encoder_context)
+{
+    struct gen6_vme_context *vme_context = encoder_context->vme_context;
+    struct gen6_vme_walker_batchbuffer *walker = &vme_context->vme_walker_batchbuffer;
+    unsigned int *key;
+
+    i965_stats_count(I965_STATS_VME_FILL_BYTES,
+                     (unsigned char *)command_ptr - (unsigned char *)vme_context->vme_batchbuffer.bo->virtual);
+
+    dri_bo_unreference(walker->bo);
+    walker->bo = NULL;
+
+    if (walker->next_key_size) {
+        key = walker->key;
+        walker->key = walker->next_key;
+        walker->next_key = key;
+        walker->key_size = walker->next_key_size;
+
+        dri_bo_reference(vme_context->vme_batchbuffer.bo);
+        walker->bo = vme_context->vme_batchbuffer.bo;
+    }
+}
+
+void
+intel_vme_walker_batchbuffer_free(struct gen6_vme_context *vme_context)
+{
+    struct gen6_vme_walker_batchbuffer *walker = &vme_context->vme_walker_batchbuffer;
+
+    dri_bo_unreference(walker->bo);
+    free(walker->key);
+    free(walker->next_key);
+    memset(walker, 0, sizeof(*walker));
+}
+
 void
 gen7_vme_walker_fill_vme_batchbuffer(VADriverContextP ctx, 
                                      struct encode_state *encode_state,
@@ -1058,9 +1224,14 @@ gen7_vme_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     int mb_row;
     int s;
     unsigned int *command_ptr;
+    unsigned int params[] = { mb_width, mb_height, kernel, transform_8x8_mode_flag };
 
 #define		USE_SCOREBOARD		(1 << 21)
  
+    if (intel_vme_walker_batchbuffer_reuse(ctx, encode_state, params, ARRAY_ELEMS(params), encoder_context))
+        return;
+
+    I965_TRACE_BEGIN("vme walker fill");
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1167,7 +1338,10 @@ gen7_vme_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     *command_ptr++ = 0;
     *command_ptr++ = MI_BATCH_BUFFER_END;
 
+    intel_vme_walker_batchbuffer_store(ctx, command_ptr, encoder_context);
     dri_bo_unmap(vme_context->vme_batchbuffer.bo);
+
+    I965_TRACE_END("vme walker fill");
 }
 
 static uint8_t
@@ -1358,9 +1532,14 @@ gen7_vme_mpeg2_walker_fill_vme_batchbuffer(VADriverContextP ctx,
 {
     struct gen6_vme_context *vme_context = encoder_context->vme_context;
     unsigned int *command_ptr;
+    unsigned int params[] = { mb_width, mb_height, kernel };
 
 #define		MPEG2_SCOREBOARD		(1 << 21)
 
+    if (intel_vme_walker_batchbuffer_reuse(ctx, encode_state, params, ARRAY_ELEMS(params), encoder_context))
+        return;
+
+    I965_TRACE_BEGIN("vme walker fill");
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1469,7 +1648,10 @@ gen7_vme_mpeg2_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     *command_ptr++ = 0;
     *command_ptr++ = MI_BATCH_BUFFER_END;
 
+    intel_vme_walker_batchbuffer_store(ctx, command_ptr, encoder_context);
     dri_bo_unmap(vme_context->vme_batchbuffer.bo);
+
+    I965_TRACE_END("vme walker fill");
     return;
 }
 
@@ -1906,3 +2088,357 @@ void intel_vme_hevc_update_mbmv_cost(VADriverContextP ctx,
         }
     }
 }
+
+static pthread_mutex_t vme_dump_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *vme_dump_fp = NULL;
+static int vme_dump_checked = 0;
+
+void
+intel_mfc_avc_vme_dump(struct encode_state *encode_state,
+                       struct intel_encoder_context *encoder_context)
+{
+    struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
+    struct gen6_vme_context *vme_context = encoder_context->vme_context;
+    VAEncPictureParameterBufferH264 *pic_param =
+        (VAEncPictureParameterBufferH264 *)encode_state->pic_param_ext->buffer;
+    VAEncSliceParameterBufferH264 *slice_param =
+        (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[0]->buffer;
+    struct intel_mfc_vme_dump_header header;
+    const char *env_str;
+
+    pthread_mutex_lock(&vme_dump_mutex);
+
+    if (!vme_dump_checked) {
+        vme_dump_checked = 1;
+
+        if ((env_str = getenv("VA_INTEL_VME_DUMP")))
+            vme_dump_fp = fopen(env_str, "wb");
+    }
+
+    if (!vme_dump_fp) {
+        pthread_mutex_unlock(&vme_dump_mutex);
+        return;
+    }
+
+    header.width_in_mbs = (mfc_context->surface_state.width + 15) / 16;
+    header.height_in_mbs = (mfc_context->surface_state.height + 15) / 16;
+    header.size_block = vme_context->vme_output.size_block;
+    header.is_intra = intel_avc_enc_slice_type_fixup(slice_param->slice_type) == SLICE_TYPE_I;
+    header.qp = pic_param->pic_init_qp + slice_param->slice_qp_delta;
+    header.ref_index_in_mb[0] = vme_context->ref_index_in_mb[0];
+    header.ref_index_in_mb[1] = vme_context->ref_index_in_mb[1];
+
+    dri_bo_map(vme_context->vme_output.bo, 0);
+    fwrite(&header, sizeof(header), 1, vme_dump_fp);
+    fwrite(vme_context->vme_output.bo->virtual,
+           header.size_block,
+           header.width_in_mbs * header.height_in_mbs,
+           vme_dump_fp);
+    dri_bo_unmap(vme_context->vme_output.bo);
+    fflush(vme_dump_fp);
+
+    pthread_mutex_unlock(&vme_dump_mutex);
+}
+
+/*
+ * The slice workers live as long as the display and are shared by its
+ * encoder contexts, one picture at a time: a picture that finds them busy
+ * is programmed on the calling thread only. workers[0] stands for the
+ * calling thread, which programs the first range of slices straight into
+ * the final batch.
+ *
+ * The other workers program their slices with a snapshot of the encoder,
+ * MFC and VME contexts into a CPU batch, which is appended to the final
+ * batch in slice order with its relocations. They don't touch any BO, the
+ * VME output is mapped once by the calling thread.
+ */
+struct intel_mfc_slice_worker
+{
+    struct intel_mfc_slice_pool *pool;
+    pthread_t thread;
+    int has_thread;
+    unsigned int job;                   /* last job seen by the thread */
+
+    /* The slices of the current picture, first_slice == last_slice if none */
+    VADriverContextP ctx;
+    struct encode_state *encode_state;
+    intel_mfc_slice_programing_func slice_programing;
+    unsigned char *vme_output;
+    int first_slice;
+    int last_slice;
+
+    /* Private state */
+    struct intel_encoder_context encoder_context;
+    struct gen6_mfc_context mfc_context;
+    struct gen6_vme_context vme_context;
+    struct intel_batchbuffer *batch;
+};
+
+struct intel_mfc_slice_pool
+{
+    pthread_mutex_t busy_mutex;         /* held by the picture using the workers */
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    unsigned int job;
+    int num_pending;
+    int quit;
+    int max_workers;
+    struct intel_mfc_slice_worker workers[INTEL_MFC_MAX_SLICE_THREADS];
+};
+
+static void
+intel_mfc_slice_worker_run(struct intel_mfc_slice_worker *worker,
+                           struct intel_encoder_context *encoder_context,
+                           struct intel_batchbuffer *batch)
+{
+    int i;
+
+    for (i = worker->first_slice; i < worker->last_slice; i++)
+        worker->slice_programing(worker->ctx,
+                                 worker->encode_state,
+                                 encoder_context,
+                                 i,
+                                 worker->vme_output,
+                                 batch);
+}
+
+static void *
+intel_mfc_slice_worker_thread(void *data)
+{
+    struct intel_mfc_slice_worker * const worker = data;
+    struct intel_mfc_slice_pool * const pool = worker->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    for (;;) {
+        while (!pool->quit && worker->job == pool->job)
+            pthread_cond_wait(&pool->work_cond, &pool->mutex);
+
+        if (pool->quit)
+            break;
+
+        worker->job = pool->job;
+
+        if (worker->first_slice == worker->last_slice)
+            continue;
+
+        pthread_mutex_unlock(&pool->mutex);
+        intel_mfc_slice_worker_run(worker, &worker->encoder_context,
+                                   worker->batch);
+        pthread_mutex_lock(&pool->mutex);
+
+        if (--pool->num_pending == 0)
+            pthread_cond_signal(&pool->done_cond);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+struct intel_mfc_slice_pool *
+intel_mfc_slice_pool_new(void)
+{
+    struct intel_mfc_slice_pool *pool;
+    long num_cpus;
+
+    pool = calloc(1, sizeof(*pool));
+
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->busy_mutex, NULL);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pool->max_workers = INTEL_MFC_MAX_SLICE_THREADS;
+
+    if (num_cpus > 0)
+        pool->max_workers = MIN(pool->max_workers, num_cpus);
+
+    return pool;
+}
+
+void
+intel_mfc_slice_pool_destroy(struct intel_mfc_slice_pool *pool)
+{
+    int i;
+
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 1; i < INTEL_MFC_MAX_SLICE_THREADS; i++) {
+        struct intel_mfc_slice_worker * const worker = &pool->workers[i];
+
+        if (worker->has_thread)
+            pthread_join(worker->thread, NULL);
+
+        if (worker->batch)
+            intel_batchbuffer_free(worker->batch);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_mutex_destroy(&pool->busy_mutex);
+    free(pool);
+}
+
+static int
+intel_mfc_slice_num_mbs(struct encode_state *encode_state, int slice_index)
+{
+    VAEncSliceParameterBufferH264 *slice_param =
+        (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[slice_index]->buffer;
+
+    return slice_param->num_macroblocks;
+}
+
+/*
+ * Programs all the AVC slices into the software PAK batch. The slices are
+ * independent, so for big enough frames they are split in contiguous
+ * ranges of about the same number of macroblocks, programmed in parallel
+ * by the slice workers of the display
+ */
+void
+intel_mfc_avc_slice_batchbuffers(VADriverContextP ctx,
+                                 struct encode_state *encode_state,
+                                 struct intel_encoder_context *encoder_context,
+                                 intel_mfc_slice_programing_func slice_programing,
+                                 struct intel_batchbuffer *batch)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct gen6_vme_context *vme_context = encoder_context->vme_context;
+    struct intel_mfc_slice_pool *pool = i965->mfc_slice_pool;
+    struct intel_mfc_slice_worker *worker;
+    unsigned char *vme_output;
+    int num_slices = encode_state->num_slice_params_ext;
+    int num_workers, num_mbs = 0, mbs_per_worker, worker_mbs, slice_mbs;
+    int i, j, first_slice;
+
+    /* Before the MVs are expanded in place */
+    intel_mfc_avc_vme_dump(encode_state, encoder_context);
+
+    for (i = 0; i < num_slices; i++)
+        num_mbs += intel_mfc_slice_num_mbs(encode_state, i);
+
+    num_workers = pool ? MIN(num_slices, pool->max_workers) : 1;
+    num_workers = MIN(num_workers, encoder_context->max_slice_threads);
+
+    dri_bo_map(vme_context->vme_output.bo, 1);
+    vme_output = vme_context->vme_output.bo->virtual;
+
+    if (num_workers < 2 || num_mbs < INTEL_MFC_MIN_MBS_PER_SLICE_THREAD * 2 ||
+        pthread_mutex_trylock(&pool->busy_mutex)) {
+        for (i = 0; i < num_slices; i++)
+            slice_programing(ctx, encode_state, encoder_context, i,
+                             vme_output, batch);
+
+        dri_bo_unmap(vme_context->vme_output.bo);
+        return;
+    }
+
+    num_workers = MIN(num_workers, num_mbs / INTEL_MFC_MIN_MBS_PER_SLICE_THREAD);
+    mbs_per_worker = (num_mbs + num_workers - 1) / num_workers;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    pool->num_pending = 0;
+    first_slice = 0;
+
+    for (j = 0; j < INTEL_MFC_MAX_SLICE_THREADS; j++) {
+        worker = &pool->workers[j];
+        worker->first_slice = worker->last_slice = 0;
+
+        if (j >= num_workers || first_slice == num_slices)
+            continue;
+
+        worker_mbs = 0;
+        for (i = first_slice; i < num_slices; i++) {
+            slice_mbs = intel_mfc_slice_num_mbs(encode_state, i);
+
+            if (worker_mbs > 0 && worker_mbs + slice_mbs > mbs_per_worker &&
+                j < num_workers - 1)
+                break;
+
+            worker_mbs += slice_mbs;
+        }
+
+        if (j == num_workers - 1)
+            i = num_slices;
+
+        worker->ctx = ctx;
+        worker->encode_state = encode_state;
+        worker->slice_programing = slice_programing;
+        worker->vme_output = vme_output;
+        worker->first_slice = first_slice;
+        worker->last_slice = i;
+        first_slice = i;
+
+        if (j == 0)
+            continue;
+
+        /* Whatever the slice programing leaves there is dropped */
+        worker->encoder_context = *encoder_context;
+        worker->mfc_context = *(struct gen6_mfc_context *)encoder_context->mfc_context;
+        worker->vme_context = *vme_context;
+        worker->encoder_context.mfc_context = &worker->mfc_context;
+        worker->encoder_context.vme_context = &worker->vme_context;
+
+        if (!worker->batch)
+            worker->batch = intel_batchbuffer_new_cpu(&i965->intel, I915_EXEC_BSD,
+                                                      64 * worker_mbs + 4096 +
+                                                      (SLICE_HEADER + SLICE_TAIL) *
+                                                      (worker->last_slice - worker->first_slice));
+
+        if (!worker->has_thread) {
+            worker->pool = pool;
+            worker->job = pool->job;
+            worker->has_thread = !pthread_create(&worker->thread, NULL,
+                                                 intel_mfc_slice_worker_thread,
+                                                 worker);
+        }
+
+        if (worker->has_thread)
+            pool->num_pending++;
+    }
+
+    pool->job++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    intel_mfc_slice_worker_run(&pool->workers[0], encoder_context, batch);
+
+    /* The ranges of the workers whose thread couldn't be created */
+    for (j = 1; j < num_workers; j++) {
+        worker = &pool->workers[j];
+
+        if (!worker->has_thread)
+            intel_mfc_slice_worker_run(worker, &worker->encoder_context,
+                                       worker->batch);
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+
+    while (pool->num_pending > 0)
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (j = 1; j < num_workers; j++) {
+        worker = &pool->workers[j];
+
+        if (worker->batch)
+            intel_batchbuffer_append(batch, worker->batch);
+    }
+
+    pthread_mutex_unlock(&pool->busy_mutex);
+    dri_bo_unmap(vme_context->vme_output.bo);
+}
@@ -729,7 +729,6 @@ gen6_mfd_avc_decode_init(VADriverContextP ctx,
     VASliceParameterBufferH264 *slice_param;
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct object_surface *obj_surface;
-    dri_bo *bo;
     int i, j, enable_avc_ildb = 0;
     int width_in_mbs;
 
@@ -780,41 +779,13 @@ gen6_mfd_avc_decode_init(VADriverContextP ctx,
     dri_bo_reference(gen6_mfd_context->pre_deblocking_output.bo);
     gen6_mfd_context->pre_deblocking_output.valid = !enable_avc_ildb;
 
-    dri_bo_unreference(gen6_mfd_context->intra_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "intra row store",
-                      width_in_mbs * 64,
-                      0x1000);
-    assert(bo);
-    gen6_mfd_context->intra_row_store_scratch_buffer.bo = bo;
-    gen6_mfd_context->intra_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen6_mfd_context->intra_row_store_scratch_buffer), "intra row store", width_in_mbs * 64);
 
-    dri_bo_unreference(gen6_mfd_context->deblocking_filter_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "deblocking filter row store",
-                      width_in_mbs * 64 * 4,
-                      0x1000);
-    assert(bo);
-    gen6_mfd_context->deblocking_filter_row_store_scratch_buffer.bo = bo;
-    gen6_mfd_context->deblocking_filter_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen6_mfd_context->deblocking_filter_row_store_scratch_buffer), "deblocking filter row store", width_in_mbs * 64 * 4);
 
-    dri_bo_unreference(gen6_mfd_context->bsd_mpc_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "bsd mpc row store",
-                      width_in_mbs * 96,
-                      0x1000);
-    assert(bo);
-    gen6_mfd_context->bsd_mpc_row_store_scratch_buffer.bo = bo;
-    gen6_mfd_context->bsd_mpc_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen6_mfd_context->bsd_mpc_row_store_scratch_buffer), "bsd mpc row store", width_in_mbs * 96);
 
-    dri_bo_unreference(gen6_mfd_context->mpr_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "mpr row store",
-                      width_in_mbs * 64,
-                      0x1000);
-    assert(bo);
-    gen6_mfd_context->mpr_row_store_scratch_buffer.bo = bo;
-    gen6_mfd_context->mpr_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen6_mfd_context->mpr_row_store_scratch_buffer), "mpr row store", width_in_mbs * 64);
 
     gen6_mfd_context->bitplane_read_buffer.valid = 0;
 }
@@ -893,7 +864,6 @@ gen6_mfd_mpeg2_decode_init(VADriverContextP ctx,
     VAPictureParameterBufferMPEG2 *pic_param;
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct object_surface *obj_surface;
-    dri_bo *bo;
     unsigned int width_in_mbs;
 
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
@@ -916,14 +886,7 @@ gen6_mfd_mpeg2_decode_init(VADriverContextP ctx,
     dri_bo_reference(gen6_mfd_context->pre_deblocking_output.bo);
     gen6_mfd_context->pre_deblocking_output.valid = 1;
 
-    dri_bo_unreference(gen6_mfd_context->bsd_mpc_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "bsd mpc row store",
-                      width_in_mbs * 96,
-                      0x1000);
-    assert(bo);
-    gen6_mfd_context->bsd_mpc_row_store_scratch_buffer.bo = bo;
-    gen6_mfd_context->bsd_mpc_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen6_mfd_context->bsd_mpc_row_store_scratch_buffer), "bsd mpc row store", width_in_mbs * 96);
 
     gen6_mfd_context->post_deblocking_output.valid = 0;
     gen6_mfd_context->intra_row_store_scratch_buffer.valid = 0;
@@ -1239,32 +1202,11 @@ gen6_mfd_vc1_decode_init(VADriverContextP ctx,
     dri_bo_reference(gen6_mfd_context->pre_deblocking_output.bo);
     gen6_mfd_context->pre_deblocking_output.valid = !pic_param->entrypoint_fields.bits.loopfilter;
 
-    dri_bo_unreference(gen6_mfd_context->intra_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "intra row store",
-                      width_in_mbs * 64,
-                      0x1000);
-    assert(bo);
-    gen6_mfd_context->intra_row_store_scratch_buffer.bo = bo;
-    gen6_mfd_context->intra_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen6_mfd_context->intra_row_store_scratch_buffer), "intra row store", width_in_mbs * 64);
 
-    dri_bo_unreference(gen6_mfd_context->deblocking_filter_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "deblocking filter row store",
-                      width_in_mbs * 7 * 64,
-                      0x1000);
-    assert(bo);
-    gen6_mfd_context->deblocking_filter_row_store_scratch_buffer.bo = bo;
-    gen6_mfd_context->deblocking_filter_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen6_mfd_context->deblocking_filter_row_store_scratch_buffer), "deblocking filter row store", width_in_mbs * 7 * 64);
 
-    dri_bo_unreference(gen6_mfd_context->bsd_mpc_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "bsd mpc row store",
-                      width_in_mbs * 96,
-                      0x1000);
-    assert(bo);
-    gen6_mfd_context->bsd_mpc_row_store_scratch_buffer.bo = bo;
-    gen6_mfd_context->bsd_mpc_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen6_mfd_context->bsd_mpc_row_store_scratch_buffer), "bsd mpc row store", width_in_mbs * 96);
 
     gen6_mfd_context->mpr_row_store_scratch_buffer.valid = 0;
 
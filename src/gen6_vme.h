@@ -49,6 +49,21 @@
 struct encode_state;
 struct intel_encoder_context;
 
+/*
+ * The MEDIA_OBJECTs built by a walker fill only depend on the frame size,
+ * the kernel, a few flags and the slice layout, the key. The batchbuffer
+ * is kept and submitted again for the next pictures with the same key.
+ */
+struct gen6_vme_walker_batchbuffer
+{
+    dri_bo *bo;
+    unsigned int *key;
+    unsigned int *next_key;     /* of the picture being encoded */
+    int key_size;               /* in dwords */
+    int next_key_size;
+    int max_key_size;
+};
+
 struct gen6_vme_context
 {
     struct i965_gpe_context gpe_context;
@@ -59,7 +74,14 @@ struct gen6_vme_context
 
     struct i965_buffer_surface vme_output;
     struct i965_buffer_surface vme_batchbuffer;
+    struct gen6_vme_walker_batchbuffer vme_walker_batchbuffer;
 
+    /* where vme_batchbuffer is bound once its fill has chosen the BO */
+    struct {
+        int enabled;
+        unsigned long binding_table_offset;
+        unsigned long surface_state_offset;
+    } vme_batchbuffer_binding;
 
     void (*vme_surface2_setup)(VADriverContextP ctx,
                                struct i965_gpe_context *gpe_context,
@@ -152,6 +174,45 @@ gen7_vme_walker_fill_vme_batchbuffer(VADriverContextP ctx,
                                      int transform_8x8_mode_flag,
                                      struct intel_encoder_context *encoder_context);
 
+/*
+ * Called by the batchbuffer setups once num_blocks and size_block are set.
+ * The BO is chosen by the fill, with intel_vme_walker_batchbuffer_reuse()
+ * or intel_vme_batchbuffer_alloc(), and bound then when bind is set.
+ */
+void
+intel_vme_batchbuffer_setup(VADriverContextP ctx,
+                            struct intel_encoder_context *encoder_context,
+                            int bind,
+                            unsigned long binding_table_offset,
+                            unsigned long surface_state_offset);
+
+/* Allocates vme_batchbuffer unless it's already chosen, for the fills */
+void
+intel_vme_batchbuffer_alloc(VADriverContextP ctx,
+                            struct intel_encoder_context *encoder_context);
+
+/*
+ * Called by the walker fills before mapping vme_batchbuffer. Returns true
+ * when vme_batchbuffer is the kept batchbuffer built for the same params
+ * and slice layout, else a new one is allocated, the fill must be done
+ * and followed by intel_vme_walker_batchbuffer_store() with the end of the
+ * commands.
+ */
+bool
+intel_vme_walker_batchbuffer_reuse(VADriverContextP ctx,
+                                   struct encode_state *encode_state,
+                                   const unsigned int *params,
+                                   int num_params,
+                                   struct intel_encoder_context *encoder_context);
+
+void
+intel_vme_walker_batchbuffer_store(VADriverContextP ctx,
+                                   unsigned int *command_ptr,
+                                   struct intel_encoder_context *encoder_context);
+
+void
+intel_vme_walker_batchbuffer_free(struct gen6_vme_context *vme_context);
+
 extern void 
 gen7_vme_scoreboard_init(VADriverContextP ctx, struct gen6_vme_context *vme_context);
 
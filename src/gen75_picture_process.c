@@ -71,6 +71,9 @@ gen75_vpp_vebox(VADriverContextP ctx,
      VAProcPipelineParameterBuffer* pipeline_param = proc_ctx->pipeline_param; 
      struct i965_driver_data *i965 = i965_driver_data(ctx); 
  
+     /* VEBox runs on another ring */
+     i965_proc_flush_deferred(ctx, NULL);
+
      /* vpp features based on VEBox fixed function */
      if(proc_ctx->vpp_vebox_ctx == NULL) {
          proc_ctx->vpp_vebox_ctx = gen75_vebox_context_init(ctx);
@@ -96,6 +99,8 @@ gen75_vpp_gpe(VADriverContextP ctx,
 {
      VAStatus va_status = VA_STATUS_SUCCESS;
 
+     i965_proc_flush_deferred(ctx, NULL);
+
      if(proc_ctx->vpp_gpe_ctx == NULL){
          proc_ctx->vpp_gpe_ctx = vpp_gpe_context_init(ctx);
      }
@@ -157,6 +162,15 @@ gen75_proc_picture(VADriverContextP ctx,
         goto error;
     }
 
+    /* Only the scaling/format conversion path renders additional outputs
+     * and composites several layers */
+    if (pipeline_param->num_filters &&
+        (pipeline_param->num_additional_outputs ||
+         proc_st->num_pipeline_params > 1)) {
+        status = VA_STATUS_ERROR_UNIMPLEMENTED;
+        goto error;
+    }
+
     if (!obj_dst_surf->bo) {
         unsigned int is_tiled = 1;
         unsigned int fourcc = VA_FOURCC_NV12;
@@ -229,7 +229,6 @@ gen75_vme_output_vme_batchbuffer_setup(VADriverContextP ctx,
                                        struct intel_encoder_context *encoder_context)
 
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen6_vme_context *vme_context = encoder_context->vme_context;
     VAEncSequenceParameterBufferH264 *pSequenceParameter = (VAEncSequenceParameterBufferH264 *)encode_state->seq_param_ext->buffer;
     int width_in_mbs = pSequenceParameter->picture_width_in_mbs;
@@ -238,15 +237,9 @@ gen75_vme_output_vme_batchbuffer_setup(VADriverContextP ctx,
     vme_context->vme_batchbuffer.num_blocks = width_in_mbs * height_in_mbs + 1;
     vme_context->vme_batchbuffer.size_block = 64; /* 4 OWORDs */
     vme_context->vme_batchbuffer.pitch = 16;
-    vme_context->vme_batchbuffer.bo = dri_bo_alloc(i965->intel.bufmgr, 
-                                                   "VME batchbuffer",
-                                                   vme_context->vme_batchbuffer.num_blocks * vme_context->vme_batchbuffer.size_block,
-                                                   0x1000);
-    vme_context->vme_buffer_suface_setup(ctx,
-                                         &vme_context->gpe_context,
-                                         &vme_context->vme_batchbuffer,
-                                         BINDING_TABLE_OFFSET(index),
-                                         SURFACE_STATE_OFFSET(index));
+    intel_vme_batchbuffer_setup(ctx, encoder_context, 1,
+                                BINDING_TABLE_OFFSET(index),
+                                SURFACE_STATE_OFFSET(index));
 }
 
 static VAStatus
@@ -489,6 +482,7 @@ gen75_vme_fill_vme_batchbuffer(VADriverContextP ctx,
     int i, s;
     unsigned int *command_ptr;
 
+    intel_vme_batchbuffer_alloc(ctx, encoder_context);
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -738,7 +732,6 @@ gen75_vme_mpeg2_output_vme_batchbuffer_setup(VADriverContextP ctx,
                                              struct intel_encoder_context *encoder_context)
 
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen6_vme_context *vme_context = encoder_context->vme_context;
     VAEncSequenceParameterBufferMPEG2 *seq_param = (VAEncSequenceParameterBufferMPEG2 *)encode_state->seq_param_ext->buffer;
     int width_in_mbs = ALIGN(seq_param->picture_width, 16) / 16;
@@ -747,15 +740,9 @@ gen75_vme_mpeg2_output_vme_batchbuffer_setup(VADriverContextP ctx,
     vme_context->vme_batchbuffer.num_blocks = width_in_mbs * height_in_mbs + 1;
     vme_context->vme_batchbuffer.size_block = 64; /* 4 OWORDs */
     vme_context->vme_batchbuffer.pitch = 16;
-    vme_context->vme_batchbuffer.bo = dri_bo_alloc(i965->intel.bufmgr, 
-                                                   "VME batchbuffer",
-                                                   vme_context->vme_batchbuffer.num_blocks * vme_context->vme_batchbuffer.size_block,
-                                                   0x1000);
-    vme_context->vme_buffer_suface_setup(ctx,
-                                         &vme_context->gpe_context,
-                                         &vme_context->vme_batchbuffer,
-                                         BINDING_TABLE_OFFSET(index),
-                                         SURFACE_STATE_OFFSET(index));
+    intel_vme_batchbuffer_setup(ctx, encoder_context, 1,
+                                BINDING_TABLE_OFFSET(index),
+                                SURFACE_STATE_OFFSET(index));
 }
 
 static VAStatus
@@ -806,6 +793,7 @@ gen75_vme_mpeg2_fill_vme_batchbuffer(VADriverContextP ctx,
     unsigned int *command_ptr;
 
 
+    intel_vme_batchbuffer_alloc(ctx, encoder_context);
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1002,6 +990,8 @@ gen75_vme_context_destroy(void *context)
     dri_bo_unreference(vme_context->vme_batchbuffer.bo);
     vme_context->vme_batchbuffer.bo = NULL;
 
+    intel_vme_walker_batchbuffer_free(vme_context);
+
     if (vme_context->vme_state_message) {
 	free(vme_context->vme_state_message);
 	vme_context->vme_state_message = NULL;
@@ -94,6 +94,8 @@ struct gen7_mfd_context
 
     int                 wa_mpeg2_slice_vertical_position;
 
+    GenDeferredDecode   deferred;
+
     void *driver_context;
 };
 
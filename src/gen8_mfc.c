@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include <assert.h>
 
 #include "intel_batchbuffer.h"
@@ -44,6 +45,7 @@
 #include "intel_media.h"
 #include <va/va_enc_jpeg.h>
 #include "vp8_probs.h"
+#include "i965_jpeg_huffman.h"
 
 #define SURFACE_STATE_PADDED_SIZE               SURFACE_STATE_PADDED_SIZE_GEN8
 #define SURFACE_STATE_OFFSET(index)             (SURFACE_STATE_PADDED_SIZE * index)
@@ -933,155 +935,6 @@ gen8_mfc_avc_slice_state(VADriverContextP ctx,
 
 #ifdef MFC_SOFTWARE_HASWELL
 
-static int
-gen8_mfc_avc_pak_object_intra(VADriverContextP ctx, int x, int y, int end_mb,
-                              int qp,unsigned int *msg,
-                              struct intel_encoder_context *encoder_context,
-                              unsigned char target_mb_size, unsigned char max_mb_size,
-                              struct intel_batchbuffer *batch)
-{
-    int len_in_dwords = 12;
-    unsigned int intra_msg;
-#define		INTRA_MSG_FLAG		(1 << 13)
-#define		INTRA_MBTYPE_MASK	(0x1F0000)
-    if (batch == NULL)
-        batch = encoder_context->base.batch;
-
-    BEGIN_BCS_BATCH(batch, len_in_dwords);
-
-    intra_msg = msg[0] & 0xC0FF;
-    intra_msg |= INTRA_MSG_FLAG;
-    intra_msg |= ((msg[0] & INTRA_MBTYPE_MASK) >> 8);
-    OUT_BCS_BATCH(batch, MFC_AVC_PAK_OBJECT | (len_in_dwords - 2));
-    OUT_BCS_BATCH(batch, 0);
-    OUT_BCS_BATCH(batch, 0);
-    OUT_BCS_BATCH(batch, 
-                  (0 << 24) |		/* PackedMvNum, Debug*/
-                  (0 << 20) | 		/* No motion vector */
-                  (1 << 19) |		/* CbpDcY */
-                  (1 << 18) |		/* CbpDcU */
-                  (1 << 17) |		/* CbpDcV */
-                  intra_msg);
-
-    OUT_BCS_BATCH(batch, (0xFFFF << 16) | (y << 8) | x);		/* Code Block Pattern for Y*/
-    OUT_BCS_BATCH(batch, 0x000F000F);							/* Code Block Pattern */		
-    OUT_BCS_BATCH(batch, (0 << 27) | (end_mb << 26) | qp);	/* Last MB */
-
-    /*Stuff for Intra MB*/
-    OUT_BCS_BATCH(batch, msg[1]);			/* We using Intra16x16 no 4x4 predmode*/	
-    OUT_BCS_BATCH(batch, msg[2]);	
-    OUT_BCS_BATCH(batch, msg[3]&0xFF);	
-    
-    /*MaxSizeInWord and TargetSzieInWord*/
-    OUT_BCS_BATCH(batch, (max_mb_size << 24) |
-                  (target_mb_size << 16) );
-
-    OUT_BCS_BATCH(batch, 0);
-
-    ADVANCE_BCS_BATCH(batch);
-
-    return len_in_dwords;
-}
-
-static int
-gen8_mfc_avc_pak_object_inter(VADriverContextP ctx, int x, int y, int end_mb, int qp,
-                              unsigned int *msg, unsigned int offset,
-                              struct intel_encoder_context *encoder_context,
-                              unsigned char target_mb_size,unsigned char max_mb_size, int slice_type,
-                              struct intel_batchbuffer *batch)
-{
-    struct gen6_vme_context *vme_context = encoder_context->vme_context;
-    int len_in_dwords = 12;
-    unsigned int inter_msg = 0;
-    if (batch == NULL)
-        batch = encoder_context->base.batch;
-    {
-#define MSG_MV_OFFSET	4
-	unsigned int *mv_ptr;
-	mv_ptr = msg + MSG_MV_OFFSET;
-	/* MV of VME output is based on 16 sub-blocks. So it is necessary
-         * to convert them to be compatible with the format of AVC_PAK
-         * command.
-         */
-	if ((msg[0] & INTER_MODE_MASK) == INTER_8X16) {
-            /* MV[0] and MV[2] are replicated */
-            mv_ptr[4] = mv_ptr[0];
-            mv_ptr[5] = mv_ptr[1];
-            mv_ptr[2] = mv_ptr[8];
-            mv_ptr[3] = mv_ptr[9];
-            mv_ptr[6] = mv_ptr[8];
-            mv_ptr[7] = mv_ptr[9];
-	} else if ((msg[0] & INTER_MODE_MASK) == INTER_16X8) {
-            /* MV[0] and MV[1] are replicated */
-            mv_ptr[2] = mv_ptr[0];
-            mv_ptr[3] = mv_ptr[1];
-            mv_ptr[4] = mv_ptr[16];
-            mv_ptr[5] = mv_ptr[17];
-            mv_ptr[6] = mv_ptr[24];
-            mv_ptr[7] = mv_ptr[25];
-	} else if (((msg[0] & INTER_MODE_MASK) == INTER_8X8) &&
-                   !(msg[1] & SUBMB_SHAPE_MASK)) {
-            /* Don't touch MV[0] or MV[1] */
-            mv_ptr[2] = mv_ptr[8];
-            mv_ptr[3] = mv_ptr[9];
-            mv_ptr[4] = mv_ptr[16];
-            mv_ptr[5] = mv_ptr[17];
-            mv_ptr[6] = mv_ptr[24];
-            mv_ptr[7] = mv_ptr[25];
-	}
-    }
-
-    BEGIN_BCS_BATCH(batch, len_in_dwords);
-
-    OUT_BCS_BATCH(batch, MFC_AVC_PAK_OBJECT | (len_in_dwords - 2));
-
-    inter_msg = 32;
-    /* MV quantity */
-    if ((msg[0] & INTER_MODE_MASK) == INTER_8X8) {
-        if (msg[1] & SUBMB_SHAPE_MASK)
-            inter_msg = 128;
-    }
-    OUT_BCS_BATCH(batch, inter_msg);         /* 32 MV*/
-    OUT_BCS_BATCH(batch, offset);
-    inter_msg = msg[0] & (0x1F00FFFF);
-    inter_msg |= INTER_MV8;
-    inter_msg |= ((1 << 19) | (1 << 18) | (1 << 17));
-    if (((msg[0] & INTER_MODE_MASK) == INTER_8X8) &&
-        (msg[1] & SUBMB_SHAPE_MASK)) {
-        inter_msg |= INTER_MV32;
-    }
-
-    OUT_BCS_BATCH(batch, inter_msg);
-
-    OUT_BCS_BATCH(batch, (0xFFFF<<16) | (y << 8) | x);        /* Code Block Pattern for Y*/
-    OUT_BCS_BATCH(batch, 0x000F000F);                         /* Code Block Pattern */  
-#if 0 
-    if ( slice_type == SLICE_TYPE_B) {
-        OUT_BCS_BATCH(batch, (0xF<<28) | (end_mb << 26) | qp);	/* Last MB */
-    } else {
-        OUT_BCS_BATCH(batch, (end_mb << 26) | qp);	/* Last MB */
-    }
-#else
-    OUT_BCS_BATCH(batch, (end_mb << 26) | qp);	/* Last MB */
-#endif
-
-    inter_msg = msg[1] >> 8;
-    /*Stuff for Inter MB*/
-    OUT_BCS_BATCH(batch, inter_msg);        
-    OUT_BCS_BATCH(batch, vme_context->ref_index_in_mb[0]);
-    OUT_BCS_BATCH(batch, vme_context->ref_index_in_mb[1]);
-
-    /*MaxSizeInWord and TargetSzieInWord*/
-    OUT_BCS_BATCH(batch, (max_mb_size << 24) |
-                  (target_mb_size << 16) );
-
-    OUT_BCS_BATCH(batch, 0x0);    
-
-    ADVANCE_BCS_BATCH(batch);
-
-    return len_in_dwords;
-}
-
 #define		AVC_INTRA_RDO_OFFSET	4
 #define		AVC_INTER_RDO_OFFSET	10
 #define		AVC_INTER_MSG_OFFSET	8	
@@ -1093,6 +946,7 @@ gen8_mfc_avc_pipeline_slice_programing(VADriverContextP ctx,
                                        struct encode_state *encode_state,
                                        struct intel_encoder_context *encoder_context,
                                        int slice_index,
+                                       unsigned char *vme_output,
                                        struct intel_batchbuffer *slice_batch)
 {
     struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
@@ -1100,12 +954,12 @@ gen8_mfc_avc_pipeline_slice_programing(VADriverContextP ctx,
     VAEncSequenceParameterBufferH264 *pSequenceParameter = (VAEncSequenceParameterBufferH264 *)encode_state->seq_param_ext->buffer;
     VAEncPictureParameterBufferH264 *pPicParameter = (VAEncPictureParameterBufferH264 *)encode_state->pic_param_ext->buffer;
     VAEncSliceParameterBufferH264 *pSliceParameter = (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[slice_index]->buffer; 
-    unsigned int *msg = NULL, offset = 0;
-    unsigned char *msg_ptr = NULL;
+    unsigned int *command_ptr;
     int width_in_mbs = (mfc_context->surface_state.width + 15) / 16;
     int height_in_mbs = (mfc_context->surface_state.height + 15) / 16;
-    int last_slice = (pSliceParameter->macroblock_address + pSliceParameter->num_macroblocks) == (width_in_mbs * height_in_mbs);
-    int i,x,y;
+    int end_mb = pSliceParameter->macroblock_address + pSliceParameter->num_macroblocks;
+    int last_slice = end_mb == (width_in_mbs * height_in_mbs);
+    int i, x, y, num_mbs;
     int qp = pPicParameter->pic_init_qp + pSliceParameter->slice_qp_delta;
     unsigned int rate_control_mode = encoder_context->rate_control_mode;
     unsigned int tail_data[] = { 0x0, 0x0 };
@@ -1139,40 +993,25 @@ gen8_mfc_avc_pipeline_slice_programing(VADriverContextP ctx,
 
     intel_avc_slice_insert_packed_data(ctx, encode_state, encoder_context, slice_index, slice_batch);
 
-    dri_bo_map(vme_context->vme_output.bo , 1);
-    msg_ptr = (unsigned char *)vme_context->vme_output.bo->virtual;
-
-    if (is_intra) {
-        msg = (unsigned int *) (msg_ptr + pSliceParameter->macroblock_address * vme_context->vme_output.size_block);
-    } else {
-        msg = (unsigned int *) (msg_ptr + pSliceParameter->macroblock_address * vme_context->vme_output.size_block);
-    }
-   
-    for (i = pSliceParameter->macroblock_address; 
-         i < pSliceParameter->macroblock_address + pSliceParameter->num_macroblocks; i++) {
-        int last_mb = (i == (pSliceParameter->macroblock_address + pSliceParameter->num_macroblocks - 1) );
+    /* The PAK objects are written one macroblock row at a time */
+    for (i = pSliceParameter->macroblock_address; i < end_mb; i += num_mbs) {
         x = i % width_in_mbs;
         y = i / width_in_mbs;
-        msg = (unsigned int *) (msg_ptr + i * vme_context->vme_output.size_block);
-
-        if (is_intra) {
-            assert(msg);
-            gen8_mfc_avc_pak_object_intra(ctx, x, y, last_mb, qp, msg, encoder_context, 0, 0, slice_batch);
-        } else {
-	    int inter_rdo, intra_rdo;
-	    inter_rdo = msg[AVC_INTER_RDO_OFFSET] & AVC_RDO_MASK;
-	    intra_rdo = msg[AVC_INTRA_RDO_OFFSET] & AVC_RDO_MASK;
-	    offset = i * vme_context->vme_output.size_block + AVC_INTER_MV_OFFSET;
-	    if (intra_rdo < inter_rdo) { 
-                gen8_mfc_avc_pak_object_intra(ctx, x, y, last_mb, qp, msg, encoder_context, 0, 0, slice_batch);
-            } else {
-		msg += AVC_INTER_MSG_OFFSET;
-                gen8_mfc_avc_pak_object_inter(ctx, x, y, last_mb, qp, msg, offset, encoder_context, 0, 0, pSliceParameter->slice_type, slice_batch);
-            }
-        }
+        num_mbs = MIN(width_in_mbs - x, end_mb - i);
+
+        BEGIN_BCS_BATCH(slice_batch, num_mbs * INTEL_AVC_PAK_OBJECT_DWORDS);
+        command_ptr = intel_batchbuffer_dwords(slice_batch);
+        command_ptr += intel_mfc_avc_pak_object_row(command_ptr,
+                                                    vme_output,
+                                                    vme_context->vme_output.size_block,
+                                                    x, y, width_in_mbs,
+                                                    num_mbs,
+                                                    i + num_mbs == end_mb,
+                                                    qp,
+                                                    is_intra,
+                                                    vme_context->ref_index_in_mb);
+        intel_batchbuffer_advance_dwords(slice_batch, command_ptr);
     }
-   
-    dri_bo_unmap(vme_context->vme_output.bo);
 
     if ( last_slice ) {    
         mfc_context->insert_object(ctx, encoder_context,
@@ -1193,13 +1032,12 @@ gen8_mfc_avc_software_batchbuffer(VADriverContextP ctx,
     struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
     struct intel_batchbuffer *batch;
     dri_bo *batch_bo;
-    int i;
 
     batch = mfc_context->aux_batchbuffer;
     batch_bo = batch->buffer;
-    for (i = 0; i < encode_state->num_slice_params_ext; i++) {
-        gen8_mfc_avc_pipeline_slice_programing(ctx, encode_state, encoder_context, i, batch);
-    }
+    intel_mfc_avc_slice_batchbuffers(ctx, encode_state, encoder_context,
+                                     gen8_mfc_avc_pipeline_slice_programing,
+                                     batch);
 
     intel_batchbuffer_align(batch, 8);
     
@@ -1661,9 +1499,13 @@ gen8_mfc_avc_encode_picture(VADriverContextP ctx,
     struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
     unsigned int rate_control_mode = encoder_context->rate_control_mode;
     int current_frame_bits_size;
-    int sts;
+    int sts, pass = 0;
  
     for (;;) {
+        //each re-encode of the picture by the BRC is a pass
+        if (rate_control_mode == VA_RC_CBR)
+            I965_TRACE_BEGIN_ARG("BRC pass", pass++);
+
         gen8_mfc_init(ctx, encode_state, encoder_context);
         intel_mfc_avc_prepare(ctx, encode_state, encoder_context);
         /*Programing bcs pipeline*/
@@ -1671,6 +1513,7 @@ gen8_mfc_avc_encode_picture(VADriverContextP ctx,
         gen8_mfc_run(ctx, encode_state, encoder_context);
         if (rate_control_mode == VA_RC_CBR /*|| rate_control_mode == VA_RC_VBR*/) {
             gen8_mfc_stop(ctx, encode_state, encoder_context, &current_frame_bits_size);
+            I965_TRACE_END("BRC pass");
             sts = intel_mfc_brc_postpack(encode_state, mfc_context, current_frame_bits_size);
             if (sts == BRC_NO_HRD_VIOLATION) {
                 intel_mfc_hrd_context_update(encode_state, mfc_context);
@@ -1882,46 +1725,45 @@ gen8_mfc_mpeg2_pak_object_intra(VADriverContextP ctx,
                                 struct intel_batchbuffer *batch)
 {
     int len_in_dwords = 9;
+    unsigned int *command_ptr;
 
     if (batch == NULL)
         batch = encoder_context->base.batch;
 
     BEGIN_BCS_BATCH(batch, len_in_dwords);
 
-    OUT_BCS_BATCH(batch, MFC_MPEG2_PAK_OBJECT | (len_in_dwords - 2));
-    OUT_BCS_BATCH(batch,
-                  0 << 24 |     /* PackedMvNum */
-                  0 << 20 |     /* MvFormat */
-                  7 << 17 |     /* CbpDcY/CbpDcU/CbpDcV */
-                  0 << 15 |     /* TransformFlag: frame DCT */
-                  0 << 14 |     /* FieldMbFlag */
-                  1 << 13 |     /* IntraMbFlag */
-                  mb_type << 8 |   /* MbType: Intra */
-                  0 << 2 |      /* SkipMbFlag */
-                  0 << 0 |      /* InterMbMode */
-                  0);
-    OUT_BCS_BATCH(batch, y << 16 | x);
-    OUT_BCS_BATCH(batch,
-                  max_size_in_word << 24 |
-                  target_size_in_word << 16 |
-                  coded_block_pattern << 6 |      /* CBP */
-                  0);
-    OUT_BCS_BATCH(batch,
-                  last_mb_in_slice << 31 |
-                  first_mb_in_slice << 30 |
-                  0 << 27 |     /* EnableCoeffClamp */
-                  last_mb_in_slice_group << 26 |
-                  0 << 25 |     /* MbSkipConvDisable */
-                  first_mb_in_slice_group << 24 |
-                  0 << 16 |     /* MvFieldSelect */
-                  qp_scale_code << 0 |
-                  0);
-    OUT_BCS_BATCH(batch, 0);    /* MV[0][0] */
-    OUT_BCS_BATCH(batch, 0);    /* MV[1][0] */
-    OUT_BCS_BATCH(batch, 0);    /* MV[0][1] */
-    OUT_BCS_BATCH(batch, 0);    /* MV[1][1] */
-
-    ADVANCE_BCS_BATCH(batch);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    *command_ptr++ = MFC_MPEG2_PAK_OBJECT | (len_in_dwords - 2);
+    *command_ptr++ = 0 << 24 |     /* PackedMvNum */
+                     0 << 20 |     /* MvFormat */
+                     7 << 17 |     /* CbpDcY/CbpDcU/CbpDcV */
+                     0 << 15 |     /* TransformFlag: frame DCT */
+                     0 << 14 |     /* FieldMbFlag */
+                     1 << 13 |     /* IntraMbFlag */
+                     mb_type << 8 |   /* MbType: Intra */
+                     0 << 2 |      /* SkipMbFlag */
+                     0 << 0 |      /* InterMbMode */
+                     0;
+    *command_ptr++ = y << 16 | x;
+    *command_ptr++ = max_size_in_word << 24 |
+                     target_size_in_word << 16 |
+                     coded_block_pattern << 6 |      /* CBP */
+                     0;
+    *command_ptr++ = last_mb_in_slice << 31 |
+                     first_mb_in_slice << 30 |
+                     0 << 27 |     /* EnableCoeffClamp */
+                     last_mb_in_slice_group << 26 |
+                     0 << 25 |     /* MbSkipConvDisable */
+                     first_mb_in_slice_group << 24 |
+                     0 << 16 |     /* MvFieldSelect */
+                     qp_scale_code << 0 |
+                     0;
+    *command_ptr++ = 0;    /* MV[0][0] */
+    *command_ptr++ = 0;    /* MV[1][0] */
+    *command_ptr++ = 0;    /* MV[0][1] */
+    *command_ptr++ = 0;    /* MV[1][1] */
+
+    intel_batchbuffer_advance_dwords(batch, command_ptr);
 
     return len_in_dwords;
 }
@@ -1983,6 +1825,7 @@ gen8_mfc_mpeg2_pak_object_inter(VADriverContextP ctx,
     VAEncPictureParameterBufferMPEG2 *pic_param = (VAEncPictureParameterBufferMPEG2 *)encode_state->pic_param_ext->buffer;
     int len_in_dwords = 9;
     short *mvptr, mvx0, mvy0, mvx1, mvy1;
+    unsigned int *command_ptr;
     
     if (batch == NULL)
         batch = encoder_context->base.batch;
@@ -1995,41 +1838,39 @@ gen8_mfc_mpeg2_pak_object_inter(VADriverContextP ctx,
 
     BEGIN_BCS_BATCH(batch, len_in_dwords);
 
-    OUT_BCS_BATCH(batch, MFC_MPEG2_PAK_OBJECT | (len_in_dwords - 2));
-    OUT_BCS_BATCH(batch,
-                  2 << 24 |     /* PackedMvNum */
-                  7 << 20 |     /* MvFormat */
-                  7 << 17 |     /* CbpDcY/CbpDcU/CbpDcV */
-                  0 << 15 |     /* TransformFlag: frame DCT */
-                  0 << 14 |     /* FieldMbFlag */
-                  0 << 13 |     /* IntraMbFlag */
-                  1 << 8 |      /* MbType: Frame-based */
-                  0 << 2 |      /* SkipMbFlag */
-                  0 << 0 |      /* InterMbMode */
-                  0);
-    OUT_BCS_BATCH(batch, y << 16 | x);
-    OUT_BCS_BATCH(batch,
-                  max_size_in_word << 24 |
-                  target_size_in_word << 16 |
-                  0x3f << 6 |   /* CBP */
-                  0);
-    OUT_BCS_BATCH(batch,
-                  last_mb_in_slice << 31 |
-                  first_mb_in_slice << 30 |
-                  0 << 27 |     /* EnableCoeffClamp */
-                  last_mb_in_slice_group << 26 |
-                  0 << 25 |     /* MbSkipConvDisable */
-                  first_mb_in_slice_group << 24 |
-                  0 << 16 |     /* MvFieldSelect */
-                  qp_scale_code << 0 |
-                  0);
-
-    OUT_BCS_BATCH(batch, (mvx0 & 0xFFFF) | mvy0 << 16);    /* MV[0][0] */
-    OUT_BCS_BATCH(batch, (mvx1 & 0xFFFF) | mvy1 << 16);    /* MV[1][0] */
-    OUT_BCS_BATCH(batch, 0);    /* MV[0][1] */
-    OUT_BCS_BATCH(batch, 0);    /* MV[1][1] */
-
-    ADVANCE_BCS_BATCH(batch);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    *command_ptr++ = MFC_MPEG2_PAK_OBJECT | (len_in_dwords - 2);
+    *command_ptr++ = 2 << 24 |     /* PackedMvNum */
+                     7 << 20 |     /* MvFormat */
+                     7 << 17 |     /* CbpDcY/CbpDcU/CbpDcV */
+                     0 << 15 |     /* TransformFlag: frame DCT */
+                     0 << 14 |     /* FieldMbFlag */
+                     0 << 13 |     /* IntraMbFlag */
+                     1 << 8 |      /* MbType: Frame-based */
+                     0 << 2 |      /* SkipMbFlag */
+                     0 << 0 |      /* InterMbMode */
+                     0;
+    *command_ptr++ = y << 16 | x;
+    *command_ptr++ = max_size_in_word << 24 |
+                     target_size_in_word << 16 |
+                     0x3f << 6 |   /* CBP */
+                     0;
+    *command_ptr++ = last_mb_in_slice << 31 |
+                     first_mb_in_slice << 30 |
+                     0 << 27 |     /* EnableCoeffClamp */
+                     last_mb_in_slice_group << 26 |
+                     0 << 25 |     /* MbSkipConvDisable */
+                     first_mb_in_slice_group << 24 |
+                     0 << 16 |     /* MvFieldSelect */
+                     qp_scale_code << 0 |
+                     0;
+
+    *command_ptr++ = (mvx0 & 0xFFFF) | mvy0 << 16;    /* MV[0][0] */
+    *command_ptr++ = (mvx1 & 0xFFFF) | mvy1 << 16;    /* MV[1][0] */
+    *command_ptr++ = 0;    /* MV[0][1] */
+    *command_ptr++ = 0;    /* MV[1][1] */
+
+    intel_batchbuffer_advance_dwords(batch, command_ptr);
 
     return len_in_dwords;
 }
@@ -2680,16 +2521,70 @@ get_reciprocal_dword_qm(unsigned char *raster_qm, uint32_t *dword_qm)
 }
 
 
+//Scale the zigzag qm (in place) by the normalized quality and convert it to the
+//32 reciprocal dwords the HW expects. Applications usually send the same matrix
+//and quality for every picture, so the result is kept per component (0 for luma,
+//1 for chroma) and reused while they don't change.
+static void
+gen8_mfc_jpeg_get_dword_qm(struct gen6_mfc_context *mfc_context,
+                           int index,
+                           unsigned char *qm,
+                           unsigned int quality,
+                           uint32_t *dword_qm)
+{
+    uint32_t temp, i = 0, j = 0;
+    unsigned char raster_qm[64], column_raster_qm[64];
+
+    if (mfc_context->jpeg_fqm_cache.valid[index] &&
+        mfc_context->jpeg_fqm_cache.quality[index] == quality &&
+        !memcmp(mfc_context->jpeg_fqm_cache.qm[index], qm, 64)) {
+        memcpy(qm, mfc_context->jpeg_fqm_cache.scaled_qm[index], 64);
+        memcpy(dword_qm, mfc_context->jpeg_fqm_cache.dword_qm[index], 32 * sizeof(uint32_t));
+        return;
+    }
+
+    memcpy(mfc_context->jpeg_fqm_cache.qm[index], qm, 64);
+
+    //apply quality to the quantiser matrix
+    for(i=0; i < 64; i++) {
+        temp = (qm[i] * quality)/100;
+        //clamp to range [1,255]
+        temp = (temp > 255) ? 255 : temp;
+        temp = (temp < 1) ? 1 : temp;
+        qm[i] = (unsigned char)temp;
+    }
+
+    //For VAAPI, the VAQMatrixBuffer needs to be in zigzag order. 
+    //The App should send it in zigzag. Now, the driver has to extract the raster from it. 
+    for (j = 0; j < 64; j++)
+        raster_qm[zigzag_direct[j]] = qm[j];
+
+    //Convert the raster order(row-ordered) to the column-raster (column by column).
+    //To be consistent with the other encoders, send it in column order.
+    //Need to double check if our HW expects col or row raster.
+    for (j = 0; j < 64; j++) {
+        int row = j / 8, col = j % 8;
+        column_raster_qm[col * 8 + row] = raster_qm[j];
+    }
+
+    //Convert to raster QM to reciprocal. HW expects values in reciprocal.
+    get_reciprocal_dword_qm(column_raster_qm, dword_qm);
+
+    memcpy(mfc_context->jpeg_fqm_cache.scaled_qm[index], qm, 64);
+    memcpy(mfc_context->jpeg_fqm_cache.dword_qm[index], dword_qm, 32 * sizeof(uint32_t));
+    mfc_context->jpeg_fqm_cache.quality[index] = quality;
+    mfc_context->jpeg_fqm_cache.valid[index] = 1;
+}
+
 static void 
 gen8_mfc_jpeg_fqm_state(VADriverContextP ctx,
                         struct intel_encoder_context *encoder_context,
                         struct encode_state *encode_state)
 {
     unsigned int quality = 0;
-    uint32_t temp, i = 0, j = 0, dword_qm[32];
+    uint32_t dword_qm[32];
     VAEncPictureParameterBufferJPEG *pic_param;
     VAQMatrixBufferJPEG *qmatrix;
-    unsigned char raster_qm[64], column_raster_qm[64];
     struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
     
     assert(encode_state->pic_param_ext && encode_state->pic_param_ext->buffer);
@@ -2740,62 +2635,15 @@ gen8_mfc_jpeg_fqm_state(VADriverContextP ctx,
     
     //For luma (Y or R)
     if(qmatrix->load_lum_quantiser_matrix) {
-        //apply quality to lum_quantiser_matrix
-        for(i=0; i < 64; i++) {
-            temp = (qmatrix->lum_quantiser_matrix[i] * quality)/100;
-            //clamp to range [1,255]
-            temp = (temp > 255) ? 255 : temp;
-            temp = (temp < 1) ? 1 : temp;
-            qmatrix->lum_quantiser_matrix[i] = (unsigned char)temp;
-        }       
-        
-        //For VAAPI, the VAQMatrixBuffer needs to be in zigzag order. 
-        //The App should send it in zigzag. Now, the driver has to extract the raster from it. 
-        for (j = 0; j < 64; j++)
-            raster_qm[zigzag_direct[j]] = qmatrix->lum_quantiser_matrix[j];
-
-        //Convert the raster order(row-ordered) to the column-raster (column by column).
-        //To be consistent with the other encoders, send it in column order.
-        //Need to double check if our HW expects col or row raster.
-        for (j = 0; j < 64; j++) {
-            int row = j / 8, col = j % 8;
-            column_raster_qm[col * 8 + row] = raster_qm[j];
-        }
-        
-        //Convert to raster QM to reciprocal. HW expects values in reciprocal.
-        get_reciprocal_dword_qm(column_raster_qm, dword_qm);
-        
+        gen8_mfc_jpeg_get_dword_qm(mfc_context, 0, qmatrix->lum_quantiser_matrix, quality, dword_qm);
+
         //send the luma qm to the command buffer
         gen8_mfc_fqm_state(ctx, MFX_QM_JPEG_LUMA_Y_QUANTIZER_MATRIX, dword_qm, 32, encoder_context);
     } 
     
     //For Chroma, if chroma exists (Cb, Cr or G, B)
     if(qmatrix->load_chroma_quantiser_matrix) {
-        //apply quality to chroma_quantiser_matrix
-        for(i=0; i < 64; i++) {
-            temp = (qmatrix->chroma_quantiser_matrix[i] * quality)/100;
-            //clamp to range [1,255]
-            temp = (temp > 255) ? 255 : temp;
-            temp = (temp < 1) ? 1 : temp;
-            qmatrix->chroma_quantiser_matrix[i] = (unsigned char)temp;
-        }
-        
-        //For VAAPI, the VAQMatrixBuffer needs to be in zigzag order. 
-        //The App should send it in zigzag. Now, the driver has to extract the raster from it. 
-        for (j = 0; j < 64; j++)
-            raster_qm[zigzag_direct[j]] = qmatrix->chroma_quantiser_matrix[j];
-        
-        //Convert the raster order(row-ordered) to the column-raster (column by column).
-        //To be consistent with the other encoders, send it in column order.
-        //Need to double check if our HW expects col or row raster.
-        for (j = 0; j < 64; j++) {
-            int row = j / 8, col = j % 8;
-            column_raster_qm[col * 8 + row] = raster_qm[j];
-        }
-
-
-        //Convert to raster QM to reciprocal. HW expects values in reciprocal.
-        get_reciprocal_dword_qm(column_raster_qm, dword_qm);
+        gen8_mfc_jpeg_get_dword_qm(mfc_context, 1, qmatrix->chroma_quantiser_matrix, quality, dword_qm);
 
         //send the same chroma qm to the command buffer (for both U,V or G,B)
         gen8_mfc_fqm_state(ctx, MFX_QM_JPEG_CHROMA_CB_QUANTIZER_MATRIX, dword_qm, 32, encoder_context);
@@ -2931,6 +2779,86 @@ convert_hufftable_to_codes(VAHuffmanTableBufferJPEGBaseline *huff_buffer, uint32
 
 }
 
+static unsigned int
+jpeg_huff_codes_hash(unsigned int hash, const uint8_t *data, int size)
+{
+    int i;
+
+    //FNV-1a
+    for (i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+
+    return hash;
+}
+
+//Get the DC and AC code tables of huffman table "index". Applications nearly
+//always send the standard tables, so the converted tables are kept in a small
+//driver wide cache, looked up by the contents of the huffman table.
+static void
+gen8_mfc_jpeg_get_huff_codes(VADriverContextP ctx,
+                             VAHuffmanTableBufferJPEGBaseline *huff_buffer,
+                             uint8_t index,
+                             uint32_t *dc_table,
+                             uint32_t *ac_table)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_jpeg_huffman_cache *cache = &i965->jpeg_huffman_cache;
+    struct i965_jpeg_huffman_codes *codes;
+    unsigned int hash = 2166136261u;
+    int i;
+
+    hash = jpeg_huff_codes_hash(hash, huff_buffer->huffman_table[index].num_dc_codes, 16);
+    hash = jpeg_huff_codes_hash(hash, huff_buffer->huffman_table[index].dc_values, 12);
+    hash = jpeg_huff_codes_hash(hash, huff_buffer->huffman_table[index].num_ac_codes, 16);
+    hash = jpeg_huff_codes_hash(hash, huff_buffer->huffman_table[index].ac_values, 162);
+
+    _i965LockMutex(&cache->mutex);
+    cache->num_lookups++;
+
+    for (i = 0; i < cache->num_entries; i++) {
+        codes = &cache->entries[i];
+
+        if (codes->hash == hash &&
+            !memcmp(codes->num_dc_codes, huff_buffer->huffman_table[index].num_dc_codes, 16) &&
+            !memcmp(codes->dc_values, huff_buffer->huffman_table[index].dc_values, 12) &&
+            !memcmp(codes->num_ac_codes, huff_buffer->huffman_table[index].num_ac_codes, 16) &&
+            !memcmp(codes->ac_values, huff_buffer->huffman_table[index].ac_values, 162)) {
+            memcpy(dc_table, codes->dc_table, sizeof(codes->dc_table));
+            memcpy(ac_table, codes->ac_table, sizeof(codes->ac_table));
+            _i965UnlockMutex(&cache->mutex);
+            return;
+        }
+    }
+
+    cache->num_misses++;
+    _i965UnlockMutex(&cache->mutex);
+
+    //load DC table with 12 DWords
+    convert_hufftable_to_codes(huff_buffer, dc_table, 0, index);  //0 for Dc
+
+    //load AC table with 162 DWords 
+    convert_hufftable_to_codes(huff_buffer, ac_table, 1, index);  //1 for AC 
+
+    _i965LockMutex(&cache->mutex);
+
+    if (cache->num_entries < I965_MAX_CACHED_JPEG_HUFFMAN_CODES) {
+        codes = &cache->entries[cache->num_entries++];
+    } else {
+        codes = &cache->entries[cache->next_entry];
+        cache->next_entry = (cache->next_entry + 1) % I965_MAX_CACHED_JPEG_HUFFMAN_CODES;
+    }
+
+    codes->hash = hash;
+    memcpy(codes->num_dc_codes, huff_buffer->huffman_table[index].num_dc_codes, 16);
+    memcpy(codes->dc_values, huff_buffer->huffman_table[index].dc_values, 12);
+    memcpy(codes->num_ac_codes, huff_buffer->huffman_table[index].num_ac_codes, 16);
+    memcpy(codes->ac_values, huff_buffer->huffman_table[index].ac_values, 162);
+    memcpy(codes->dc_table, dc_table, sizeof(codes->dc_table));
+    memcpy(codes->ac_table, ac_table, sizeof(codes->ac_table));
+
+    _i965UnlockMutex(&cache->mutex);
+}
+
 //send the huffman table using MFC_JPEG_HUFF_TABLE_STATE
 static void
 gen8_mfc_jpeg_huff_table_state(VADriverContextP ctx,
@@ -2938,14 +2866,21 @@ gen8_mfc_jpeg_huff_table_state(VADriverContextP ctx,
                                            struct intel_encoder_context *encoder_context,
                                            int num_tables)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
     VAHuffmanTableBufferJPEGBaseline *huff_buffer;
     struct intel_batchbuffer *batch = encoder_context->base.batch;
     uint8_t index;
     uint32_t dc_table[12], ac_table[162]; 
+    struct timespec start, end;
+    int bench = !!(g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH);
     
     assert(encode_state->huffman_table && encode_state->huffman_table->buffer);
     huff_buffer = (VAHuffmanTableBufferJPEGBaseline *)encode_state->huffman_table->buffer;
 
+    if (mfc_context->jpeg_huffman.valid)
+        huff_buffer = &mfc_context->jpeg_huffman.huff_buffer;
+
     memset(dc_table, 0, 12);
     memset(ac_table, 0, 162);
 
@@ -2954,12 +2889,24 @@ gen8_mfc_jpeg_huff_table_state(VADriverContextP ctx,
  
         if (!huff_buffer->load_huffman_table[index])
             continue;
-     
-        //load DC table with 12 DWords
-        convert_hufftable_to_codes(huff_buffer, dc_table, 0, index);  //0 for Dc
 
-        //load AC table with 162 DWords 
-        convert_hufftable_to_codes(huff_buffer, ac_table, 1, index);  //1 for AC 
+        if (bench)
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+        //The optimized tables change with every picture, don't cache them
+        if (mfc_context->jpeg_huffman.valid) {
+            convert_hufftable_to_codes(huff_buffer, dc_table, 0, index);
+            convert_hufftable_to_codes(huff_buffer, ac_table, 1, index);
+        } else
+            gen8_mfc_jpeg_get_huff_codes(ctx, huff_buffer, index, dc_table, ac_table);
+
+        if (bench) {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            _i965LockMutex(&i965->jpeg_huffman_cache.mutex);
+            i965->jpeg_huffman_cache.setup_time_ns +=
+                (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+            _i965UnlockMutex(&i965->jpeg_huffman_cache.mutex);
+        }
 
         BEGIN_BCS_BATCH(batch, 176);
         OUT_BCS_BATCH(batch, MFC_JPEG_HUFF_TABLE_STATE | (176 - 2));
@@ -2972,6 +2919,12 @@ gen8_mfc_jpeg_huff_table_state(VADriverContextP ctx,
         intel_batchbuffer_data(batch, ac_table, 162*4);
         ADVANCE_BCS_BATCH(batch);
     }    
+
+    if (bench) {
+        _i965LockMutex(&i965->jpeg_huffman_cache.mutex);
+        i965->jpeg_huffman_cache.num_pictures++;
+        _i965UnlockMutex(&i965->jpeg_huffman_cache.mutex);
+    }
 }
 
 
@@ -3107,6 +3060,8 @@ gen8_mfc_jpeg_add_headers(VADriverContextP ctx,
                                            struct encode_state *encode_state,
                                            struct intel_encoder_context *encoder_context)
 {
+    struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
+
     if (encode_state->packed_header_data_ext) {
         VAEncPackedHeaderParameterBuffer *param = NULL;
         unsigned int *header_data = (unsigned int *)(*encode_state->packed_header_data_ext)->buffer;
@@ -3115,6 +3070,12 @@ gen8_mfc_jpeg_add_headers(VADriverContextP ctx,
         param = (VAEncPackedHeaderParameterBuffer *)(*encode_state->packed_header_params_ext)->buffer;
         length_in_bits = param->bit_length;
 
+        //the headers with the optimized Huffman tables
+        if (mfc_context->jpeg_huffman.valid) {
+            header_data = (unsigned int *)mfc_context->jpeg_huffman.header;
+            length_in_bits = mfc_context->jpeg_huffman.header_bits;
+        }
+
         gen8_mfc_jpeg_pak_insert_object(encoder_context, 
                                         header_data, 
                                         ALIGN(length_in_bits, 32) >> 5,
@@ -3124,6 +3085,261 @@ gen8_mfc_jpeg_add_headers(VADriverContextP ctx,
     }
 }
 
+//Gather the symbol statistics of the picture with a CPU model of the PAK:
+//forward DCT and quantization of every block, in MCU order. stats[] is
+//indexed by the table selectors of the components. Only NV12 and Y800
+//inputs are handled.
+static int
+gen8_mfc_jpeg_gather_statistics(struct encode_state *encode_state,
+                                struct gen6_mfc_context *mfc_context,
+                                struct i965_jpeg_huffman_stats *stats)
+{
+    struct object_surface *obj_surface = encode_state->input_yuv_object;
+    VAEncPictureParameterBufferJPEG *pic_param = (VAEncPictureParameterBufferJPEG *)encode_state->pic_param_ext->buffer;
+    VAEncSliceParameterBufferJPEG *slice_param = (VAEncSliceParameterBufferJPEG *)encode_state->slice_params_ext[0]->buffer;
+    int width = pic_param->picture_width, height = pic_param->picture_height;
+    int pitch = obj_surface->width;
+    int num_components = (obj_surface->fourcc == VA_FOURCC_NV12) ? 3 : 1;
+    int mcu_size = (num_components == 3) ? 16 : 8;
+    int mcu_x, mcu_y, num_mcus = 0, i, j, component;
+    int dc_pred[3];
+    uint8_t *plane[3], block[64];
+    int16_t coefs[64];
+
+    if (pic_param->num_components != num_components ||
+        !mfc_context->jpeg_fqm_cache.valid[0] ||
+        (num_components > 1 && !mfc_context->jpeg_fqm_cache.valid[1]))
+        return 0;
+
+    for (component = 0; component < num_components; component++) {
+        if (slice_param->components[component].dc_table_selector > 1 ||
+            slice_param->components[component].ac_table_selector > 1)
+            return 0;
+    }
+
+    if (drm_intel_gem_bo_map_gtt(obj_surface->bo))
+        return 0;
+
+    plane[0] = (uint8_t *)obj_surface->bo->virtual;
+    plane[1] = plane[0] + obj_surface->y_cb_offset * pitch;
+    plane[2] = plane[1] + 1;
+    memset(dc_pred, 0, sizeof(dc_pred));
+
+    for (mcu_y = 0; mcu_y < height; mcu_y += mcu_size) {
+        for (mcu_x = 0; mcu_x < width; mcu_x += mcu_size) {
+            if (slice_param->restart_interval &&
+                num_mcus && !(num_mcus % slice_param->restart_interval))
+                memset(dc_pred, 0, sizeof(dc_pred));
+
+            num_mcus++;
+
+            for (j = 0; j < mcu_size; j += 8) {
+                for (i = 0; i < mcu_size; i += 8) {
+                    i965_jpeg_load_block(plane[0], pitch, 1, width, height,
+                                         mcu_x + i, mcu_y + j, block);
+                    i965_jpeg_quantize_block(block, mfc_context->jpeg_fqm_cache.scaled_qm[0], coefs);
+                    i965_jpeg_huffman_count_block(&stats[slice_param->components[0].dc_table_selector],
+                                                  &stats[slice_param->components[0].ac_table_selector],
+                                                  coefs, &dc_pred[0]);
+                }
+            }
+
+            for (component = 1; component < num_components; component++) {
+                i965_jpeg_load_block(plane[component], pitch, 2, (width + 1) / 2, (height + 1) / 2,
+                                     mcu_x / 2, mcu_y / 2, block);
+                i965_jpeg_quantize_block(block, mfc_context->jpeg_fqm_cache.scaled_qm[1], coefs);
+                i965_jpeg_huffman_count_block(&stats[slice_param->components[component].dc_table_selector],
+                                              &stats[slice_param->components[component].ac_table_selector],
+                                              coefs, &dc_pred[component]);
+            }
+        }
+    }
+
+    drm_intel_gem_bo_unmap_gtt(obj_surface->bo);
+
+    return 1;
+}
+
+//Copy the packed headers, replacing the DHT tables 0 and 1 with the optimized
+//ones. Fails unless all the tables in used_tables (bit Tc * 2 + Th) are found,
+//or if the rewritten headers don't fit in max_size.
+static int
+gen8_mfc_jpeg_rewrite_headers(struct encode_state *encode_state,
+                              struct gen6_mfc_context *mfc_context,
+                              unsigned int used_tables)
+{
+    VAEncPackedHeaderParameterBuffer *param = (VAEncPackedHeaderParameterBuffer *)(*encode_state->packed_header_params_ext)->buffer;
+    VAHuffmanTableBufferJPEGBaseline *huff_buffer = &mfc_context->jpeg_huffman.huff_buffer;
+    const uint8_t *src = (const uint8_t *)(*encode_state->packed_header_data_ext)->buffer;
+    unsigned int size = param->bit_length / 8;
+    unsigned int max_size, pos = 0, out = 0, segment, end, count, src_count, found = 0;
+    const uint8_t *bits, *vals;
+    uint8_t *dst;
+    int i, tc, th;
+
+    if (param->bit_length % 8)
+        return 0;
+
+    //room for the 4 tables to grow to 16 + 162 bytes, headers which redefine
+    //them more often are checked against it
+    max_size = ALIGN(size + 4 * (16 + 162), 4);
+
+    if (mfc_context->jpeg_huffman.header_size < max_size) {
+        dst = realloc(mfc_context->jpeg_huffman.header, max_size);
+
+        if (!dst)
+            return 0;
+
+        mfc_context->jpeg_huffman.header = dst;
+        mfc_context->jpeg_huffman.header_size = max_size;
+    }
+
+    dst = mfc_context->jpeg_huffman.header;
+
+    while (pos < size) {
+        if (pos + 2 > size || src[pos] != 0xFF)
+            return 0;
+
+        //markers without a segment: SOI, RSTn, TEM
+        if (src[pos + 1] == 0xD8 || src[pos + 1] == 0x01 ||
+            (src[pos + 1] >= 0xD0 && src[pos + 1] <= 0xD7)) {
+            memcpy(dst + out, src + pos, 2);
+            pos += 2;
+            out += 2;
+            continue;
+        }
+
+        if (pos + 4 > size)
+            return 0;
+
+        end = pos + 2 + ((src[pos + 2] << 8) | src[pos + 3]);
+
+        if (end > size)
+            return 0;
+
+        if (src[pos + 1] != 0xC4) {
+            memcpy(dst + out, src + pos, end - pos);
+            out += end - pos;
+            pos = end;
+            continue;
+        }
+
+        //DHT, the segment length is written once the tables are known
+        segment = out;
+        memcpy(dst + out, src + pos, 2);
+        out += 4;
+        pos += 4;
+
+        while (pos < end) {
+            if (pos + 17 > end)
+                return 0;
+
+            tc = src[pos] >> 4;
+            th = src[pos] & 0x0F;
+
+            for (i = 0, src_count = 0; i < 16; i++)
+                src_count += src[pos + 1 + i];
+
+            if (pos + 17 + src_count > end)
+                return 0;
+
+            if (tc < 2 && th < 2) {
+                bits = tc ? huff_buffer->huffman_table[th].num_ac_codes : huff_buffer->huffman_table[th].num_dc_codes;
+                vals = tc ? huff_buffer->huffman_table[th].ac_values : huff_buffer->huffman_table[th].dc_values;
+
+                for (i = 0, count = 0; i < 16; i++)
+                    count += bits[i];
+
+                //a header may redefine the tables any number of times, the
+                //rest of it must still fit once this table has grown
+                if (out + 17 + count + size - (pos + 17 + src_count) > max_size)
+                    return 0;
+
+                dst[out++] = src[pos];
+                memcpy(dst + out, bits, 16);
+                out += 16;
+
+                memcpy(dst + out, vals, count);
+                out += count;
+                found |= 1 << (tc * 2 + th);
+            } else {
+                memcpy(dst + out, src + pos, 17 + src_count);
+                out += 17 + src_count;
+            }
+
+            pos += 17 + src_count;
+        }
+
+        if (out - segment - 2 > 0xFFFF)
+            return 0;
+
+        dst[segment + 2] = (out - segment - 2) >> 8;
+        dst[segment + 3] = (out - segment - 2) & 0xFF;
+    }
+
+    if ((found & used_tables) != used_tables)
+        return 0;
+
+    mfc_context->jpeg_huffman.header_bits = out * 8;
+
+    while (out % 4)
+        dst[out++] = 0;
+
+    return 1;
+}
+
+//Build the Huffman tables of the picture from its own statistics, in place of
+//the tables the application sent. The packed headers are rewritten with the
+//new tables; on any failure the tables of the application are used.
+static void
+gen8_mfc_jpeg_optimize_huffman(struct encode_state *encode_state,
+                               struct gen6_mfc_context *mfc_context)
+{
+    VAHuffmanTableBufferJPEGBaseline *huff_buffer = &mfc_context->jpeg_huffman.huff_buffer;
+    VAEncSliceParameterBufferJPEG *slice_param;
+    struct i965_jpeg_huffman_stats stats[2];
+    unsigned int used_tables = 0;
+    int i, component;
+
+    mfc_context->jpeg_huffman.valid = 0;
+
+    if (!mfc_context->jpeg_huffman.enabled ||
+        !encode_state->packed_header_data_ext ||
+        !encode_state->slice_params_ext ||
+        !encode_state->slice_params_ext[0]->buffer)
+        return;
+
+    memset(stats, 0, sizeof(stats));
+
+    if (!gen8_mfc_jpeg_gather_statistics(encode_state, mfc_context, stats))
+        return;
+
+    slice_param = (VAEncSliceParameterBufferJPEG *)encode_state->slice_params_ext[0]->buffer;
+
+    for (component = 0; component < slice_param->num_components; component++) {
+        used_tables |= 1 << slice_param->components[component].dc_table_selector;
+        used_tables |= 1 << (2 + slice_param->components[component].ac_table_selector);
+    }
+
+    memset(huff_buffer, 0, sizeof(*huff_buffer));
+
+    for (i = 0; i < 2; i++) {
+        i965_jpeg_huffman_stats_complete(&stats[i]);
+        i965_jpeg_huffman_build(stats[i].dc_freq, I965_JPEG_HUFFMAN_DC_SYMBOLS,
+                                huff_buffer->huffman_table[i].num_dc_codes,
+                                huff_buffer->huffman_table[i].dc_values);
+        i965_jpeg_huffman_build(stats[i].ac_freq, 256,
+                                huff_buffer->huffman_table[i].num_ac_codes,
+                                huff_buffer->huffman_table[i].ac_values);
+        huff_buffer->load_huffman_table[i] = 1;
+    }
+
+    if (!gen8_mfc_jpeg_rewrite_headers(encode_state, mfc_context, used_tables))
+        return;
+
+    mfc_context->jpeg_huffman.valid = 1;
+}
+
 //Initialize the buffered_qmatrix with the default qmatrix in the driver.
 //If the app sends the qmatrix, this will be replaced with the one app sends.
 static void 
@@ -3159,6 +3375,9 @@ gen8_mfc_jpeg_pipeline_picture_programing(VADriverContextP ctx,
     //do the slice level encoding here
     gen8_mfc_jpeg_fqm_state(ctx, encoder_context, encode_state);
 
+    //optionally replace the Huffman tables of the app with ones fitted to the picture
+    gen8_mfc_jpeg_optimize_huffman(encode_state, encoder_context->mfc_context);
+
     //I dont think I need this for loop. Just to be consistent with other encoding logic...
     for(i = 0; i < encode_state->num_slice_params_ext; i++) {
         assert(encode_state->slice_params && encode_state->slice_params_ext[i]->buffer);
@@ -3217,7 +3436,10 @@ gen8_mfc_jpeg_encode_picture(VADriverContextP ctx,
     intel_mfc_jpeg_prepare(ctx, encode_state, encoder_context);
     /*Programing bcs pipeline*/
     gen8_mfc_jpeg_pipeline_programing(ctx, encode_state, encoder_context);
-    gen8_mfc_run(ctx, encode_state, encoder_context);
+
+    /* Batched pictures are submitted from i965_encoder.c */
+    if (encoder_context->max_batched_pictures <= 1)
+        gen8_mfc_run(ctx, encode_state, encoder_context);
 
     return VA_STATUS_SUCCESS;
 }
@@ -4166,6 +4388,7 @@ gen8_mfc_vp8_pak_object_intra(VADriverContextP ctx,
     unsigned int vme_intra_mb_mode, vme_chroma_pred_mode;
     unsigned int pak_intra_mb_mode, pak_chroma_pred_mode;
     unsigned int vme_luma_pred_mode[2], pak_luma_pred_mode[2];
+    unsigned int *command_ptr;
 
     if (batch == NULL)
         batch = encoder_context->base.batch;
@@ -4184,25 +4407,25 @@ gen8_mfc_vp8_pak_object_intra(VADriverContextP ctx,
 
     BEGIN_BCS_BATCH(batch, 7);
 
-    OUT_BCS_BATCH(batch, MFX_VP8_PAK_OBJECT | (7 - 2));
-    OUT_BCS_BATCH(batch, 0);
-    OUT_BCS_BATCH(batch, 0);
-    OUT_BCS_BATCH(batch,
-                  (0 << 20) |                    /* mv format: intra mb */
-                  (0 << 18) |                    /* Segment ID */
-                  (0 << 17) |                    /* disable coeff clamp */
-                  (1 << 13) |                    /* intra mb flag */
-                  (0 << 11) | 		         /* refer picture select: last frame */
-                  (pak_intra_mb_mode << 8) |     /* mb type */
-                  (pak_chroma_pred_mode << 4) |  /* mb uv mode */
-                  (0 << 2) |                     /* skip mb flag: disable */
-                  0);
-
-    OUT_BCS_BATCH(batch, (y << 16) | x);
-    OUT_BCS_BATCH(batch, pak_luma_pred_mode[0]);
-    OUT_BCS_BATCH(batch, pak_luma_pred_mode[1]);
-
-    ADVANCE_BCS_BATCH(batch);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    *command_ptr++ = MFX_VP8_PAK_OBJECT | (7 - 2);
+    *command_ptr++ = 0;
+    *command_ptr++ = 0;
+    *command_ptr++ = (0 << 20) |                    /* mv format: intra mb */
+                     (0 << 18) |                    /* Segment ID */
+                     (0 << 17) |                    /* disable coeff clamp */
+                     (1 << 13) |                    /* intra mb flag */
+                     (0 << 11) |                    /* refer picture select: last frame */
+                     (pak_intra_mb_mode << 8) |     /* mb type */
+                     (pak_chroma_pred_mode << 4) |  /* mb uv mode */
+                     (0 << 2) |                     /* skip mb flag: disable */
+                     0;
+
+    *command_ptr++ = (y << 16) | x;
+    *command_ptr++ = pak_luma_pred_mode[0];
+    *command_ptr++ = pak_luma_pred_mode[1];
+
+    intel_batchbuffer_advance_dwords(batch, command_ptr);
 }
 
 static void
@@ -4213,6 +4436,7 @@ gen8_mfc_vp8_pak_object_inter(VADriverContextP ctx,
                               int x, int y,
                               struct intel_batchbuffer *batch)
 {
+    unsigned int *command_ptr;
     int i;
 
     if (batch == NULL)
@@ -4232,30 +4456,28 @@ gen8_mfc_vp8_pak_object_inter(VADriverContextP ctx,
     
     BEGIN_BCS_BATCH(batch, 7);
 
-    OUT_BCS_BATCH(batch, MFX_VP8_PAK_OBJECT | (7 - 2));
-    OUT_BCS_BATCH(batch,
-                  (0 << 29) |           /* enable inline mv data: disable */
-                  64);
-    OUT_BCS_BATCH(batch,
-                  offset);
-    OUT_BCS_BATCH(batch,
-                  (4 << 20) |           /* mv format: inter */
-                  (0 << 18) |           /* Segment ID */
-                  (0 << 17) |           /* coeff clamp: disable */
-                  (0 << 13) |		/* intra mb flag: inter mb */
-                  (0 << 11) | 		/* refer picture select: last frame */
-                  (0 << 8) |            /* mb type: 16x16 */
-                  (0 << 4) |		/* mb uv mode: dc_pred */
-                  (0 << 2) |		/* skip mb flag: disable */
-                  0);
-
-    OUT_BCS_BATCH(batch, (y << 16) | x);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    *command_ptr++ = MFX_VP8_PAK_OBJECT | (7 - 2);
+    *command_ptr++ = (0 << 29) |           /* enable inline mv data: disable */
+                     64;
+    *command_ptr++ = offset;
+    *command_ptr++ = (4 << 20) |           /* mv format: inter */
+                     (0 << 18) |           /* Segment ID */
+                     (0 << 17) |           /* coeff clamp: disable */
+                     (0 << 13) |           /* intra mb flag: inter mb */
+                     (0 << 11) |           /* refer picture select: last frame */
+                     (0 << 8) |            /* mb type: 16x16 */
+                     (0 << 4) |            /* mb uv mode: dc_pred */
+                     (0 << 2) |            /* skip mb flag: disable */
+                     0;
+
+    *command_ptr++ = (y << 16) | x;
 
     /*new mv*/
-    OUT_BCS_BATCH(batch, 0x8);
-    OUT_BCS_BATCH(batch, 0x8);
+    *command_ptr++ = 0x8;
+    *command_ptr++ = 0x8;
 
-    ADVANCE_BCS_BATCH(batch);
+    intel_batchbuffer_advance_dwords(batch, command_ptr);
 }
 
 static void
@@ -4523,6 +4745,11 @@ gen8_mfc_context_destroy(void *context)
     dri_bo_unreference(mfc_context->vp8_state.token_statistics_bo);
     mfc_context->vp8_state.token_statistics_bo = NULL;
 
+    free(mfc_context->vp8_state.vp8_frame_header);
+    mfc_context->vp8_state.vp8_frame_header = NULL;
+
+    free(mfc_context->jpeg_huffman.header);
+
     free(mfc_context);
 }
 
@@ -4596,6 +4823,12 @@ Bool gen8_mfc_context_init(VADriverContextP ctx, struct intel_encoder_context *e
     mfc_context->insert_object = gen8_mfc_avc_insert_object;
     mfc_context->buffer_suface_setup = gen8_gpe_buffer_suface_setup;
 
+    if (encoder_context->codec == CODEC_JPEG) {
+        char *env_str = getenv("VA_INTEL_JPEG_OPTIMIZE_HUFFMAN");
+
+        mfc_context->jpeg_huffman.enabled = env_str && atoi(env_str);
+    }
+
     encoder_context->mfc_context = mfc_context;
     encoder_context->mfc_context_destroy = gen8_mfc_context_destroy;
     encoder_context->mfc_pipeline = gen8_mfc_pipeline;
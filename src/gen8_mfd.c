@@ -94,49 +94,46 @@ gen8_mfd_init_avc_surface(VADriverContextP ctx,
     }
 }
 
-static void
+static unsigned int *
 gen8_mfd_pipe_mode_select(VADriverContextP ctx,
                           struct decode_state *decode_state,
                           int standard_select,
-                          struct gen7_mfd_context *gen7_mfd_context)
+                          struct gen7_mfd_context *gen7_mfd_context,
+                          unsigned int *command_ptr)
 {
-    struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
-
     assert(standard_select == MFX_FORMAT_MPEG2 ||
            standard_select == MFX_FORMAT_AVC ||
            standard_select == MFX_FORMAT_VC1 ||
            standard_select == MFX_FORMAT_JPEG ||
            standard_select == MFX_FORMAT_VP8);
 
-    BEGIN_BCS_BATCH(batch, 5);
-    OUT_BCS_BATCH(batch, MFX_PIPE_MODE_SELECT | (5 - 2));
-    OUT_BCS_BATCH(batch,
-                  (MFX_LONG_MODE << 17) | /* Currently only support long format */
-                  (MFD_MODE_VLD << 15) | /* VLD mode */
-                  (0 << 10) | /* disable Stream-Out */
-                  (gen7_mfd_context->post_deblocking_output.valid << 9)  | /* Post Deblocking Output */
-                  (gen7_mfd_context->pre_deblocking_output.valid << 8)  | /* Pre Deblocking Output */
-                  (0 << 5)  | /* not in stitch mode */
-                  (MFX_CODEC_DECODE << 4)  | /* decoding mode */
-                  (standard_select << 0));
-    OUT_BCS_BATCH(batch,
-                  (0 << 4)  | /* terminate if AVC motion and POC table error occurs */
-                  (0 << 3)  | /* terminate if AVC mbdata error occurs */
-                  (0 << 2)  | /* terminate if AVC CABAC/CAVLC decode error occurs */
-                  (0 << 1)  |
-                  (0 << 0));
-    OUT_BCS_BATCH(batch, 0); /* pic status/error report id */ 
-    OUT_BCS_BATCH(batch, 0); /* reserved */
-    ADVANCE_BCS_BATCH(batch);
+    *command_ptr++ = MFX_PIPE_MODE_SELECT | (5 - 2);
+    *command_ptr++ = (MFX_LONG_MODE << 17) | /* Currently only support long format */
+                     (MFD_MODE_VLD << 15) | /* VLD mode */
+                     (0 << 10) | /* disable Stream-Out */
+                     (gen7_mfd_context->post_deblocking_output.valid << 9)  | /* Post Deblocking Output */
+                     (gen7_mfd_context->pre_deblocking_output.valid << 8)  | /* Pre Deblocking Output */
+                     (0 << 5)  | /* not in stitch mode */
+                     (MFX_CODEC_DECODE << 4)  | /* decoding mode */
+                     (standard_select << 0);
+    *command_ptr++ = (0 << 4)  | /* terminate if AVC motion and POC table error occurs */
+                     (0 << 3)  | /* terminate if AVC mbdata error occurs */
+                     (0 << 2)  | /* terminate if AVC CABAC/CAVLC decode error occurs */
+                     (0 << 1)  |
+                     (0 << 0);
+    *command_ptr++ = 0; /* pic status/error report id */
+    *command_ptr++ = 0; /* reserved */
+
+    return command_ptr;
 }
 
-static void
+static unsigned int *
 gen8_mfd_surface_state(VADriverContextP ctx,
                        struct decode_state *decode_state,
                        int standard_select,
-                       struct gen7_mfd_context *gen7_mfd_context)
+                       struct gen7_mfd_context *gen7_mfd_context,
+                       unsigned int *command_ptr)
 {
-    struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     struct object_surface *obj_surface = decode_state->render_object;
     unsigned int y_cb_offset;
     unsigned int y_cr_offset;
@@ -150,27 +147,42 @@ gen8_mfd_surface_state(VADriverContextP ctx,
     surface_format = obj_surface->fourcc == VA_FOURCC_Y800 ?
         MFX_SURFACE_MONOCHROME : MFX_SURFACE_PLANAR_420_8;
 
-    BEGIN_BCS_BATCH(batch, 6);
-    OUT_BCS_BATCH(batch, MFX_SURFACE_STATE | (6 - 2));
-    OUT_BCS_BATCH(batch, 0);
-    OUT_BCS_BATCH(batch,
-                  ((obj_surface->orig_height - 1) << 18) |
-                  ((obj_surface->orig_width - 1) << 4));
-    OUT_BCS_BATCH(batch,
-                  (surface_format << 28) | /* 420 planar YUV surface */
-                  ((standard_select != MFX_FORMAT_JPEG) << 27) | /* interleave chroma, set to 0 for JPEG */
-                  (0 << 22) | /* surface object control state, ignored */
-                  ((obj_surface->width - 1) << 3) | /* pitch */
-                  (0 << 2)  | /* must be 0 */
-                  (1 << 1)  | /* must be tiled */
-                  (I965_TILEWALK_YMAJOR << 0));  /* tile walk, must be 1 */
-    OUT_BCS_BATCH(batch,
-                  (0 << 16) | /* X offset for U(Cb), must be 0 */
-                  (y_cb_offset << 0)); /* Y offset for U(Cb) */
-    OUT_BCS_BATCH(batch,
-                  (0 << 16) | /* X offset for V(Cr), must be 0 */
-                  (y_cr_offset << 0)); /* Y offset for V(Cr), must be 0 for video codec, non-zoro for JPEG */
-    ADVANCE_BCS_BATCH(batch);
+    *command_ptr++ = MFX_SURFACE_STATE | (6 - 2);
+    *command_ptr++ = 0;
+    *command_ptr++ = ((obj_surface->orig_height - 1) << 18) |
+                     ((obj_surface->orig_width - 1) << 4);
+    *command_ptr++ = (surface_format << 28) | /* 420 planar YUV surface */
+                     ((standard_select != MFX_FORMAT_JPEG) << 27) | /* interleave chroma, set to 0 for JPEG */
+                     (0 << 22) | /* surface object control state, ignored */
+                     ((obj_surface->width - 1) << 3) | /* pitch */
+                     (0 << 2)  | /* must be 0 */
+                     (1 << 1)  | /* must be tiled */
+                     (I965_TILEWALK_YMAJOR << 0);  /* tile walk, must be 1 */
+    *command_ptr++ = (0 << 16) | /* X offset for U(Cb), must be 0 */
+                     (y_cb_offset << 0); /* Y offset for U(Cb) */
+    *command_ptr++ = (0 << 16) | /* X offset for V(Cr), must be 0 */
+                     (y_cr_offset << 0); /* Y offset for V(Cr), must be 0 for video codec, non-zoro for JPEG */
+
+    return command_ptr;
+}
+
+/* MFX_PIPE_MODE_SELECT and MFX_SURFACE_STATE */
+static void
+gen8_mfd_picture_state(VADriverContextP ctx,
+                       struct decode_state *decode_state,
+                       int standard_select,
+                       struct gen7_mfd_context *gen7_mfd_context)
+{
+    struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
+    unsigned int *command_ptr;
+
+    BEGIN_BCS_BATCH(batch, 5 + 6);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    command_ptr = gen8_mfd_pipe_mode_select(ctx, decode_state, standard_select,
+                                            gen7_mfd_context, command_ptr);
+    command_ptr = gen8_mfd_surface_state(ctx, decode_state, standard_select,
+                                         gen7_mfd_context, command_ptr);
+    intel_batchbuffer_advance_dwords(batch, command_ptr);
 }
 
 static void
@@ -363,6 +375,22 @@ gen8_mfd_bsp_buf_base_addr_state(VADriverContextP ctx,
     ADVANCE_BCS_BATCH(batch);
 }
 
+static unsigned int *
+gen8_mfd_qm_command(int qm_type,
+                    unsigned char *qm,
+                    int qm_length,
+                    unsigned int *command_ptr)
+{
+    assert(qm_length <= 16 * 4);
+
+    *command_ptr++ = MFX_QM_STATE | (18 - 2);
+    *command_ptr++ = qm_type << 0;
+    memcpy(command_ptr, qm, qm_length);
+    memset((unsigned char *)command_ptr + qm_length, 0, 16 * 4 - qm_length);
+
+    return command_ptr + 16;
+}
+
 static void
 gen8_mfd_qm_state(VADriverContextP ctx,
                   int qm_type,
@@ -371,16 +399,12 @@ gen8_mfd_qm_state(VADriverContextP ctx,
                   struct gen7_mfd_context *gen7_mfd_context)
 {
     struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
-    unsigned int qm_buffer[16];
-
-    assert(qm_length <= 16 * 4);
-    memcpy(qm_buffer, qm, qm_length);
+    unsigned int *command_ptr;
 
     BEGIN_BCS_BATCH(batch, 18);
-    OUT_BCS_BATCH(batch, MFX_QM_STATE | (18 - 2));
-    OUT_BCS_BATCH(batch, qm_type << 0);
-    intel_batchbuffer_data(batch, qm_buffer, 16 * 4);
-    ADVANCE_BCS_BATCH(batch);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    command_ptr = gen8_mfd_qm_command(qm_type, qm, qm_length, command_ptr);
+    intel_batchbuffer_advance_dwords(batch, command_ptr);
 }
 
 static void
@@ -474,8 +498,11 @@ gen8_mfd_avc_qm_state(VADriverContextP ctx,
                       struct decode_state *decode_state,
                       struct gen7_mfd_context *gen7_mfd_context)
 {
+    struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     VAIQMatrixBufferH264 *iq_matrix;
     VAPictureParameterBufferH264 *pic_param;
+    unsigned int *command_ptr;
+    int transform_8x8_mode_flag;
 
     if (decode_state->iq_matrix && decode_state->iq_matrix->buffer)
         iq_matrix = (VAIQMatrixBufferH264 *)decode_state->iq_matrix->buffer;
@@ -484,14 +511,19 @@ gen8_mfd_avc_qm_state(VADriverContextP ctx,
 
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
     pic_param = (VAPictureParameterBufferH264 *)decode_state->pic_param->buffer;
+    transform_8x8_mode_flag = pic_param->pic_fields.bits.transform_8x8_mode_flag;
 
-    gen8_mfd_qm_state(ctx, MFX_QM_AVC_4X4_INTRA_MATRIX, &iq_matrix->ScalingList4x4[0][0], 3 * 16, gen7_mfd_context);
-    gen8_mfd_qm_state(ctx, MFX_QM_AVC_4X4_INTER_MATRIX, &iq_matrix->ScalingList4x4[3][0], 3 * 16, gen7_mfd_context);
+    BEGIN_BCS_BATCH(batch, (transform_8x8_mode_flag ? 4 : 2) * 18);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    command_ptr = gen8_mfd_qm_command(MFX_QM_AVC_4X4_INTRA_MATRIX, &iq_matrix->ScalingList4x4[0][0], 3 * 16, command_ptr);
+    command_ptr = gen8_mfd_qm_command(MFX_QM_AVC_4X4_INTER_MATRIX, &iq_matrix->ScalingList4x4[3][0], 3 * 16, command_ptr);
 
-    if (pic_param->pic_fields.bits.transform_8x8_mode_flag) {
-        gen8_mfd_qm_state(ctx, MFX_QM_AVC_8x8_INTRA_MATRIX, &iq_matrix->ScalingList8x8[0][0], 64, gen7_mfd_context);
-        gen8_mfd_qm_state(ctx, MFX_QM_AVC_8x8_INTER_MATRIX, &iq_matrix->ScalingList8x8[1][0], 64, gen7_mfd_context);
+    if (transform_8x8_mode_flag) {
+        command_ptr = gen8_mfd_qm_command(MFX_QM_AVC_8x8_INTRA_MATRIX, &iq_matrix->ScalingList8x8[0][0], 64, command_ptr);
+        command_ptr = gen8_mfd_qm_command(MFX_QM_AVC_8x8_INTER_MATRIX, &iq_matrix->ScalingList8x8[1][0], 64, command_ptr);
     }
+
+    intel_batchbuffer_advance_dwords(batch, command_ptr);
 }
 
 static inline void
@@ -797,7 +829,6 @@ gen8_mfd_avc_decode_init(VADriverContextP ctx,
     VASliceParameterBufferH264 *slice_param;
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct object_surface *obj_surface;
-    dri_bo *bo;
     int i, j, enable_avc_ildb = 0;
     unsigned int width_in_mbs, height_in_mbs;
 
@@ -851,41 +882,13 @@ gen8_mfd_avc_decode_init(VADriverContextP ctx,
     dri_bo_reference(gen7_mfd_context->pre_deblocking_output.bo);
     gen7_mfd_context->pre_deblocking_output.valid = !enable_avc_ildb;
 
-    dri_bo_unreference(gen7_mfd_context->intra_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "intra row store",
-                      width_in_mbs * 64,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->intra_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->intra_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->intra_row_store_scratch_buffer), "intra row store", width_in_mbs * 64);
 
-    dri_bo_unreference(gen7_mfd_context->deblocking_filter_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "deblocking filter row store",
-                      width_in_mbs * 64 * 4,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->deblocking_filter_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->deblocking_filter_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->deblocking_filter_row_store_scratch_buffer), "deblocking filter row store", width_in_mbs * 64 * 4);
 
-    dri_bo_unreference(gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "bsd mpc row store",
-                      width_in_mbs * 64 * 2,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->bsd_mpc_row_store_scratch_buffer), "bsd mpc row store", width_in_mbs * 64 * 2);
 
-    dri_bo_unreference(gen7_mfd_context->mpr_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "mpr row store",
-                      width_in_mbs * 64 * 2,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->mpr_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->mpr_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->mpr_row_store_scratch_buffer), "mpr row store", width_in_mbs * 64 * 2);
 
     gen7_mfd_context->bitplane_read_buffer.valid = 0;
 }
@@ -905,10 +908,9 @@ gen8_mfd_avc_decode_picture(VADriverContextP ctx,
     pic_param = (VAPictureParameterBufferH264 *)decode_state->pic_param->buffer;
     gen8_mfd_avc_decode_init(ctx, decode_state, gen7_mfd_context);
 
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_decoder_start_atomic_bcs(ctx, &gen7_mfd_context->deferred, 0x1000);
     intel_batchbuffer_emit_mi_flush(batch);
-    gen8_mfd_pipe_mode_select(ctx, decode_state, MFX_FORMAT_AVC, gen7_mfd_context);
-    gen8_mfd_surface_state(ctx, decode_state, MFX_FORMAT_AVC, gen7_mfd_context);
+    gen8_mfd_picture_state(ctx, decode_state, MFX_FORMAT_AVC, gen7_mfd_context);
     gen8_mfd_pipe_buf_addr_state(ctx, decode_state, MFX_FORMAT_AVC, gen7_mfd_context);
     gen8_mfd_bsp_buf_base_addr_state(ctx, decode_state, MFX_FORMAT_AVC, gen7_mfd_context);
     gen8_mfd_avc_qm_state(ctx, decode_state, gen7_mfd_context);
@@ -952,7 +954,6 @@ gen8_mfd_avc_decode_picture(VADriverContextP ctx,
     }
 
     intel_batchbuffer_end_atomic(batch);
-    intel_batchbuffer_flush(batch);
 }
 
 static void
@@ -963,7 +964,6 @@ gen8_mfd_mpeg2_decode_init(VADriverContextP ctx,
     VAPictureParameterBufferMPEG2 *pic_param;
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct object_surface *obj_surface;
-    dri_bo *bo;
     unsigned int width_in_mbs;
 
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
@@ -986,14 +986,7 @@ gen8_mfd_mpeg2_decode_init(VADriverContextP ctx,
     dri_bo_reference(gen7_mfd_context->pre_deblocking_output.bo);
     gen7_mfd_context->pre_deblocking_output.valid = 1;
 
-    dri_bo_unreference(gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "bsd mpc row store",
-                      width_in_mbs * 96,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->bsd_mpc_row_store_scratch_buffer), "bsd mpc row store", width_in_mbs * 96);
 
     gen7_mfd_context->post_deblocking_output.valid = 0;
     gen7_mfd_context->intra_row_store_scratch_buffer.valid = 0;
@@ -1173,10 +1166,9 @@ gen8_mfd_mpeg2_decode_picture(VADriverContextP ctx,
     pic_param = (VAPictureParameterBufferMPEG2 *)decode_state->pic_param->buffer;
 
     gen8_mfd_mpeg2_decode_init(ctx, decode_state, gen7_mfd_context);
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_decoder_start_atomic_bcs(ctx, &gen7_mfd_context->deferred, 0x1000);
     intel_batchbuffer_emit_mi_flush(batch);
-    gen8_mfd_pipe_mode_select(ctx, decode_state, MFX_FORMAT_MPEG2, gen7_mfd_context);
-    gen8_mfd_surface_state(ctx, decode_state, MFX_FORMAT_MPEG2, gen7_mfd_context);
+    gen8_mfd_picture_state(ctx, decode_state, MFX_FORMAT_MPEG2, gen7_mfd_context);
     gen8_mfd_pipe_buf_addr_state(ctx, decode_state, MFX_FORMAT_MPEG2, gen7_mfd_context);
     gen8_mfd_bsp_buf_base_addr_state(ctx, decode_state, MFX_FORMAT_MPEG2, gen7_mfd_context);
     gen8_mfd_mpeg2_pic_state(ctx, decode_state, gen7_mfd_context);
@@ -1211,7 +1203,6 @@ gen8_mfd_mpeg2_decode_picture(VADriverContextP ctx,
     }
 
     intel_batchbuffer_end_atomic(batch);
-    intel_batchbuffer_flush(batch);
 }
 
 static const int va_to_gen7_vc1_pic_type[5] = {
@@ -1332,32 +1323,11 @@ gen8_mfd_vc1_decode_init(VADriverContextP ctx,
     dri_bo_reference(gen7_mfd_context->pre_deblocking_output.bo);
     gen7_mfd_context->pre_deblocking_output.valid = !pic_param->entrypoint_fields.bits.loopfilter;
 
-    dri_bo_unreference(gen7_mfd_context->intra_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "intra row store",
-                      width_in_mbs * 64,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->intra_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->intra_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->intra_row_store_scratch_buffer), "intra row store", width_in_mbs * 64);
 
-    dri_bo_unreference(gen7_mfd_context->deblocking_filter_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "deblocking filter row store",
-                      width_in_mbs * 7 * 64,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->deblocking_filter_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->deblocking_filter_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->deblocking_filter_row_store_scratch_buffer), "deblocking filter row store", width_in_mbs * 7 * 64);
 
-    dri_bo_unreference(gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "bsd mpc row store",
-                      width_in_mbs * 96,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->bsd_mpc_row_store_scratch_buffer), "bsd mpc row store", width_in_mbs * 96);
 
     gen7_mfd_context->mpr_row_store_scratch_buffer.valid = 0;
 
@@ -1830,10 +1800,9 @@ gen8_mfd_vc1_decode_picture(VADriverContextP ctx,
     pic_param = (VAPictureParameterBufferVC1 *)decode_state->pic_param->buffer;
 
     gen8_mfd_vc1_decode_init(ctx, decode_state, gen7_mfd_context);
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_decoder_start_atomic_bcs(ctx, &gen7_mfd_context->deferred, 0x1000);
     intel_batchbuffer_emit_mi_flush(batch);
-    gen8_mfd_pipe_mode_select(ctx, decode_state, MFX_FORMAT_VC1, gen7_mfd_context);
-    gen8_mfd_surface_state(ctx, decode_state, MFX_FORMAT_VC1, gen7_mfd_context);
+    gen8_mfd_picture_state(ctx, decode_state, MFX_FORMAT_VC1, gen7_mfd_context);
     gen8_mfd_pipe_buf_addr_state(ctx, decode_state, MFX_FORMAT_VC1, gen7_mfd_context);
     gen8_mfd_bsp_buf_base_addr_state(ctx, decode_state, MFX_FORMAT_VC1, gen7_mfd_context);
     gen8_mfd_vc1_pic_state(ctx, decode_state, gen7_mfd_context);
@@ -1865,7 +1834,6 @@ gen8_mfd_vc1_decode_picture(VADriverContextP ctx,
     }
 
     intel_batchbuffer_end_atomic(batch);
-    intel_batchbuffer_flush(batch);
 }
 
 static void
@@ -2624,13 +2592,12 @@ gen8_mfd_jpeg_decode_picture(VADriverContextP ctx,
 
     /* Currently only support Baseline DCT */
     gen8_mfd_jpeg_decode_init(ctx, decode_state, gen7_mfd_context);
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_decoder_start_atomic_bcs(ctx, &gen7_mfd_context->deferred, 0x1000);
 #ifdef JPEG_WA
     gen8_mfd_jpeg_wa(ctx, gen7_mfd_context);
 #endif
     intel_batchbuffer_emit_mi_flush(batch);
-    gen8_mfd_pipe_mode_select(ctx, decode_state, MFX_FORMAT_JPEG, gen7_mfd_context);
-    gen8_mfd_surface_state(ctx, decode_state, MFX_FORMAT_JPEG, gen7_mfd_context);
+    gen8_mfd_picture_state(ctx, decode_state, MFX_FORMAT_JPEG, gen7_mfd_context);
     gen8_mfd_pipe_buf_addr_state(ctx, decode_state, MFX_FORMAT_JPEG, gen7_mfd_context);
     gen8_mfd_jpeg_pic_state(ctx, decode_state, gen7_mfd_context);
     gen8_mfd_jpeg_qm_state(ctx, decode_state, gen7_mfd_context);
@@ -2696,7 +2663,6 @@ gen8_mfd_jpeg_decode_picture(VADriverContextP ctx,
     }
 
     intel_batchbuffer_end_atomic(batch);
-    intel_batchbuffer_flush(batch);
 }
 
 static const int vp8_dc_qlookup[128] =
@@ -2740,7 +2706,6 @@ gen8_mfd_vp8_decode_init(VADriverContextP ctx,
 {
     struct object_surface *obj_surface;
     struct i965_driver_data *i965 = i965_driver_data(ctx);
-    dri_bo *bo;
     VAPictureParameterBufferVP8 *pic_param = (VAPictureParameterBufferVP8 *)decode_state->pic_param->buffer;
     int width_in_mbs = (pic_param->frame_width + 15) / 16;
     int height_in_mbs = (pic_param->frame_height + 15) / 16;
@@ -2771,41 +2736,13 @@ gen8_mfd_vp8_decode_init(VADriverContextP ctx,
         &gen7_mfd_context->segmentation_buffer, width_in_mbs, height_in_mbs);
 
     /* The same as AVC */
-    dri_bo_unreference(gen7_mfd_context->intra_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "intra row store",
-                      width_in_mbs * 64,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->intra_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->intra_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->intra_row_store_scratch_buffer), "intra row store", width_in_mbs * 64);
 
-    dri_bo_unreference(gen7_mfd_context->deblocking_filter_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "deblocking filter row store",
-                      width_in_mbs * 64 * 4,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->deblocking_filter_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->deblocking_filter_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->deblocking_filter_row_store_scratch_buffer), "deblocking filter row store", width_in_mbs * 64 * 4);
 
-    dri_bo_unreference(gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "bsd mpc row store",
-                      width_in_mbs * 64 * 2,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->bsd_mpc_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->bsd_mpc_row_store_scratch_buffer), "bsd mpc row store", width_in_mbs * 64 * 2);
 
-    dri_bo_unreference(gen7_mfd_context->mpr_row_store_scratch_buffer.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "mpr row store",
-                      width_in_mbs * 64 * 2,
-                      0x1000);
-    assert(bo);
-    gen7_mfd_context->mpr_row_store_scratch_buffer.bo = bo;
-    gen7_mfd_context->mpr_row_store_scratch_buffer.valid = 1;
+    ALLOC_GEN_BUFFER((&gen7_mfd_context->mpr_row_store_scratch_buffer), "mpr row store", width_in_mbs * 64 * 2);
 
     gen7_mfd_context->bitplane_read_buffer.valid = 0;
 }
@@ -3048,17 +2985,15 @@ gen8_mfd_vp8_decode_picture(VADriverContextP ctx,
     slice_data_bo = decode_state->slice_datas[0]->bo;
 
     gen8_mfd_vp8_decode_init(ctx, decode_state, gen7_mfd_context);
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_decoder_start_atomic_bcs(ctx, &gen7_mfd_context->deferred, 0x1000);
     intel_batchbuffer_emit_mi_flush(batch);
-    gen8_mfd_pipe_mode_select(ctx, decode_state, MFX_FORMAT_VP8, gen7_mfd_context);
-    gen8_mfd_surface_state(ctx, decode_state, MFX_FORMAT_VP8, gen7_mfd_context);
+    gen8_mfd_picture_state(ctx, decode_state, MFX_FORMAT_VP8, gen7_mfd_context);
     gen8_mfd_pipe_buf_addr_state(ctx, decode_state, MFX_FORMAT_VP8, gen7_mfd_context);
     gen8_mfd_bsp_buf_base_addr_state(ctx, decode_state, MFX_FORMAT_VP8, gen7_mfd_context);
     gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_VP8, gen7_mfd_context);
     gen8_mfd_vp8_pic_state(ctx, decode_state, gen7_mfd_context);
     gen8_mfd_vp8_bsd_object(ctx, pic_param, slice_param, slice_data_bo, gen7_mfd_context);
     intel_batchbuffer_end_atomic(batch);
-    intel_batchbuffer_flush(batch);
 }
 
 static VAStatus
@@ -3081,6 +3016,8 @@ gen8_mfd_decode_picture(VADriverContextP ctx,
 
     gen7_mfd_context->wa_mpeg2_slice_vertical_position = -1;
 
+    intel_decoder_begin_picture(ctx, &gen7_mfd_context->deferred, decode_state);
+
     switch (profile) {
     case VAProfileMPEG2Simple:
     case VAProfileMPEG2Main:
@@ -3114,6 +3051,7 @@ gen8_mfd_decode_picture(VADriverContextP ctx,
         break;
     }
 
+    intel_decoder_end_picture(ctx, &gen7_mfd_context->deferred);
     vaStatus = VA_STATUS_SUCCESS;
 
 out:
@@ -3128,6 +3066,8 @@ gen8_mfd_context_destroy(void *hw_context)
 
     ctx = (VADriverContextP)(gen7_mfd_context->driver_context);
 
+    intel_decoder_deferred_terminate(ctx, &gen7_mfd_context->deferred);
+
     dri_bo_unreference(gen7_mfd_context->post_deblocking_output.bo);
     gen7_mfd_context->post_deblocking_output.bo = NULL;
 
@@ -3196,6 +3136,9 @@ gen8_dec_hw_context_init(VADriverContextP ctx, struct object_config *obj_config)
     gen7_mfd_context->jpeg_wa_surface_id = VA_INVALID_SURFACE;
     gen7_mfd_context->segmentation_buffer.valid = 0;
 
+    intel_decoder_deferred_init(ctx, &gen7_mfd_context->deferred,
+                                &gen7_mfd_context->base);
+
     switch (obj_config->profile) {
     case VAProfileMPEG2Simple:
     case VAProfileMPEG2Main:
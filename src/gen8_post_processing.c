@@ -38,6 +38,7 @@
 #include "i965_structs.h"
 #include "i965_drv_video.h"
 #include "i965_post_processing.h"
+#include "i965_gpe_utils.h"
 #include "i965_render.h"
 #include "intel_media.h"
 
@@ -1382,6 +1383,22 @@ gen8_pp_object_walker(VADriverContextP ctx,
 
     dri_bo_unmap(command_buffer);
 
+    if (pp_context->chain_object_walker) {
+        /* MI_BATCH_BUFFER_END returns to this batch, so more passes can
+         * still be queued before it is submitted */
+        BEGIN_BATCH(batch, 3);
+        OUT_BATCH(batch, MI_BATCH_BUFFER_START |
+                  MI_BATCH_BUFFER_START_SECOND_LEVEL |
+                  (1 << 8) | (1 << 0));
+        OUT_RELOC(batch, command_buffer,
+                  I915_GEM_DOMAIN_COMMAND, 0, 0);
+        OUT_BATCH(batch, 0);
+        ADVANCE_BATCH(batch);
+
+        dri_bo_unreference(command_buffer);
+        return;
+    }
+
     BEGIN_BATCH(batch, 3);
     OUT_BATCH(batch, MI_BATCH_BUFFER_START | (1 << 8) | (1 << 0));
     OUT_RELOC(batch, command_buffer,
@@ -1451,6 +1468,8 @@ static void
 gen8_post_processing_context_finalize(VADriverContextP ctx,
     struct i965_post_processing_context *pp_context)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+
     dri_bo_unreference(pp_context->surface_state_binding_table.bo);
     pp_context->surface_state_binding_table.bo = NULL;
 
@@ -1458,7 +1477,7 @@ gen8_post_processing_context_finalize(VADriverContextP ctx,
     pp_context->pp_dn_context.stmm_bo = NULL;
 
     if (pp_context->instruction_state.bo) {
-	dri_bo_unreference(pp_context->instruction_state.bo);
+	i965_kernel_cache_put(&i965->kernel_cache, pp_context->instruction_state.bo);
 	pp_context->instruction_state.bo = NULL;
     }
 
@@ -1487,11 +1506,9 @@ gen8_post_processing_context_common_init(VADriverContextP ctx,
                                          int num_pp_modules,
                                          struct intel_batchbuffer *batch)
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
-    int i, kernel_size;
-    unsigned int kernel_offset, end_offset;
-    unsigned char *kernel_ptr;
-    struct pp_module *pp_module;
+    struct i965_kernel *kernels[NUM_PP_MODULES];
+    unsigned int end_offset;
+    int i;
     struct i965_post_processing_context *pp_context = data;
 
     pp_context->vfe_gpu_state.max_num_threads = 60;
@@ -1507,52 +1524,19 @@ gen8_post_processing_context_common_init(VADriverContextP ctx,
 
     memcpy(pp_context->pp_modules, pp_modules, sizeof(pp_context->pp_modules));
 
-    kernel_size = 4096 ;
-
-    for (i = 0; i < NUM_PP_MODULES; i++) {
-        pp_module = &pp_context->pp_modules[i];
-
-        if (pp_module->kernel.bin && pp_module->kernel.size) {
-	    kernel_size += pp_module->kernel.size;
-        }
-    }
+    for (i = 0; i < NUM_PP_MODULES; i++)
+        kernels[i] = &pp_context->pp_modules[i].kernel;
 
-    pp_context->instruction_state.bo = dri_bo_alloc(i965->intel.bufmgr,
-                                  "kernel shader",
-                                  kernel_size,
-                                  0x1000);
+    /* shared with the other post processing contexts of the display */
+    pp_context->instruction_state.bo = i965_kernel_cache_get(ctx, kernels, NUM_PP_MODULES, &end_offset);
     if (pp_context->instruction_state.bo == NULL) {
         WARN_ONCE("failure to allocate the buffer space for kernel shader in VPP\n");
         return;
     }
 
-    assert(pp_context->instruction_state.bo);
-
-
-    pp_context->instruction_state.bo_size = kernel_size;
-    pp_context->instruction_state.end_offset = 0;
-    end_offset = 0;
-
-    dri_bo_map(pp_context->instruction_state.bo, 1);
-    kernel_ptr = (unsigned char *)(pp_context->instruction_state.bo->virtual);
-
-    for (i = 0; i < NUM_PP_MODULES; i++) {
-        pp_module = &pp_context->pp_modules[i];
-
-        kernel_offset = ALIGN(end_offset, 64);
-        pp_module->kernel.kernel_offset = kernel_offset;
-
-        if (pp_module->kernel.bin && pp_module->kernel.size) {
-
-	    memcpy(kernel_ptr + kernel_offset, pp_module->kernel.bin, pp_module->kernel.size);
-	    end_offset = kernel_offset + pp_module->kernel.size;
-        }
-    }
-
+    pp_context->instruction_state.bo_size = pp_context->instruction_state.bo->size;
     pp_context->instruction_state.end_offset = ALIGN(end_offset, 64);
 
-    dri_bo_unmap(pp_context->instruction_state.bo);
-
     /* static & inline parameters */
     pp_context->pp_static_parameter = calloc(sizeof(struct gen7_pp_static_parameter), 1);
     pp_context->pp_inline_parameter = calloc(sizeof(struct gen7_pp_inline_parameter), 1);
@@ -858,166 +858,12 @@ gen9_mfc_avc_slice_state(VADriverContextP ctx,
 
 #ifdef MFC_SOFTWARE_HASWELL
 
-static int
-gen9_mfc_avc_pak_object_intra(VADriverContextP ctx, int x, int y, int end_mb,
-                              int qp,unsigned int *msg,
-                              struct intel_encoder_context *encoder_context,
-                              unsigned char target_mb_size, unsigned char max_mb_size,
-                              struct intel_batchbuffer *batch)
-{
-    int len_in_dwords = 12;
-    unsigned int intra_msg;
-#define		INTRA_MSG_FLAG		(1 << 13)
-#define		INTRA_MBTYPE_MASK	(0x1F0000)
-    if (batch == NULL)
-        batch = encoder_context->base.batch;
-
-    BEGIN_BCS_BATCH(batch, len_in_dwords);
-
-    intra_msg = msg[0] & 0xC0FF;
-    intra_msg |= INTRA_MSG_FLAG;
-    intra_msg |= ((msg[0] & INTRA_MBTYPE_MASK) >> 8);
-    OUT_BCS_BATCH(batch, MFC_AVC_PAK_OBJECT | (len_in_dwords - 2));
-    OUT_BCS_BATCH(batch, 0);
-    OUT_BCS_BATCH(batch, 0);
-    OUT_BCS_BATCH(batch,
-                  (0 << 24) |		/* PackedMvNum, Debug*/
-                  (0 << 20) | 		/* No motion vector */
-                  (1 << 19) |		/* CbpDcY */
-                  (1 << 18) |		/* CbpDcU */
-                  (1 << 17) |		/* CbpDcV */
-                  intra_msg);
-
-    OUT_BCS_BATCH(batch, (0xFFFF << 16) | (y << 8) | x);		/* Code Block Pattern for Y*/
-    OUT_BCS_BATCH(batch, 0x000F000F);     /* Code Block Pattern */
-
-    OUT_BCS_BATCH(batch, (0 << 27) | (end_mb << 26) | qp);	/* Last MB */
-
-    /*Stuff for Intra MB*/
-    OUT_BCS_BATCH(batch, msg[1]);	/* We using Intra16x16 no 4x4 predmode*/
-    OUT_BCS_BATCH(batch, msg[2]);
-    OUT_BCS_BATCH(batch, msg[3]&0xFF);
-
-    /*MaxSizeInWord and TargetSzieInWord*/
-    OUT_BCS_BATCH(batch, (max_mb_size << 24) |
-                  (target_mb_size << 16) );
-
-    OUT_BCS_BATCH(batch, 0);
-
-    ADVANCE_BCS_BATCH(batch);
-
-    return len_in_dwords;
-}
-
-static int
-gen9_mfc_avc_pak_object_inter(VADriverContextP ctx, int x, int y, int end_mb, int qp,
-                              unsigned int *msg, unsigned int offset,
-                              struct intel_encoder_context *encoder_context,
-                              unsigned char target_mb_size,unsigned char max_mb_size, int slice_type,
-                              struct intel_batchbuffer *batch)
-{
-    struct gen6_vme_context *vme_context = encoder_context->vme_context;
-    int len_in_dwords = 12;
-    unsigned int inter_msg = 0;
-    if (batch == NULL)
-        batch = encoder_context->base.batch;
-    {
-#define MSG_MV_OFFSET	4
-	unsigned int *mv_ptr;
-	mv_ptr = msg + MSG_MV_OFFSET;
-	/* MV of VME output is based on 16 sub-blocks. So it is necessary
-         * to convert them to be compatible with the format of AVC_PAK
-         * command.
-         */
-	if ((msg[0] & INTER_MODE_MASK) == INTER_8X16) {
-            /* MV[0] and MV[2] are replicated */
-            mv_ptr[4] = mv_ptr[0];
-            mv_ptr[5] = mv_ptr[1];
-            mv_ptr[2] = mv_ptr[8];
-            mv_ptr[3] = mv_ptr[9];
-            mv_ptr[6] = mv_ptr[8];
-            mv_ptr[7] = mv_ptr[9];
-	} else if ((msg[0] & INTER_MODE_MASK) == INTER_16X8) {
-            /* MV[0] and MV[1] are replicated */
-            mv_ptr[2] = mv_ptr[0];
-            mv_ptr[3] = mv_ptr[1];
-            mv_ptr[4] = mv_ptr[16];
-            mv_ptr[5] = mv_ptr[17];
-            mv_ptr[6] = mv_ptr[24];
-            mv_ptr[7] = mv_ptr[25];
-	} else if (((msg[0] & INTER_MODE_MASK) == INTER_8X8) &&
-                   !(msg[1] & SUBMB_SHAPE_MASK)) {
-            /* Don't touch MV[0] or MV[1] */
-            mv_ptr[2] = mv_ptr[8];
-            mv_ptr[3] = mv_ptr[9];
-            mv_ptr[4] = mv_ptr[16];
-            mv_ptr[5] = mv_ptr[17];
-            mv_ptr[6] = mv_ptr[24];
-            mv_ptr[7] = mv_ptr[25];
-	}
-    }
-
-    BEGIN_BCS_BATCH(batch, len_in_dwords);
-
-    OUT_BCS_BATCH(batch, MFC_AVC_PAK_OBJECT | (len_in_dwords - 2));
-
-    inter_msg = 32;
-    /* MV quantity */
-    if ((msg[0] & INTER_MODE_MASK) == INTER_8X8) {
-        if (msg[1] & SUBMB_SHAPE_MASK)
-            inter_msg = 128;
-    }
-    OUT_BCS_BATCH(batch, inter_msg);         /* 32 MV*/
-    OUT_BCS_BATCH(batch, offset);
-    inter_msg = msg[0] & (0x1F00FFFF);
-    inter_msg |= INTER_MV8;
-    inter_msg |= ((1 << 19) | (1 << 18) | (1 << 17));
-    if (((msg[0] & INTER_MODE_MASK) == INTER_8X8) &&
-        (msg[1] & SUBMB_SHAPE_MASK)) {
-        inter_msg |= INTER_MV32;
-    }
-
-    OUT_BCS_BATCH(batch, inter_msg);
-
-    OUT_BCS_BATCH(batch, (0xFFFF<<16) | (y << 8) | x);        /* Code Block Pattern for Y*/
-    OUT_BCS_BATCH(batch, 0x000F000F);                         /* Code Block Pattern */
-#if 0
-    if ( slice_type == SLICE_TYPE_B) {
-        OUT_BCS_BATCH(batch, (0xF<<28) | (end_mb << 26) | qp);	/* Last MB */
-    } else {
-        OUT_BCS_BATCH(batch, (end_mb << 26) | qp);	/* Last MB */
-    }
-#else
-    OUT_BCS_BATCH(batch, (end_mb << 26) | qp);	/* Last MB */
-#endif
-
-    inter_msg = msg[1] >> 8;
-    /*Stuff for Inter MB*/
-    OUT_BCS_BATCH(batch, inter_msg);
-    OUT_BCS_BATCH(batch, vme_context->ref_index_in_mb[0]);
-    OUT_BCS_BATCH(batch, vme_context->ref_index_in_mb[1]);
-
-    /*MaxSizeInWord and TargetSzieInWord*/
-    OUT_BCS_BATCH(batch, (max_mb_size << 24) |
-                  (target_mb_size << 16) );
-
-    OUT_BCS_BATCH(batch, 0x0);
-    ADVANCE_BCS_BATCH(batch);
-
-    return len_in_dwords;
-}
-
-#define		AVC_INTRA_RDO_OFFSET	4
-#define		AVC_INTER_RDO_OFFSET	10
-#define		AVC_INTER_MSG_OFFSET	8
-#define		AVC_INTER_MV_OFFSET		48
-#define		AVC_RDO_MASK		0xFFFF
-
 static void
 gen9_mfc_avc_pipeline_slice_programing(VADriverContextP ctx,
                                        struct encode_state *encode_state,
                                        struct intel_encoder_context *encoder_context,
                                        int slice_index,
+                                       unsigned char *vme_output,
                                        struct intel_batchbuffer *slice_batch)
 {
     struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
@@ -1025,12 +871,12 @@ gen9_mfc_avc_pipeline_slice_programing(VADriverContextP ctx,
     VAEncSequenceParameterBufferH264 *pSequenceParameter = (VAEncSequenceParameterBufferH264 *)encode_state->seq_param_ext->buffer;
     VAEncPictureParameterBufferH264 *pPicParameter = (VAEncPictureParameterBufferH264 *)encode_state->pic_param_ext->buffer;
     VAEncSliceParameterBufferH264 *pSliceParameter = (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[slice_index]->buffer;
-    unsigned int *msg = NULL, offset = 0;
-    unsigned char *msg_ptr = NULL;
+    unsigned int *command_ptr;
     int width_in_mbs = (mfc_context->surface_state.width + 15) / 16;
     int height_in_mbs = (mfc_context->surface_state.height + 15) / 16;
-    int last_slice = (pSliceParameter->macroblock_address + pSliceParameter->num_macroblocks) == (width_in_mbs * height_in_mbs);
-    int i,x,y;
+    int end_mb = pSliceParameter->macroblock_address + pSliceParameter->num_macroblocks;
+    int last_slice = end_mb == (width_in_mbs * height_in_mbs);
+    int i, x, y, num_mbs;
     int qp = pPicParameter->pic_init_qp + pSliceParameter->slice_qp_delta;
     unsigned int rate_control_mode = encoder_context->rate_control_mode;
     unsigned int tail_data[] = { 0x0, 0x0 };
@@ -1064,41 +910,26 @@ gen9_mfc_avc_pipeline_slice_programing(VADriverContextP ctx,
 
          intel_avc_slice_insert_packed_data(ctx, encode_state, encoder_context, slice_index, slice_batch);
 
-    dri_bo_map(vme_context->vme_output.bo , 1);
-    msg_ptr = (unsigned char *)vme_context->vme_output.bo->virtual;
-
-    if (is_intra) {
-        msg = (unsigned int *) (msg_ptr + pSliceParameter->macroblock_address * vme_context->vme_output.size_block);
-    } else {
-        msg = (unsigned int *) (msg_ptr + pSliceParameter->macroblock_address * vme_context->vme_output.size_block);
-    }
-
-    for (i = pSliceParameter->macroblock_address;
-        i < pSliceParameter->macroblock_address + pSliceParameter->num_macroblocks; i++) {
-        int last_mb = (i == (pSliceParameter->macroblock_address + pSliceParameter->num_macroblocks - 1) );
+    /* The PAK objects are written one macroblock row at a time */
+    for (i = pSliceParameter->macroblock_address; i < end_mb; i += num_mbs) {
         x = i % width_in_mbs;
         y = i / width_in_mbs;
-        msg = (unsigned int *) (msg_ptr + i * vme_context->vme_output.size_block);
-
-        if (is_intra) {
-            assert(msg);
-            gen9_mfc_avc_pak_object_intra(ctx, x, y, last_mb, qp, msg, encoder_context, 0, 0, slice_batch);
-        } else {
-	    int inter_rdo, intra_rdo;
-	    inter_rdo = msg[AVC_INTER_RDO_OFFSET] & AVC_RDO_MASK;
-	    intra_rdo = msg[AVC_INTRA_RDO_OFFSET] & AVC_RDO_MASK;
-	    offset = i * vme_context->vme_output.size_block + AVC_INTER_MV_OFFSET;
-	    if (intra_rdo < inter_rdo) {
-                gen9_mfc_avc_pak_object_intra(ctx, x, y, last_mb, qp, msg, encoder_context, 0, 0, slice_batch);
-            } else {
-		msg += AVC_INTER_MSG_OFFSET;
-                gen9_mfc_avc_pak_object_inter(ctx, x, y, last_mb, qp, msg, offset, encoder_context, 0, 0, pSliceParameter->slice_type, slice_batch);
-            }
-        }
+        num_mbs = MIN(width_in_mbs - x, end_mb - i);
+
+        BEGIN_BCS_BATCH(slice_batch, num_mbs * INTEL_AVC_PAK_OBJECT_DWORDS);
+        command_ptr = intel_batchbuffer_dwords(slice_batch);
+        command_ptr += intel_mfc_avc_pak_object_row(command_ptr,
+                                                    vme_output,
+                                                    vme_context->vme_output.size_block,
+                                                    x, y, width_in_mbs,
+                                                    num_mbs,
+                                                    i + num_mbs == end_mb,
+                                                    qp,
+                                                    is_intra,
+                                                    vme_context->ref_index_in_mb);
+        intel_batchbuffer_advance_dwords(slice_batch, command_ptr);
     }
 
-    dri_bo_unmap(vme_context->vme_output.bo);
-
     if ( last_slice ) {
         mfc_context->insert_object(ctx, encoder_context,
                                    tail_data, 2, 8,
@@ -1120,13 +951,12 @@ gen9_mfc_avc_software_batchbuffer(VADriverContextP ctx,
     struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
     struct intel_batchbuffer *batch;
     dri_bo *batch_bo;
-    int i;
 
     batch = mfc_context->aux_batchbuffer;
     batch_bo = batch->buffer;
-    for (i = 0; i < encode_state->num_slice_params_ext; i++) {
-        gen9_mfc_avc_pipeline_slice_programing(ctx, encode_state, encoder_context, i, batch);
-    }
+    intel_mfc_avc_slice_batchbuffers(ctx, encode_state, encoder_context,
+                                     gen9_mfc_avc_pipeline_slice_programing,
+                                     batch);
 
     intel_batchbuffer_align(batch, 8);
 
@@ -1590,9 +1420,13 @@ gen9_mfc_avc_encode_picture(VADriverContextP ctx,
     struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
     unsigned int rate_control_mode = encoder_context->rate_control_mode;
     int current_frame_bits_size;
-    int sts;
+    int sts, pass = 0;
 
     for (;;) {
+        //each re-encode of the picture by the BRC is a pass
+        if (rate_control_mode == VA_RC_CBR)
+            I965_TRACE_BEGIN_ARG("BRC pass", pass++);
+
         gen9_mfc_init(ctx, encode_state, encoder_context);
         intel_mfc_avc_prepare(ctx, encode_state, encoder_context);
         /*Programing bcs pipeline*/
@@ -1600,6 +1434,7 @@ gen9_mfc_avc_encode_picture(VADriverContextP ctx,
         gen9_mfc_run(ctx, encode_state, encoder_context);
         if (rate_control_mode == VA_RC_CBR /*|| rate_control_mode == VA_RC_VBR*/) {
             gen9_mfc_stop(ctx, encode_state, encoder_context, &current_frame_bits_size);
+            I965_TRACE_END("BRC pass");
             sts = intel_mfc_brc_postpack(encode_state, mfc_context, current_frame_bits_size);
             if (sts == BRC_NO_HRD_VIOLATION) {
                 intel_mfc_hrd_context_update(encode_state, mfc_context);
@@ -177,35 +177,31 @@ gen9_hcpd_hevc_decode_init(VADriverContextP ctx,
     return VA_STATUS_SUCCESS;
 }
 
-static void
+static unsigned int *
 gen9_hcpd_pipe_mode_select(VADriverContextP ctx,
                            struct decode_state *decode_state,
                            int codec,
-                           struct gen9_hcpd_context *gen9_hcpd_context)
+                           struct gen9_hcpd_context *gen9_hcpd_context,
+                           unsigned int *command_ptr)
 {
-    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
-
     assert(codec == HCP_CODEC_HEVC);
 
-    BEGIN_BCS_BATCH(batch, 4);
-
-    OUT_BCS_BATCH(batch, HCP_PIPE_MODE_SELECT | (4 - 2));
-    OUT_BCS_BATCH(batch,
-                  (codec << 5) |
-                  (0 << 3) | /* disable Pic Status / Error Report */
-                  HCP_CODEC_SELECT_DECODE);
-    OUT_BCS_BATCH(batch, 0);
-    OUT_BCS_BATCH(batch, 0);
+    *command_ptr++ = HCP_PIPE_MODE_SELECT | (4 - 2);
+    *command_ptr++ = (codec << 5) |
+                     (0 << 3) | /* disable Pic Status / Error Report */
+                     HCP_CODEC_SELECT_DECODE;
+    *command_ptr++ = 0;
+    *command_ptr++ = 0;
 
-    ADVANCE_BCS_BATCH(batch);
+    return command_ptr;
 }
 
-static void
+static unsigned int *
 gen9_hcpd_surface_state(VADriverContextP ctx,
                         struct decode_state *decode_state,
-                        struct gen9_hcpd_context *gen9_hcpd_context)
+                        struct gen9_hcpd_context *gen9_hcpd_context,
+                        unsigned int *command_ptr)
 {
-    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
     struct object_surface *obj_surface = decode_state->render_object;
     unsigned int y_cb_offset;
 
@@ -213,17 +209,32 @@ gen9_hcpd_surface_state(VADriverContextP ctx,
 
     y_cb_offset = obj_surface->y_cb_offset;
 
-    BEGIN_BCS_BATCH(batch, 3);
+    *command_ptr++ = HCP_SURFACE_STATE | (3 - 2);
+    *command_ptr++ = (0 << 28) |                   /* surface id */
+                     (obj_surface->width - 1);     /* pitch - 1 */
+    *command_ptr++ = (SURFACE_FORMAT_PLANAR_420_8 << 28) |
+                     y_cb_offset;
 
-    OUT_BCS_BATCH(batch, HCP_SURFACE_STATE | (3 - 2));
-    OUT_BCS_BATCH(batch,
-                  (0 << 28) |                   /* surface id */
-                  (obj_surface->width - 1));    /* pitch - 1 */
-    OUT_BCS_BATCH(batch,
-                  (SURFACE_FORMAT_PLANAR_420_8 << 28) |
-                  y_cb_offset);
+    return command_ptr;
+}
 
-    ADVANCE_BCS_BATCH(batch);
+/* HCP_PIPE_MODE_SELECT and HCP_SURFACE_STATE */
+static void
+gen9_hcpd_picture_state(VADriverContextP ctx,
+                        struct decode_state *decode_state,
+                        int codec,
+                        struct gen9_hcpd_context *gen9_hcpd_context)
+{
+    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
+    unsigned int *command_ptr;
+
+    BEGIN_BCS_BATCH(batch, 4 + 3);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    command_ptr = gen9_hcpd_pipe_mode_select(ctx, decode_state, codec,
+                                             gen9_hcpd_context, command_ptr);
+    command_ptr = gen9_hcpd_surface_state(ctx, decode_state,
+                                          gen9_hcpd_context, command_ptr);
+    intel_batchbuffer_advance_dwords(batch, command_ptr);
 }
 
 static void
@@ -314,7 +325,7 @@ gen9_hcpd_ind_obj_base_addr_state(VADriverContextP ctx,
     ADVANCE_BCS_BATCH(batch);
 }
 
-static void
+static unsigned int *
 gen9_hcpd_qm_state(VADriverContextP ctx,
                    int size_id,
                    int color_component,
@@ -322,26 +333,20 @@ gen9_hcpd_qm_state(VADriverContextP ctx,
                    int dc,
                    unsigned char *qm,
                    int qm_length,
-                   struct gen9_hcpd_context *gen9_hcpd_context)
+                   struct gen9_hcpd_context *gen9_hcpd_context,
+                   unsigned int *command_ptr)
 {
-    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
-    unsigned char qm_buffer[64];
-
     assert(qm_length <= 64);
-    memset(qm_buffer, 0, sizeof(qm_buffer));
-    memcpy(qm_buffer, qm, qm_length);
-
-    BEGIN_BCS_BATCH(batch, 18);
 
-    OUT_BCS_BATCH(batch, HCP_QM_STATE | (18 - 2));
-    OUT_BCS_BATCH(batch,
-                  dc << 5 |
-                  color_component << 3 |
-                  size_id << 1 |
-                  pred_type);
-    intel_batchbuffer_data(batch, qm_buffer, 64);
+    *command_ptr++ = HCP_QM_STATE | (18 - 2);
+    *command_ptr++ = dc << 5 |
+                     color_component << 3 |
+                     size_id << 1 |
+                     pred_type;
+    memcpy(command_ptr, qm, qm_length);
+    memset((unsigned char *)command_ptr + qm_length, 0, 64 - qm_length);
 
-    ADVANCE_BCS_BATCH(batch);
+    return command_ptr + 16;
 }
 
 static void
@@ -349,8 +354,10 @@ gen9_hcpd_hevc_qm_state(VADriverContextP ctx,
                         struct decode_state *decode_state,
                         struct gen9_hcpd_context *gen9_hcpd_context)
 {
+    GenCommandTemplate *tmpl = &gen9_hcpd_context->qm_state;
     VAIQMatrixBufferHEVC *iq_matrix;
     VAPictureParameterBufferHEVC *pic_param;
+    unsigned int *command_ptr;
     int i;
 
     if (decode_state->iq_matrix && decode_state->iq_matrix->buffer)
@@ -364,33 +371,41 @@ gen9_hcpd_hevc_qm_state(VADriverContextP ctx,
     if (!pic_param->pic_fields.bits.scaling_list_enabled_flag)
         iq_matrix = &gen9_hcpd_context->iq_matrix_hevc;
 
-    for (i = 0; i < 6; i++) {
-        gen9_hcpd_qm_state(ctx,
-                           0, i % 3, i / 3, 0,
-                           iq_matrix->ScalingList4x4[i], 16,
-                           gen9_hcpd_context);
-    }
+    command_ptr = intel_command_template_begin(tmpl, iq_matrix, sizeof(*iq_matrix));
 
-    for (i = 0; i < 6; i++) {
-        gen9_hcpd_qm_state(ctx,
-                           1, i % 3, i / 3, 0,
-                           iq_matrix->ScalingList8x8[i], 64,
-                           gen9_hcpd_context);
-    }
+    if (command_ptr) {
+        for (i = 0; i < 6; i++) {
+            command_ptr = gen9_hcpd_qm_state(ctx,
+                                             0, i % 3, i / 3, 0,
+                                             iq_matrix->ScalingList4x4[i], 16,
+                                             gen9_hcpd_context, command_ptr);
+        }
 
-    for (i = 0; i < 6; i++) {
-        gen9_hcpd_qm_state(ctx,
-                           2, i % 3, i / 3, iq_matrix->ScalingListDC16x16[i],
-                           iq_matrix->ScalingList16x16[i], 64,
-                           gen9_hcpd_context);
-    }
+        for (i = 0; i < 6; i++) {
+            command_ptr = gen9_hcpd_qm_state(ctx,
+                                             1, i % 3, i / 3, 0,
+                                             iq_matrix->ScalingList8x8[i], 64,
+                                             gen9_hcpd_context, command_ptr);
+        }
 
-    for (i = 0; i < 2; i++) {
-        gen9_hcpd_qm_state(ctx,
-                           3, 0, i % 2, iq_matrix->ScalingListDC32x32[i],
-                           iq_matrix->ScalingList32x32[i], 64,
-                           gen9_hcpd_context);
+        for (i = 0; i < 6; i++) {
+            command_ptr = gen9_hcpd_qm_state(ctx,
+                                             2, i % 3, i / 3, iq_matrix->ScalingListDC16x16[i],
+                                             iq_matrix->ScalingList16x16[i], 64,
+                                             gen9_hcpd_context, command_ptr);
+        }
+
+        for (i = 0; i < 2; i++) {
+            command_ptr = gen9_hcpd_qm_state(ctx,
+                                             3, 0, i % 2, iq_matrix->ScalingListDC32x32[i],
+                                             iq_matrix->ScalingList32x32[i], 64,
+                                             gen9_hcpd_context, command_ptr);
+        }
+
+        intel_command_template_end(tmpl, command_ptr);
     }
+
+    intel_command_template_emit(gen9_hcpd_context->base.batch, tmpl);
 }
 
 static void
@@ -859,7 +874,6 @@ gen9_hcpd_hevc_decode_picture(VADriverContextP ctx,
                               struct gen9_hcpd_context *gen9_hcpd_context)
 {
     VAStatus vaStatus;
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
     VAPictureParameterBufferHEVC *pic_param;
     VASliceParameterBufferHEVC *slice_param, *next_slice_param, *next_slice_group_param;
@@ -874,14 +888,10 @@ gen9_hcpd_hevc_decode_picture(VADriverContextP ctx,
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
     pic_param = (VAPictureParameterBufferHEVC *)decode_state->pic_param->buffer;
 
-    if (i965->intel.has_bsd2)
-        intel_batchbuffer_start_atomic_bcs_override(batch, 0x1000, BSD_RING0);
-    else
-        intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_decoder_start_atomic_bcs(ctx, &gen9_hcpd_context->deferred, 0x1000);
     intel_batchbuffer_emit_mi_flush(batch);
 
-    gen9_hcpd_pipe_mode_select(ctx, decode_state, HCP_CODEC_HEVC, gen9_hcpd_context);
-    gen9_hcpd_surface_state(ctx, decode_state, gen9_hcpd_context);
+    gen9_hcpd_picture_state(ctx, decode_state, HCP_CODEC_HEVC, gen9_hcpd_context);
     gen9_hcpd_pipe_buf_addr_state(ctx, decode_state, gen9_hcpd_context);
     gen9_hcpd_hevc_qm_state(ctx, decode_state, gen9_hcpd_context);
     gen9_hcpd_pic_state(ctx, decode_state, gen9_hcpd_context);
@@ -917,7 +927,6 @@ gen9_hcpd_hevc_decode_picture(VADriverContextP ctx,
     }
 
     intel_batchbuffer_end_atomic(batch);
-    intel_batchbuffer_flush(batch);
 
 out:
     return vaStatus;
@@ -940,6 +949,8 @@ gen9_hcpd_decode_picture(VADriverContextP ctx,
     if (vaStatus != VA_STATUS_SUCCESS)
         goto out;
 
+    intel_decoder_begin_picture(ctx, &gen9_hcpd_context->deferred, decode_state);
+
     switch (profile) {
     case VAProfileHEVCMain:
     case VAProfileHEVCMain10:
@@ -952,6 +963,8 @@ gen9_hcpd_decode_picture(VADriverContextP ctx,
         break;
     }
 
+    intel_decoder_end_picture(ctx, &gen9_hcpd_context->deferred);
+
 out:
     return vaStatus;
 }
@@ -961,6 +974,9 @@ gen9_hcpd_context_destroy(void *hw_context)
 {
     struct gen9_hcpd_context *gen9_hcpd_context = (struct gen9_hcpd_context *)hw_context;
 
+    intel_decoder_deferred_terminate(gen9_hcpd_context->driver_context,
+                                     &gen9_hcpd_context->deferred);
+
     FREE_GEN_BUFFER((&gen9_hcpd_context->deblocking_filter_line_buffer));
     FREE_GEN_BUFFER((&gen9_hcpd_context->deblocking_filter_tile_line_buffer));
     FREE_GEN_BUFFER((&gen9_hcpd_context->deblocking_filter_tile_column_buffer));
@@ -1012,6 +1028,13 @@ gen9_hcpd_context_init(VADriverContextP ctx, struct object_config *object_config
         break;
     }
 
+    gen9_hcpd_context->driver_context = ctx;
+    intel_decoder_deferred_init(ctx, &gen9_hcpd_context->deferred,
+                                &gen9_hcpd_context->base);
+
+    /* HEVC decoding stays on the first ring */
+    i965_bsd_stream_init(&gen9_hcpd_context->deferred.bsd_stream, 0);
+
     return (struct hw_context *)gen9_hcpd_context;
 }
 
@@ -69,6 +69,12 @@ struct gen9_hcpd_context
     unsigned short first_inter_slice_collocated_ref_idx;
     unsigned short first_inter_slice_collocated_from_l0_flag;
     int first_inter_slice_valid;
+
+    GenCommandTemplate qm_state;
+
+    GenDeferredDecode deferred;
+
+    void *driver_context;
 };
 
 #endif /* GEN9_MFD_H */
@@ -290,21 +290,14 @@ gen9_vme_output_vme_batchbuffer_setup(VADriverContextP ctx,
                                       int width_in_mbs,
                                       int height_in_mbs)
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen6_vme_context *vme_context = encoder_context->vme_context;
 
     vme_context->vme_batchbuffer.num_blocks = width_in_mbs * height_in_mbs + 1;
     vme_context->vme_batchbuffer.size_block = 64; /* 4 OWORDs */
     vme_context->vme_batchbuffer.pitch = 16;
-    vme_context->vme_batchbuffer.bo = dri_bo_alloc(i965->intel.bufmgr,
-                                                   "VME batchbuffer",
-                                                   vme_context->vme_batchbuffer.num_blocks * vme_context->vme_batchbuffer.size_block,
-                                                   0x1000);
-    vme_context->vme_buffer_suface_setup(ctx,
-                                         &vme_context->gpe_context,
-                                         &vme_context->vme_batchbuffer,
-                                         BINDING_TABLE_OFFSET(index),
-                                         SURFACE_STATE_OFFSET(index));
+    intel_vme_batchbuffer_setup(ctx, encoder_context, 1,
+                                BINDING_TABLE_OFFSET(index),
+                                SURFACE_STATE_OFFSET(index));
 }
 
 static void
@@ -474,9 +467,14 @@ gen9wa_vme_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     int mb_row;
     int s;
     unsigned int *command_ptr;
+    unsigned int params[] = { mb_width, mb_height, kernel, transform_8x8_mode_flag };
 
 #define		USE_SCOREBOARD		(1 << 21)
 
+    if (intel_vme_walker_batchbuffer_reuse(ctx, encode_state, params, ARRAY_ELEMS(params), encoder_context))
+        return;
+
+    I965_TRACE_BEGIN("vme walker fill");
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -588,7 +586,10 @@ gen9wa_vme_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     *command_ptr++ = MI_BATCH_BUFFER_END;
     *command_ptr++ = 0;
 
+    intel_vme_walker_batchbuffer_store(ctx, command_ptr, encoder_context);
     dri_bo_unmap(vme_context->vme_batchbuffer.bo);
+
+    I965_TRACE_END("vme walker fill");
 }
 
 static void
@@ -604,6 +605,7 @@ gen9_vme_fill_vme_batchbuffer(VADriverContextP ctx,
     int i, s;
     unsigned int *command_ptr;
 
+    intel_vme_batchbuffer_alloc(ctx, encoder_context);
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -886,9 +888,14 @@ gen9wa_vme_mpeg2_walker_fill_vme_batchbuffer(VADriverContextP ctx,
 {
     struct gen6_vme_context *vme_context = encoder_context->vme_context;
     unsigned int *command_ptr;
+    unsigned int params[] = { mb_width, mb_height, kernel };
 
 #define		MPEG2_SCOREBOARD		(1 << 21)
 
+    if (intel_vme_walker_batchbuffer_reuse(ctx, encode_state, params, ARRAY_ELEMS(params), encoder_context))
+        return;
+
+    I965_TRACE_BEGIN("vme walker fill");
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1001,7 +1008,10 @@ gen9wa_vme_mpeg2_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     *command_ptr++ = MI_BATCH_BUFFER_END;
     *command_ptr++ = 0;
 
+    intel_vme_walker_batchbuffer_store(ctx, command_ptr, encoder_context);
     dri_bo_unmap(vme_context->vme_batchbuffer.bo);
+
+    I965_TRACE_END("vme walker fill");
     return;
 }
 
@@ -1019,6 +1029,7 @@ gen9_vme_mpeg2_fill_vme_batchbuffer(VADriverContextP ctx,
     unsigned int *command_ptr;
 
 
+    intel_vme_batchbuffer_alloc(ctx, encoder_context);
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1371,7 +1382,6 @@ gen9_vme_hevc_output_vme_batchbuffer_setup(VADriverContextP ctx,
                                       struct intel_encoder_context *encoder_context)
 
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen6_vme_context *vme_context = encoder_context->vme_context;
     VAEncSequenceParameterBufferHEVC *pSequenceParameter = (VAEncSequenceParameterBufferHEVC *)encode_state->seq_param_ext->buffer;
     int width_in_mbs = (pSequenceParameter->pic_width_in_luma_samples + 15)/16;
@@ -1380,10 +1390,7 @@ gen9_vme_hevc_output_vme_batchbuffer_setup(VADriverContextP ctx,
     vme_context->vme_batchbuffer.num_blocks = width_in_mbs * height_in_mbs + 1;
     vme_context->vme_batchbuffer.size_block = 64; /* 4 OWORDs */
     vme_context->vme_batchbuffer.pitch = 16;
-    vme_context->vme_batchbuffer.bo = dri_bo_alloc(i965->intel.bufmgr,
-                                                   "VME batchbuffer",
-                                                   vme_context->vme_batchbuffer.num_blocks * vme_context->vme_batchbuffer.size_block,
-                                                   0x1000);
+    intel_vme_batchbuffer_setup(ctx, encoder_context, 0, 0, 0);
 }
 static VAStatus
 gen9_vme_hevc_surface_setup(VADriverContextP ctx,
@@ -1438,9 +1445,14 @@ gen9wa_vme_hevc_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     int ctb_size = 1 << log2_ctb_size;
     int num_mb_in_ctb = (ctb_size + 15)/16;
     num_mb_in_ctb = num_mb_in_ctb * num_mb_in_ctb;
+    unsigned int params[] = { mb_width, mb_height, kernel, transform_8x8_mode_flag, num_mb_in_ctb };
 
 #define		USE_SCOREBOARD		(1 << 21)
 
+    if (intel_vme_walker_batchbuffer_reuse(ctx, encode_state, params, ARRAY_ELEMS(params), encoder_context))
+        return;
+
+    I965_TRACE_BEGIN("vme walker fill");
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1553,7 +1565,10 @@ gen9wa_vme_hevc_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     *command_ptr++ = MI_BATCH_BUFFER_END;
     *command_ptr++ = 0;
 
+    intel_vme_walker_batchbuffer_store(ctx, command_ptr, encoder_context);
     dri_bo_unmap(vme_context->vme_batchbuffer.bo);
+
+    I965_TRACE_END("vme walker fill");
 }
 
 static void
@@ -1576,6 +1591,7 @@ gen9_vme_hevc_fill_vme_batchbuffer(VADriverContextP ctx,
     int num_mb_in_ctb = (ctb_size + 15)/16;
     num_mb_in_ctb = num_mb_in_ctb * num_mb_in_ctb;
 
+    intel_vme_batchbuffer_alloc(ctx, encoder_context);
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1771,6 +1787,8 @@ gen9_vme_context_destroy(void *context)
     dri_bo_unreference(vme_context->vme_batchbuffer.bo);
     vme_context->vme_batchbuffer.bo = NULL;
 
+    intel_vme_walker_batchbuffer_free(vme_context);
+
     if (vme_context->vme_state_message) {
         free(vme_context->vme_state_message);
         vme_context->vme_state_message = NULL;
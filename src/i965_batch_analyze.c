@@ -0,0 +1,296 @@
+/*
+ * i965_batch_analyze.c - reports the commands of captured batches
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Usage: i965_batch_analyze [-d] file
+ *
+ * Reads a file written by the driver with VA_INTEL_BATCH_CAPTURE=<file> and
+ * reports, for each command, how often it was emitted and how many dwords
+ * it took, per frame and in total. -d also prints every batch decoded, with
+ * the relocated dwords replaced by their delta, so that the captures of two
+ * driver versions can be compared with diff, and exits with 2 if some
+ * commands weren't known to the decoder.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <i915_drm.h>
+
+#include "intel_batchbuffer_dump.h"
+
+#define ANALYZE_NUM_RINGS       (I915_EXEC_VEBOX + 1)
+
+static const char *analyze_ring_names[ANALYZE_NUM_RINGS] = {
+    [I915_EXEC_DEFAULT] = "default",
+    [I915_EXEC_RENDER] = "render",
+    [I915_EXEC_BSD] = "bsd",
+    [I915_EXEC_BLT] = "blt",
+    [I915_EXEC_VEBOX] = "vebox",
+};
+
+struct analyze_command {
+    const char *name;                   /* NULL for the unknown commands */
+    unsigned int ring;
+    uint64_t count;
+    uint64_t dwords;
+};
+
+static struct analyze_command *analyze_commands = NULL;
+static int analyze_num_commands = 0;
+static int analyze_max_commands = 0;
+
+static struct {
+    uint64_t batches;
+    uint64_t dwords;
+} analyze_rings[ANALYZE_NUM_RINGS];
+
+static uint64_t analyze_frames = 0;
+static uint64_t analyze_batches = 0;
+static uint64_t analyze_second_level = 0;
+static uint64_t analyze_dwords = 0;
+
+static struct analyze_command *
+analyze_lookup(const char *name, unsigned int ring)
+{
+    int i;
+
+    /* the names come from the same table, so the pointers can be compared */
+    for (i = 0; i < analyze_num_commands; i++) {
+        if (analyze_commands[i].name == name && analyze_commands[i].ring == ring)
+            return &analyze_commands[i];
+    }
+
+    if (analyze_num_commands == analyze_max_commands) {
+        analyze_max_commands = analyze_max_commands ? analyze_max_commands * 2 : 64;
+        analyze_commands = realloc(analyze_commands,
+                                   analyze_max_commands * sizeof(*analyze_commands));
+
+        if (!analyze_commands) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    memset(&analyze_commands[analyze_num_commands], 0, sizeof(*analyze_commands));
+    analyze_commands[analyze_num_commands].name = name;
+    analyze_commands[analyze_num_commands].ring = ring;
+
+    return &analyze_commands[analyze_num_commands++];
+}
+
+static void
+analyze_batch(const struct intel_batch_decode *decode,
+              const unsigned int *data, unsigned int count)
+{
+    struct analyze_command *command;
+    const char *name;
+    unsigned int index = 0, length;
+
+    while (index < count) {
+        length = intel_batchbuffer_decode(decode, data + index, &name);
+
+        if (length > count - index)
+            length = count - index;
+
+        command = analyze_lookup(name, decode->ring);
+        command->count++;
+        command->dwords += length;
+        index += length;
+    }
+}
+
+static int
+analyze_compare(const void *a, const void *b)
+{
+    const struct analyze_command *ca = a, *cb = b;
+
+    if (ca->dwords != cb->dwords)
+        return ca->dwords < cb->dwords ? 1 : -1;
+
+    return ca->ring - cb->ring;
+}
+
+static void
+analyze_report(void)
+{
+    uint64_t frames = analyze_frames ? analyze_frames : 1;
+    int i;
+
+    printf("%llu frames, %llu batches (%llu second level), %llu dwords, %.1f dwords/frame\n",
+           (unsigned long long)analyze_frames,
+           (unsigned long long)analyze_batches,
+           (unsigned long long)analyze_second_level,
+           (unsigned long long)analyze_dwords,
+           (double)analyze_dwords / frames);
+
+    for (i = 0; i < ANALYZE_NUM_RINGS; i++) {
+        if (!analyze_rings[i].batches)
+            continue;
+
+        printf("  %-8s %10llu batches %12llu dwords %12.1f dwords/frame\n",
+               analyze_ring_names[i],
+               (unsigned long long)analyze_rings[i].batches,
+               (unsigned long long)analyze_rings[i].dwords,
+               (double)analyze_rings[i].dwords / frames);
+    }
+
+    qsort(analyze_commands, analyze_num_commands, sizeof(*analyze_commands), analyze_compare);
+
+    printf("\n  %-40s %-8s %10s %12s %6s %12s\n",
+           "command", "ring", "count", "dwords", "%", "dwords/frame");
+
+    for (i = 0; i < analyze_num_commands; i++) {
+        struct analyze_command *command = &analyze_commands[i];
+
+        printf("  %-40s %-8s %10llu %12llu %6.2f %12.1f\n",
+               command->name ? command->name : "UNKNOWN",
+               analyze_ring_names[command->ring],
+               (unsigned long long)command->count,
+               (unsigned long long)command->dwords,
+               analyze_dwords ? 100.0 * command->dwords / analyze_dwords : 0.0,
+               (double)command->dwords / frames);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    const struct intel_batch_capture_header *header;
+    struct intel_batch_decode decode;
+    unsigned char *file_data;
+    uint32_t version;
+    long file_size, pos, size;
+    int opt, dump = 0, failures = 0;
+    FILE *fp;
+
+    while ((opt = getopt(argc, argv, "d")) != -1) {
+        switch (opt) {
+        case 'd':
+            dump = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d] file\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-d] file\n", argv[0]);
+        return 1;
+    }
+
+    fp = fopen(argv[optind], "rb");
+
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s\n", argv[optind]);
+        return 1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    file_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    file_data = malloc(file_size);
+
+    if (!file_data || fread(file_data, 1, file_size, fp) != (size_t)file_size) {
+        fprintf(stderr, "Failed to read %s\n", argv[optind]);
+        return 1;
+    }
+
+    fclose(fp);
+    memcpy(&version, file_data + 8, sizeof(version));
+
+    if (file_size < 12 || memcmp(file_data, INTEL_BATCH_CAPTURE_MAGIC, 8) ||
+        version != INTEL_BATCH_CAPTURE_VERSION) {
+        fprintf(stderr, "%s isn't a batch capture of this driver version\n", argv[optind]);
+        return 1;
+    }
+
+    for (pos = 12; pos + (long)sizeof(*header) <= file_size; pos += size) {
+        header = (const struct intel_batch_capture_header *)(file_data + pos);
+        size = sizeof(*header);
+
+        if (header->type == INTEL_BATCH_CAPTURE_FRAME) {
+            analyze_frames++;
+
+            if (dump)
+                printf("frame %llu\n", (unsigned long long)analyze_frames);
+
+            continue;
+        }
+
+        size += header->num_relocs * sizeof(struct intel_batch_reloc) +
+            header->num_dwords * sizeof(unsigned int);
+
+        if (header->type != INTEL_BATCH_CAPTURE_BATCH ||
+            header->ring >= ANALYZE_NUM_RINGS ||
+            pos + size > file_size) {
+            fprintf(stderr, "Truncated or corrupted capture\n");
+            break;
+        }
+
+        decode.gen = header->gen;
+        decode.ring = header->ring;
+        decode.relocs = (const struct intel_batch_reloc *)(header + 1);
+        decode.num_relocs = header->num_relocs;
+
+        analyze_batch(&decode, (const unsigned int *)(decode.relocs + decode.num_relocs),
+                      header->num_dwords);
+
+        analyze_batches++;
+        analyze_second_level += header->level > 1;
+        analyze_dwords += header->num_dwords;
+        analyze_rings[header->ring].batches++;
+        analyze_rings[header->ring].dwords += header->num_dwords;
+
+        if (dump) {
+            printf("batch %llu, gen %u, %s ring, level %u, %u dwords\n",
+                   (unsigned long long)analyze_batches, header->gen,
+                   analyze_ring_names[header->ring], header->level,
+                   header->num_dwords);
+            failures += intel_batchbuffer_dump(stdout, &decode,
+                                               (const unsigned int *)(decode.relocs + decode.num_relocs),
+                                               header->num_dwords);
+        }
+    }
+
+    if (dump)
+        printf("\n");
+
+    analyze_report();
+    free(file_data);
+    free(analyze_commands);
+
+    return failures ? 2 : 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * i965_batch_bench.c - measures the batch emission rate
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Usage: i965_batch_bench [count]
+ *
+ * Emits count (10000000 by default) 9 dword PAK objects, shaped as the
+ * MPEG-2 ones of gen8_mfc.c, into a BSD batch of the host-memory buffer
+ * manager, once with OUT_BCS_BATCH() and once through
+ * intel_batchbuffer_dwords(), and prints the dwords/s of both. The batch
+ * flushes are included, they only cost a map and an unmap here.
+ *
+ * The OUT_BCS_BATCH() run is then repeated with the event tracing on, a
+ * begin and an end event per 1080p picture of objects as in EndPicture
+ * plus the ones of the flushes, and the overhead of the tracing is
+ * printed. The trace is written to VA_INTEL_TRACE, /dev/null by default.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "intel_batchbuffer.h"
+#include "i965_defines.h"
+#include "intel_mock_bufmgr.h"
+#include "i965_trace.h"
+
+#define BENCH_OBJECT_DWORDS     9
+#define BENCH_PICTURE_MBS       (120 * 68)
+
+/* Set by intel_memman_init() in the driver, which isn't linked in */
+const struct intel_bufmgr_backend *intel_bufmgr_backend = &intel_mock_bufmgr_backend;
+
+static const struct intel_device_info bench_device_info = {
+    .gen = 8,
+};
+
+static double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench_out_batch(struct intel_batchbuffer *batch, int x, int y)
+{
+    BEGIN_BCS_BATCH(batch, BENCH_OBJECT_DWORDS);
+    OUT_BCS_BATCH(batch, MFC_MPEG2_PAK_OBJECT | (BENCH_OBJECT_DWORDS - 2));
+    OUT_BCS_BATCH(batch, 7 << 17 | 1 << 13);
+    OUT_BCS_BATCH(batch, y << 16 | x);
+    OUT_BCS_BATCH(batch, 0x3f << 6);
+    OUT_BCS_BATCH(batch, (x == 0) << 30);
+    OUT_BCS_BATCH(batch, 0);
+    OUT_BCS_BATCH(batch, 0);
+    OUT_BCS_BATCH(batch, 0);
+    OUT_BCS_BATCH(batch, 0);
+    ADVANCE_BCS_BATCH(batch);
+}
+
+static void
+bench_dwords(struct intel_batchbuffer *batch, int x, int y)
+{
+    unsigned int *command_ptr;
+
+    BEGIN_BCS_BATCH(batch, BENCH_OBJECT_DWORDS);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    *command_ptr++ = MFC_MPEG2_PAK_OBJECT | (BENCH_OBJECT_DWORDS - 2);
+    *command_ptr++ = 7 << 17 | 1 << 13;
+    *command_ptr++ = y << 16 | x;
+    *command_ptr++ = 0x3f << 6;
+    *command_ptr++ = (x == 0) << 30;
+    *command_ptr++ = 0;
+    *command_ptr++ = 0;
+    *command_ptr++ = 0;
+    *command_ptr++ = 0;
+    intel_batchbuffer_advance_dwords(batch, command_ptr);
+}
+
+static double
+bench_run(struct intel_driver_data *intel, const char *name, int count,
+          void (*emit)(struct intel_batchbuffer *batch, int x, int y))
+{
+    struct intel_batchbuffer *batch;
+    double start, elapsed;
+    int i, j, n;
+
+    batch = intel_batchbuffer_new(intel, I915_EXEC_BSD, 0);
+    start = bench_now();
+
+    /* 1080p pictures, in rows of 120 macroblocks */
+    for (i = 0; i < count; i += n) {
+        n = MIN(count - i, BENCH_PICTURE_MBS);
+
+        I965_TRACE_BEGIN("EndPicture");
+
+        for (j = 0; j < n; j++)
+            emit(batch, j % 120, j / 120);
+
+        I965_TRACE_END("EndPicture");
+    }
+
+    intel_batchbuffer_flush(batch);
+    elapsed = bench_now() - start;
+    intel_batchbuffer_free(batch);
+
+    printf("%-24s %8.3f s %10.1f Mdwords/s\n",
+           name, elapsed, (double)count * BENCH_OBJECT_DWORDS / elapsed / 1e6);
+
+    return elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct intel_driver_data intel = { 0 };
+    int count = 10000000;
+    double untraced, traced;
+
+    if (argc > 2 || (argc == 2 && (count = atoi(argv[1])) <= 0)) {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return 1;
+    }
+
+    intel.device_info = &bench_device_info;
+    intel.bufmgr = intel_mock_bufmgr_init(bench_device_info.gen);
+
+    if (!intel.bufmgr) {
+        fprintf(stderr, "%s: can't create the buffer manager\n", argv[0]);
+        return 1;
+    }
+
+    untraced = bench_run(&intel, "OUT_BCS_BATCH", count, bench_out_batch);
+    bench_run(&intel, "intel_batchbuffer_dwords", count, bench_dwords);
+
+    setenv("VA_INTEL_TRACE", "/dev/null", 0);
+
+    if (i965_trace_init()) {
+        traced = bench_run(&intel, "OUT_BCS_BATCH, traced", count, bench_out_batch);
+        printf("tracing overhead %.2f%%\n", (traced - untraced) / untraced * 100);
+    }
+
+    i965_trace_terminate();
+
+    intel_mock_bufmgr_backend.destroy(intel.bufmgr);
+
+    return 0;
+}
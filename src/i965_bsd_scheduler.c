@@ -0,0 +1,118 @@
+/*
+ * i965_bsd_scheduler.c - Assignment of decoder streams to BSD rings
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+#include "i965_bsd_scheduler.h"
+
+void
+i965_bsd_scheduler_init(I965BSDScheduler *sched, int num_rings)
+{
+    memset(sched, 0, sizeof(*sched));
+
+    if (num_rings < 1)
+        num_rings = 1;
+    if (num_rings > I965_BSD_MAX_RINGS)
+        num_rings = I965_BSD_MAX_RINGS;
+    sched->num_rings = num_rings;
+}
+
+void
+i965_bsd_stream_init(I965BSDStream *stream, int fixed_ring)
+{
+    stream->fixed_ring = fixed_ring;
+    stream->ring = fixed_ring >= 0 ? fixed_ring : 0;
+    stream->depth = 0;
+}
+
+int
+i965_bsd_scheduler_select(const I965BSDScheduler *sched,
+                          const I965BSDStream *stream)
+{
+    int i, ring;
+
+    if (stream->fixed_ring >= 0)
+        return stream->fixed_ring < sched->num_rings ? stream->fixed_ring : 0;
+
+    if (stream->depth > 0)
+        return stream->ring;
+
+    for (i = 1, ring = 0; i < sched->num_rings; i++) {
+        const struct i965_bsd_ring * const r = &sched->rings[i];
+        const struct i965_bsd_ring * const best = &sched->rings[ring];
+
+        if (r->load < best->load ||
+            (r->load == best->load && r->depth < best->depth))
+            ring = i;
+    }
+    return ring;
+}
+
+void
+i965_bsd_scheduler_submit(I965BSDScheduler *sched, I965BSDStream *stream,
+                          int ring, unsigned int load)
+{
+    struct i965_bsd_ring * const r = &sched->rings[ring];
+
+    assert(ring >= 0 && ring < sched->num_rings);
+    assert(stream->depth == 0 || stream->ring == ring);
+
+    r->load += load;
+    if (++r->depth > r->max_depth)
+        r->max_depth = r->depth;
+    r->num_submissions++;
+
+    stream->ring = ring;
+    stream->depth++;
+}
+
+void
+i965_bsd_scheduler_retire(I965BSDScheduler *sched, I965BSDStream *stream,
+                          int ring, unsigned int load)
+{
+    struct i965_bsd_ring * const r = &sched->rings[ring];
+
+    assert(ring >= 0 && ring < sched->num_rings);
+    assert(r->depth > 0 && r->load >= load);
+
+    r->load -= load;
+    r->depth--;
+
+    if (stream) {
+        assert(stream->depth > 0 && stream->ring == ring);
+        stream->depth--;
+    }
+}
+
+int
+i965_bsd_scheduler_query(const I965BSDScheduler *sched, int ring,
+                         struct i965_bsd_ring *counters)
+{
+    if (ring < 0 || ring >= sched->num_rings)
+        return 0;
+
+    *counters = sched->rings[ring];
+    return 1;
+}
@@ -0,0 +1,96 @@
+/*
+ * i965_bsd_scheduler.h - Assignment of decoder streams to BSD rings
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_BSD_SCHEDULER_H
+#define I965_BSD_SCHEDULER_H
+
+#define I965_BSD_MAX_RINGS      2
+
+typedef struct i965_bsd_scheduler       I965BSDScheduler;
+typedef struct i965_bsd_stream          I965BSDStream;
+
+/** Per-ring accounting of the submitted work */
+struct i965_bsd_ring {
+    /** Outstanding work, in macroblocks */
+    unsigned int load;
+    /** Outstanding submissions, i.e. the queue depth */
+    unsigned int depth;
+    /** Highest queue depth seen */
+    unsigned int max_depth;
+    /** Total number of submissions */
+    unsigned int num_submissions;
+};
+
+struct i965_bsd_scheduler {
+    int num_rings;
+    struct i965_bsd_ring rings[I965_BSD_MAX_RINGS];
+};
+
+/** One decoder context, as seen by the scheduler */
+struct i965_bsd_stream {
+    /** Ring the stream must run on, or -1 if it can be moved */
+    int fixed_ring;
+    /** Ring of the outstanding submissions */
+    int ring;
+    /** Number of outstanding submissions */
+    unsigned int depth;
+};
+
+void
+i965_bsd_scheduler_init(I965BSDScheduler *sched, int num_rings);
+
+void
+i965_bsd_stream_init(I965BSDStream *stream, int fixed_ring);
+
+/**
+ * Returns the ring for the next submission of the stream. A stream with
+ * outstanding submissions stays on its ring, so that dependent pictures
+ * execute in order on the same engine. Otherwise, the ring with the least
+ * outstanding work is picked, then the one with the shortest queue
+ */
+int
+i965_bsd_scheduler_select(const I965BSDScheduler *sched,
+                          const I965BSDStream *stream);
+
+/** Accounts for a submission of load macroblocks to ring */
+void
+i965_bsd_scheduler_submit(I965BSDScheduler *sched, I965BSDStream *stream,
+                          int ring, unsigned int load);
+
+/**
+ * Accounts for the completion of a submission. stream may be NULL if the
+ * context was destroyed in the meantime
+ */
+void
+i965_bsd_scheduler_retire(I965BSDScheduler *sched, I965BSDStream *stream,
+                          int ring, unsigned int load);
+
+/** Copies the counters of ring. Returns 0 if there is no such ring */
+int
+i965_bsd_scheduler_query(const I965BSDScheduler *sched, int ring,
+                         struct i965_bsd_ring *counters);
+
+#endif /* I965_BSD_SCHEDULER_H */
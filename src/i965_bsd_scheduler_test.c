@@ -0,0 +1,334 @@
+/*
+ * i965_bsd_scheduler_test.c - BSD ring scheduling on simulated rings
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Drives i965_bsd_scheduler.c with decoder streams submitting pictures to
+ * simulated rings, which execute their batches in order at a fixed rate.
+ * Checks the counters against the simulation, that the pictures of a
+ * stream stay on one ring while some are outstanding and that the load is
+ * spread over the rings. Run by make check.
+ */
+
+#include "sysdeps.h"
+#include "i965_bsd_scheduler.h"
+
+#define NUM_RINGS       2
+#define MAX_STREAMS     32
+#define MAX_BATCHES     256
+#define RING_RATE       1000    /* macroblocks per tick */
+
+static int test_failures = 0;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+struct sim_batch {
+    int stream;
+    unsigned int load;
+    unsigned int remaining;
+};
+
+/* A ring executes its batches in submission order */
+struct sim_ring {
+    struct sim_batch batches[MAX_BATCHES];
+    int first;
+    int count;
+    unsigned long long busy_ticks;
+    unsigned long long work;
+};
+
+struct sim_stream {
+    I965BSDStream stream;
+    unsigned int picture_load;
+    int max_outstanding;        /* like VA_INTEL_DECODE_BATCH */
+    int destroyed;
+    int outstanding;
+};
+
+struct sim {
+    I965BSDScheduler sched;
+    struct sim_ring rings[NUM_RINGS];
+    struct sim_stream streams[MAX_STREAMS];
+    int num_streams;
+};
+
+static void
+sim_check_counters(struct sim *sim)
+{
+    struct i965_bsd_ring counters;
+    int i, j;
+
+    for (i = 0; i < sim->sched.num_rings; i++) {
+        const struct sim_ring * const ring = &sim->rings[i];
+        unsigned int load = 0;
+
+        for (j = 0; j < ring->count; j++)
+            load += ring->batches[(ring->first + j) % MAX_BATCHES].load;
+
+        CHECK(i965_bsd_scheduler_query(&sim->sched, i, &counters));
+        CHECK(counters.depth == (unsigned int)ring->count);
+        CHECK(counters.load == load);
+        CHECK(counters.max_depth >= counters.depth);
+    }
+    CHECK(!i965_bsd_scheduler_query(&sim->sched, sim->sched.num_rings, &counters));
+    CHECK(!i965_bsd_scheduler_query(&sim->sched, -1, &counters));
+
+    for (i = 0; i < sim->num_streams; i++) {
+        if (!sim->streams[i].destroyed)
+            CHECK(sim->streams[i].stream.depth ==
+                  (unsigned int)sim->streams[i].outstanding);
+    }
+}
+
+static void
+sim_submit(struct sim *sim, int index)
+{
+    struct sim_stream * const s = &sim->streams[index];
+    struct sim_ring *ring;
+    struct sim_batch *batch;
+    int r;
+
+    r = i965_bsd_scheduler_select(&sim->sched, &s->stream);
+    CHECK(r >= 0 && r < sim->sched.num_rings);
+
+    /* Dependent pictures execute in order on one ring */
+    if (s->stream.depth > 0)
+        CHECK(r == s->stream.ring);
+    if (s->stream.fixed_ring >= 0 && s->stream.fixed_ring < sim->sched.num_rings)
+        CHECK(r == s->stream.fixed_ring);
+
+    ring = &sim->rings[r];
+    if (ring->count == MAX_BATCHES)
+        return;
+
+    batch = &ring->batches[(ring->first + ring->count++) % MAX_BATCHES];
+    batch->stream = index;
+    batch->load = batch->remaining = s->picture_load;
+    s->outstanding++;
+
+    i965_bsd_scheduler_submit(&sim->sched, &s->stream, r, s->picture_load);
+}
+
+static void
+sim_tick(struct sim *sim)
+{
+    int i;
+
+    for (i = 0; i < sim->sched.num_rings; i++) {
+        struct sim_ring * const ring = &sim->rings[i];
+        unsigned int budget = RING_RATE;
+
+        if (ring->count > 0)
+            ring->busy_ticks++;
+
+        while (ring->count > 0 && budget > 0) {
+            struct sim_batch * const batch = &ring->batches[ring->first];
+            struct sim_stream * const s = &sim->streams[batch->stream];
+            const unsigned int work = budget < batch->remaining ?
+                budget : batch->remaining;
+
+            batch->remaining -= work;
+            budget -= work;
+            ring->work += work;
+
+            if (batch->remaining > 0)
+                break;
+
+            i965_bsd_scheduler_retire(&sim->sched,
+                                      s->destroyed ? NULL : &s->stream,
+                                      i, batch->load);
+            s->outstanding--;
+            ring->first = (ring->first + 1) % MAX_BATCHES;
+            ring->count--;
+        }
+    }
+}
+
+static void
+sim_init(struct sim *sim, int num_rings)
+{
+    memset(sim, 0, sizeof(*sim));
+    i965_bsd_scheduler_init(&sim->sched, num_rings);
+}
+
+static int
+sim_add_stream(struct sim *sim, int fixed_ring, unsigned int picture_load,
+               int max_outstanding)
+{
+    struct sim_stream * const s = &sim->streams[sim->num_streams];
+
+    i965_bsd_stream_init(&s->stream, fixed_ring);
+    s->picture_load = picture_load;
+    s->max_outstanding = max_outstanding;
+    return sim->num_streams++;
+}
+
+/* Every stream keeps up to max_outstanding pictures queued */
+static void
+sim_run(struct sim *sim, int num_ticks)
+{
+    int i, t;
+
+    for (t = 0; t < num_ticks; t++) {
+        for (i = 0; i < sim->num_streams; i++) {
+            struct sim_stream * const s = &sim->streams[i];
+
+            if (!s->destroyed && s->outstanding < s->max_outstanding)
+                sim_submit(sim, i);
+        }
+        sim_check_counters(sim);
+        sim_tick(sim);
+        sim_check_counters(sim);
+    }
+}
+
+/* 32 streams of mixed resolutions on two rings */
+static void
+test_balance(void)
+{
+    static const unsigned int loads[] = { 8160, 3600, 1620, 396 };
+    struct sim sim;
+    double ratio;
+    int i;
+
+    sim_init(&sim, NUM_RINGS);
+    for (i = 0; i < MAX_STREAMS; i++)
+        sim_add_stream(&sim, -1, loads[(i * 7) % 4], 1 + i % 3);
+
+    sim_run(&sim, 20000);
+
+    /* Both rings stay busy and get about the same work */
+    for (i = 0; i < NUM_RINGS; i++)
+        CHECK(sim.rings[i].busy_ticks > 19900);
+
+    ratio = (double)sim.rings[0].work / sim.rings[1].work;
+    CHECK(ratio > 0.95 && ratio < 1.05);
+}
+
+/* A few streams: the idle ring is picked first */
+static void
+test_idle_ring(void)
+{
+    struct sim sim;
+    int a, b;
+
+    sim_init(&sim, NUM_RINGS);
+    a = sim_add_stream(&sim, -1, 8160, 1);
+    b = sim_add_stream(&sim, -1, 8160, 1);
+
+    sim_submit(&sim, a);
+    sim_submit(&sim, b);
+    CHECK(sim.streams[a].stream.ring != sim.streams[b].stream.ring);
+    CHECK(sim.rings[0].count == 1 && sim.rings[1].count == 1);
+
+    /* The stream with an outstanding picture stays on its ring, even if
+       the other one is less loaded */
+    sim.streams[a].max_outstanding = 4;
+    sim_submit(&sim, a);
+    sim_submit(&sim, a);
+    CHECK(sim.rings[sim.streams[a].stream.ring].count == 3);
+    sim_check_counters(&sim);
+}
+
+static void
+test_fixed_ring(void)
+{
+    struct sim sim;
+    int a, b, i;
+
+    sim_init(&sim, NUM_RINGS);
+    a = sim_add_stream(&sim, 1, 1000, 2);
+    b = sim_add_stream(&sim, 5, 1000, 2);       /* no such ring */
+    for (i = 0; i < 4; i++)
+        sim_add_stream(&sim, -1, 2000, 2);
+
+    sim_run(&sim, 1000);
+    CHECK(sim.streams[a].stream.ring == 1);
+    CHECK(sim.streams[b].stream.ring == 0);
+}
+
+static void
+test_single_ring(void)
+{
+    struct sim sim;
+    struct i965_bsd_ring counters;
+    int i;
+
+    sim_init(&sim, 1);
+    for (i = 0; i < 8; i++)
+        sim_add_stream(&sim, i % 2 ? -1 : 1, 500 * (i + 1), 3);
+
+    sim_run(&sim, 1000);
+    CHECK(i965_bsd_scheduler_query(&sim.sched, 0, &counters));
+    CHECK(counters.max_depth > 1);
+    CHECK(!i965_bsd_scheduler_query(&sim.sched, 1, &counters));
+}
+
+/* The batches of a destroyed context still count until they complete */
+static void
+test_destroyed_stream(void)
+{
+    struct sim sim;
+    struct i965_bsd_ring counters;
+    int a, i;
+
+    sim_init(&sim, NUM_RINGS);
+    a = sim_add_stream(&sim, -1, 3000, 4);
+    for (i = 0; i < 4; i++)
+        sim_submit(&sim, a);
+    sim.streams[a].destroyed = 1;
+
+    CHECK(i965_bsd_scheduler_query(&sim.sched, sim.streams[a].stream.ring,
+                                   &counters));
+    CHECK(counters.depth == 4 && counters.load == 12000);
+
+    sim_run(&sim, 12);
+    CHECK(i965_bsd_scheduler_query(&sim.sched, sim.streams[a].stream.ring,
+                                   &counters));
+    CHECK(counters.depth == 0 && counters.load == 0);
+    CHECK(counters.num_submissions == 4 && counters.max_depth == 4);
+}
+
+int
+main(void)
+{
+    test_balance();
+    test_idle_ring();
+    test_fixed_ring();
+    test_single_ring();
+    test_destroyed_stream();
+
+    if (test_failures) {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2006-2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host memory of the VA buffers. This has no dependency on the rest of the
+ * driver, so that i965_buffer_store_test can count its allocations.
+ */
+
+#include "sysdeps.h"
+#include "i965_buffer_store.h"
+
+/*
+ * Returns a buffer store with a host buffer of at least buffer_size bytes,
+ * or without host buffer if buffer_size is 0. Parameter buffers are created
+ * and destroyed for every picture, so released stores are recycled instead
+ * of going back to the heap.
+ */
+struct buffer_store *
+i965_alloc_buffer_store(struct buffer_store_cache *cache,
+                        unsigned int buffer_size)
+{
+    struct buffer_store *buffer_store, **prev;
+
+    _i965LockMutex(&cache->mutex);
+    cache->num_requests++;
+
+    for (prev = &cache->free_list; *prev; prev = &(*prev)->next) {
+        buffer_store = *prev;
+
+        if (buffer_size ? buffer_store->buffer_size >= buffer_size :
+            buffer_store->buffer_size == 0) {
+            *prev = buffer_store->next;
+            cache->num_free--;
+            _i965UnlockMutex(&cache->mutex);
+
+            buffer_store->next = NULL;
+            buffer_store->ref_count = 1;
+            return buffer_store;
+        }
+    }
+
+    cache->num_allocs++;
+    _i965UnlockMutex(&cache->mutex);
+
+    buffer_store = calloc(1, sizeof(struct buffer_store));
+    if (!buffer_store)
+        return NULL;
+
+    if (buffer_size) {
+        buffer_store->buffer = malloc(buffer_size);
+        if (!buffer_store->buffer) {
+            free(buffer_store);
+            return NULL;
+        }
+    }
+
+    buffer_store->cache = cache;
+    buffer_store->buffer_size = buffer_size;
+    buffer_store->ref_count = 1;
+    return buffer_store;
+}
+
+void
+i965_free_buffer_store(struct buffer_store *buffer_store)
+{
+    free(buffer_store->buffer);
+    free(buffer_store);
+}
+
+void
+i965_buffer_store_cache_init(struct buffer_store_cache *cache)
+{
+    _i965InitMutex(&cache->mutex);
+    cache->free_list = NULL;
+    cache->num_free = 0;
+    cache->num_allocs = 0;
+    cache->num_requests = 0;
+}
+
+void
+i965_buffer_store_cache_terminate(struct buffer_store_cache *cache)
+{
+    struct buffer_store *buffer_store;
+
+    while ((buffer_store = cache->free_list) != NULL) {
+        cache->free_list = buffer_store->next;
+        i965_free_buffer_store(buffer_store);
+    }
+
+    cache->num_free = 0;
+    _i965DestroyMutex(&cache->mutex);
+}
+
+/* Keeps a store whose last reference is gone, and whose BO was released */
+void
+i965_recycle_buffer_store(struct buffer_store *buffer_store)
+{
+    struct buffer_store_cache * const cache = buffer_store->cache;
+
+    buffer_store->num_elements = 0;
+
+    if (cache && buffer_store->buffer_size <= I965_MAX_CACHED_BUFFER_STORE_SIZE) {
+        _i965LockMutex(&cache->mutex);
+
+        if (cache->num_free < I965_MAX_CACHED_BUFFER_STORES) {
+            buffer_store->next = cache->free_list;
+            cache->free_list = buffer_store;
+            cache->num_free++;
+            buffer_store = NULL;
+        }
+
+        _i965UnlockMutex(&cache->mutex);
+    }
+
+    if (buffer_store)
+        i965_free_buffer_store(buffer_store);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2006-2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _I965_BUFFER_STORE_H_
+#define _I965_BUFFER_STORE_H_
+
+#include <intel_bufmgr.h>
+
+#include "i965_mutext.h"
+
+struct buffer_store
+{
+    unsigned char *buffer;
+    dri_bo *bo;
+    int ref_count;
+    int num_elements;
+
+    /* Recycling, see i965_release_buffer_store() */
+    struct buffer_store_cache *cache;
+    unsigned int buffer_size;
+    struct buffer_store *next;
+};
+
+#define I965_MAX_CACHED_BUFFER_STORES           64
+#define I965_MAX_CACHED_BUFFER_STORE_SIZE       (64 * 1024)
+
+/* Released buffer stores, kept with their host memory for reuse */
+struct buffer_store_cache
+{
+    _I965Mutex mutex;
+    struct buffer_store *free_list;
+    unsigned int num_free;
+    unsigned int num_allocs;
+    unsigned int num_requests;
+};
+
+void
+i965_buffer_store_cache_init(struct buffer_store_cache *cache);
+
+void
+i965_buffer_store_cache_terminate(struct buffer_store_cache *cache);
+
+struct buffer_store *
+i965_alloc_buffer_store(struct buffer_store_cache *cache,
+                        unsigned int buffer_size);
+
+void
+i965_recycle_buffer_store(struct buffer_store *buffer_store);
+
+void
+i965_free_buffer_store(struct buffer_store *buffer_store);
+
+#endif /* _I965_BUFFER_STORE_H_ */
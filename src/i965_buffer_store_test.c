@@ -0,0 +1,255 @@
+/*
+ * i965_frame_store_test.c - property test of the Frame Store allocation
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runs the CPU side bookkeeping of an H.264 decode context, the parameter
+ * buffer stores of every picture and the Frame Store update, on synthetic
+ * streams, and counts the heap allocations: there must be none once the
+ * first pictures have been decoded. The allocations of the modules under
+ * test go through the wrappers below (ld --wrap). Run by make check.
+ */
+
+#include "sysdeps.h"
+#include <va/va_backend.h>
+#include "i965_decoder.h"
+#include "i965_buffer_store.h"
+
+#define NUM_ELEMENTS    MAX_GEN_REFERENCE_FRAMES
+#define NUM_SURFACES    (NUM_ELEMENTS + 4)
+#define MAX_SLICES      8
+#define NUM_WARMUP      (2 * MAX_SLICES)
+#define NUM_PICTURES    1000
+
+/* About the sizes of the H.264 decode parameter buffers */
+#define PIC_PARAM_SIZE          712
+#define IQ_MATRIX_SIZE          224
+#define SLICE_PARAM_SIZE        1504
+
+static int test_failures = 0;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+static unsigned int num_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+    num_allocs++;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+    num_allocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+    num_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+/* A decode context: its Frame Store and the state of the surfaces */
+struct decoder {
+    struct buffer_store_cache cache;
+    GenFrameStoreContext fs_ctx;
+    GenFrameStore frame_store[NUM_ELEMENTS];
+    int frame_store_ids[NUM_SURFACES];
+    /* the slice data of the previous picture, destroyed late */
+    struct buffer_store *slice_data[MAX_SLICES];
+    int num_slice_data;
+};
+
+/* Surface objects are only stored, any distinct address will do */
+static char surface_objects[NUM_SURFACES];
+
+#define SURFACE_OBJECT(i) ((struct object_surface *)&surface_objects[i])
+
+static void
+decoder_init(struct decoder *dec)
+{
+    int i;
+
+    memset(dec, 0, sizeof(*dec));
+    i965_buffer_store_cache_init(&dec->cache);
+
+    for (i = 0; i < NUM_ELEMENTS; i++) {
+        dec->frame_store[i].surface_id = VA_INVALID_ID;
+        dec->frame_store[i].frame_store_id = -1;
+    }
+
+    for (i = 0; i < NUM_SURFACES; i++)
+        dec->frame_store_ids[i] = -1;
+}
+
+static void
+decoder_release_slice_data(struct decoder *dec)
+{
+    int i;
+
+    for (i = 0; i < dec->num_slice_data; i++)
+        i965_recycle_buffer_store(dec->slice_data[i]);
+
+    dec->num_slice_data = 0;
+}
+
+static void
+decoder_terminate(struct decoder *dec)
+{
+    decoder_release_slice_data(dec);
+    i965_buffer_store_cache_terminate(&dec->cache);
+}
+
+static struct buffer_store *
+create_buffer(struct decoder *dec, unsigned int size)
+{
+    struct buffer_store *buffer_store = i965_alloc_buffer_store(&dec->cache, size);
+
+    CHECK(buffer_store && buffer_store->buffer_size >= size);
+
+    if (buffer_store && size)
+        memset(buffer_store->buffer, 0, size);
+
+    return buffer_store;
+}
+
+/*
+ * Picture n of a stream of num_slices slices per picture, referencing the
+ * up to num_refs previous pictures. Its slice data is destroyed after the
+ * next picture, as with an application destroying its buffers late
+ */
+static void
+decode_picture(struct decoder *dec, int n, int num_slices, int num_refs)
+{
+    struct buffer_store *pic_param, *iq_matrix, *slice_params[MAX_SLICES];
+    GenFrameStoreRef refs[NUM_ELEMENTS];
+    int i, surface;
+
+    pic_param = create_buffer(dec, PIC_PARAM_SIZE);
+    iq_matrix = create_buffer(dec, IQ_MATRIX_SIZE);
+
+    for (i = 0; i < num_slices; i++)
+        slice_params[i] = create_buffer(dec, SLICE_PARAM_SIZE);
+
+    decoder_release_slice_data(dec);
+
+    /* Slice data lives in a BO, the store has no host buffer */
+    for (i = 0; i < num_slices; i++)
+        dec->slice_data[i] = create_buffer(dec, 0);
+
+    dec->num_slice_data = num_slices;
+
+    for (i = 0; i < num_refs && i < n; i++) {
+        surface = (n - 1 - i) % NUM_SURFACES;
+        refs[i].surface_id = surface;
+        refs[i].obj_surface = SURFACE_OBJECT(surface);
+        refs[i].frame_store_id = &dec->frame_store_ids[surface];
+    }
+
+    CHECK(intel_frame_store_update(&dec->fs_ctx, dec->frame_store, NUM_ELEMENTS,
+                                   2 * n, refs, i) == 0);
+
+    i965_recycle_buffer_store(pic_param);
+    i965_recycle_buffer_store(iq_matrix);
+
+    for (i = 0; i < num_slices; i++)
+        i965_recycle_buffer_store(slice_params[i]);
+}
+
+static void
+test_stream(unsigned int seed)
+{
+    struct decoder dec;
+    int n;
+
+    srand(seed);
+    decoder_init(&dec);
+
+    /* Up to the largest slice count and DPB of the stream */
+    for (n = 0; n < NUM_WARMUP; n++)
+        decode_picture(&dec, n, 1 + n % MAX_SLICES, NUM_ELEMENTS);
+
+    num_allocs = 0;
+
+    for ( ; n < NUM_WARMUP + NUM_PICTURES; n++)
+        decode_picture(&dec, n, 1 + rand() % MAX_SLICES, rand() % (NUM_ELEMENTS + 1));
+
+    if (num_allocs) {
+        fprintf(stderr, "seed %u: %u allocations in %d pictures after warm-up\n",
+                seed, num_allocs, NUM_PICTURES);
+        test_failures++;
+    }
+
+    CHECK(dec.cache.num_allocs <= I965_MAX_CACHED_BUFFER_STORES);
+    decoder_terminate(&dec);
+}
+
+/* A buffer larger than the cache keeps gets back to the heap every time */
+static void
+test_uncached_size(void)
+{
+    struct decoder dec;
+    int n;
+
+    decoder_init(&dec);
+
+    for (n = 0; n < 4; n++)
+        i965_recycle_buffer_store(create_buffer(&dec, I965_MAX_CACHED_BUFFER_STORE_SIZE + 1));
+
+    CHECK(dec.cache.num_allocs == 4);
+    CHECK(dec.cache.num_free == 0);
+    decoder_terminate(&dec);
+}
+
+int
+main(void)
+{
+    unsigned int seed;
+
+    test_uncached_size();
+
+    for (seed = 1; seed <= 20; seed++)
+        test_stream(seed);
+
+    if (test_failures) {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return 1;
+    }
+
+    return 0;
+}
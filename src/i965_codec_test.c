@@ -0,0 +1,846 @@
+/*
+ * i965_codec_test.c - end to end tests of the codecs on the mock bufmgr
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Usage: i965_codec_test [-d device] [-n pictures]
+ *
+ * Drives MPEG-2 and H.264 decode contexts and JPEG and H.264 encode
+ * contexts through the VA API, pictures (8 by default) each, and checks
+ * that every call succeeds and that an invalid MPEG-2 picture is rejected.
+ * The CPU time per picture of each context is printed, and that of
+ * creating and destroying 64 H.264 encode contexts at once, which share
+ * their kernels (VA_INTEL_DEBUG=bench prints the kernel cache totals).
+ * H.264 I pictures are also encoded with and without pipelining
+ * (VA_INTEL_ENCODE_PIPELINE) and their frames/s printed: each batch takes
+ * VA_INTEL_MOCK_RING_LATENCY (1000 us by default) on its ring. Full HD
+ * pictures of 4 slices are encoded with their PAK batch programmed by 1
+ * and 4 threads (VA_INTEL_MFC_SLICE_THREADS), and their CPU and wall time
+ * per picture printed.
+ *
+ * Unless set otherwise in the environment, the driver of the build tree
+ * is loaded on the host-memory buffer manager of intel_mock_bufmgr.h, as
+ * a Skylake, so no GPU is needed. The bitstreams are dummies: the batches
+ * are built but not executed. Built with the driver, it isn't part of
+ * make check yet.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <va/va.h>
+#include <va/va_drm.h>
+
+#define TEST_WIDTH              176
+#define TEST_HEIGHT             144
+#define TEST_WIDTH_IN_MBS       (TEST_WIDTH / 16)
+#define TEST_HEIGHT_IN_MBS      (TEST_HEIGHT / 16)
+#define TEST_NUM_SURFACES       4
+#define TEST_SLICE_DATA_SIZE    64
+#define TEST_NUM_CONTEXTS       64
+#define TEST_HD_WIDTH           1920
+#define TEST_HD_HEIGHT          1088
+#define TEST_HD_NUM_SLICES      4
+#define TEST_HD_SLICE_MBS       (TEST_HD_WIDTH / 16 * TEST_HD_HEIGHT / 16 / TEST_HD_NUM_SLICES)
+
+static VADisplay test_dpy;
+static int test_pictures = 8;
+static int test_failures = 0;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+#define CHECK_STATUS(status) do {                                       \
+        VAStatus check_status = (status);                               \
+                                                                        \
+        if (check_status != VA_STATUS_SUCCESS) {                        \
+            fprintf(stderr, "%s:%d: %s failed: %s\n", __FILE__, __LINE__, \
+                    #status, vaErrorStr(check_status));                 \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+struct test_codec {
+    VAConfigID config;
+    VAContextID context;
+    VASurfaceID surfaces[TEST_NUM_SURFACES];
+    VABufferID coded_buf;
+    uint64_t cpu_ns;
+    int pictures;
+};
+
+static uint64_t
+test_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t
+test_wall_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Returns 0 if the display doesn't support profile/entrypoint */
+static int
+test_codec_create_size(struct test_codec *codec, VAProfile profile, VAEntrypoint entrypoint,
+                       unsigned int rt_format, int width, int height)
+{
+    VAConfigAttrib attrib;
+    VAStatus status;
+
+    memset(codec, 0, sizeof(*codec));
+    codec->coded_buf = VA_INVALID_ID;
+
+    attrib.type = VAConfigAttribRateControl;
+    attrib.value = VA_RC_CQP;
+    status = vaCreateConfig(test_dpy, profile, entrypoint, &attrib,
+                            entrypoint == VAEntrypointEncSlice, &codec->config);
+
+    if (status == VA_STATUS_ERROR_UNSUPPORTED_PROFILE ||
+        status == VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT)
+        return 0;
+
+    CHECK_STATUS(status);
+    CHECK_STATUS(vaCreateSurfaces(test_dpy, rt_format, width, height,
+                                  codec->surfaces, TEST_NUM_SURFACES, NULL, 0));
+    CHECK_STATUS(vaCreateContext(test_dpy, codec->config, width, height,
+                                 VA_PROGRESSIVE, codec->surfaces, TEST_NUM_SURFACES,
+                                 &codec->context));
+
+    if (entrypoint != VAEntrypointVLD)
+        CHECK_STATUS(vaCreateBuffer(test_dpy, codec->context, VAEncCodedBufferType,
+                                    width * height * 3, 1, NULL,
+                                    &codec->coded_buf));
+
+    return 1;
+}
+
+static int
+test_codec_create(struct test_codec *codec, VAProfile profile, VAEntrypoint entrypoint,
+                  unsigned int rt_format)
+{
+    return test_codec_create_size(codec, profile, entrypoint, rt_format,
+                                  TEST_WIDTH, TEST_HEIGHT);
+}
+
+static void
+test_codec_destroy(struct test_codec *codec, const char *name)
+{
+    if (codec->coded_buf != VA_INVALID_ID)
+        CHECK_STATUS(vaDestroyBuffer(test_dpy, codec->coded_buf));
+
+    CHECK_STATUS(vaDestroyContext(test_dpy, codec->context));
+    CHECK_STATUS(vaDestroySurfaces(test_dpy, codec->surfaces, TEST_NUM_SURFACES));
+    CHECK_STATUS(vaDestroyConfig(test_dpy, codec->config));
+
+    if (codec->pictures)
+        printf("%-16s %4d pictures %10.1f us of CPU time per picture\n",
+               name, codec->pictures, codec->cpu_ns / 1000.0 / codec->pictures);
+}
+
+static VABufferID
+test_buffer(struct test_codec *codec, VABufferType type, unsigned int size,
+            unsigned int num_elements, void *data)
+{
+    VABufferID buf_id = VA_INVALID_ID;
+
+    CHECK_STATUS(vaCreateBuffer(test_dpy, codec->context, type, size, num_elements,
+                                data, &buf_id));
+
+    return buf_id;
+}
+
+/*
+ * Runs a picture of the buffers on surface, which are destroyed after it.
+ * Returns the status of vaEndPicture()
+ */
+static VAStatus
+test_picture(struct test_codec *codec, VASurfaceID surface,
+             VABufferID *buffers, int num_buffers)
+{
+    uint64_t start = test_cpu_ns();
+    VAStatus status;
+    int i;
+
+    CHECK_STATUS(vaBeginPicture(test_dpy, codec->context, surface));
+    CHECK_STATUS(vaRenderPicture(test_dpy, codec->context, buffers, num_buffers));
+    status = vaEndPicture(test_dpy, codec->context);
+
+    if (status == VA_STATUS_SUCCESS) {
+        CHECK_STATUS(vaSyncSurface(test_dpy, surface));
+        codec->cpu_ns += test_cpu_ns() - start;
+        codec->pictures++;
+    }
+
+    for (i = 0; i < num_buffers; i++)
+        vaDestroyBuffer(test_dpy, buffers[i]);
+
+    return status;
+}
+
+static void
+test_check_coded_buf(struct test_codec *codec)
+{
+    VACodedBufferSegment *segment = NULL;
+
+    CHECK_STATUS(vaMapBuffer(test_dpy, codec->coded_buf, (void **)&segment));
+    CHECK(segment != NULL);
+    CHECK_STATUS(vaUnmapBuffer(test_dpy, codec->coded_buf));
+}
+
+static void
+test_invalid_h264(VAPictureH264 *pic)
+{
+    pic->picture_id = VA_INVALID_SURFACE;
+    pic->flags = VA_PICTURE_H264_INVALID;
+}
+
+static void
+test_decode_mpeg2(void)
+{
+    struct test_codec codec;
+    VAPictureParameterBufferMPEG2 pic_param;
+    VAIQMatrixBufferMPEG2 iq_matrix;
+    VASliceParameterBufferMPEG2 slice_params[TEST_HEIGHT_IN_MBS];
+    unsigned char slice_data[TEST_HEIGHT_IN_MBS * TEST_SLICE_DATA_SIZE];
+    VABufferID buffers[4];
+    VASurfaceID forward = VA_INVALID_SURFACE, backward = VA_INVALID_SURFACE;
+    int i, n;
+
+    if (!test_codec_create(&codec, VAProfileMPEG2Main, VAEntrypointVLD, VA_RT_FORMAT_YUV420))
+        return;
+
+    memset(&iq_matrix, 0, sizeof(iq_matrix));
+    memset(slice_data, 0, sizeof(slice_data));
+
+    /* one slice per macroblock row */
+    for (i = 0; i < TEST_HEIGHT_IN_MBS; i++) {
+        memset(&slice_params[i], 0, sizeof(slice_params[i]));
+        slice_params[i].slice_data_size = TEST_SLICE_DATA_SIZE;
+        slice_params[i].slice_data_offset = i * TEST_SLICE_DATA_SIZE;
+        slice_params[i].slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+        slice_params[i].macroblock_offset = 38;
+        slice_params[i].slice_vertical_position = i;
+        slice_params[i].quantiser_scale_code = 8;
+    }
+
+    /* I P B P B ... */
+    for (n = 0; n < test_pictures; n++) {
+        memset(&pic_param, 0, sizeof(pic_param));
+        pic_param.horizontal_size = TEST_WIDTH;
+        pic_param.vertical_size = TEST_HEIGHT;
+        pic_param.forward_reference_picture = VA_INVALID_SURFACE;
+        pic_param.backward_reference_picture = VA_INVALID_SURFACE;
+        pic_param.f_code = 0xffff;
+        pic_param.picture_coding_extension.bits.picture_structure = 3;
+        pic_param.picture_coding_extension.bits.top_field_first = 1;
+        pic_param.picture_coding_extension.bits.frame_pred_frame_dct = 1;
+        pic_param.picture_coding_extension.bits.progressive_frame = 1;
+        pic_param.picture_coding_extension.bits.is_first_field = 1;
+
+        if (n == 0) {
+            pic_param.picture_coding_type = 1;
+        } else if (n & 1) {
+            pic_param.picture_coding_type = 2;
+            pic_param.forward_reference_picture = backward != VA_INVALID_SURFACE ? backward : forward;
+            pic_param.f_code = 0x11ff;
+        } else {
+            pic_param.picture_coding_type = 3;
+            pic_param.forward_reference_picture = forward;
+            pic_param.backward_reference_picture = backward;
+            pic_param.f_code = 0x1111;
+        }
+
+        buffers[0] = test_buffer(&codec, VAPictureParameterBufferType, sizeof(pic_param), 1, &pic_param);
+        buffers[1] = test_buffer(&codec, VAIQMatrixBufferType, sizeof(iq_matrix), 1, &iq_matrix);
+        buffers[2] = test_buffer(&codec, VASliceParameterBufferType, sizeof(slice_params[0]),
+                                 TEST_HEIGHT_IN_MBS, slice_params);
+        buffers[3] = test_buffer(&codec, VASliceDataBufferType, sizeof(slice_data), 1, slice_data);
+        CHECK_STATUS(test_picture(&codec, codec.surfaces[n % TEST_NUM_SURFACES], buffers, 4));
+
+        /* the I and P pictures are the references */
+        if (pic_param.picture_coding_type != 3) {
+            forward = backward != VA_INVALID_SURFACE ? backward : codec.surfaces[n % TEST_NUM_SURFACES];
+            backward = codec.surfaces[n % TEST_NUM_SURFACES];
+        }
+    }
+
+    /* an unknown picture coding type is rejected */
+    pic_param.picture_coding_type = 0;
+    buffers[0] = test_buffer(&codec, VAPictureParameterBufferType, sizeof(pic_param), 1, &pic_param);
+    buffers[1] = test_buffer(&codec, VASliceParameterBufferType, sizeof(slice_params[0]),
+                             TEST_HEIGHT_IN_MBS, slice_params);
+    buffers[2] = test_buffer(&codec, VASliceDataBufferType, sizeof(slice_data), 1, slice_data);
+    CHECK(test_picture(&codec, codec.surfaces[0], buffers, 3) == VA_STATUS_ERROR_INVALID_PARAMETER);
+
+    test_codec_destroy(&codec, "MPEG-2 decode");
+}
+
+static void
+test_decode_h264(void)
+{
+    struct test_codec codec;
+    VAPictureParameterBufferH264 pic_param;
+    VAIQMatrixBufferH264 iq_matrix;
+    VASliceParameterBufferH264 slice_param;
+    unsigned char slice_data[TEST_SLICE_DATA_SIZE];
+    VABufferID buffers[4];
+    VAPictureH264 ref;
+    int i, n;
+
+    if (!test_codec_create(&codec, VAProfileH264High, VAEntrypointVLD, VA_RT_FORMAT_YUV420))
+        return;
+
+    memset(&iq_matrix, 0x10, sizeof(iq_matrix));
+    memset(slice_data, 0, sizeof(slice_data));
+    test_invalid_h264(&ref);
+
+    /* an IDR picture, then P pictures referencing the previous one */
+    for (n = 0; n < test_pictures; n++) {
+        memset(&pic_param, 0, sizeof(pic_param));
+        pic_param.CurrPic.picture_id = codec.surfaces[n % TEST_NUM_SURFACES];
+        pic_param.CurrPic.frame_idx = n;
+        pic_param.CurrPic.TopFieldOrderCnt = n * 2;
+        pic_param.CurrPic.BottomFieldOrderCnt = n * 2;
+
+        for (i = 0; i < 16; i++)
+            test_invalid_h264(&pic_param.ReferenceFrames[i]);
+
+        if (n)
+            pic_param.ReferenceFrames[0] = ref;
+
+        pic_param.picture_width_in_mbs_minus1 = TEST_WIDTH_IN_MBS - 1;
+        pic_param.picture_height_in_mbs_minus1 = TEST_HEIGHT_IN_MBS - 1;
+        pic_param.num_ref_frames = 1;
+        pic_param.seq_fields.bits.chroma_format_idc = 1;
+        pic_param.seq_fields.bits.frame_mbs_only_flag = 1;
+        pic_param.seq_fields.bits.direct_8x8_inference_flag = 1;
+        pic_param.seq_fields.bits.log2_max_frame_num_minus4 = 4;
+        pic_param.seq_fields.bits.log2_max_pic_order_cnt_lsb_minus4 = 4;
+        pic_param.pic_fields.bits.entropy_coding_mode_flag = 1;
+        pic_param.pic_fields.bits.reference_pic_flag = 1;
+        pic_param.pic_fields.bits.deblocking_filter_control_present_flag = 1;
+        pic_param.frame_num = n;
+
+        memset(&slice_param, 0, sizeof(slice_param));
+        slice_param.slice_data_size = sizeof(slice_data);
+        slice_param.slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+        slice_param.slice_data_bit_offset = 24;
+        slice_param.slice_type = n ? 0 : 2;
+
+        for (i = 0; i < 32; i++) {
+            test_invalid_h264(&slice_param.RefPicList0[i]);
+            test_invalid_h264(&slice_param.RefPicList1[i]);
+        }
+
+        if (n)
+            slice_param.RefPicList0[0] = ref;
+
+        buffers[0] = test_buffer(&codec, VAPictureParameterBufferType, sizeof(pic_param), 1, &pic_param);
+        buffers[1] = test_buffer(&codec, VAIQMatrixBufferType, sizeof(iq_matrix), 1, &iq_matrix);
+        buffers[2] = test_buffer(&codec, VASliceParameterBufferType, sizeof(slice_param), 1, &slice_param);
+        buffers[3] = test_buffer(&codec, VASliceDataBufferType, sizeof(slice_data), 1, slice_data);
+        CHECK_STATUS(test_picture(&codec, codec.surfaces[n % TEST_NUM_SURFACES], buffers, 4));
+
+        ref = pic_param.CurrPic;
+        ref.flags = VA_PICTURE_H264_SHORT_TERM_REFERENCE;
+    }
+
+    test_codec_destroy(&codec, "H.264 decode");
+}
+
+/* Mid grey input, written through a derived image */
+static void
+test_fill_surface(VASurfaceID surface)
+{
+    VAImage image;
+    void *data;
+
+    CHECK_STATUS(vaDeriveImage(test_dpy, surface, &image));
+    CHECK_STATUS(vaMapBuffer(test_dpy, image.buf, &data));
+    memset(data, 0x80, image.data_size);
+    CHECK_STATUS(vaUnmapBuffer(test_dpy, image.buf));
+    CHECK_STATUS(vaDestroyImage(test_dpy, image.image_id));
+}
+
+static void
+test_encode_jpeg(void)
+{
+    struct test_codec codec;
+    VAEncPictureParameterBufferJPEG pic_param;
+    VAHuffmanTableBufferJPEGBaseline huffman_table;
+    VAEncSliceParameterBufferJPEG slice_param;
+    VABufferID buffers[3];
+    int i, run, size, n;
+
+    if (!test_codec_create(&codec, VAProfileJPEGBaseline, VAEntrypointEncPicture, VA_RT_FORMAT_YUV420))
+        return;
+
+    test_fill_surface(codec.surfaces[0]);
+
+    /* valid tables of fixed length codes: the 12 DC symbols take 4 bits,
+     * the 162 AC ones 8 bits */
+    memset(&huffman_table, 0, sizeof(huffman_table));
+
+    for (i = 0; i < 2; i++) {
+        huffman_table.load_huffman_table[i] = 1;
+        huffman_table.huffman_table[i].num_dc_codes[3] = 12;
+        huffman_table.huffman_table[i].num_ac_codes[7] = 162;
+
+        for (size = 0; size < 12; size++)
+            huffman_table.huffman_table[i].dc_values[size] = size;
+
+        n = 0;
+        huffman_table.huffman_table[i].ac_values[n++] = 0x00;
+        huffman_table.huffman_table[i].ac_values[n++] = 0xf0;
+
+        for (run = 0; run < 16; run++) {
+            for (size = 1; size <= 10; size++)
+                huffman_table.huffman_table[i].ac_values[n++] = run << 4 | size;
+        }
+    }
+
+    memset(&slice_param, 0, sizeof(slice_param));
+    slice_param.num_components = 3;
+
+    for (i = 0; i < 3; i++) {
+        slice_param.components[i].component_selector = i + 1;
+        slice_param.components[i].dc_table_selector = !!i;
+        slice_param.components[i].ac_table_selector = !!i;
+    }
+
+    for (n = 0; n < test_pictures; n++) {
+        memset(&pic_param, 0, sizeof(pic_param));
+        pic_param.reconstructed_picture = codec.surfaces[0];
+        pic_param.picture_width = TEST_WIDTH;
+        pic_param.picture_height = TEST_HEIGHT;
+        pic_param.coded_buf = codec.coded_buf;
+        pic_param.pic_flags.bits.huffman = 1;
+        pic_param.pic_flags.bits.interleaved = 1;
+        pic_param.sample_bit_depth = 8;
+        pic_param.num_scan = 1;
+        pic_param.num_components = 3;
+
+        for (i = 0; i < 3; i++) {
+            pic_param.component_id[i] = i + 1;
+            pic_param.quantiser_table_selector[i] = !!i;
+        }
+
+        pic_param.quality = 50 + n;
+
+        buffers[0] = test_buffer(&codec, VAEncPictureParameterBufferType, sizeof(pic_param), 1, &pic_param);
+        buffers[1] = test_buffer(&codec, VAHuffmanTableBufferType, sizeof(huffman_table), 1, &huffman_table);
+        buffers[2] = test_buffer(&codec, VAEncSliceParameterBufferType, sizeof(slice_param), 1, &slice_param);
+        CHECK_STATUS(test_picture(&codec, codec.surfaces[0], buffers, 3));
+        test_check_coded_buf(&codec);
+    }
+
+    test_codec_destroy(&codec, "JPEG encode");
+}
+
+static void
+test_encode_h264(void)
+{
+    struct test_codec codec;
+    VAEncSequenceParameterBufferH264 seq_param;
+    VAEncPictureParameterBufferH264 pic_param;
+    VAEncSliceParameterBufferH264 slice_param;
+    VABufferID buffers[3];
+    VAPictureH264 ref;
+    VASurfaceID input;
+    int i, n;
+
+    if (!test_codec_create(&codec, VAProfileH264Main, VAEntrypointEncSlice, VA_RT_FORMAT_YUV420))
+        return;
+
+    /* the first surface is the input, the others the reconstructed pictures */
+    input = codec.surfaces[0];
+    test_fill_surface(input);
+    test_invalid_h264(&ref);
+
+    memset(&seq_param, 0, sizeof(seq_param));
+    seq_param.level_idc = 30;
+    seq_param.intra_period = 30;
+    seq_param.intra_idr_period = 30;
+    seq_param.ip_period = 1;
+    seq_param.max_num_ref_frames = 1;
+    seq_param.picture_width_in_mbs = TEST_WIDTH_IN_MBS;
+    seq_param.picture_height_in_mbs = TEST_HEIGHT_IN_MBS;
+    seq_param.seq_fields.bits.chroma_format_idc = 1;
+    seq_param.seq_fields.bits.frame_mbs_only_flag = 1;
+    seq_param.seq_fields.bits.direct_8x8_inference_flag = 1;
+    seq_param.seq_fields.bits.log2_max_frame_num_minus4 = 4;
+    seq_param.seq_fields.bits.log2_max_pic_order_cnt_lsb_minus4 = 4;
+    seq_param.num_units_in_tick = 1;
+    seq_param.time_scale = 60;
+
+    /* an IDR picture, then P pictures referencing the previous one */
+    for (n = 0; n < test_pictures; n++) {
+        memset(&pic_param, 0, sizeof(pic_param));
+        pic_param.CurrPic.picture_id = codec.surfaces[1 + n % 2];
+        pic_param.CurrPic.frame_idx = n;
+        pic_param.CurrPic.TopFieldOrderCnt = n * 2;
+        pic_param.CurrPic.BottomFieldOrderCnt = n * 2;
+
+        for (i = 0; i < 16; i++)
+            test_invalid_h264(&pic_param.ReferenceFrames[i]);
+
+        if (n)
+            pic_param.ReferenceFrames[0] = ref;
+
+        pic_param.coded_buf = codec.coded_buf;
+        pic_param.frame_num = n;
+        pic_param.pic_init_qp = 26;
+        pic_param.pic_fields.bits.idr_pic_flag = !n;
+        pic_param.pic_fields.bits.reference_pic_flag = 1;
+        pic_param.pic_fields.bits.entropy_coding_mode_flag = 1;
+        pic_param.pic_fields.bits.deblocking_filter_control_present_flag = 1;
+
+        memset(&slice_param, 0, sizeof(slice_param));
+        slice_param.num_macroblocks = TEST_WIDTH_IN_MBS * TEST_HEIGHT_IN_MBS;
+        slice_param.slice_type = n ? 0 : 2;
+        slice_param.pic_order_cnt_lsb = n * 2;
+
+        for (i = 0; i < 32; i++) {
+            test_invalid_h264(&slice_param.RefPicList0[i]);
+            test_invalid_h264(&slice_param.RefPicList1[i]);
+        }
+
+        if (n)
+            slice_param.RefPicList0[0] = ref;
+
+        buffers[0] = test_buffer(&codec, VAEncSequenceParameterBufferType, sizeof(seq_param), 1, &seq_param);
+        buffers[1] = test_buffer(&codec, VAEncPictureParameterBufferType, sizeof(pic_param), 1, &pic_param);
+        buffers[2] = test_buffer(&codec, VAEncSliceParameterBufferType, sizeof(slice_param), 1, &slice_param);
+        CHECK_STATUS(test_picture(&codec, input, buffers, 3));
+        test_check_coded_buf(&codec);
+
+        ref = pic_param.CurrPic;
+        ref.flags = VA_PICTURE_H264_SHORT_TERM_REFERENCE;
+    }
+
+    test_codec_destroy(&codec, "H.264 encode");
+}
+
+/*
+ * I pictures from two input surfaces into two reconstructed surfaces, with
+ * the coded buffer read at the end only, so that nothing makes the PAK
+ * stage of a picture wait for the next one when pipeline is set
+ */
+static void
+test_encode_h264_rate(int pipeline)
+{
+    struct test_codec codec;
+    VAEncSequenceParameterBufferH264 seq_param;
+    VAEncPictureParameterBufferH264 pic_param;
+    VAEncSliceParameterBufferH264 slice_param;
+    VABufferID buffers[3];
+    uint64_t wall_ns;
+    int i, n;
+
+    setenv("VA_INTEL_ENCODE_PIPELINE", pipeline ? "1" : "0", 1);
+
+    if (!test_codec_create(&codec, VAProfileH264Main, VAEntrypointEncSlice, VA_RT_FORMAT_YUV420))
+        return;
+
+    test_fill_surface(codec.surfaces[0]);
+    test_fill_surface(codec.surfaces[1]);
+
+    memset(&seq_param, 0, sizeof(seq_param));
+    seq_param.level_idc = 30;
+    seq_param.intra_period = 1;
+    seq_param.intra_idr_period = 1;
+    seq_param.ip_period = 1;
+    seq_param.picture_width_in_mbs = TEST_WIDTH_IN_MBS;
+    seq_param.picture_height_in_mbs = TEST_HEIGHT_IN_MBS;
+    seq_param.seq_fields.bits.chroma_format_idc = 1;
+    seq_param.seq_fields.bits.frame_mbs_only_flag = 1;
+    seq_param.seq_fields.bits.direct_8x8_inference_flag = 1;
+    seq_param.seq_fields.bits.log2_max_frame_num_minus4 = 4;
+    seq_param.seq_fields.bits.log2_max_pic_order_cnt_lsb_minus4 = 4;
+    seq_param.num_units_in_tick = 1;
+    seq_param.time_scale = 60;
+
+    wall_ns = test_wall_ns();
+
+    for (n = 0; n < test_pictures; n++) {
+        memset(&pic_param, 0, sizeof(pic_param));
+        pic_param.CurrPic.picture_id = codec.surfaces[2 + n % 2];
+
+        for (i = 0; i < 16; i++)
+            test_invalid_h264(&pic_param.ReferenceFrames[i]);
+
+        pic_param.coded_buf = codec.coded_buf;
+        pic_param.pic_init_qp = 26;
+        pic_param.pic_fields.bits.idr_pic_flag = 1;
+        pic_param.pic_fields.bits.reference_pic_flag = 1;
+        pic_param.pic_fields.bits.entropy_coding_mode_flag = 1;
+        pic_param.pic_fields.bits.deblocking_filter_control_present_flag = 1;
+
+        memset(&slice_param, 0, sizeof(slice_param));
+        slice_param.num_macroblocks = TEST_WIDTH_IN_MBS * TEST_HEIGHT_IN_MBS;
+        slice_param.slice_type = 2;
+        slice_param.idr_pic_id = n;
+
+        for (i = 0; i < 32; i++) {
+            test_invalid_h264(&slice_param.RefPicList0[i]);
+            test_invalid_h264(&slice_param.RefPicList1[i]);
+        }
+
+        buffers[0] = test_buffer(&codec, VAEncSequenceParameterBufferType, sizeof(seq_param), 1, &seq_param);
+        buffers[1] = test_buffer(&codec, VAEncPictureParameterBufferType, sizeof(pic_param), 1, &pic_param);
+        buffers[2] = test_buffer(&codec, VAEncSliceParameterBufferType, sizeof(slice_param), 1, &slice_param);
+        CHECK_STATUS(vaBeginPicture(test_dpy, codec.context, codec.surfaces[n % 2]));
+        CHECK_STATUS(vaRenderPicture(test_dpy, codec.context, buffers, 3));
+        CHECK_STATUS(vaEndPicture(test_dpy, codec.context));
+
+        for (i = 0; i < 3; i++)
+            vaDestroyBuffer(test_dpy, buffers[i]);
+    }
+
+    test_check_coded_buf(&codec);
+    wall_ns = test_wall_ns() - wall_ns;
+    printf("%-16s %4d pictures %10.1f frames/s%s\n",
+           "H.264 encode", test_pictures, test_pictures * 1e9 / wall_ns,
+           pipeline ? ", pipelined" : "");
+    test_codec_destroy(&codec, "H.264 encode");
+    unsetenv("VA_INTEL_ENCODE_PIPELINE");
+}
+
+/*
+ * Full HD I pictures of 4 slices, whose PAK batch is programmed by up to
+ * threads threads (VA_INTEL_MFC_SLICE_THREADS)
+ */
+static void
+test_encode_h264_slices(int threads)
+{
+    struct test_codec codec;
+    VAEncSequenceParameterBufferH264 seq_param;
+    VAEncPictureParameterBufferH264 pic_param;
+    VAEncSliceParameterBufferH264 slice_param[TEST_HD_NUM_SLICES];
+    VABufferID buffers[2 + TEST_HD_NUM_SLICES];
+    char name[32];
+    uint64_t wall_ns;
+    int i, j, n;
+
+    sprintf(name, "%d", threads);
+    setenv("VA_INTEL_MFC_SLICE_THREADS", name, 1);
+
+    if (!test_codec_create_size(&codec, VAProfileH264Main, VAEntrypointEncSlice, VA_RT_FORMAT_YUV420,
+                                TEST_HD_WIDTH, TEST_HD_HEIGHT))
+        return;
+
+    test_fill_surface(codec.surfaces[0]);
+
+    memset(&seq_param, 0, sizeof(seq_param));
+    seq_param.level_idc = 41;
+    seq_param.intra_period = 1;
+    seq_param.intra_idr_period = 1;
+    seq_param.ip_period = 1;
+    seq_param.picture_width_in_mbs = TEST_HD_WIDTH / 16;
+    seq_param.picture_height_in_mbs = TEST_HD_HEIGHT / 16;
+    seq_param.seq_fields.bits.chroma_format_idc = 1;
+    seq_param.seq_fields.bits.frame_mbs_only_flag = 1;
+    seq_param.seq_fields.bits.direct_8x8_inference_flag = 1;
+    seq_param.seq_fields.bits.log2_max_frame_num_minus4 = 4;
+    seq_param.seq_fields.bits.log2_max_pic_order_cnt_lsb_minus4 = 4;
+    seq_param.num_units_in_tick = 1;
+    seq_param.time_scale = 60;
+
+    wall_ns = test_wall_ns();
+
+    for (n = 0; n < test_pictures; n++) {
+        memset(&pic_param, 0, sizeof(pic_param));
+        pic_param.CurrPic.picture_id = codec.surfaces[1 + n % 2];
+
+        for (i = 0; i < 16; i++)
+            test_invalid_h264(&pic_param.ReferenceFrames[i]);
+
+        pic_param.coded_buf = codec.coded_buf;
+        pic_param.pic_init_qp = 26;
+        pic_param.pic_fields.bits.idr_pic_flag = 1;
+        pic_param.pic_fields.bits.reference_pic_flag = 1;
+        pic_param.pic_fields.bits.entropy_coding_mode_flag = 1;
+        pic_param.pic_fields.bits.deblocking_filter_control_present_flag = 1;
+
+        for (j = 0; j < TEST_HD_NUM_SLICES; j++) {
+            memset(&slice_param[j], 0, sizeof(slice_param[j]));
+            slice_param[j].macroblock_address = j * TEST_HD_SLICE_MBS;
+            slice_param[j].num_macroblocks = TEST_HD_SLICE_MBS;
+            slice_param[j].slice_type = 2;
+            slice_param[j].idr_pic_id = n;
+
+            for (i = 0; i < 32; i++) {
+                test_invalid_h264(&slice_param[j].RefPicList0[i]);
+                test_invalid_h264(&slice_param[j].RefPicList1[i]);
+            }
+        }
+
+        buffers[0] = test_buffer(&codec, VAEncSequenceParameterBufferType, sizeof(seq_param), 1, &seq_param);
+        buffers[1] = test_buffer(&codec, VAEncPictureParameterBufferType, sizeof(pic_param), 1, &pic_param);
+
+        for (j = 0; j < TEST_HD_NUM_SLICES; j++)
+            buffers[2 + j] = test_buffer(&codec, VAEncSliceParameterBufferType,
+                                         sizeof(slice_param[j]), 1, &slice_param[j]);
+
+        CHECK_STATUS(test_picture(&codec, codec.surfaces[0], buffers, 2 + TEST_HD_NUM_SLICES));
+    }
+
+    test_check_coded_buf(&codec);
+    wall_ns = test_wall_ns() - wall_ns;
+    sprintf(name, "H.264 1080p %dT", threads);
+    printf("%-16s %4d pictures %10.1f us of wall time per picture\n",
+           name, test_pictures, wall_ns / 1000.0 / test_pictures);
+    test_codec_destroy(&codec, name);
+    unsetenv("VA_INTEL_MFC_SLICE_THREADS");
+}
+
+static void
+test_encode_contexts(void)
+{
+    struct test_codec *codecs;
+    uint64_t create_ns, destroy_ns;
+    int i, num_codecs;
+
+    codecs = calloc(TEST_NUM_CONTEXTS, sizeof(*codecs));
+    CHECK(codecs);
+
+    if (!codecs)
+        return;
+
+    create_ns = test_cpu_ns();
+
+    for (num_codecs = 0; num_codecs < TEST_NUM_CONTEXTS; num_codecs++) {
+        if (!test_codec_create(&codecs[num_codecs], VAProfileH264Main,
+                               VAEntrypointEncSlice, VA_RT_FORMAT_YUV420))
+            break;
+    }
+
+    create_ns = test_cpu_ns() - create_ns;
+    destroy_ns = test_cpu_ns();
+
+    for (i = 0; i < num_codecs; i++)
+        test_codec_destroy(&codecs[i], "H.264 encode");
+
+    destroy_ns = test_cpu_ns() - destroy_ns;
+
+    if (num_codecs)
+        printf("%-16s %4d contexts %10.1f us of CPU time to create, %.1f us to destroy each\n",
+               "H.264 encode", num_codecs,
+               create_ns / 1000.0 / num_codecs, destroy_ns / 1000.0 / num_codecs);
+
+    free(codecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *device = "/dev/null";
+    int opt, fd, major, minor;
+    VAStatus status;
+
+    while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 'n':
+            test_pictures = atoi(optarg);
+            break;
+        default:
+            test_pictures = 0;
+            break;
+        }
+    }
+
+    if (test_pictures < 1) {
+        fprintf(stderr, "Usage: %s [-d device] [-n pictures]\n", argv[0]);
+        return 1;
+    }
+
+    setenv("LIBVA_DRIVER_NAME", "i965", 0);
+    setenv("VA_INTEL_MOCK", "0x1916", 0);
+    setenv("VA_INTEL_MOCK_RING_LATENCY", "1000", 0);
+#ifdef I965_TEST_DRIVERS_PATH
+    setenv("LIBVA_DRIVERS_PATH", I965_TEST_DRIVERS_PATH, 0);
+#endif
+
+    fd = open(device, O_RDWR);
+
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s\n", device);
+        return 1;
+    }
+
+    test_dpy = vaGetDisplayDRM(fd);
+    status = vaInitialize(test_dpy, &major, &minor);
+
+    if (status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "vaInitialize failed: %s\n", vaErrorStr(status));
+        return 1;
+    }
+
+    test_decode_mpeg2();
+    test_decode_h264();
+    test_encode_jpeg();
+    test_encode_h264();
+    test_encode_h264_rate(0);
+    test_encode_h264_rate(1);
+    test_encode_h264_slices(1);
+    test_encode_h264_slices(4);
+    test_encode_contexts();
+
+    vaTerminate(test_dpy);
+    close(fd);
+
+    if (test_failures) {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -33,18 +33,29 @@
 #include <va/va_dec_hevc.h>
 #include <intel_bufmgr.h>
 
+#include "i965_bsd_scheduler.h"
+
 #define MAX_GEN_REFERENCE_FRAMES 16
 #define MAX_GEN_HCP_REFERENCE_FRAMES    8
 
+/*
+ * Scratch buffers live as long as the decoder context: the bo is only
+ * reallocated when the stream needs a bigger one than it already has.
+ */
 #define ALLOC_GEN_BUFFER(gen_buffer, string, size) do {         \
-        dri_bo_unreference(gen_buffer->bo);                     \
-        gen_buffer->bo = dri_bo_alloc(i965->intel.bufmgr,       \
-                                      string,                   \
-                                      size,                     \
-                                      0x1000);                  \
-        assert(gen_buffer->bo);                                 \
+        if (!gen_buffer->bo ||                                  \
+            gen_buffer->bo->size < (unsigned long)(size)) {     \
+            dri_bo_unreference(gen_buffer->bo);                 \
+            gen_buffer->bo = dri_bo_alloc(i965->intel.bufmgr,   \
+                                          string,               \
+                                          size,                 \
+                                          0x1000);              \
+            assert(gen_buffer->bo);                             \
+            __atomic_fetch_add(&i965->num_decoder_scratch_allocs, \
+                               1, __ATOMIC_RELAXED);              \
+        }                                                       \
         gen_buffer->valid = 1;                                  \
-    } while (0);
+    } while (0)
 
 #define FREE_GEN_BUFFER(gen_buffer) do {        \
         dri_bo_unreference(gen_buffer->bo);     \
@@ -72,17 +83,102 @@ typedef struct gen_frame_store_context GenFrameStoreContext;
 struct gen_frame_store_context {
     uint64_t    age;
     int         prev_poc;
+
+    /* Frame Store entries by increasing age when they were last used,
+       entries of the same age being ordered by index */
+    uint8_t     lru[MAX_GEN_REFERENCE_FRAMES];
+};
+
+/* A reference of the picture being decoded, see intel_frame_store_update() */
+typedef struct gen_frame_store_ref GenFrameStoreRef;
+struct gen_frame_store_ref {
+    VASurfaceID surface_id;
+    struct      object_surface *obj_surface;    /* only stored */
+    int        *frame_store_id;                 /* of the surface, -1 if none */
 };
 
+/*
+ * Keeps the references of a picture in the Frame Store entries they
+ * already have and assigns the least recently used free entries to the
+ * others. Returns the number of references left without an entry
+ */
+int
+intel_frame_store_update(GenFrameStoreContext *fs_ctx,
+                         GenFrameStore frame_store[],
+                         int num_elements,
+                         int poc,
+                         const GenFrameStoreRef *refs,
+                         int num_refs);
+
 typedef struct gen_buffer GenBuffer;
 struct gen_buffer {
     dri_bo     *bo;
     int         valid;
 };
 
+#define MAX_GEN_COMMAND_TEMPLATE_KEY    1024    /* VAIQMatrixBufferHEVC */
+#define MAX_GEN_COMMAND_TEMPLATE_DWORDS (20 * 18)       /* the HCP_QM_STATEs */
+
+/*
+ * Commands that only change with the stream configuration, such as the QM
+ * states, encoded once and copied into the batch of each picture as long
+ * as their inputs, the key, stay the same. They can't hold relocations.
+ */
+typedef struct gen_command_template GenCommandTemplate;
+struct gen_command_template {
+    int                 valid;
+    int                 key_size;
+    int                 num_dwords;
+    unsigned char       key[MAX_GEN_COMMAND_TEMPLATE_KEY];
+    unsigned int        dwords[MAX_GEN_COMMAND_TEMPLATE_DWORDS];
+};
+
+#define MAX_GEN_DEFERRED_PICTURES       64
+
+/*
+ * Submission state of a Gen8+ decoder context.
+ *
+ * Deferred submission (VA_INTEL_DECODE_BATCH=<n>): the command streams of
+ * up to n pictures are accumulated into the context batch and only
+ * submitted on synchronization, on a dependency or when the batch is full.
+ *
+ * On parts with two BSD rings, the ring of each batch is picked by the
+ * driver-wide scheduler, see i965_bsd_scheduler.h
+ */
+typedef struct gen_deferred_decode GenDeferredDecode;
+struct gen_deferred_decode {
+    struct hw_context  *hw_context;
+    int                 max_pictures;   /* 0: submit every picture */
+    int                 num_pending;
+    int                 batch_used;     /* at the start of the current picture */
+    int                 building;       /* the current picture isn't complete */
+    GenDeferredDecode  *next;           /* in i965->deferred_decode_list */
+
+    I965BSDStream       bsd_stream;
+    int                 bsd_ring;       /* ring of the batch being built */
+    unsigned int        batch_load;     /* macroblocks in the batch */
+    unsigned int        picture_load;   /* macroblocks of the current picture */
+
+    unsigned int        num_pictures;
+    unsigned int        num_submissions;
+};
+
+struct object_config;
+
 struct hw_context *
 gen75_dec_hw_context_init(VADriverContextP ctx, struct object_config *obj_config);
 
 extern struct hw_context *
 gen8_dec_hw_context_init(VADriverContextP ctx, struct object_config *obj_config);
+
+void
+i965_decoder_flush_deferred(VADriverContextP ctx, dri_bo *bo,
+                            struct hw_context *hw_context);
+
+void
+i965_decoder_bsd_init(VADriverContextP ctx);
+
+void
+i965_decoder_bsd_terminate(VADriverContextP ctx);
+
 #endif /* I965_DECODER_H */
@@ -562,16 +562,6 @@ gen6_mfd_avc_phantom_slice(VADriverContextP ctx,
     gen6_mfd_avc_phantom_slice_bsd_object(ctx, pic_param, batch);
 }
 
-/* Comparison function for sorting out the array of free frame store entries */
-static int
-compare_avc_ref_store_func(const void *p1, const void *p2)
-{
-    const GenFrameStore * const fs1 = *((GenFrameStore **)p1);
-    const GenFrameStore * const fs2 = *((GenFrameStore **)p2);
-
-    return fs1->ref_age - fs2->ref_age;
-}
-
 static void
 intel_update_codec_frame_store_index(
     VADriverContextP              ctx,
@@ -582,21 +572,9 @@ intel_update_codec_frame_store_index(
     GenFrameStoreContext         *fs_ctx
 )
 {
-    GenFrameStore **free_refs = calloc(num_elements, sizeof(GenFrameStore *));
-    uint32_t used_refs = 0, add_refs = 0;
-    uint64_t age;
-    int i, n, num_free_refs;
+    GenFrameStoreRef refs[ARRAY_ELEMS(decode_state->reference_objects)];
+    int i, num_refs = 0;
 
-    if (!free_refs)
-        return;
-
-    /* Detect changes of access unit */
-    if (fs_ctx->age == 0 || fs_ctx->prev_poc != poc)
-        fs_ctx->age++;
-    fs_ctx->prev_poc = poc;
-    age = fs_ctx->age;
-
-    /* Tag entries that are still available in our Frame Store */
     for (i = 0; i < ARRAY_ELEMS(decode_state->reference_objects); i++) {
         struct object_surface * const obj_surface =
             decode_state->reference_objects[i];
@@ -606,54 +584,16 @@ intel_update_codec_frame_store_index(
         GenCodecSurface * const codec_surface = obj_surface->private_data;
         if (!codec_surface)
             continue;
-        if (codec_surface->frame_store_id >= 0) {
-            GenFrameStore * const fs =
-                &frame_store[codec_surface->frame_store_id];
-            if (fs->surface_id == obj_surface->base.id) {
-                fs->obj_surface = obj_surface;
-                fs->ref_age = age;
-                used_refs |= 1 << fs->frame_store_id;
-                continue;
-            }
-        }
-        add_refs |= 1 << i;
-    }
 
-    /* Build and sort out the list of retired candidates. The resulting
-       list is ordered by increasing age when they were last used */
-    for (i = 0, n = 0; i < num_elements; i++) {
-        if (!(used_refs & (1 << i))) {
-            GenFrameStore * const fs = &frame_store[i];
-            fs->obj_surface = NULL;
-            free_refs[n++] = fs;
-        }
+        refs[num_refs].surface_id = obj_surface->base.id;
+        refs[num_refs].obj_surface = obj_surface;
+        refs[num_refs].frame_store_id = &codec_surface->frame_store_id;
+        num_refs++;
     }
-    num_free_refs = n;
-    qsort(&free_refs[0], n, sizeof(free_refs[0]), compare_avc_ref_store_func);
-
-    /* Append the new reference frames */
-    for (i = 0, n = 0; i < ARRAY_ELEMS(decode_state->reference_objects); i++) {
-        struct object_surface * const obj_surface =
-            decode_state->reference_objects[i];
-        if (!obj_surface || !(add_refs & (1 << i)))
-            continue;
 
-        GenCodecSurface * const codec_surface = obj_surface->private_data;
-        if (!codec_surface)
-            continue;
-        if (n < num_free_refs) {
-            GenFrameStore * const fs = free_refs[n++];
-            fs->surface_id = obj_surface->base.id;
-            fs->obj_surface = obj_surface;
-            fs->frame_store_id = fs - frame_store;
-            fs->ref_age = age;
-            codec_surface->frame_store_id = fs->frame_store_id;
-            continue;
-        }
+    if (intel_frame_store_update(fs_ctx, frame_store, num_elements, poc,
+                                 refs, num_refs))
         WARN_ONCE("No free slot found for DPB reference list!!!\n");
-    }
-
-    free(free_refs);
 }
 
 void
@@ -1307,6 +1247,360 @@ intel_mpeg2_find_next_slice(struct decode_state *decode_state,
     return NULL;
 }
 
+#define GEN_DEFERRED_DECODE_MIN_SPACE   0x4000
+
+void
+intel_decoder_deferred_init(VADriverContextP ctx,
+                            GenDeferredDecode *deferred,
+                            struct hw_context *hw_context)
+{
+    const char *env_str;
+
+    memset(deferred, 0, sizeof(*deferred));
+    deferred->hw_context = hw_context;
+    i965_bsd_stream_init(&deferred->bsd_stream, -1);
+
+    if ((env_str = getenv("VA_INTEL_DECODE_BATCH")) && atoi(env_str) > 1)
+        deferred->max_pictures = MIN(atoi(env_str), MAX_GEN_DEFERRED_PICTURES);
+}
+
+/* Called with i965->bsd_mutex held */
+static void
+intel_decoder_bsd_retire(struct i965_driver_data *i965,
+                         struct i965_bsd_queue *queue)
+{
+    struct i965_bsd_submission * const s = &queue->submissions[queue->first];
+
+    i965_bsd_scheduler_retire(&i965->bsd_scheduler, s->stream, s->ring, s->load);
+    dri_bo_unreference(s->bo);
+
+    queue->first = (queue->first + 1) % I965_MAX_BSD_SUBMISSIONS;
+    queue->count--;
+}
+
+/*
+ * Called with i965->bsd_mutex held. The batches of a ring complete in
+ * submission order, so only the oldest one of each ring is checked
+ */
+static void
+intel_decoder_bsd_update(struct i965_driver_data *i965)
+{
+    int i;
+
+    for (i = 0; i < i965->bsd_scheduler.num_rings; i++) {
+        struct i965_bsd_queue * const queue = &i965->bsd_queues[i];
+
+        while (queue->count > 0 &&
+               !drm_intel_bo_busy(queue->submissions[queue->first].bo))
+            intel_decoder_bsd_retire(i965, queue);
+    }
+}
+
+/* Submits the batch and accounts for it on its BSD ring */
+static void
+intel_decoder_flush_batch(struct i965_driver_data *i965,
+                          GenDeferredDecode *deferred)
+{
+    struct intel_batchbuffer * const batch = deferred->hw_context->batch;
+    struct i965_bsd_queue * const queue = &i965->bsd_queues[deferred->bsd_ring];
+    struct i965_bsd_submission *s;
+    dri_bo * const bo = batch->buffer;
+
+    if (intel_batchbuffer_used_size(batch) == 0)
+        return;
+
+    dri_bo_reference(bo);
+    intel_batchbuffer_flush(batch);
+    deferred->num_submissions++;
+
+    _i965LockMutex(&i965->bsd_mutex);
+
+    /* The ring is that far behind, wait for its oldest batch */
+    while (queue->count == I965_MAX_BSD_SUBMISSIONS) {
+        dri_bo * const oldest = queue->submissions[queue->first].bo;
+
+        dri_bo_reference(oldest);
+        _i965UnlockMutex(&i965->bsd_mutex);
+        drm_intel_bo_wait_rendering(oldest);
+        dri_bo_unreference(oldest);
+        _i965LockMutex(&i965->bsd_mutex);
+        intel_decoder_bsd_update(i965);
+    }
+
+    s = &queue->submissions[(queue->first + queue->count++) % I965_MAX_BSD_SUBMISSIONS];
+    s->bo = bo;
+    s->stream = &deferred->bsd_stream;
+    s->ring = deferred->bsd_ring;
+    s->load = deferred->batch_load;
+    i965_bsd_scheduler_submit(&i965->bsd_scheduler, s->stream, s->ring, s->load);
+
+    _i965UnlockMutex(&i965->bsd_mutex);
+
+    deferred->batch_load = 0;
+}
+
+/* Called with i965->deferred_decode_mutex held */
+static void
+intel_decoder_deferred_submit(struct i965_driver_data *i965,
+                              GenDeferredDecode *deferred)
+{
+    GenDeferredDecode **p;
+
+    if (deferred->num_pending == 0)
+        return;
+
+    intel_decoder_flush_batch(i965, deferred);
+    deferred->num_pending = 0;
+
+    for (p = &i965->deferred_decode_list; *p; p = &(*p)->next) {
+        if (*p == deferred) {
+            *p = deferred->next;
+            break;
+        }
+    }
+
+    deferred->next = NULL;
+}
+
+void
+intel_decoder_deferred_terminate(VADriverContextP ctx,
+                                 GenDeferredDecode *deferred)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    int i, j;
+
+    if (deferred->max_pictures) {
+        _i965LockMutex(&i965->deferred_decode_mutex);
+        intel_decoder_deferred_submit(i965, deferred);
+        _i965UnlockMutex(&i965->deferred_decode_mutex);
+
+        if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+            deferred->num_pictures)
+            fprintf(stderr, "decode deferred submission: %u pictures, "
+                    "%u submissions, %.2f submissions per frame\n",
+                    deferred->num_pictures,
+                    deferred->num_submissions,
+                    (float)deferred->num_submissions / deferred->num_pictures);
+    }
+
+    /* The outstanding batches still count as load of their ring */
+    _i965LockMutex(&i965->bsd_mutex);
+    for (i = 0; i < i965->bsd_scheduler.num_rings; i++) {
+        struct i965_bsd_queue * const queue = &i965->bsd_queues[i];
+
+        for (j = 0; j < queue->count; j++) {
+            struct i965_bsd_submission * const s =
+                &queue->submissions[(queue->first + j) % I965_MAX_BSD_SUBMISSIONS];
+
+            if (s->stream == &deferred->bsd_stream)
+                s->stream = NULL;
+        }
+    }
+    _i965UnlockMutex(&i965->bsd_mutex);
+}
+
+/*
+ * In deferred mode, the picture is built into a batch that other threads
+ * may have to submit on synchronization. They wait for the picture to be
+ * complete, see i965_decoder_flush_deferred()
+ */
+void
+intel_decoder_begin_picture(VADriverContextP ctx,
+                            GenDeferredDecode *deferred,
+                            struct decode_state *decode_state)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer * const batch = deferred->hw_context->batch;
+    struct object_surface * const obj_surface = decode_state->render_object;
+
+    if (deferred->max_pictures) {
+        _i965LockMutex(&i965->deferred_decode_mutex);
+        deferred->building = 1;
+        _i965UnlockMutex(&i965->deferred_decode_mutex);
+    }
+
+    deferred->batch_used = intel_batchbuffer_used_size(batch);
+    deferred->picture_load = obj_surface ?
+        (ALIGN(obj_surface->orig_width, 16) / 16) *
+        (ALIGN(obj_surface->orig_height, 16) / 16) : 0;
+
+    /* Pictures batched together go to the same ring */
+    if (deferred->batch_used == 0) {
+        _i965LockMutex(&i965->bsd_mutex);
+        intel_decoder_bsd_update(i965);
+        deferred->bsd_ring = i965_bsd_scheduler_select(&i965->bsd_scheduler,
+                                                       &deferred->bsd_stream);
+        _i965UnlockMutex(&i965->bsd_mutex);
+    }
+}
+
+void
+intel_decoder_start_atomic_bcs(VADriverContextP ctx,
+                               GenDeferredDecode *deferred,
+                               unsigned int size)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    bsd_ring_flag ring_flag = BSD_DEFAULT;
+
+    if (i965->bsd_scheduler.num_rings > 1)
+        ring_flag = deferred->bsd_ring ? BSD_RING1 : BSD_RING0;
+
+    intel_batchbuffer_start_atomic_bcs_override(deferred->hw_context->batch,
+                                                size, ring_flag);
+}
+
+void
+intel_decoder_end_picture(VADriverContextP ctx,
+                          GenDeferredDecode *deferred)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer * const batch = deferred->hw_context->batch;
+    int emitted = intel_batchbuffer_used_size(batch) != deferred->batch_used;
+
+    if (emitted) {
+        deferred->num_pictures++;
+        deferred->batch_load += deferred->picture_load;
+    }
+
+    if (!deferred->max_pictures) {
+        if (emitted)
+            intel_decoder_flush_batch(i965, deferred);
+        return;
+    }
+
+    _i965LockMutex(&i965->deferred_decode_mutex);
+
+    /* Nothing was emitted, e.g. on invalid parameters */
+    if (emitted) {
+        if (deferred->num_pending++ == 0) {
+            deferred->next = i965->deferred_decode_list;
+            i965->deferred_decode_list = deferred;
+        }
+
+        if (deferred->num_pending >= deferred->max_pictures ||
+            !intel_batchbuffer_check_free_space(batch, GEN_DEFERRED_DECODE_MIN_SPACE))
+            intel_decoder_deferred_submit(i965, deferred);
+    }
+
+    deferred->building = 0;
+    _i965BroadcastCond(&i965->deferred_decode_cond);
+    _i965UnlockMutex(&i965->deferred_decode_mutex);
+}
+
+void
+i965_decoder_bsd_init(VADriverContextP ctx)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+
+    _i965InitMutex(&i965->bsd_mutex);
+    i965_bsd_scheduler_init(&i965->bsd_scheduler, i965->intel.has_bsd2 ? 2 : 1);
+    memset(i965->bsd_queues, 0, sizeof(i965->bsd_queues));
+}
+
+void
+i965_decoder_bsd_terminate(VADriverContextP ctx)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct i965_bsd_ring counters;
+    int i;
+
+    for (i = 0; i < i965->bsd_scheduler.num_rings; i++) {
+        while (i965->bsd_queues[i].count > 0)
+            intel_decoder_bsd_retire(i965, &i965->bsd_queues[i]);
+    }
+
+    if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+        i965->bsd_scheduler.num_rings > 1) {
+        for (i = 0; i965_bsd_scheduler_query(&i965->bsd_scheduler, i, &counters); i++)
+            fprintf(stderr, "BSD ring %d: %u submissions, max queue depth %u\n",
+                    i, counters.num_submissions, counters.max_depth);
+    }
+
+    _i965DestroyMutex(&i965->bsd_mutex);
+}
+
+/*
+ * Submits the decoder batches referencing bo, or all of them if bo is
+ * NULL. The batch of hw_context, if any, is left alone: this is the
+ * context about to decode into bo and its own pictures execute in order.
+ * A batch receiving a picture on another thread can't even be looked at,
+ * so this waits for the picture to be complete
+ */
+void
+i965_decoder_flush_deferred(VADriverContextP ctx, dri_bo *bo,
+                            struct hw_context *hw_context)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    GenDeferredDecode *deferred, *next_deferred;
+
+    _i965LockMutex(&i965->deferred_decode_mutex);
+
+restart:
+    for (deferred = i965->deferred_decode_list;
+         deferred;
+         deferred = next_deferred) {
+        next_deferred = deferred->next;
+
+        if (deferred->hw_context == hw_context)
+            continue;
+
+        if (deferred->building) {
+            _i965WaitCond(&i965->deferred_decode_cond,
+                          &i965->deferred_decode_mutex);
+            goto restart;
+        }
+
+        if (!bo || drm_intel_bo_references(deferred->hw_context->batch->buffer, bo))
+            intel_decoder_deferred_submit(i965, deferred);
+    }
+
+    _i965UnlockMutex(&i965->deferred_decode_mutex);
+}
+
+/*
+ * Returns NULL if the template was encoded for the same key, else where to
+ * write its commands, to be followed by intel_command_template_end()
+ */
+unsigned int *
+intel_command_template_begin(GenCommandTemplate *tmpl,
+                             const void *key, int key_size)
+{
+    assert(key_size <= sizeof(tmpl->key));
+
+    if (tmpl->valid &&
+        tmpl->key_size == key_size &&
+        memcmp(tmpl->key, key, key_size) == 0)
+        return NULL;
+
+    memcpy(tmpl->key, key, key_size);
+    tmpl->key_size = key_size;
+    tmpl->valid = 0;
+
+    return tmpl->dwords;
+}
+
+void
+intel_command_template_end(GenCommandTemplate *tmpl, unsigned int *end)
+{
+    tmpl->num_dwords = end - tmpl->dwords;
+    assert(tmpl->num_dwords <= MAX_GEN_COMMAND_TEMPLATE_DWORDS);
+    tmpl->valid = 1;
+}
+
+void
+intel_command_template_emit(struct intel_batchbuffer *batch,
+                            GenCommandTemplate *tmpl)
+{
+    unsigned int *command_ptr;
+
+    assert(tmpl->valid);
+
+    BEGIN_BCS_BATCH(batch, tmpl->num_dwords);
+    command_ptr = intel_batchbuffer_dwords(batch);
+    memcpy(command_ptr, tmpl->dwords, tmpl->num_dwords * 4);
+    intel_batchbuffer_advance_dwords(batch, command_ptr + tmpl->num_dwords);
+}
+
 /* Ensure the segmentation buffer is large enough for the supplied
    number of MBs, or re-allocate it */
 bool
@@ -159,6 +159,40 @@ intel_update_vp8_frame_store_index(VADriverContextP ctx,
                                    VAPictureParameterBufferVP8 *pic_param,
                                    GenFrameStore frame_store[MAX_GEN_REFERENCE_FRAMES]);
 
+void
+intel_decoder_deferred_init(VADriverContextP ctx,
+                            GenDeferredDecode *deferred,
+                            struct hw_context *hw_context);
+
+void
+intel_decoder_deferred_terminate(VADriverContextP ctx,
+                                 GenDeferredDecode *deferred);
+
+void
+intel_decoder_begin_picture(VADriverContextP ctx,
+                            GenDeferredDecode *deferred,
+                            struct decode_state *decode_state);
+
+void
+intel_decoder_start_atomic_bcs(VADriverContextP ctx,
+                               GenDeferredDecode *deferred,
+                               unsigned int size);
+
+void
+intel_decoder_end_picture(VADriverContextP ctx,
+                          GenDeferredDecode *deferred);
+
+unsigned int *
+intel_command_template_begin(GenCommandTemplate *tmpl,
+                             const void *key, int key_size);
+
+void
+intel_command_template_end(GenCommandTemplate *tmpl, unsigned int *end);
+
+void
+intel_command_template_emit(struct intel_batchbuffer *batch,
+                            GenCommandTemplate *tmpl);
+
 bool
 intel_ensure_vp8_segmentation_buffer(VADriverContextP ctx, GenBuffer *buf,
     unsigned int mb_width, unsigned int mb_height);
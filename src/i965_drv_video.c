@@ -47,6 +47,7 @@
 #include "i965_drv_video.h"
 #include "i965_decoder.h"
 #include "i965_encoder.h"
+#include "i965_record.h"
 
 #define CONFIG_ID_OFFSET                0x01000000
 #define CONTEXT_ID_OFFSET               0x02000000
@@ -376,6 +377,15 @@ is_surface_busy(struct i965_driver_data *i965,
     return false;
 }
 
+/* Submits the deferred VPP, decoder and encoder work involving bo (all if NULL) */
+static void
+i965_flush_deferred(VADriverContextP ctx, dri_bo *bo)
+{
+    i965_proc_flush_deferred(ctx, bo);
+    i965_decoder_flush_deferred(ctx, bo, NULL);
+    i965_encoder_flush_deferred(ctx, bo);
+}
+
 /* Checks whether the image is in busy state */
 static bool
 is_image_busy(struct i965_driver_data *i965, struct object_image *obj_image, VASurfaceID surface)
@@ -1583,6 +1593,9 @@ i965_DestroySurfaces(VADriverContextP ctx,
            obj_surface->exported_primefd = -1;
         }
 
+        if (obj_surface->bo)
+            i965_flush_deferred(ctx, obj_surface->bo);
+
         i965_destroy_surface(&i965->surface_heap, (struct object_base *)obj_surface);
     }
 
@@ -1904,10 +1917,8 @@ i965_release_buffer_store(struct buffer_store **ptr)
     
     if (buffer_store->ref_count == 0) {
         dri_bo_unreference(buffer_store->bo);
-        free(buffer_store->buffer);
         buffer_store->bo = NULL;
-        buffer_store->buffer = NULL;
-        free(buffer_store);
+        i965_recycle_buffer_store(buffer_store);
     }
 
     *ptr = NULL;
@@ -1927,6 +1938,9 @@ i965_destroy_context(struct object_heap *heap, struct object_base *obj)
     if (obj_context->codec_type == CODEC_PROC) {
         i965_release_buffer_store(&obj_context->codec_state.proc.pipeline_param);
 
+        for (i = 0; i < ARRAY_ELEMS(obj_context->codec_state.proc.layer_params); i++)
+            i965_release_buffer_store(&obj_context->codec_state.proc.layer_params[i]);
+
     } else if (obj_context->codec_type == CODEC_ENC) {
         assert(obj_context->codec_state.encode.num_slice_params <= obj_context->codec_state.encode.max_slice_params);
         i965_release_buffer_store(&obj_context->codec_state.encode.pic_param);
@@ -2221,6 +2235,7 @@ i965_create_buffer_internal(VADriverContextP ctx,
     VAStatus vaStatus = VA_STATUS_ERROR_UNKNOWN;
     struct object_context *obj_context = CONTEXT(context);
     int wrapper_flag = 0;
+    unsigned int msize;
 
     /* Validate type */
     switch (type) {
@@ -2273,13 +2288,30 @@ i965_create_buffer_internal(VADriverContextP ctx,
     obj_buffer->buffer_store = NULL;
     obj_buffer->wrapper_buffer = VA_INVALID_ID;
 
-    buffer_store = calloc(1, sizeof(struct buffer_store));
-    assert(buffer_store);
-    buffer_store->ref_count = 1;
-
     if (obj_context &&
         (obj_context->wrapper_context != VA_INVALID_ID) &&
-        i965->wrapper_pdrvctx) {
+        i965->wrapper_pdrvctx)
+        wrapper_flag = 1;
+
+    if (store_bo != NULL ||
+        type == VASliceDataBufferType || 
+        type == VAImageBufferType || 
+        type == VAEncCodedBufferType ||
+        type == VAProbabilityBufferType) {
+        msize = 0;
+    } else if (wrapper_flag) {
+        /* If the buffer is wrapped, it is enough to allocate 4 bytes */
+        msize = 4;
+    } else if (type == VAEncPackedHeaderDataBufferType) {
+        msize = MAX(ALIGN(size, 4) * num_elements, 1);
+    } else {
+        msize = MAX(size * num_elements, 1);
+    }
+
+    buffer_store = i965_alloc_buffer_store(&i965->buffer_store_cache, msize);
+    assert(buffer_store);
+
+    if (wrapper_flag) {
         VAGenericID wrapper_buffer;
         VADriverContextP pdrvctx = i965->wrapper_pdrvctx;
 
@@ -2289,10 +2321,9 @@ i965_create_buffer_internal(VADriverContextP ctx,
         if (vaStatus == VA_STATUS_SUCCESS) {
             obj_buffer->wrapper_buffer = wrapper_buffer;
         } else {
-            free(buffer_store);
+            i965_free_buffer_store(buffer_store);
             return vaStatus;
         }
-        wrapper_flag = 1;
     }
 
     if (store_bo != NULL) {
@@ -2343,17 +2374,6 @@ i965_create_buffer_internal(VADriverContextP ctx,
        }
 
     } else {
-        int msize = size;
-        
-        if (type == VAEncPackedHeaderDataBufferType) {
-            msize = ALIGN(size, 4);
-        }
-
-        /* If the buffer is wrapped, it is enough to allocate 4 bytes */
-        if (wrapper_flag)
-            buffer_store->buffer = malloc(4);
-        else
-            buffer_store->buffer = malloc(msize * num_elements);
         assert(buffer_store->buffer);
 
         if (data && (!wrapper_flag))
@@ -2450,6 +2470,7 @@ i965_MapBuffer(VADriverContextP ctx,
     if (NULL != obj_buffer->buffer_store->bo) {
         unsigned int tiling, swizzle;
 
+        i965_flush_deferred(ctx, obj_buffer->buffer_store->bo);
         dri_bo_get_tiling(obj_buffer->buffer_store->bo, &tiling, &swizzle);
 
         if (tiling != I915_TILING_NONE)
@@ -2596,6 +2617,10 @@ i965_DestroyBuffer(VADriverContextP ctx, VABufferID buffer_id)
 
     ASSERT_RET(obj_buffer, VA_STATUS_ERROR_INVALID_BUFFER);
 
+    /* A deferred PAK stage may still write to the coded buffer */
+    if (obj_buffer->buffer_store && obj_buffer->buffer_store->bo)
+        i965_encoder_flush_deferred(ctx, obj_buffer->buffer_store->bo);
+
     if ((obj_buffer->wrapper_buffer != VA_INVALID_ID) &&
         i965->wrapper_pdrvctx) {
         CALL_VTABLE(i965->wrapper_pdrvctx, va_status,
@@ -2629,7 +2654,15 @@ i965_BeginPicture(VADriverContextP ctx,
     if (is_surface_busy(i965, obj_surface))
         return VA_STATUS_ERROR_SURFACE_BUSY;
 
+    /* Pending pictures of other decoders may still use the surface */
+    if (obj_surface->bo)
+        i965_decoder_flush_deferred(ctx, obj_surface->bo, obj_context->hw_context);
+
     if (obj_context->codec_type == CODEC_PROC) {
+        for (i = 0; i < ARRAY_ELEMS(obj_context->codec_state.proc.layer_params); i++)
+            i965_release_buffer_store(&obj_context->codec_state.proc.layer_params[i]);
+
+        obj_context->codec_state.proc.num_pipeline_params = 0;
         obj_context->codec_state.proc.current_render_target = render_target;
     } else if (obj_context->codec_type == CODEC_ENC) {
         i965_release_buffer_store(&obj_context->codec_state.encode.pic_param);
@@ -3217,8 +3250,28 @@ i965_encoder_render_picture(VADriverContextP ctx,
 
 #define I965_RENDER_PROC_BUFFER(name) I965_RENDER_BUFFER(proc, name)
 
-#define DEF_RENDER_PROC_SINGLE_BUFFER_FUNC(name, member) DEF_RENDER_SINGLE_BUFFER_FUNC(proc, name, member)
-DEF_RENDER_PROC_SINGLE_BUFFER_FUNC(pipeline_parameter, pipeline_param)    
+/* Several pipeline parameters in one picture are composited in order */
+static VAStatus
+i965_render_proc_pipeline_parameter_buffer(VADriverContextP ctx,
+                                           struct object_context *obj_context,
+                                           struct object_buffer *obj_buffer)
+{
+    struct proc_state *proc = &obj_context->codec_state.proc;
+    struct buffer_store **buffer_store;
+
+    if (proc->num_pipeline_params == 0)
+        buffer_store = &proc->pipeline_param;
+    else if (proc->num_pipeline_params < I965_MAX_PROC_LAYERS)
+        buffer_store = &proc->layer_params[proc->num_pipeline_params - 1];
+    else
+        return VA_STATUS_ERROR_MAX_NUM_EXCEEDED;
+
+    i965_release_buffer_store(buffer_store);
+    i965_reference_buffer_store(buffer_store, obj_buffer->buffer_store);
+    proc->num_pipeline_params++;
+
+    return VA_STATUS_SUCCESS;
+}
 
 static VAStatus 
 i965_proc_render_picture(VADriverContextP ctx,
@@ -3285,17 +3338,61 @@ i965_RenderPicture(VADriverContextP ctx,
     return vaStatus;
 }
 
+/* Submits the deferred decoder batches writing to surface */
+static void
+i965_flush_deferred_decode_surface(VADriverContextP ctx, VASurfaceID surface)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct object_surface *obj_surface = SURFACE(surface);
+
+    if (obj_surface && obj_surface->bo)
+        i965_decoder_flush_deferred(ctx, obj_surface->bo, NULL);
+}
+
+/* The same for all the input surfaces of the pipeline parameters */
+static void
+i965_flush_deferred_decode_proc(VADriverContextP ctx, struct proc_state *proc_state)
+{
+    VAProcPipelineParameterBuffer *pipeline_param;
+    int i, j;
+
+    for (i = 0; i < proc_state->num_pipeline_params; i++) {
+        struct buffer_store *buffer_store = i == 0 ?
+            proc_state->pipeline_param : proc_state->layer_params[i - 1];
+
+        if (!buffer_store || !buffer_store->buffer)
+            continue;
+
+        pipeline_param = (VAProcPipelineParameterBuffer *)buffer_store->buffer;
+        i965_flush_deferred_decode_surface(ctx, pipeline_param->surface);
+
+        for (j = 0; j < pipeline_param->num_forward_references; j++)
+            i965_flush_deferred_decode_surface(ctx, pipeline_param->forward_references[j]);
+
+        for (j = 0; j < pipeline_param->num_backward_references; j++)
+            i965_flush_deferred_decode_surface(ctx, pipeline_param->backward_references[j]);
+    }
+}
+
 VAStatus 
 i965_EndPicture(VADriverContextP ctx, VAContextID context)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx); 
     struct object_context *obj_context = CONTEXT(context);
     struct object_config *obj_config;
+    VAStatus vaStatus;
 
     ASSERT_RET(obj_context, VA_STATUS_ERROR_INVALID_CONTEXT);
     obj_config = obj_context->obj_config;
     ASSERT_RET(obj_config, VA_STATUS_ERROR_INVALID_CONFIG);
 
+    /* VPP and encoders read surfaces decoded on another batch, only the
+     * batches of those surfaces are submitted */
+    if (obj_context->codec_type == CODEC_PROC)
+        i965_flush_deferred_decode_proc(ctx, &obj_context->codec_state.proc);
+    else if (obj_context->codec_type == CODEC_ENC)
+        i965_flush_deferred_decode_surface(ctx, obj_context->codec_state.encode.current_render_target);
+
     if (obj_context->codec_type == CODEC_PROC) {
         ASSERT_RET(VAEntrypointVideoProc == obj_config->entrypoint, VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT);
     } else if (obj_context->codec_type == CODEC_ENC) {
@@ -3355,10 +3452,25 @@ i965_EndPicture(VADriverContextP ctx, VAContextID context)
 
             return va_status;
         }
+
+        __atomic_fetch_add(&i965->num_decoded_pictures, 1, __ATOMIC_RELAXED);
     }
 
     ASSERT_RET(obj_context->hw_context->run, VA_STATUS_ERROR_OPERATION_FAILED);
-    return obj_context->hw_context->run(ctx, obj_config->profile, &obj_context->codec_state, obj_context->hw_context);
+
+    if (i965_trace_enabled) {
+        static const char *run_names[] = { "decode", "encode", "vpp" };
+
+        i965_trace_event(run_names[obj_context->codec_type], 'B', -1);
+        vaStatus = obj_context->hw_context->run(ctx, obj_config->profile, &obj_context->codec_state, obj_context->hw_context);
+        i965_trace_event(run_names[obj_context->codec_type], 'E', -1);
+    } else
+        vaStatus = obj_context->hw_context->run(ctx, obj_config->profile, &obj_context->codec_state, obj_context->hw_context);
+
+    if (intel_batch_capture_enabled)
+        intel_batchbuffer_capture_frame();
+
+    return vaStatus;
 }
 
 VAStatus 
@@ -3370,8 +3482,13 @@ i965_SyncSurface(VADriverContextP ctx,
 
     ASSERT_RET(obj_surface, VA_STATUS_ERROR_INVALID_SURFACE);
 
-    if(obj_surface->bo)
+    if(obj_surface->bo) {
+        i965_flush_deferred(ctx, obj_surface->bo);
+
+        I965_TRACE_BEGIN("wait rendering");
         drm_intel_bo_wait_rendering(obj_surface->bo);
+        I965_TRACE_END("wait rendering");
+    }
 
     return VA_STATUS_SUCCESS;
 }
@@ -3387,6 +3504,8 @@ i965_QuerySurfaceStatus(VADriverContextP ctx,
     ASSERT_RET(obj_surface, VA_STATUS_ERROR_INVALID_SURFACE);
 
     if (obj_surface->bo) {
+        i965_flush_deferred(ctx, obj_surface->bo);
+
         if (drm_intel_bo_busy(obj_surface->bo)){
             *status = VASurfaceRendering;
         }
@@ -4035,6 +4154,9 @@ VAStatus i965_DeriveImage(VADriverContextP ctx,
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
 
+    if (obj_surface->bo)
+        i965_flush_deferred(ctx, obj_surface->bo);
+
     if (!obj_surface->bo) {
         unsigned int is_tiled = 0;
         unsigned int fourcc = VA_FOURCC_YV12;
@@ -4541,6 +4663,8 @@ i965_GetImage(VADriverContextP ctx,
     if (is_surface_busy(i965, obj_surface))
         return VA_STATUS_ERROR_SURFACE_BUSY;
 
+    i965_flush_deferred(ctx, obj_surface->bo);
+
     if (!obj_image || !obj_image->bo)
         return VA_STATUS_ERROR_INVALID_IMAGE;
     if (is_image_busy(i965, obj_image, surface))
@@ -4857,6 +4981,9 @@ i965_PutImage(VADriverContextP ctx,
     if (is_image_busy(i965, obj_image, surface))
         return VA_STATUS_ERROR_SURFACE_BUSY;
 
+    if (obj_surface->bo)
+        i965_flush_deferred(ctx, obj_surface->bo);
+
     if (src_x < 0 ||
         src_y < 0 ||
         src_x + src_width > obj_image->image.width ||
@@ -4907,8 +5034,13 @@ i965_PutSurface(VADriverContextP ctx,
 {
 #ifdef HAVE_VA_X11
     if (IS_VA_X11(ctx)) {
+        struct i965_driver_data * const i965 = i965_driver_data(ctx);
+        struct object_surface * const obj_surface = SURFACE(surface);
         VARectangle src_rect, dst_rect;
 
+        if (obj_surface && obj_surface->bo)
+            i965_flush_deferred(ctx, obj_surface->bo);
+
         src_rect.x      = srcx;
         src_rect.y      = srcy;
         src_rect.width  = srcw;
@@ -5786,6 +5918,10 @@ i965_AcquireBufferHandle(VADriverContextP ctx, VABufferID buf_id,
         if (!mem_type)
             return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
     }
+
+    if (obj_buffer->buffer_store && obj_buffer->buffer_store->bo)
+        i965_flush_deferred(ctx, obj_buffer->buffer_store->bo);
+
     return i965_acquire_buffer_handle(obj_buffer, mem_type, buf_info);
 }
 
@@ -6022,6 +6158,7 @@ VAStatus i965_QueryVideoProcPipelineCaps(
     pipeline_cap->input_color_standards = vpp_input_color_standards;
     pipeline_cap->num_output_color_standards = 1;
     pipeline_cap->output_color_standards = vpp_output_color_standards;
+    pipeline_cap->num_additional_outputs = I965_MAX_PROC_ADDITIONAL_OUTPUTS;
 
     for (i = 0; i < num_filters; i++) {
         struct object_buffer *obj_buffer = BUFFER(filters[i]);
@@ -6095,9 +6232,18 @@ i965_driver_data_init(VADriverContextP ctx)
         goto err_subpic_heap;
 
     i965->batch = intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0);
-    i965->pp_batch = intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0);
     _i965InitMutex(&i965->render_mutex);
     _i965InitMutex(&i965->pp_mutex);
+    _i965InitMutex(&i965->deferred_proc_mutex);
+    _i965InitMutex(&i965->deferred_decode_mutex);
+    _i965InitCond(&i965->deferred_decode_cond);
+    _i965InitMutex(&i965->deferred_encode_mutex);
+    i965_decoder_bsd_init(ctx);
+    i965_buffer_store_cache_init(&i965->buffer_store_cache);
+    memset(&i965->jpeg_huffman_cache, 0, sizeof(i965->jpeg_huffman_cache));
+    _i965InitMutex(&i965->jpeg_huffman_cache.mutex);
+    i965_kernel_cache_init(&i965->kernel_cache);
+    i965->mfc_slice_pool = intel_mfc_slice_pool_new();
 
     return true;
 
@@ -6121,21 +6267,71 @@ i965_driver_data_terminate(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx); 
 
+    /* The deferred PAK stages use surfaces and coded buffers */
+    i965_encoder_flush_deferred(ctx, NULL);
+
+    if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+        i965->num_decoded_pictures)
+        fprintf(stderr, "decoder scratch buffers: %u allocations for %u pictures\n",
+                i965->num_decoder_scratch_allocs,
+                i965->num_decoded_pictures);
+
+    if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+        i965->buffer_store_cache.num_requests)
+        fprintf(stderr, "buffer stores: %u allocations for %u buffers\n",
+                i965->buffer_store_cache.num_allocs,
+                i965->buffer_store_cache.num_requests);
+
+    if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+        i965->num_overlapped_paks)
+        fprintf(stderr, "encoder: %u of %u PAK stages overlapped with the next VME stage\n",
+                i965->num_overlapped_paks,
+                i965->num_encoded_pictures);
+
+    if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+        i965->jpeg_huffman_cache.num_pictures)
+        fprintf(stderr, "JPEG Huffman tables: %u of %u derived, %.2f us setup per picture\n",
+                i965->jpeg_huffman_cache.num_misses,
+                i965->jpeg_huffman_cache.num_lookups,
+                i965->jpeg_huffman_cache.setup_time_ns / 1000.0 /
+                i965->jpeg_huffman_cache.num_pictures);
+
+    if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+        i965->num_encode_batches)
+        fprintf(stderr, "encoder: %u pictures batched into %u submissions\n",
+                i965->num_batched_encodes,
+                i965->num_encode_batches);
+
+    if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+        i965->kernel_cache.num_lookups)
+        fprintf(stderr, "kernel cache: %u uploads for %u lookups, peak %llu bytes\n",
+                i965->kernel_cache.num_uploads,
+                i965->kernel_cache.num_lookups,
+                i965->kernel_cache.max_bytes);
+
     _i965DestroyMutex(&i965->pp_mutex);
     _i965DestroyMutex(&i965->render_mutex);
 
     if (i965->batch)
         intel_batchbuffer_free(i965->batch);
 
-    if (i965->pp_batch)
-        intel_batchbuffer_free(i965->pp_batch);
-
     i965_destroy_heap(&i965->subpic_heap, i965_destroy_subpic);
     i965_destroy_heap(&i965->image_heap, i965_destroy_image);
     i965_destroy_heap(&i965->buffer_heap, i965_destroy_buffer);
     i965_destroy_heap(&i965->surface_heap, i965_destroy_surface);
     i965_destroy_heap(&i965->context_heap, i965_destroy_context);
     i965_destroy_heap(&i965->config_heap, i965_destroy_config);
+
+    /* The contexts submit their deferred work when destroyed */
+    i965_decoder_bsd_terminate(ctx);
+    _i965DestroyMutex(&i965->deferred_encode_mutex);
+    _i965DestroyCond(&i965->deferred_decode_cond);
+    _i965DestroyMutex(&i965->deferred_decode_mutex);
+    _i965DestroyMutex(&i965->deferred_proc_mutex);
+    i965_buffer_store_cache_terminate(&i965->buffer_store_cache);
+    _i965DestroyMutex(&i965->jpeg_huffman_cache.mutex);
+    i965_kernel_cache_terminate(&i965->kernel_cache);
+    intel_mfc_slice_pool_destroy(i965->mfc_slice_pool);
 }
 
 struct {
@@ -6416,6 +6612,11 @@ i965_Terminate(VADriverContextP ctx)
             i965->wrapper_pdrvctx = NULL;
         }
 
+        i965_record_terminate(ctx);
+        i965_stats_terminate();
+        i965_trace_terminate();
+        intel_batchbuffer_capture_terminate();
+
         for (i = ARRAY_ELEMS(i965_sub_ops); i > 0; i--)
             if (i965_sub_ops[i - 1].display_type == 0 ||
                 i965_sub_ops[i - 1].display_type == (ctx->display_type & VA_DISPLAY_MAJOR_MASK)) {
@@ -6429,6 +6630,114 @@ i965_Terminate(VADriverContextP ctx)
     return VA_STATUS_SUCCESS;
 }
 
+/*
+ * Timed and traced entrypoints, installed in the vtable when VA_INTEL_STATS
+ * or VA_INTEL_TRACE is set
+ */
+#define I965_STATS_WRAPPER(func, call, params, args)    \
+    static VAStatus                                     \
+    func##_stats params                                 \
+    {                                                   \
+        uint64_t start = i965_stats_begin();            \
+        VAStatus status;                                \
+                                                        \
+        I965_TRACE_BEGIN(#func);                        \
+        status = func args;                             \
+        I965_TRACE_END(#func);                          \
+        i965_stats_end(call, start);                    \
+                                                        \
+        return status;                                  \
+    }
+
+I965_STATS_WRAPPER(i965_CreateSurfaces, I965_STATS_CREATE_SURFACES,
+                   (VADriverContextP ctx, int width, int height, int format, int num_surfaces, VASurfaceID *surfaces),
+                   (ctx, width, height, format, num_surfaces, surfaces))
+I965_STATS_WRAPPER(i965_CreateSurfaces2, I965_STATS_CREATE_SURFACES,
+                   (VADriverContextP ctx, unsigned int format, unsigned int width, unsigned int height,
+                    VASurfaceID *surfaces, unsigned int num_surfaces, VASurfaceAttrib *attrib_list, unsigned int num_attribs),
+                   (ctx, format, width, height, surfaces, num_surfaces, attrib_list, num_attribs))
+I965_STATS_WRAPPER(i965_DestroySurfaces, I965_STATS_DESTROY_SURFACES,
+                   (VADriverContextP ctx, VASurfaceID *surface_list, int num_surfaces),
+                   (ctx, surface_list, num_surfaces))
+I965_STATS_WRAPPER(i965_CreateContext, I965_STATS_CREATE_CONTEXT,
+                   (VADriverContextP ctx, VAConfigID config_id, int picture_width, int picture_height, int flag,
+                    VASurfaceID *render_targets, int num_render_targets, VAContextID *context),
+                   (ctx, config_id, picture_width, picture_height, flag, render_targets, num_render_targets, context))
+I965_STATS_WRAPPER(i965_DestroyContext, I965_STATS_DESTROY_CONTEXT,
+                   (VADriverContextP ctx, VAContextID context),
+                   (ctx, context))
+I965_STATS_WRAPPER(i965_CreateBuffer, I965_STATS_CREATE_BUFFER,
+                   (VADriverContextP ctx, VAContextID context, VABufferType type, unsigned int size,
+                    unsigned int num_elements, void *data, VABufferID *buf_id),
+                   (ctx, context, type, size, num_elements, data, buf_id))
+I965_STATS_WRAPPER(i965_DestroyBuffer, I965_STATS_DESTROY_BUFFER,
+                   (VADriverContextP ctx, VABufferID buffer_id),
+                   (ctx, buffer_id))
+I965_STATS_WRAPPER(i965_MapBuffer, I965_STATS_MAP_BUFFER,
+                   (VADriverContextP ctx, VABufferID buf_id, void **pbuf),
+                   (ctx, buf_id, pbuf))
+I965_STATS_WRAPPER(i965_UnmapBuffer, I965_STATS_UNMAP_BUFFER,
+                   (VADriverContextP ctx, VABufferID buf_id),
+                   (ctx, buf_id))
+I965_STATS_WRAPPER(i965_BeginPicture, I965_STATS_BEGIN_PICTURE,
+                   (VADriverContextP ctx, VAContextID context, VASurfaceID render_target),
+                   (ctx, context, render_target))
+I965_STATS_WRAPPER(i965_RenderPicture, I965_STATS_RENDER_PICTURE,
+                   (VADriverContextP ctx, VAContextID context, VABufferID *buffers, int num_buffers),
+                   (ctx, context, buffers, num_buffers))
+I965_STATS_WRAPPER(i965_EndPicture, I965_STATS_END_PICTURE,
+                   (VADriverContextP ctx, VAContextID context),
+                   (ctx, context))
+I965_STATS_WRAPPER(i965_SyncSurface, I965_STATS_SYNC_SURFACE,
+                   (VADriverContextP ctx, VASurfaceID render_target),
+                   (ctx, render_target))
+I965_STATS_WRAPPER(i965_QuerySurfaceStatus, I965_STATS_QUERY_SURFACE_STATUS,
+                   (VADriverContextP ctx, VASurfaceID render_target, VASurfaceStatus *status),
+                   (ctx, render_target, status))
+I965_STATS_WRAPPER(i965_PutSurface, I965_STATS_PUT_SURFACE,
+                   (VADriverContextP ctx, VASurfaceID surface, void *draw,
+                    short srcx, short srcy, unsigned short srcw, unsigned short srch,
+                    short destx, short desty, unsigned short destw, unsigned short desth,
+                    VARectangle *cliprects, unsigned int number_cliprects, unsigned int flags),
+                   (ctx, surface, draw, srcx, srcy, srcw, srch, destx, desty, destw, desth,
+                    cliprects, number_cliprects, flags))
+I965_STATS_WRAPPER(i965_DeriveImage, I965_STATS_DERIVE_IMAGE,
+                   (VADriverContextP ctx, VASurfaceID surface, VAImage *out_image),
+                   (ctx, surface, out_image))
+I965_STATS_WRAPPER(i965_GetImage, I965_STATS_GET_IMAGE,
+                   (VADriverContextP ctx, VASurfaceID surface, int x, int y,
+                    unsigned int width, unsigned int height, VAImageID image),
+                   (ctx, surface, x, y, width, height, image))
+I965_STATS_WRAPPER(i965_PutImage, I965_STATS_PUT_IMAGE,
+                   (VADriverContextP ctx, VASurfaceID surface, VAImageID image,
+                    int src_x, int src_y, unsigned int src_width, unsigned int src_height,
+                    int dest_x, int dest_y, unsigned int dest_width, unsigned int dest_height),
+                   (ctx, surface, image, src_x, src_y, src_width, src_height,
+                    dest_x, dest_y, dest_width, dest_height))
+
+static void
+i965_stats_install(struct VADriverVTable *vtable)
+{
+    vtable->vaCreateSurfaces = i965_CreateSurfaces_stats;
+    vtable->vaCreateSurfaces2 = i965_CreateSurfaces2_stats;
+    vtable->vaDestroySurfaces = i965_DestroySurfaces_stats;
+    vtable->vaCreateContext = i965_CreateContext_stats;
+    vtable->vaDestroyContext = i965_DestroyContext_stats;
+    vtable->vaCreateBuffer = i965_CreateBuffer_stats;
+    vtable->vaDestroyBuffer = i965_DestroyBuffer_stats;
+    vtable->vaMapBuffer = i965_MapBuffer_stats;
+    vtable->vaUnmapBuffer = i965_UnmapBuffer_stats;
+    vtable->vaBeginPicture = i965_BeginPicture_stats;
+    vtable->vaRenderPicture = i965_RenderPicture_stats;
+    vtable->vaEndPicture = i965_EndPicture_stats;
+    vtable->vaSyncSurface = i965_SyncSurface_stats;
+    vtable->vaQuerySurfaceStatus = i965_QuerySurfaceStatus_stats;
+    vtable->vaPutSurface = i965_PutSurface_stats;
+    vtable->vaDeriveImage = i965_DeriveImage_stats;
+    vtable->vaGetImage = i965_GetImage_stats;
+    vtable->vaPutImage = i965_PutImage_stats;
+}
+
 VAStatus DLL_EXPORT
 VA_DRIVER_INIT_FUNC(VADriverContextP ctx);
 
@@ -6519,6 +6828,13 @@ VA_DRIVER_INIT_FUNC(  VADriverContextP ctx )
 
     if (ret == VA_STATUS_SUCCESS) {
         ctx->str_vendor = i965->va_vendor;
+
+        /* both, so that each can count its displays */
+        if (i965_stats_init() | i965_trace_init())
+            i965_stats_install(vtable);
+
+        i965_record_init(ctx);
+        intel_batchbuffer_capture_init();
     } else {
         free(i965);
         ctx->pDriverData = NULL;
@@ -41,9 +41,11 @@
 #include <va/va_backend_vpp.h>
 
 #include "i965_mutext.h"
+#include "i965_buffer_store.h"
 #include "object_heap.h"
 #include "intel_driver.h"
 #include "i965_fourcc.h"
+#include "i965_bsd_scheduler.h"
 
 #define I965_MAX_PROFILES                       20
 #define I965_MAX_ENTRYPOINTS                    5
@@ -52,6 +54,8 @@
 #define I965_MAX_SUBPIC_FORMATS                 6
 #define I965_MAX_SUBPIC_SUM                     4
 #define I965_MAX_SURFACE_ATTRIBUTES             16
+#define I965_MAX_PROC_ADDITIONAL_OUTPUTS        8
+#define I965_MAX_PROC_LAYERS                    16
 
 #define INTEL_STR_DRIVER_VENDOR                 "Intel"
 #define INTEL_STR_DRIVER_NAME                   "i965"
@@ -90,12 +94,58 @@ struct i965_kernel
     unsigned int kernel_offset;
 };
 
-struct buffer_store
+#define I965_MAX_CACHED_JPEG_HUFFMAN_CODES      8
+
+/* MFC_JPEG_HUFF_TABLE_STATE code tables derived from one JPEG Huffman table */
+struct i965_jpeg_huffman_codes
+{
+    unsigned int hash;
+    uint8_t num_dc_codes[16];
+    uint8_t dc_values[12];
+    uint8_t num_ac_codes[16];
+    uint8_t ac_values[162];
+    uint32_t dc_table[12];
+    uint32_t ac_table[162];
+};
+
+/* Derived JPEG Huffman codes, shared by the encoder contexts */
+struct i965_jpeg_huffman_cache
 {
-    unsigned char *buffer;
+    _I965Mutex mutex;
+    struct i965_jpeg_huffman_codes entries[I965_MAX_CACHED_JPEG_HUFFMAN_CODES];
+    int num_entries;
+    int next_entry;
+    unsigned int num_lookups;
+    unsigned int num_misses;
+    unsigned int num_pictures;
+    unsigned long long setup_time_ns;
+};
+
+/* A list of kernels packed in one BO, see i965_kernel_cache_get() */
+struct i965_kernel_cache_entry
+{
+    struct i965_kernel_cache_entry *next;
     dri_bo *bo;
-    int ref_count;
-    int num_elements;
+    unsigned int size;                  /* of the packed kernels */
+    unsigned int num_users;
+    int num_kernels;
+    struct {
+        const uint32_t (*bin)[4];       /* the key, with size */
+        int size;
+        unsigned int offset;
+    } kernels[];
+};
+
+/* Kernels uploaded once and shared, read-only, by all the contexts */
+struct i965_kernel_cache
+{
+    _I965Mutex mutex;
+    struct i965_kernel_cache_entry *entries;
+    unsigned int num_entries;
+    unsigned int num_uploads;
+    unsigned int num_lookups;
+    unsigned long long num_bytes;
+    unsigned long long max_bytes;
 };
     
 struct object_config 
@@ -209,6 +259,11 @@ struct proc_state
     struct codec_state_base base;
     struct buffer_store *pipeline_param;
 
+    /* The pipeline parameters rendered after the first one in the same
+     * picture, composited over it in that order */
+    struct buffer_store *layer_params[I965_MAX_PROC_LAYERS - 1];
+    int num_pipeline_params;
+
     VASurfaceID current_render_target;
 };
 
@@ -393,6 +448,27 @@ struct hw_codec_info
 
 #include "i965_render.h"
 
+struct i965_proc_context;
+struct i965_post_processing_context;
+
+#define I965_MAX_BSD_SUBMISSIONS                128     /* per ring */
+
+struct i965_bsd_submission
+{
+    dri_bo *bo;                         /* the batch buffer */
+    struct i965_bsd_stream *stream;     /* NULL once the context is gone */
+    int ring;
+    unsigned int load;
+};
+
+/* The outstanding batches of a BSD ring, in submission order */
+struct i965_bsd_queue
+{
+    struct i965_bsd_submission submissions[I965_MAX_BSD_SUBMISSIONS];
+    int first;
+    int count;
+};
+
 struct i965_driver_data 
 {
     struct intel_driver_data intel;
@@ -404,12 +480,51 @@ struct i965_driver_data
     struct object_heap subpic_heap;
     struct hw_codec_info *codec_info;
 
+    /* vaPutSurface() rendering, serialized on the DRI drawables */
     _I965Mutex render_mutex;
-    _I965Mutex pp_mutex;
     struct intel_batchbuffer *batch;
-    struct intel_batchbuffer *pp_batch;
     struct i965_render_state render_state;
-    void *pp_context;
+
+    /* Idle post-processing contexts, each caller takes one of its own */
+    _I965Mutex pp_mutex;
+    struct i965_post_processing_context *pp_free_list;
+    unsigned int num_pp_contexts;
+
+    /* VPP contexts holding deferred submissions */
+    _I965Mutex deferred_proc_mutex;
+    struct i965_proc_context *deferred_proc_list;
+
+    /* Decoder contexts holding deferred submissions */
+    _I965Mutex deferred_decode_mutex;
+    _I965Cond deferred_decode_cond;     /* a deferred picture was built */
+    struct gen_deferred_decode *deferred_decode_list;
+
+    /* Encoder contexts holding a deferred PAK stage */
+    _I965Mutex deferred_encode_mutex;
+    struct intel_encoder_context *deferred_encode_list;
+    unsigned int num_encoded_pictures;
+    unsigned int num_overlapped_paks;
+    unsigned int num_batched_encodes;
+    unsigned int num_encode_batches;
+
+    /* Threads programming the slices of the software PAK batches */
+    struct intel_mfc_slice_pool *mfc_slice_pool;
+
+    /* Outstanding decoder batches, by BSD ring */
+    _I965Mutex bsd_mutex;
+    struct i965_bsd_scheduler bsd_scheduler;
+    struct i965_bsd_queue bsd_queues[I965_BSD_MAX_RINGS];
+
+    /*
+     * decoder scratch buffer statistics, see ALLOC_GEN_BUFFER(). The
+     * contexts decode concurrently, so they are updated atomically
+     */
+    unsigned int num_decoder_scratch_allocs;
+    unsigned int num_decoded_pictures;
+
+    struct buffer_store_cache buffer_store_cache;
+    struct i965_jpeg_huffman_cache jpeg_huffman_cache;
+    struct i965_kernel_cache kernel_cache;
     char va_vendor[256];
  
     VADisplayAttribute *display_attributes;
@@ -525,4 +640,11 @@ extern VAStatus i965_CreateSurfaces(VADriverContextP ctx,
 void
 i965_destroy_surface_storage(struct object_surface *obj_surface);
 
+void
+i965_reference_buffer_store(struct buffer_store **ptr,
+                            struct buffer_store *buffer_store);
+
+void
+i965_release_buffer_store(struct buffer_store **ptr);
+
 #endif /* _I965_DRV_VIDEO_H_ */
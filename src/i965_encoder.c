@@ -622,6 +622,465 @@ out:
     return vaStatus;
 }
  
+/*
+ * Pipelined encoding: the PAK stage of picture N is run after the VME
+ * stage of picture N + 1 has been submitted, so that building the PAK
+ * batch (which reads back the VME output) doesn't stall vaEndPicture()
+ * and the BSD ring works on picture N while the render ring works on
+ * picture N + 1. The PAK stage of picture N runs first when picture
+ * N + 1 refers to its reconstructed surface.
+ */
+static int
+intel_encoder_state_uses_bo(struct encode_state *encode_state, dri_bo *bo)
+{
+    int i;
+
+    if (encode_state->input_yuv_object &&
+        encode_state->input_yuv_object->bo == bo)
+        return 1;
+
+    if (encode_state->reconstructed_object &&
+        encode_state->reconstructed_object->bo == bo)
+        return 1;
+
+    if (encode_state->coded_buf_object &&
+        encode_state->coded_buf_object->buffer_store->bo == bo)
+        return 1;
+
+    for (i = 0; i < ARRAY_ELEMS(encode_state->reference_objects); i++) {
+        if (encode_state->reference_objects[i] &&
+            encode_state->reference_objects[i]->bo == bo)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void
+intel_encoder_release_state(struct encode_state *encode_state)
+{
+    int i;
+
+    i965_release_buffer_store(&encode_state->seq_param);
+    i965_release_buffer_store(&encode_state->pic_param);
+    i965_release_buffer_store(&encode_state->pic_control);
+    i965_release_buffer_store(&encode_state->iq_matrix);
+    i965_release_buffer_store(&encode_state->q_matrix);
+    i965_release_buffer_store(&encode_state->huffman_table);
+    i965_release_buffer_store(&encode_state->seq_param_ext);
+    i965_release_buffer_store(&encode_state->pic_param_ext);
+
+    for (i = 0; i < ARRAY_ELEMS(encode_state->packed_header_param); i++)
+        i965_release_buffer_store(&encode_state->packed_header_param[i]);
+
+    for (i = 0; i < ARRAY_ELEMS(encode_state->packed_header_data); i++)
+        i965_release_buffer_store(&encode_state->packed_header_data[i]);
+
+    for (i = 0; i < ARRAY_ELEMS(encode_state->misc_param); i++)
+        i965_release_buffer_store(&encode_state->misc_param[i]);
+
+    if (encode_state->slice_params) {
+        for (i = 0; i < encode_state->num_slice_params; i++)
+            i965_release_buffer_store(&encode_state->slice_params[i]);
+    }
+
+    if (encode_state->slice_params_ext) {
+        for (i = 0; i < encode_state->num_slice_params_ext; i++)
+            i965_release_buffer_store(&encode_state->slice_params_ext[i]);
+    }
+
+    if (encode_state->packed_header_params_ext) {
+        for (i = 0; i < encode_state->num_packed_header_params_ext; i++)
+            i965_release_buffer_store(&encode_state->packed_header_params_ext[i]);
+    }
+
+    if (encode_state->packed_header_data_ext) {
+        for (i = 0; i < encode_state->num_packed_header_data_ext; i++)
+            i965_release_buffer_store(&encode_state->packed_header_data_ext[i]);
+    }
+
+    memset(encode_state, 0, sizeof(*encode_state));
+}
+
+/* The arrays are kept in the deferred PAK stage and only grow */
+static struct buffer_store **
+intel_encoder_copy_stores(struct buffer_store ***array, int *size,
+                          struct buffer_store **src, int max_num, int num)
+{
+    int i;
+
+    if (!src)
+        return NULL;
+
+    if (*size < max_num) {
+        struct buffer_store **dst = realloc(*array, max_num * sizeof(*dst));
+
+        if (!dst)
+            return NULL;
+
+        *array = dst;
+        *size = max_num;
+    }
+
+    memset(*array, 0, max_num * sizeof(**array));
+
+    for (i = 0; i < num; i++)
+        i965_reference_buffer_store(&(*array)[i], src[i]);
+
+    return *array;
+}
+
+static int *
+intel_encoder_copy_ints(int **array, int *size, int *src, int num)
+{
+    if (!src)
+        return NULL;
+
+    if (*size < num) {
+        int *dst = realloc(*array, num * sizeof(*dst));
+
+        if (!dst)
+            return NULL;
+
+        *array = dst;
+        *size = num;
+    }
+
+    memcpy(*array, src, num * sizeof(**array));
+
+    return *array;
+}
+
+/* Returns 0 if memory is short, then the PAK stage runs right away */
+static int
+intel_encoder_copy_state(struct intel_encoder_deferred_pak *pak, struct encode_state *src)
+{
+    struct encode_state * const dst = &pak->encode_state;
+    int i;
+
+    *dst = *src;
+    dst->seq_param = NULL;
+    dst->pic_param = NULL;
+    dst->pic_control = NULL;
+    dst->iq_matrix = NULL;
+    dst->q_matrix = NULL;
+    dst->huffman_table = NULL;
+    dst->seq_param_ext = NULL;
+    dst->pic_param_ext = NULL;
+    memset(dst->packed_header_param, 0, sizeof(dst->packed_header_param));
+    memset(dst->packed_header_data, 0, sizeof(dst->packed_header_data));
+    memset(dst->misc_param, 0, sizeof(dst->misc_param));
+
+    i965_reference_buffer_store(&dst->seq_param, src->seq_param);
+    i965_reference_buffer_store(&dst->pic_param, src->pic_param);
+    i965_reference_buffer_store(&dst->pic_control, src->pic_control);
+    i965_reference_buffer_store(&dst->iq_matrix, src->iq_matrix);
+    i965_reference_buffer_store(&dst->q_matrix, src->q_matrix);
+    i965_reference_buffer_store(&dst->huffman_table, src->huffman_table);
+    i965_reference_buffer_store(&dst->seq_param_ext, src->seq_param_ext);
+    i965_reference_buffer_store(&dst->pic_param_ext, src->pic_param_ext);
+
+    for (i = 0; i < ARRAY_ELEMS(dst->packed_header_param); i++)
+        i965_reference_buffer_store(&dst->packed_header_param[i], src->packed_header_param[i]);
+
+    for (i = 0; i < ARRAY_ELEMS(dst->packed_header_data); i++)
+        i965_reference_buffer_store(&dst->packed_header_data[i], src->packed_header_data[i]);
+
+    for (i = 0; i < ARRAY_ELEMS(dst->misc_param); i++)
+        i965_reference_buffer_store(&dst->misc_param[i], src->misc_param[i]);
+
+    dst->slice_params = intel_encoder_copy_stores(&pak->stores[0], &pak->stores_size[0],
+                                                  src->slice_params,
+                                                  src->max_slice_params,
+                                                  src->num_slice_params);
+    dst->slice_params_ext = intel_encoder_copy_stores(&pak->stores[1], &pak->stores_size[1],
+                                                      src->slice_params_ext,
+                                                      src->max_slice_params_ext,
+                                                      src->num_slice_params_ext);
+    dst->packed_header_params_ext = intel_encoder_copy_stores(&pak->stores[2], &pak->stores_size[2],
+                                                              src->packed_header_params_ext,
+                                                              src->max_packed_header_params_ext,
+                                                              src->num_packed_header_params_ext);
+    dst->packed_header_data_ext = intel_encoder_copy_stores(&pak->stores[3], &pak->stores_size[3],
+                                                            src->packed_header_data_ext,
+                                                            src->max_packed_header_data_ext,
+                                                            src->num_packed_header_data_ext);
+    dst->slice_rawdata_index = intel_encoder_copy_ints(&pak->ints[0], &pak->ints_size[0],
+                                                       src->slice_rawdata_index, src->max_slice_num);
+    dst->slice_rawdata_count = intel_encoder_copy_ints(&pak->ints[1], &pak->ints_size[1],
+                                                       src->slice_rawdata_count, src->max_slice_num);
+    dst->slice_header_index = intel_encoder_copy_ints(&pak->ints[2], &pak->ints_size[2],
+                                                      src->slice_header_index, src->max_slice_num);
+
+    if ((src->slice_params && !dst->slice_params) ||
+        (src->slice_params_ext && !dst->slice_params_ext) ||
+        (src->packed_header_params_ext && !dst->packed_header_params_ext) ||
+        (src->packed_header_data_ext && !dst->packed_header_data_ext) ||
+        (src->slice_rawdata_index && !dst->slice_rawdata_index) ||
+        (src->slice_rawdata_count && !dst->slice_rawdata_count) ||
+        (src->slice_header_index && !dst->slice_header_index)) {
+        intel_encoder_release_state(dst);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Keeps the context on the driver list while it holds a deferred PAK stage
+ * or batched pictures. Called with i965->deferred_encode_mutex held, the
+ * head of the list is also read without it, see i965_encoder_flush_deferred().
+ */
+static void
+intel_encoder_update_deferred_list(struct i965_driver_data *i965,
+                                   struct intel_encoder_context *encoder_context)
+{
+    struct intel_encoder_context **prev;
+    int deferred = encoder_context->deferred_pak.pending ||
+        encoder_context->num_batched_pictures > 0;
+
+    for (prev = &i965->deferred_encode_list; *prev; prev = &(*prev)->next_deferred) {
+        if (*prev == encoder_context)
+            break;
+    }
+
+    if (deferred && !*prev) {
+        encoder_context->next_deferred = i965->deferred_encode_list;
+        __atomic_store_n(&i965->deferred_encode_list, encoder_context, __ATOMIC_RELEASE);
+    } else if (!deferred && *prev) {
+        __atomic_store_n(prev, encoder_context->next_deferred, __ATOMIC_RELEASE);
+        encoder_context->next_deferred = NULL;
+    }
+}
+
+/* The VME and PAK (MFC) stages of a picture, as traced events */
+static VAStatus
+intel_encoder_run_vme(VADriverContextP ctx,
+                      VAProfile profile,
+                      struct encode_state *encode_state,
+                      struct intel_encoder_context *encoder_context)
+{
+    VAStatus vaStatus;
+
+    I965_TRACE_BEGIN("VME");
+    vaStatus = encoder_context->vme_pipeline(ctx, profile, encode_state, encoder_context);
+    I965_TRACE_END("VME");
+
+    return vaStatus;
+}
+
+static VAStatus
+intel_encoder_run_mfc(VADriverContextP ctx,
+                      VAProfile profile,
+                      struct encode_state *encode_state,
+                      struct intel_encoder_context *encoder_context)
+{
+    VAStatus vaStatus;
+
+    I965_TRACE_BEGIN("MFC");
+    vaStatus = encoder_context->mfc_pipeline(ctx, profile, encode_state, encoder_context);
+    I965_TRACE_END("MFC");
+
+    return vaStatus;
+}
+
+/* Called with i965->deferred_encode_mutex held */
+static VAStatus
+intel_encoder_run_deferred_pak(VADriverContextP ctx,
+                               struct intel_encoder_context *encoder_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_encoder_deferred_pak * const pak = &encoder_context->deferred_pak;
+    struct gen6_vme_context *vme_context = encoder_context->vme_context;
+    struct i965_buffer_surface vme_output;
+    struct object_surface *used_reference_objects[2];
+    void *used_references[2];
+    unsigned int ref_index_in_mb[2];
+    VAStatus vaStatus;
+
+    if (!pak->pending)
+        return VA_STATUS_SUCCESS;
+
+    pak->pending = 0;
+
+    /* Hand the VME results of the deferred picture to the PAK stage */
+    vme_output = vme_context->vme_output;
+    memcpy(used_reference_objects, vme_context->used_reference_objects, sizeof(used_reference_objects));
+    memcpy(used_references, vme_context->used_references, sizeof(used_references));
+    memcpy(ref_index_in_mb, vme_context->ref_index_in_mb, sizeof(ref_index_in_mb));
+
+    vme_context->vme_output = pak->vme_output;
+    memcpy(vme_context->used_reference_objects, pak->used_reference_objects, sizeof(used_reference_objects));
+    memcpy(vme_context->used_references, pak->used_references, sizeof(used_references));
+    memcpy(vme_context->ref_index_in_mb, pak->ref_index_in_mb, sizeof(ref_index_in_mb));
+
+    vaStatus = intel_encoder_run_mfc(ctx, pak->profile, &pak->encode_state, encoder_context);
+
+    vme_context->vme_output = vme_output;
+    memcpy(vme_context->used_reference_objects, used_reference_objects, sizeof(used_reference_objects));
+    memcpy(vme_context->used_references, used_references, sizeof(used_references));
+    memcpy(vme_context->ref_index_in_mb, ref_index_in_mb, sizeof(ref_index_in_mb));
+
+    dri_bo_unreference(pak->vme_output.bo);
+    pak->vme_output.bo = NULL;
+    intel_encoder_release_state(&pak->encode_state);
+    intel_encoder_update_deferred_list(i965, encoder_context);
+
+    return vaStatus;
+}
+
+/* Called with i965->deferred_encode_mutex held */
+static int
+intel_encoder_defer_pak(VADriverContextP ctx,
+                        VAProfile profile,
+                        struct encode_state *encode_state,
+                        struct intel_encoder_context *encoder_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_encoder_deferred_pak * const pak = &encoder_context->deferred_pak;
+    struct gen6_vme_context *vme_context = encoder_context->vme_context;
+
+    assert(!pak->pending);
+
+    /* The temporary input surface is replaced with the next picture */
+    if (encoder_context->is_tmp_id)
+        return 0;
+
+    if (!intel_encoder_copy_state(pak, encode_state))
+        return 0;
+
+    pak->profile = profile;
+    pak->vme_output = vme_context->vme_output;
+    dri_bo_reference(pak->vme_output.bo);
+    memcpy(pak->used_reference_objects, vme_context->used_reference_objects, sizeof(pak->used_reference_objects));
+    memcpy(pak->used_references, vme_context->used_references, sizeof(pak->used_references));
+    memcpy(pak->ref_index_in_mb, vme_context->ref_index_in_mb, sizeof(pak->ref_index_in_mb));
+    pak->pending = 1;
+    intel_encoder_update_deferred_list(i965, encoder_context);
+
+    return 1;
+}
+
+static VAStatus
+intel_encoder_pipelined_end_picture(VADriverContextP ctx,
+                                    VAProfile profile,
+                                    struct encode_state *encode_state,
+                                    struct intel_encoder_context *encoder_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_encoder_deferred_pak * const pak = &encoder_context->deferred_pak;
+    VAStatus vaStatus, pak_status = VA_STATUS_SUCCESS;
+
+    _i965LockMutex(&i965->deferred_encode_mutex);
+
+    if (pak->pending &&
+        intel_encoder_state_uses_bo(encode_state, pak->encode_state.reconstructed_object->bo))
+        pak_status = intel_encoder_run_deferred_pak(ctx, encoder_context);
+
+    vaStatus = intel_encoder_run_vme(ctx, profile, encode_state, encoder_context);
+
+    if (pak->pending) {
+        pak_status = intel_encoder_run_deferred_pak(ctx, encoder_context);
+        i965->num_overlapped_paks++;
+    }
+
+    if (vaStatus == VA_STATUS_SUCCESS &&
+        !intel_encoder_defer_pak(ctx, profile, encode_state, encoder_context))
+        vaStatus = intel_encoder_run_mfc(ctx, profile, encode_state, encoder_context);
+
+    i965->num_encoded_pictures++;
+    _i965UnlockMutex(&i965->deferred_encode_mutex);
+
+    /* The failure of the previous picture's PAK stage is reported here, the
+     * last point at which the application can still see it */
+    if (vaStatus == VA_STATUS_SUCCESS)
+        vaStatus = pak_status;
+
+    return vaStatus;
+}
+
+/*
+ * Batched encoding (VA_INTEL_JPEG_ENCODE_BATCH=n): the pictures of a context
+ * are appended to its batch, which is submitted once it holds n pictures or
+ * when one of the surfaces or coded buffers it uses is accessed.
+ */
+
+/* Called with i965->deferred_encode_mutex held */
+static void
+intel_encoder_submit_batched_pictures(VADriverContextP ctx,
+                                      struct intel_encoder_context *encoder_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+
+    if (!encoder_context->num_batched_pictures)
+        return;
+
+    intel_batchbuffer_flush(encoder_context->base.batch);
+    encoder_context->num_batched_pictures = 0;
+    i965->num_encode_batches++;
+    intel_encoder_update_deferred_list(i965, encoder_context);
+}
+
+static VAStatus
+intel_encoder_batched_end_picture(VADriverContextP ctx,
+                                  VAProfile profile,
+                                  struct encode_state *encode_state,
+                                  struct intel_encoder_context *encoder_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    VAStatus vaStatus = VA_STATUS_SUCCESS;
+
+    _i965LockMutex(&i965->deferred_encode_mutex);
+
+    if (encoder_context->vme_context && encoder_context->vme_pipeline)
+        vaStatus = intel_encoder_run_vme(ctx, profile, encode_state, encoder_context);
+
+    if (vaStatus == VA_STATUS_SUCCESS) {
+        vaStatus = intel_encoder_run_mfc(ctx, profile, encode_state, encoder_context);
+        encoder_context->num_batched_pictures++;
+        i965->num_batched_encodes++;
+    }
+
+    if (encoder_context->num_batched_pictures >= encoder_context->max_batched_pictures)
+        intel_encoder_submit_batched_pictures(ctx, encoder_context);
+    else
+        intel_encoder_update_deferred_list(i965, encoder_context);
+
+    _i965UnlockMutex(&i965->deferred_encode_mutex);
+
+    return vaStatus;
+}
+
+/* Runs the deferred PAK stages and batched pictures involving bo (all if NULL) */
+void
+i965_encoder_flush_deferred(VADriverContextP ctx, dri_bo *bo)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_encoder_context *encoder_context, *next_encoder_context;
+
+    /* Every batch flush comes here, most of them with nothing deferred */
+    if (!__atomic_load_n(&i965->deferred_encode_list, __ATOMIC_ACQUIRE))
+        return;
+
+    _i965LockMutex(&i965->deferred_encode_mutex);
+
+    for (encoder_context = i965->deferred_encode_list;
+         encoder_context;
+         encoder_context = next_encoder_context) {
+        next_encoder_context = encoder_context->next_deferred;
+
+        if (encoder_context->deferred_pak.pending &&
+            (!bo || intel_encoder_state_uses_bo(&encoder_context->deferred_pak.encode_state, bo)))
+            intel_encoder_run_deferred_pak(ctx, encoder_context);
+
+        if (encoder_context->num_batched_pictures &&
+            (!bo || drm_intel_bo_references(encoder_context->base.batch->buffer, bo)))
+            intel_encoder_submit_batched_pictures(ctx, encoder_context);
+    }
+
+    _i965UnlockMutex(&i965->deferred_encode_mutex);
+}
+
 static VAStatus
 intel_encoder_end_picture(VADriverContextP ctx, 
                           VAProfile profile, 
@@ -639,12 +1098,18 @@ intel_encoder_end_picture(VADriverContextP ctx,
 
     encoder_context->mfc_brc_prepare(encode_state, encoder_context);
 
+    if (encoder_context->pipeline_pak)
+        return intel_encoder_pipelined_end_picture(ctx, profile, encode_state, encoder_context);
+
+    if (encoder_context->max_batched_pictures > 1)
+        return intel_encoder_batched_end_picture(ctx, profile, encode_state, encoder_context);
+
     if((encoder_context->vme_context && encoder_context->vme_pipeline)) {
-        vaStatus = encoder_context->vme_pipeline(ctx, profile, encode_state, encoder_context);
+        vaStatus = intel_encoder_run_vme(ctx, profile, encode_state, encoder_context);
     }
 
     if (vaStatus == VA_STATUS_SUCCESS)
-        encoder_context->mfc_pipeline(ctx, profile, encode_state, encoder_context);
+        intel_encoder_run_mfc(ctx, profile, encode_state, encoder_context);
     return VA_STATUS_SUCCESS;
 }
 
@@ -652,6 +1117,23 @@ static void
 intel_encoder_context_destroy(void *hw_context)
 {
     struct intel_encoder_context *encoder_context = (struct intel_encoder_context *)hw_context;
+    int i;
+
+    if (encoder_context->deferred_pak.pending ||
+        encoder_context->num_batched_pictures) {
+        struct i965_driver_data *i965 = i965_driver_data(encoder_context->driver_context);
+
+        _i965LockMutex(&i965->deferred_encode_mutex);
+        intel_encoder_run_deferred_pak(encoder_context->driver_context, encoder_context);
+        intel_encoder_submit_batched_pictures(encoder_context->driver_context, encoder_context);
+        _i965UnlockMutex(&i965->deferred_encode_mutex);
+    }
+
+    for (i = 0; i < ARRAY_ELEMS(encoder_context->deferred_pak.stores); i++)
+        free(encoder_context->deferred_pak.stores[i]);
+
+    for (i = 0; i < ARRAY_ELEMS(encoder_context->deferred_pak.ints); i++)
+        free(encoder_context->deferred_pak.ints[i]);
 
     encoder_context->mfc_context_destroy(encoder_context->mfc_context);
 
@@ -672,9 +1154,11 @@ intel_enc_hw_context_init(VADriverContextP ctx,
 {
     struct intel_driver_data *intel = intel_driver_data(ctx);
     struct intel_encoder_context *encoder_context = calloc(1, sizeof(struct intel_encoder_context));
+    char *env_str;
     int i;
 
     assert(encoder_context);
+    encoder_context->driver_context = ctx;
     encoder_context->base.destroy = intel_encoder_context_destroy;
     encoder_context->base.run = intel_encoder_end_picture;
     encoder_context->base.batch = intel_batchbuffer_new(intel, I915_EXEC_RENDER, 0);
@@ -746,6 +1230,24 @@ intel_enc_hw_context_init(VADriverContextP ctx,
     assert(encoder_context->mfc_context_destroy);
     assert(encoder_context->mfc_pipeline);
 
+    /* The BRC loop of CBR reads back the coded size after every PAK */
+    if (encoder_context->codec == CODEC_H264 &&
+        !(encoder_context->rate_control_mode & VA_RC_CBR) &&
+        (IS_GEN8(intel->device_info) || IS_GEN9(intel->device_info)) &&
+        (env_str = getenv("VA_INTEL_ENCODE_PIPELINE")) && atoi(env_str))
+        encoder_context->pipeline_pak = 1;
+
+    if (encoder_context->codec == CODEC_JPEG &&
+        (IS_GEN8(intel->device_info) || IS_GEN9(intel->device_info)) &&
+        (env_str = getenv("VA_INTEL_JPEG_ENCODE_BATCH")) && atoi(env_str) > 1)
+        encoder_context->max_batched_pictures = MIN(atoi(env_str), MAX_ENCODER_BATCHED_PICTURES);
+
+    /* VA_INTEL_MFC_SLICE_THREADS=1 programs the PAK slices serially */
+    encoder_context->max_slice_threads = INTEL_MFC_MAX_SLICE_THREADS;
+
+    if ((env_str = getenv("VA_INTEL_MFC_SLICE_THREADS")) && atoi(env_str) > 0)
+        encoder_context->max_slice_threads = MIN(atoi(env_str), INTEL_MFC_MAX_SLICE_THREADS);
+
     return (struct hw_context *)encoder_context;
 }
 
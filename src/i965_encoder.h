@@ -35,10 +35,36 @@
 
 #include "i965_structs.h"
 #include "i965_drv_video.h"
+#include "i965_gpe_utils.h"
+
+#define MAX_ENCODER_BATCHED_PICTURES    64
+
+/*
+ * PAK stage of a picture, held back until the VME stage of the next
+ * picture has been submitted (VA_INTEL_ENCODE_PIPELINE)
+ */
+struct intel_encoder_deferred_pak
+{
+    int pending;
+    VAProfile profile;
+    /* private copy, holding references on the parameter buffers */
+    struct encode_state encode_state;
+    /* VME results of the picture */
+    struct i965_buffer_surface vme_output;
+    struct object_surface *used_reference_objects[2];
+    void *used_references[2];
+    unsigned int ref_index_in_mb[2];
+    /* arrays of encode_state, kept from picture to picture */
+    struct buffer_store **stores[4];
+    int stores_size[4];
+    int *ints[3];
+    int ints_size[3];
+};
 
 struct intel_encoder_context
 {
     struct hw_context base;
+    VADriverContextP driver_context;
     int codec;
     VASurfaceID input_yuv_surface;
     int is_tmp_id;
@@ -59,8 +85,25 @@ struct intel_encoder_context
                              struct intel_encoder_context *encoder_context);
     void (*mfc_brc_prepare)(struct encode_state *encode_state,
                             struct intel_encoder_context *encoder_context);
+
+    int pipeline_pak;
+    struct intel_encoder_deferred_pak deferred_pak;
+    int max_batched_pictures;
+    int num_batched_pictures;
+    int max_slice_threads;
+    struct intel_encoder_context *next_deferred;
 };
 
+void
+i965_encoder_flush_deferred(VADriverContextP ctx, dri_bo *bo);
+
+/* The workers of the software PAK batch generation, see gen6_mfc_common.c */
+struct intel_mfc_slice_pool *
+intel_mfc_slice_pool_new(void);
+
+void
+intel_mfc_slice_pool_destroy(struct intel_mfc_slice_pool *pool);
+
 extern struct hw_context *
 gen75_enc_hw_context_init(VADriverContextP ctx, struct object_config *obj_config);
 
@@ -115,6 +115,20 @@ avc_bitstream_end(avc_bitstream *bs)
     // free(bs->buffer);
 }
 
+/* Restarts a bitstream on a buffer kept from a previous use, if any */
+static void
+avc_bitstream_restart(avc_bitstream *bs, unsigned int *buffer, int size_in_dword)
+{
+    if (!buffer) {
+        avc_bitstream_start(bs);
+        return;
+    }
+
+    bs->buffer = buffer;
+    bs->max_size_in_dword = size_in_dword;
+    bs->bit_offset = 0;
+}
+
 static void
 avc_bitstream_put_ui(avc_bitstream *bs, unsigned int val, int size_in_bits)
 {
@@ -149,6 +163,42 @@ avc_bitstream_put_ui(avc_bitstream *bs, unsigned int val, int size_in_bits)
     }
 }
 
+/*
+ * Writes count copies of the same bit, a whole dword at a time once the
+ * stream is dword aligned. Same output as count calls to put_ui(bit, 1)
+ */
+static void
+avc_bitstream_put_run(avc_bitstream *bs, int bit, int count)
+{
+    unsigned int val = bit ? 0xffffffff : 0;
+    int head = (32 - (bs->bit_offset & 0x1f)) & 0x1f;
+    int pos;
+
+    if (head > count)
+        head = count;
+
+    avc_bitstream_put_ui(bs, val, head);
+    count -= head;
+
+    while (count >= 32) {
+        pos = (bs->bit_offset >> 5);
+
+        if (pos + 1 == bs->max_size_in_dword) {
+            bs->max_size_in_dword += BITSTREAM_ALLOCATE_STEPPING;
+            bs->buffer = realloc(bs->buffer, bs->max_size_in_dword * sizeof(unsigned int));
+
+            if (!bs->buffer)
+                return;
+        }
+
+        bs->buffer[pos] = val;
+        bs->bit_offset += 32;
+        count -= 32;
+    }
+
+    avc_bitstream_put_ui(bs, val, count);
+}
+
 static void
 avc_bitstream_put_ue(avc_bitstream *bs, unsigned int val)
 {
@@ -533,7 +583,7 @@ void binarize_vp8_frame_header(VAEncSequenceParameterBufferVP8 *seq_param,
                            struct intel_encoder_context *encoder_context)
 {
     avc_bitstream bs;
-    int i, j;
+    int i;
     int is_intra_frame = !pic_param->pic_flags.bits.frame_type;
     int log2num = pic_param->pic_flags.bits.num_token_partitions;
 
@@ -548,7 +598,10 @@ void binarize_vp8_frame_header(VAEncSequenceParameterBufferVP8 *seq_param,
     if (pic_param->pic_flags.bits.version > 1)
         pic_param->loop_filter_level[0] = 0; 
 
-    avc_bitstream_start(&bs);
+    /* the buffer is kept in the context and reused for every frame */
+    avc_bitstream_restart(&bs,
+                          (unsigned int *)mfc_context->vp8_state.vp8_frame_header,
+                          mfc_context->vp8_state.frame_header_buffer_size);
 
     if (is_intra_frame) {
        avc_bitstream_put_ui(&bs, 0, 1);
@@ -642,8 +695,7 @@ void binarize_vp8_frame_header(VAEncSequenceParameterBufferVP8 *seq_param,
 
     mfc_context->vp8_state.frame_header_token_update_pos = bs.bit_offset;
 
-    for (i = 0; i < 4 * 8 * 3 * 11; i++)
-        avc_bitstream_put_ui(&bs, 0, 1); //don't update coeff_probs
+    avc_bitstream_put_run(&bs, 0, 4 * 8 * 3 * 11); //don't update coeff_probs
 
     avc_bitstream_put_ui(&bs, pic_param->pic_flags.bits.mb_no_coeff_skip, 1);
     if (pic_param->pic_flags.bits.mb_no_coeff_skip)
@@ -666,17 +718,14 @@ void binarize_vp8_frame_header(VAEncSequenceParameterBufferVP8 *seq_param,
 
         mfc_context->vp8_state.frame_header_bin_mv_upate_pos = bs.bit_offset;
         
-        for (i = 0; i < 2 ; i++) {
-            for (j = 0; j < 19; j++) {
-                avc_bitstream_put_ui(&bs, 0, 1);
-                //avc_bitstream_put_ui(&bs, mfc_context->vp8_state.mv_probs[i][j], 7);
-            }
-        } 
+        //don't update mv_probs[2][19]
+        avc_bitstream_put_run(&bs, 0, 2 * 19);
     }
 
     avc_bitstream_end(&bs);
 
     mfc_context->vp8_state.vp8_frame_header = (unsigned char *)bs.buffer;
+    mfc_context->vp8_state.frame_header_buffer_size = bs.max_size_in_dword;
     mfc_context->vp8_state.frame_header_bit_count = bs.bit_offset;
 }
 
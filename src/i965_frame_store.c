@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2006-2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Frame Store entry allocation for the decoders which manage the entries
+ * themselves. This has no dependency on the rest of the driver, so that
+ * i965_frame_store_test can check it on the CPU.
+ */
+
+#include "sysdeps.h"
+#include <va/va_backend.h>
+#include "i965_decoder.h"
+
+int
+intel_frame_store_update(GenFrameStoreContext *fs_ctx,
+                         GenFrameStore frame_store[],
+                         int num_elements,
+                         int poc,
+                         const GenFrameStoreRef *refs,
+                         int num_refs)
+{
+    uint8_t lru[MAX_GEN_REFERENCE_FRAMES];
+    uint32_t used_refs = 0, add_refs = 0;
+    uint64_t age;
+    int i, n, num_missing = 0;
+
+    assert(num_elements <= MAX_GEN_REFERENCE_FRAMES);
+    if (num_elements > MAX_GEN_REFERENCE_FRAMES)
+        num_elements = MAX_GEN_REFERENCE_FRAMES;
+
+    assert(num_refs <= 32);
+    if (num_refs > 32)
+        num_refs = 32;
+
+    /* Initially, all entries are free and ordered by index */
+    if (fs_ctx->age == 0) {
+        for (i = 0; i < num_elements; i++)
+            fs_ctx->lru[i] = i;
+    }
+
+    /* Detect changes of access unit */
+    if (fs_ctx->age == 0 || fs_ctx->prev_poc != poc)
+        fs_ctx->age++;
+    fs_ctx->prev_poc = poc;
+    age = fs_ctx->age;
+
+    /* Tag entries that are still available in our Frame Store */
+    for (i = 0; i < num_refs; i++) {
+        const int frame_store_id = *refs[i].frame_store_id;
+
+        if (frame_store_id >= 0 && frame_store_id < num_elements) {
+            GenFrameStore * const fs = &frame_store[frame_store_id];
+            if (fs->surface_id == refs[i].surface_id) {
+                fs->obj_surface = refs[i].obj_surface;
+                fs->ref_age = age;
+                used_refs |= 1 << frame_store_id;
+                continue;
+            }
+        }
+        add_refs |= 1 << i;
+    }
+
+    /* Release the retired candidates */
+    for (i = 0; i < num_elements; i++) {
+        if (!(used_refs & (1 << i)))
+            frame_store[i].obj_surface = NULL;
+    }
+
+    /* Append the new reference frames. The free entries are picked up
+       from the LRU list, i.e. by increasing age when they were last used */
+    for (i = 0, n = 0; i < num_refs; i++) {
+        if (!(add_refs & (1 << i)))
+            continue;
+
+        while (n < num_elements && (used_refs & (1 << fs_ctx->lru[n])))
+            n++;
+        if (n < num_elements) {
+            GenFrameStore * const fs = &frame_store[fs_ctx->lru[n++]];
+            fs->surface_id = refs[i].surface_id;
+            fs->obj_surface = refs[i].obj_surface;
+            fs->frame_store_id = fs - frame_store;
+            fs->ref_age = age;
+            *refs[i].frame_store_id = fs->frame_store_id;
+            continue;
+        }
+        num_missing++;
+    }
+
+    /* Move the entries used for this access unit to the end of the LRU
+       list, in index order. This keeps the list sorted by (age, index) */
+    for (i = 0, n = 0; i < num_elements; i++) {
+        if (frame_store[fs_ctx->lru[i]].ref_age != age)
+            lru[n++] = fs_ctx->lru[i];
+    }
+    for (i = 0; i < num_elements; i++) {
+        if (frame_store[i].ref_age == age)
+            lru[n++] = i;
+    }
+    memcpy(fs_ctx->lru, lru, num_elements);
+
+    return num_missing;
+}
@@ -0,0 +1,319 @@
+/*
+ * i965_frame_store_test.c - property test of the Frame Store allocation
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runs random reference lists through intel_frame_store_update() and
+ * checks that it hands out the same Frame Store entries as the former
+ * implementation, which sorted the free entries by age for every picture.
+ * Run by make check.
+ */
+
+#include "sysdeps.h"
+#include <va/va_backend.h>
+#include "i965_decoder.h"
+
+#define NUM_ELEMENTS    MAX_GEN_REFERENCE_FRAMES
+#define NUM_SURFACES    40
+#define NUM_SEQUENCES   200
+#define NUM_PICTURES    500
+
+static int test_failures = 0;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+/* A decoder instance: its Frame Store and the state of the surfaces */
+struct decoder {
+    GenFrameStoreContext fs_ctx;
+    GenFrameStore frame_store[NUM_ELEMENTS];
+    int frame_store_ids[NUM_SURFACES];
+};
+
+/* Surface objects are only stored, any distinct address will do */
+static char surface_objects[NUM_SURFACES];
+
+#define SURFACE_OBJECT(i) ((struct object_surface *)&surface_objects[i])
+
+static void
+decoder_init(struct decoder *dec)
+{
+    int i;
+
+    memset(dec, 0, sizeof(*dec));
+    for (i = 0; i < NUM_ELEMENTS; i++) {
+        dec->frame_store[i].surface_id = VA_INVALID_ID;
+        dec->frame_store[i].frame_store_id = -1;
+    }
+    for (i = 0; i < NUM_SURFACES; i++)
+        dec->frame_store_ids[i] = -1;
+}
+
+static int
+compare_free_refs(const void *p1, const void *p2)
+{
+    const GenFrameStore * const fs1 = *((GenFrameStore **)p1);
+    const GenFrameStore * const fs2 = *((GenFrameStore **)p2);
+
+    /* qsort() isn't stable, and the former implementation relied on
+       glibc's merge sort to keep entries of the same age in index order.
+       Compare the index explicitly so the reference is well defined */
+    if (fs1->ref_age != fs2->ref_age)
+        return fs1->ref_age < fs2->ref_age ? -1 : 1;
+    return fs1->frame_store_id - fs2->frame_store_id;
+}
+
+/* The allocation before the LRU list was introduced */
+static int
+reference_update(struct decoder *dec, int poc, const int *surfaces,
+                 int num_refs)
+{
+    GenFrameStore * const frame_store = dec->frame_store;
+    GenFrameStore *free_refs[NUM_ELEMENTS];
+    uint32_t used_refs = 0, add_refs = 0;
+    uint64_t age;
+    int i, n, num_free_refs, num_missing = 0;
+
+    if (dec->fs_ctx.age == 0 || dec->fs_ctx.prev_poc != poc)
+        dec->fs_ctx.age++;
+    dec->fs_ctx.prev_poc = poc;
+    age = dec->fs_ctx.age;
+
+    for (i = 0; i < num_refs; i++) {
+        const int frame_store_id = dec->frame_store_ids[surfaces[i]];
+
+        if (frame_store_id >= 0) {
+            GenFrameStore * const fs = &frame_store[frame_store_id];
+            if (fs->surface_id == (VASurfaceID)surfaces[i]) {
+                fs->obj_surface = SURFACE_OBJECT(surfaces[i]);
+                fs->ref_age = age;
+                used_refs |= 1 << frame_store_id;
+                continue;
+            }
+        }
+        add_refs |= 1 << i;
+    }
+
+    for (i = 0, n = 0; i < NUM_ELEMENTS; i++) {
+        if (!(used_refs & (1 << i))) {
+            GenFrameStore * const fs = &frame_store[i];
+            fs->obj_surface = NULL;
+            /* Unused entries don't have an index yet */
+            fs->frame_store_id = i;
+            free_refs[n++] = fs;
+        }
+    }
+    num_free_refs = n;
+    qsort(&free_refs[0], n, sizeof(free_refs[0]), compare_free_refs);
+
+    for (i = 0, n = 0; i < num_refs; i++) {
+        if (!(add_refs & (1 << i)))
+            continue;
+
+        if (n < num_free_refs) {
+            GenFrameStore * const fs = free_refs[n++];
+            fs->surface_id = surfaces[i];
+            fs->obj_surface = SURFACE_OBJECT(surfaces[i]);
+            fs->frame_store_id = fs - frame_store;
+            fs->ref_age = age;
+            dec->frame_store_ids[surfaces[i]] = fs->frame_store_id;
+            continue;
+        }
+        num_missing++;
+    }
+    return num_missing;
+}
+
+static int
+update(struct decoder *dec, int poc, const int *surfaces, int num_refs)
+{
+    GenFrameStoreRef refs[NUM_ELEMENTS + 4];
+    int i;
+
+    for (i = 0; i < num_refs; i++) {
+        refs[i].surface_id = surfaces[i];
+        refs[i].obj_surface = SURFACE_OBJECT(surfaces[i]);
+        refs[i].frame_store_id = &dec->frame_store_ids[surfaces[i]];
+    }
+    return intel_frame_store_update(&dec->fs_ctx, dec->frame_store,
+                                    NUM_ELEMENTS, poc, refs, num_refs);
+}
+
+static int
+compare_decoders(const struct decoder *dec, const struct decoder *ref)
+{
+    int i, mismatches = 0;
+
+    for (i = 0; i < NUM_ELEMENTS; i++) {
+        const GenFrameStore * const fs = &dec->frame_store[i];
+        const GenFrameStore * const ref_fs = &ref->frame_store[i];
+
+        /* Only the surface matters for an entry that was never used */
+        if (fs->surface_id != ref_fs->surface_id ||
+            fs->obj_surface != ref_fs->obj_surface ||
+            (fs->surface_id != VA_INVALID_ID &&
+             (fs->frame_store_id != ref_fs->frame_store_id ||
+              fs->ref_age != ref_fs->ref_age)))
+            mismatches++;
+    }
+    for (i = 0; i < NUM_SURFACES; i++) {
+        if (dec->frame_store_ids[i] != ref->frame_store_ids[i])
+            mismatches++;
+    }
+    return mismatches;
+}
+
+/* Every reference must end up in an entry that holds it, if there was one */
+static void
+check_references(const struct decoder *dec, const int *surfaces, int num_refs,
+                 int num_missing)
+{
+    int i, num_found = 0;
+
+    for (i = 0; i < num_refs; i++) {
+        const int frame_store_id = dec->frame_store_ids[surfaces[i]];
+
+        if (frame_store_id >= 0 && frame_store_id < NUM_ELEMENTS &&
+            dec->frame_store[frame_store_id].surface_id ==
+            (VASurfaceID)surfaces[i] &&
+            dec->frame_store[frame_store_id].obj_surface)
+            num_found++;
+    }
+    CHECK(num_found + num_missing >= num_refs);
+}
+
+static void
+test_random_sequence(unsigned int seed)
+{
+    struct decoder dec, ref;
+    int surfaces[NUM_ELEMENTS + 4];
+    int i, j, n, poc = 0, num_refs, num_missing, ref_num_missing;
+
+    srand(seed);
+    decoder_init(&dec);
+    decoder_init(&ref);
+
+    for (i = 0; i < NUM_PICTURES; i++) {
+        /* The second field of a pair shares the POC of the first one */
+        if (rand() % 4 != 0)
+            poc += 1 + rand() % 3;
+
+        /* Mostly a sliding window of the last decoded surfaces, with
+           random gaps, duplicates and sometimes more than can fit */
+        num_refs = rand() % (rand() % 8 == 0 ? NUM_ELEMENTS + 4 :
+                             NUM_ELEMENTS + 1);
+        for (j = 0, n = 0; j < num_refs; j++) {
+            if (n > 0 && rand() % 16 == 0)
+                surfaces[n] = surfaces[rand() % n];
+            else if (rand() % 4 == 0)
+                surfaces[n] = rand() % NUM_SURFACES;
+            else
+                surfaces[n] = (i + NUM_SURFACES - j) % NUM_SURFACES;
+            n++;
+        }
+
+        /* A surface that was destroyed and recreated, or that moved to
+           another context, comes with a stale index */
+        if (rand() % 16 == 0) {
+            const int s = rand() % NUM_SURFACES;
+            dec.frame_store_ids[s] = ref.frame_store_ids[s] =
+                rand() % (NUM_ELEMENTS + 1) - 1;
+        }
+
+        num_missing = update(&dec, poc, surfaces, num_refs);
+        ref_num_missing = reference_update(&ref, poc, surfaces, num_refs);
+        CHECK(num_missing == ref_num_missing);
+        check_references(&dec, surfaces, num_refs, num_missing);
+
+        if (compare_decoders(&dec, &ref) != 0) {
+            fprintf(stderr, "seed %u, picture %d: Frame Stores differ\n",
+                    seed, i);
+            test_failures++;
+            break;
+        }
+    }
+}
+
+static void
+test_kept_entries(void)
+{
+    struct decoder dec;
+    int surfaces[4] = { 0, 1, 2, 3 };
+
+    /* References keep their entries, the least recently used free entry
+       is picked for a new one */
+    decoder_init(&dec);
+    CHECK(update(&dec, 0, surfaces, 2) == 0);
+    CHECK(dec.frame_store_ids[0] == 0 && dec.frame_store_ids[1] == 1);
+    CHECK(update(&dec, 1, &surfaces[1], 2) == 0);
+    CHECK(dec.frame_store_ids[1] == 1 && dec.frame_store_ids[2] == 2);
+    CHECK(dec.frame_store[0].obj_surface == NULL);
+    CHECK(update(&dec, 2, &surfaces[2], 2) == 0);
+    CHECK(dec.frame_store_ids[2] == 2 && dec.frame_store_ids[3] == 3);
+
+    /* The entries that were never used are the least recently used */
+    surfaces[0] = 10;
+    surfaces[1] = 11;
+    CHECK(update(&dec, 3, surfaces, 2) == 0);
+    CHECK(dec.frame_store_ids[10] == 4 && dec.frame_store_ids[11] == 5);
+}
+
+static void
+test_overflow(void)
+{
+    struct decoder dec;
+    int surfaces[NUM_ELEMENTS + 2];
+    int i;
+
+    decoder_init(&dec);
+    for (i = 0; i < NUM_ELEMENTS + 2; i++)
+        surfaces[i] = i;
+    CHECK(update(&dec, 0, surfaces, NUM_ELEMENTS + 2) == 2);
+    for (i = 0; i < NUM_ELEMENTS; i++)
+        CHECK(dec.frame_store_ids[i] == i);
+    CHECK(dec.frame_store_ids[NUM_ELEMENTS] == -1);
+}
+
+int
+main(void)
+{
+    unsigned int seed;
+
+    test_kept_entries();
+    test_overflow();
+    for (seed = 1; seed <= NUM_SEQUENCES; seed++)
+        test_random_sequence(seed);
+
+    if (test_failures) {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return 1;
+    }
+
+    return 0;
+}
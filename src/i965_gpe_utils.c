@@ -126,28 +126,200 @@ gen6_gpe_idrt(VADriverContextP ctx,
     ADVANCE_BATCH(batch);
 }
 
+/* Instruction prefetch may read past the end of the last kernel */
+#define KERNEL_CACHE_PAD        4096
+
+void
+i965_kernel_cache_init(struct i965_kernel_cache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+    _i965InitMutex(&cache->mutex);
+}
+
+void
+i965_kernel_cache_terminate(struct i965_kernel_cache *cache)
+{
+    struct i965_kernel_cache_entry *entry;
+
+    while ((entry = cache->entries)) {
+        cache->entries = entry->next;
+        dri_bo_unreference(entry->bo);
+        free(entry);
+    }
+
+    cache->num_entries = 0;
+    _i965DestroyMutex(&cache->mutex);
+}
+
+static bool
+kernel_cache_entry_match(const struct i965_kernel_cache_entry *entry,
+                         struct i965_kernel **kernels,
+                         int num_kernels)
+{
+    int i;
+
+    if (entry->num_kernels != num_kernels)
+        return false;
+
+    for (i = 0; i < num_kernels; i++) {
+        if (entry->kernels[i].bin != kernels[i]->bin ||
+            entry->kernels[i].size != kernels[i]->size)
+            return false;
+    }
+
+    return true;
+}
+
+static struct i965_kernel_cache_entry *
+kernel_cache_entry_new(VADriverContextP ctx,
+                       struct i965_kernel **kernels,
+                       int num_kernels)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_kernel_cache_entry *entry;
+    unsigned int end_offset = 0;
+    unsigned char *kernel_ptr;
+    int i;
+
+    entry = calloc(1, sizeof(*entry) + num_kernels * sizeof(entry->kernels[0]));
+
+    if (!entry)
+        return NULL;
+
+    entry->num_kernels = num_kernels;
+
+    for (i = 0; i < num_kernels; i++) {
+        entry->kernels[i].bin = kernels[i]->bin;
+        entry->kernels[i].size = kernels[i]->size;
+        entry->kernels[i].offset = ALIGN(end_offset, 64);
+
+        if (kernels[i]->bin && kernels[i]->size)
+            end_offset = entry->kernels[i].offset + kernels[i]->size;
+    }
+
+    entry->size = end_offset;
+    entry->bo = dri_bo_alloc(i965->intel.bufmgr,
+                             num_kernels == 1 ? kernels[0]->name : "kernel shader",
+                             ALIGN(end_offset, 64) + KERNEL_CACHE_PAD,
+                             0x1000);
+
+    if (!entry->bo) {
+        free(entry);
+        return NULL;
+    }
+
+    dri_bo_map(entry->bo, 1);
+    kernel_ptr = entry->bo->virtual;
+
+    for (i = 0; i < num_kernels; i++) {
+        if (kernels[i]->bin && kernels[i]->size)
+            memcpy(kernel_ptr + entry->kernels[i].offset, kernels[i]->bin, kernels[i]->size);
+    }
+
+    dri_bo_unmap(entry->bo);
+
+    return entry;
+}
+
+dri_bo *
+i965_kernel_cache_get(VADriverContextP ctx,
+                      struct i965_kernel **kernels,
+                      int num_kernels,
+                      unsigned int *size)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_kernel_cache *cache = &i965->kernel_cache;
+    struct i965_kernel_cache_entry *entry;
+    dri_bo *bo = NULL;
+    int i;
+
+    /* held while uploading, so that a list is never uploaded twice */
+    _i965LockMutex(&cache->mutex);
+    cache->num_lookups++;
+
+    for (entry = cache->entries; entry; entry = entry->next) {
+        if (kernel_cache_entry_match(entry, kernels, num_kernels))
+            break;
+    }
+
+    if (!entry) {
+        entry = kernel_cache_entry_new(ctx, kernels, num_kernels);
+
+        if (entry) {
+            entry->next = cache->entries;
+            cache->entries = entry;
+            cache->num_entries++;
+            cache->num_uploads++;
+            cache->num_bytes += entry->bo->size;
+
+            if (cache->num_bytes > cache->max_bytes)
+                cache->max_bytes = cache->num_bytes;
+        }
+    }
+
+    if (entry) {
+        for (i = 0; i < num_kernels; i++)
+            kernels[i]->kernel_offset = entry->kernels[i].offset;
+
+        if (size)
+            *size = entry->size;
+
+        dri_bo_reference(entry->bo);
+        bo = entry->bo;
+        entry->num_users++;
+    }
+
+    _i965UnlockMutex(&cache->mutex);
+
+    return bo;
+}
+
+void
+i965_kernel_cache_put(struct i965_kernel_cache *cache, dri_bo *bo)
+{
+    struct i965_kernel_cache_entry **prev, *entry;
+
+    if (!bo)
+        return;
+
+    _i965LockMutex(&cache->mutex);
+
+    for (prev = &cache->entries; (entry = *prev); prev = &entry->next) {
+        if (entry->bo == bo)
+            break;
+    }
+
+    dri_bo_unreference(bo);
+
+    if (entry && --entry->num_users == 0) {
+        *prev = entry->next;
+        cache->num_entries--;
+        cache->num_bytes -= entry->bo->size;
+        dri_bo_unreference(entry->bo);
+        free(entry);
+    }
+
+    _i965UnlockMutex(&cache->mutex);
+}
+
 void
 i965_gpe_load_kernels(VADriverContextP ctx,
                       struct i965_gpe_context *gpe_context,
                       struct i965_kernel *kernel_list,
                       unsigned int num_kernels)
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
     int i;
 
     assert(num_kernels <= MAX_GPE_KERNELS);
     memcpy(gpe_context->kernels, kernel_list, sizeof(*kernel_list) * num_kernels);
     gpe_context->num_kernels = num_kernels;
+    gpe_context->kernel_cache = &i965_driver_data(ctx)->kernel_cache;
 
     for (i = 0; i < num_kernels; i++) {
         struct i965_kernel *kernel = &gpe_context->kernels[i];
 
-        kernel->bo = dri_bo_alloc(i965->intel.bufmgr, 
-                                  kernel->name, 
-                                  kernel->size,
-                                  0x1000);
+        kernel->bo = i965_kernel_cache_get(ctx, &kernel, 1, NULL);
         assert(kernel->bo);
-        dri_bo_subdata(kernel->bo, 0, kernel->size, kernel->bin);
     }
 }
 
@@ -168,7 +340,7 @@ i965_gpe_context_destroy(struct i965_gpe_context *gpe_context)
     for (i = 0; i < gpe_context->num_kernels; i++) {
         struct i965_kernel *kernel = &gpe_context->kernels[i];
 
-        dri_bo_unreference(kernel->bo);
+        i965_kernel_cache_put(gpe_context->kernel_cache, kernel->bo);
         kernel->bo = NULL;
     }
 }
@@ -1133,7 +1305,7 @@ gen8_gpe_context_destroy(struct i965_gpe_context *gpe_context)
     dri_bo_unreference(gpe_context->surface_state_binding_table.bo);
     gpe_context->surface_state_binding_table.bo = NULL;
 
-    dri_bo_unreference(gpe_context->instruction_state.bo);
+    i965_kernel_cache_put(gpe_context->kernel_cache, gpe_context->instruction_state.bo);
     gpe_context->instruction_state.bo = NULL;
 
     dri_bo_unreference(gpe_context->dynamic_state.bo);
@@ -1151,56 +1323,28 @@ gen8_gpe_load_kernels(VADriverContextP ctx,
                       struct i965_kernel *kernel_list,
                       unsigned int num_kernels)
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
-    int i, kernel_size;
-    unsigned int kernel_offset, end_offset;
-    unsigned char *kernel_ptr;
-    struct i965_kernel *kernel;
+    struct i965_kernel *kernels[MAX_GPE_KERNELS];
+    unsigned int end_offset;
+    int i;
 
     assert(num_kernels <= MAX_GPE_KERNELS);
     memcpy(gpe_context->kernels, kernel_list, sizeof(*kernel_list) * num_kernels);
     gpe_context->num_kernels = num_kernels;
+    gpe_context->kernel_cache = &i965_driver_data(ctx)->kernel_cache;
 
-    kernel_size = num_kernels * 64;
-    for (i = 0; i < num_kernels; i++) {
-        kernel = &gpe_context->kernels[i];
+    for (i = 0; i < num_kernels; i++)
+        kernels[i] = &gpe_context->kernels[i];
 
-        kernel_size += kernel->size;
-    }
-
-    gpe_context->instruction_state.bo = dri_bo_alloc(i965->intel.bufmgr,
-                                  "kernel shader",
-                                  kernel_size,
-                                  0x1000);
+    /* shared with the other contexts using the same kernels */
+    gpe_context->instruction_state.bo = i965_kernel_cache_get(ctx, kernels, num_kernels, &end_offset);
     if (gpe_context->instruction_state.bo == NULL) {
         WARN_ONCE("failure to allocate the buffer space for kernel shader\n");
         return;
     }
 
-    assert(gpe_context->instruction_state.bo);
-
-    gpe_context->instruction_state.bo_size = kernel_size;
-    gpe_context->instruction_state.end_offset = 0;
-    end_offset = 0;
-
-    dri_bo_map(gpe_context->instruction_state.bo, 1);
-    kernel_ptr = (unsigned char *)(gpe_context->instruction_state.bo->virtual);
-    for (i = 0; i < num_kernels; i++) {
-        kernel_offset = ALIGN(end_offset, 64);
-        kernel = &gpe_context->kernels[i];
-        kernel->kernel_offset = kernel_offset;
-
-        if (kernel->size) {
-            memcpy(kernel_ptr + kernel_offset, kernel->bin, kernel->size);
-
-            end_offset = kernel_offset + kernel->size;
-        }
-    }
-
+    gpe_context->instruction_state.bo_size = gpe_context->instruction_state.bo->size;
     gpe_context->instruction_state.end_offset = end_offset;
 
-    dri_bo_unmap(gpe_context->instruction_state.bo);
-
     return;
 }
 
@@ -114,6 +114,7 @@ struct i965_gpe_context
 
     unsigned int num_kernels;
     struct i965_kernel kernels[MAX_GPE_KERNELS];
+    struct i965_kernel_cache *kernel_cache;     /* of the kernel BOs */
 
     struct {
         dri_bo *bo;
@@ -139,6 +140,27 @@ struct i965_gpe_context
     int curbe_size;
 };
 
+void i965_kernel_cache_init(struct i965_kernel_cache *cache);
+void i965_kernel_cache_terminate(struct i965_kernel_cache *cache);
+
+/*
+ * Returns a new reference to a BO holding the num_kernels kernels, each at
+ * a 64 byte aligned offset stored in its kernel_offset, and sets size to
+ * the end of the last one when not NULL. The kernels are identified by
+ * their binary, a list is uploaded once while it has users and the BO is
+ * shared by all of them, so it must not be written.
+ */
+dri_bo *i965_kernel_cache_get(VADriverContextP ctx,
+                              struct i965_kernel **kernels,
+                              int num_kernels,
+                              unsigned int *size);
+
+/*
+ * Drops a reference returned by i965_kernel_cache_get(), the list is
+ * dropped from the cache with its last user
+ */
+void i965_kernel_cache_put(struct i965_kernel_cache *cache, dri_bo *bo);
+
 void i965_gpe_context_destroy(struct i965_gpe_context *gpe_context);
 void i965_gpe_context_init(VADriverContextP ctx,
                            struct i965_gpe_context *gpe_context);
@@ -0,0 +1,305 @@
+/*
+ * i965_jpeg_huffman.c - JPEG Huffman tables from image statistics
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+#include "i965_jpeg_huffman.h"
+
+/* Raster position of the coefficients, in zigzag order */
+static const uint8_t jpeg_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+/* DCT basis: C(u) / 2 * cos((2x + 1) * u * PI / 16), with C(0) = 1 / sqrt(2) */
+static const float jpeg_dct_basis[8][8] = {
+    { 0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f },
+    { 0.490392640f, 0.415734806f, 0.277785117f, 0.097545161f, -0.097545161f, -0.277785117f, -0.415734806f, -0.490392640f },
+    { 0.461939766f, 0.191341716f, -0.191341716f, -0.461939766f, -0.461939766f, -0.191341716f, 0.191341716f, 0.461939766f },
+    { 0.415734806f, -0.097545161f, -0.490392640f, -0.277785117f, 0.277785117f, 0.490392640f, 0.097545161f, -0.415734806f },
+    { 0.353553391f, -0.353553391f, -0.353553391f, 0.353553391f, 0.353553391f, -0.353553391f, -0.353553391f, 0.353553391f },
+    { 0.277785117f, -0.490392640f, 0.097545161f, 0.415734806f, -0.415734806f, -0.097545161f, 0.490392640f, -0.277785117f },
+    { 0.191341716f, -0.461939766f, 0.461939766f, -0.191341716f, -0.191341716f, 0.461939766f, -0.461939766f, 0.191341716f },
+    { 0.097545161f, -0.277785117f, 0.415734806f, -0.490392640f, 0.490392640f, -0.415734806f, 0.277785117f, -0.097545161f },
+};
+
+/* Largest code length the construction of Annex K.2 can produce */
+#define JPEG_HUFFMAN_MAX_CODESIZE       63
+
+void
+i965_jpeg_load_block(const uint8_t *plane, int pitch, int step,
+                     int width, int height, int x, int y, uint8_t block[64])
+{
+    int i, j, sx, sy;
+
+    for (j = 0; j < 8; j++) {
+        sy = y + j < height ? y + j : height - 1;
+
+        for (i = 0; i < 8; i++) {
+            sx = x + i < width ? x + i : width - 1;
+            block[j * 8 + i] = plane[sy * pitch + sx * step];
+        }
+    }
+}
+
+void
+i965_jpeg_quantize_block(const uint8_t block[64], const uint8_t qm[64],
+                         int16_t coefs[64])
+{
+    float rows[64], f;
+    int k, u, v, x, y;
+
+    for (y = 0; y < 8; y++) {
+        for (u = 0; u < 8; u++) {
+            f = 0.0f;
+
+            for (x = 0; x < 8; x++)
+                f += jpeg_dct_basis[u][x] * (block[y * 8 + x] - 128);
+
+            rows[y * 8 + u] = f;
+        }
+    }
+
+    for (k = 0; k < 64; k++) {
+        u = jpeg_zigzag[k] % 8;
+        v = jpeg_zigzag[k] / 8;
+        f = 0.0f;
+
+        for (y = 0; y < 8; y++)
+            f += jpeg_dct_basis[v][y] * rows[y * 8 + u];
+
+        f /= qm[k] ? qm[k] : 1;
+        coefs[k] = (int16_t)(f < 0.0f ? f - 0.5f : f + 0.5f);
+    }
+}
+
+/* Number of bits of the magnitude, i.e. the size category */
+static int
+jpeg_coef_size(int value)
+{
+    int size = 0;
+
+    if (value < 0)
+        value = -value;
+
+    while (value) {
+        size++;
+        value >>= 1;
+    }
+
+    return size;
+}
+
+void
+i965_jpeg_huffman_count_block(struct i965_jpeg_huffman_stats *dc_stats,
+                              struct i965_jpeg_huffman_stats *ac_stats,
+                              const int16_t coefs[64], int *dc_pred)
+{
+    int k, run = 0, size;
+
+    size = jpeg_coef_size(coefs[0] - *dc_pred);
+    *dc_pred = coefs[0];
+    dc_stats->dc_freq[size < I965_JPEG_HUFFMAN_DC_SYMBOLS ? size : I965_JPEG_HUFFMAN_DC_SYMBOLS - 1]++;
+
+    for (k = 1; k < 64; k++) {
+        if (!coefs[k]) {
+            run++;
+            continue;
+        }
+
+        /* ZRL */
+        while (run > 15) {
+            ac_stats->ac_freq[0xf0]++;
+            run -= 16;
+        }
+
+        size = jpeg_coef_size(coefs[k]);
+        ac_stats->ac_freq[(run << 4) | (size < 10 ? size : 10)]++;
+        run = 0;
+    }
+
+    /* EOB */
+    if (run)
+        ac_stats->ac_freq[0x00]++;
+}
+
+void
+i965_jpeg_huffman_stats_complete(struct i965_jpeg_huffman_stats *stats)
+{
+    int run, size;
+
+    for (size = 0; size < I965_JPEG_HUFFMAN_DC_SYMBOLS; size++) {
+        if (!stats->dc_freq[size])
+            stats->dc_freq[size] = 1;
+    }
+
+    for (run = 0; run < 16; run++) {
+        for (size = 1; size <= 10; size++) {
+            if (!stats->ac_freq[(run << 4) | size])
+                stats->ac_freq[(run << 4) | size] = 1;
+        }
+    }
+
+    if (!stats->ac_freq[0x00])
+        stats->ac_freq[0x00] = 1;
+    if (!stats->ac_freq[0xf0])
+        stats->ac_freq[0xf0] = 1;
+}
+
+int
+i965_jpeg_huffman_build(const unsigned int *freq, int num_symbols,
+                        uint8_t bits[I965_JPEG_HUFFMAN_MAX_LENGTH],
+                        uint8_t *huffval)
+{
+    unsigned int counts[257];
+    int codesize[257], others[257];
+    int num_codes[JPEG_HUFFMAN_MAX_CODESIZE + 1];
+    int i, j, v1, v2, n, num_values;
+
+    assert(num_symbols <= 256);
+    memset(bits, 0, I965_JPEG_HUFFMAN_MAX_LENGTH);
+
+    for (i = 0; i < num_symbols; i++) {
+        if (freq[i])
+            break;
+    }
+
+    if (i == num_symbols)
+        return 0;
+
+    /*
+     * An extra symbol with the lowest count takes the code point made of
+     * 1-bits only, and is removed once the code lengths are known
+     */
+    n = num_symbols + 1;
+
+    for (i = 0; i < n; i++) {
+        counts[i] = i < num_symbols ? freq[i] : 1;
+        codesize[i] = 0;
+        others[i] = -1;
+    }
+
+    /* Figure K.1: code sizes */
+    for (;;) {
+        v1 = v2 = -1;
+
+        /* the two least non-zero counts, the larger symbol first on ties */
+        for (i = 0; i < n; i++) {
+            if (!counts[i])
+                continue;
+
+            if (v1 < 0 || counts[i] <= counts[v1]) {
+                v2 = v1;
+                v1 = i;
+            } else if (v2 < 0 || counts[i] <= counts[v2])
+                v2 = i;
+        }
+
+        if (v2 < 0)
+            break;
+
+        counts[v1] += counts[v2];
+        counts[v2] = 0;
+
+        codesize[v1]++;
+
+        while (others[v1] >= 0) {
+            v1 = others[v1];
+            codesize[v1]++;
+        }
+
+        others[v1] = v2;
+        codesize[v2]++;
+
+        while (others[v2] >= 0) {
+            v2 = others[v2];
+            codesize[v2]++;
+        }
+    }
+
+    /* Figure K.2: number of codes of each size */
+    memset(num_codes, 0, sizeof(num_codes));
+
+    for (i = 0; i < n; i++) {
+        if (codesize[i]) {
+            assert(codesize[i] <= JPEG_HUFFMAN_MAX_CODESIZE);
+            num_codes[codesize[i]]++;
+        }
+    }
+
+    /* Figure K.3: limit the code lengths to 16 bits */
+    for (i = JPEG_HUFFMAN_MAX_CODESIZE; i > I965_JPEG_HUFFMAN_MAX_LENGTH; i--) {
+        while (num_codes[i] > 0) {
+            j = i - 2;
+
+            while (num_codes[j] == 0)
+                j--;
+
+            num_codes[i] -= 2;
+            num_codes[i - 1]++;
+            num_codes[j + 1] += 2;
+            num_codes[j]--;
+        }
+    }
+
+    /* remove the reserved code point, one of the longest codes */
+    for (i = I965_JPEG_HUFFMAN_MAX_LENGTH; num_codes[i] == 0; i--)
+        ;
+
+    num_codes[i]--;
+
+    for (i = 1; i <= I965_JPEG_HUFFMAN_MAX_LENGTH; i++)
+        bits[i - 1] = num_codes[i];
+
+    /*
+     * Figure K.4: symbols sorted by code size. The limiting above may
+     * split the symbols of one code size in two lengths, so the more
+     * frequent ones of a size come first
+     */
+    num_values = 0;
+
+    for (i = 1; i <= JPEG_HUFFMAN_MAX_CODESIZE; i++) {
+        for (j = 0; j < num_symbols; j++) {
+            if (codesize[j] != i)
+                continue;
+
+            for (v1 = num_values;
+                 v1 > 0 && codesize[huffval[v1 - 1]] == i && freq[huffval[v1 - 1]] < freq[j];
+                 v1--)
+                huffval[v1] = huffval[v1 - 1];
+
+            huffval[v1] = j;
+            num_values++;
+        }
+    }
+
+    return num_values;
+}
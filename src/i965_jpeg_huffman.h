@@ -0,0 +1,89 @@
+/*
+ * i965_jpeg_huffman.h - JPEG Huffman tables from image statistics
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_JPEG_HUFFMAN_H
+#define I965_JPEG_HUFFMAN_H
+
+#include <stdint.h>
+
+/** Longest code length allowed by JPEG */
+#define I965_JPEG_HUFFMAN_MAX_LENGTH    16
+
+/** Number of DC (size categories) and AC (run/size) symbols of baseline JPEG */
+#define I965_JPEG_HUFFMAN_DC_SYMBOLS    12
+#define I965_JPEG_HUFFMAN_AC_SYMBOLS    162
+
+/** Symbol counts of one DC and one AC table */
+struct i965_jpeg_huffman_stats {
+    unsigned int dc_freq[I965_JPEG_HUFFMAN_DC_SYMBOLS];
+    unsigned int ac_freq[256];
+};
+
+/**
+ * Reads the 8x8 block at (x, y) of a plane of width x height samples,
+ * step bytes apart, replicating the last column and row past the edges
+ */
+void
+i965_jpeg_load_block(const uint8_t *plane, int pitch, int step,
+                     int width, int height, int x, int y, uint8_t block[64]);
+
+/**
+ * Forward DCT of a block of samples, quantized with qm. Both qm and the
+ * resulting coefficients are in zigzag order
+ */
+void
+i965_jpeg_quantize_block(const uint8_t block[64], const uint8_t qm[64],
+                         int16_t coefs[64]);
+
+/**
+ * Counts the symbols a baseline encoder emits for the quantized block, in
+ * the DC table of dc_stats and the AC table of ac_stats. dc_pred holds the
+ * DC coefficient of the previous block of the component and is updated
+ */
+void
+i965_jpeg_huffman_count_block(struct i965_jpeg_huffman_stats *dc_stats,
+                              struct i965_jpeg_huffman_stats *ac_stats,
+                              const int16_t coefs[64], int *dc_pred);
+
+/**
+ * Gives every baseline symbol a non-zero count, so that the tables built
+ * from the statistics can code any block and not only the counted ones
+ */
+void
+i965_jpeg_huffman_stats_complete(struct i965_jpeg_huffman_stats *stats);
+
+/**
+ * Builds the optimal Huffman table for the symbol counts, as per JPEG
+ * Annex K.2: code lengths are limited to 16 bits, and no code consists
+ * of 1-bits only. Returns the number of symbols stored in huffval, in
+ * order of increasing code length
+ */
+int
+i965_jpeg_huffman_build(const unsigned int *freq, int num_symbols,
+                        uint8_t bits[I965_JPEG_HUFFMAN_MAX_LENGTH],
+                        uint8_t *huffval);
+
+#endif /* I965_JPEG_HUFFMAN_H */
@@ -0,0 +1,260 @@
+/*
+ * i965_jpeg_huffman_test.c - CPU tests of the JPEG Huffman table builder
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks that the tables of i965_jpeg_huffman_build() are valid JPEG
+ * tables (every counted symbol has a code, no code is longer than 16 bits
+ * or made of 1-bits only, the codes are a prefix code) and that the more
+ * frequent symbols get the shorter codes, on regular and on skewed
+ * histograms which force the length limiting. Run by make check.
+ */
+
+#include "sysdeps.h"
+#include "i965_jpeg_huffman.h"
+
+static int test_failures = 0;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+static unsigned int random_state = 1;
+
+static unsigned int
+test_random(void)
+{
+    random_state = random_state * 1103515245 + 12345;
+    return (random_state >> 16) & 0x7fff;
+}
+
+/*
+ * Builds the table of freq and checks it. Returns the length of the
+ * longest code
+ */
+static int
+check_table(const unsigned int *freq, int num_symbols)
+{
+    uint8_t bits[I965_JPEG_HUFFMAN_MAX_LENGTH];
+    uint8_t huffval[256];
+    int length[256];
+    int i, j, k, num_values, num_counted, max_length;
+    unsigned int code;
+
+    num_values = i965_jpeg_huffman_build(freq, num_symbols, bits, huffval);
+
+    for (i = 0, num_counted = 0; i < num_symbols; i++) {
+        if (freq[i])
+            num_counted++;
+        length[i] = 0;
+    }
+
+    CHECK(num_values == num_counted);
+
+    for (i = 0, j = 0; i < I965_JPEG_HUFFMAN_MAX_LENGTH; i++)
+        j += bits[i];
+
+    CHECK(j == num_values);
+
+    if (num_values != num_counted || j != num_values)
+        return 0;
+
+    /* Figure C.1 and C.2: canonical codes, by increasing length */
+    code = 0;
+    max_length = 0;
+
+    for (i = 0, k = 0; i < I965_JPEG_HUFFMAN_MAX_LENGTH; i++) {
+        for (j = 0; j < bits[i]; j++, k++) {
+            /* a prefix code: the codes of a length never overflow it */
+            CHECK(code < (1u << (i + 1)));
+            /* no code is made of 1-bits only */
+            CHECK(code != (1u << (i + 1)) - 1);
+
+            CHECK(freq[huffval[k]] != 0);
+            CHECK(length[huffval[k]] == 0);
+            length[huffval[k]] = i + 1;
+            max_length = i + 1;
+            code++;
+        }
+
+        code <<= 1;
+    }
+
+    /* the more frequent symbols don't have the longer codes */
+    for (i = 0; i < num_symbols; i++) {
+        for (j = 0; j < num_symbols; j++) {
+            if (freq[i] && freq[j] && freq[i] > freq[j])
+                CHECK(length[i] <= length[j]);
+        }
+    }
+
+    return max_length;
+}
+
+static void
+test_empty(void)
+{
+    unsigned int freq[I965_JPEG_HUFFMAN_DC_SYMBOLS];
+    uint8_t bits[I965_JPEG_HUFFMAN_MAX_LENGTH];
+    uint8_t huffval[I965_JPEG_HUFFMAN_DC_SYMBOLS];
+    int i;
+
+    memset(freq, 0, sizeof(freq));
+    CHECK(i965_jpeg_huffman_build(freq, I965_JPEG_HUFFMAN_DC_SYMBOLS, bits, huffval) == 0);
+
+    for (i = 0; i < I965_JPEG_HUFFMAN_MAX_LENGTH; i++)
+        CHECK(bits[i] == 0);
+
+    /* A single symbol gets the 1 bit code 0, not 1 */
+    freq[5] = 100;
+    CHECK(i965_jpeg_huffman_build(freq, I965_JPEG_HUFFMAN_DC_SYMBOLS, bits, huffval) == 1);
+    CHECK(bits[0] == 1 && huffval[0] == 5);
+    CHECK(check_table(freq, I965_JPEG_HUFFMAN_DC_SYMBOLS) == 1);
+}
+
+static void
+test_uniform(void)
+{
+    unsigned int freq[256];
+    int i;
+
+    /* 8 equal counts, plus the reserved code point: 7 codes of 3 bits
+     * and 1 of 4 bits */
+    for (i = 0; i < 8; i++)
+        freq[i] = 10;
+
+    CHECK(check_table(freq, 8) == 4);
+
+    for (i = 0; i < I965_JPEG_HUFFMAN_AC_SYMBOLS; i++)
+        freq[i] = 1000;
+
+    CHECK(check_table(freq, I965_JPEG_HUFFMAN_AC_SYMBOLS) <= 8);
+}
+
+static void
+test_skewed(void)
+{
+    unsigned int freq[256];
+    int i;
+
+    /*
+     * Fibonacci counts give the deepest Huffman trees: without the limit,
+     * the 40 symbols would take codes of up to 40 bits
+     */
+    memset(freq, 0, sizeof(freq));
+    freq[0] = freq[1] = 1;
+
+    for (i = 2; i < 40; i++)
+        freq[i] = freq[i - 1] + freq[i - 2];
+
+    CHECK(check_table(freq, 40) == I965_JPEG_HUFFMAN_MAX_LENGTH);
+
+    /* The same at the end of a completed AC table */
+    for (i = 0; i < I965_JPEG_HUFFMAN_AC_SYMBOLS; i++)
+        freq[i] = i < 40 ? freq[i] : 0;
+
+    for (i = 0; i < 40; i++)
+        freq[I965_JPEG_HUFFMAN_AC_SYMBOLS - 40 + i] = freq[i];
+
+    for (i = 0; i < I965_JPEG_HUFFMAN_AC_SYMBOLS - 40; i++)
+        freq[i] = 1;
+
+    CHECK(check_table(freq, I965_JPEG_HUFFMAN_AC_SYMBOLS) == I965_JPEG_HUFFMAN_MAX_LENGTH);
+
+    /* Powers of two: one dominant symbol, the others halving */
+    for (i = 0; i < 31; i++)
+        freq[i] = 1u << (30 - i);
+
+    CHECK(check_table(freq, 31) == I965_JPEG_HUFFMAN_MAX_LENGTH);
+
+    /* One symbol with nearly all of the count takes a 1 bit code, the 161
+     * others seen once and the reserved code point share the other half */
+    for (i = 0; i < I965_JPEG_HUFFMAN_AC_SYMBOLS; i++)
+        freq[i] = 1;
+
+    freq[0] = 0xffff0000;
+    CHECK(check_table(freq, I965_JPEG_HUFFMAN_AC_SYMBOLS) == 9);
+}
+
+static void
+test_random_histograms(void)
+{
+    unsigned int freq[256];
+    int n, i, num_symbols;
+
+    for (n = 0; n < 2000; n++) {
+        num_symbols = n & 1 ? I965_JPEG_HUFFMAN_AC_SYMBOLS : I965_JPEG_HUFFMAN_DC_SYMBOLS;
+
+        /* counts spread over many orders of magnitude, some unused */
+        for (i = 0; i < num_symbols; i++) {
+            if (test_random() % 8 == 0)
+                freq[i] = 0;
+            else
+                freq[i] = 1 + (test_random() >> (test_random() % 15)) * (1u << (test_random() % 16));
+        }
+
+        check_table(freq, num_symbols);
+    }
+}
+
+static void
+test_stats_complete(void)
+{
+    struct i965_jpeg_huffman_stats stats;
+    int i;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.dc_freq[0] = 1000;
+    stats.ac_freq[0x00] = 1000;
+    stats.ac_freq[0x01] = 500;
+    i965_jpeg_huffman_stats_complete(&stats);
+
+    /* The completed tables code every baseline symbol */
+    for (i = 0; i < I965_JPEG_HUFFMAN_DC_SYMBOLS; i++)
+        CHECK(stats.dc_freq[i] != 0);
+
+    CHECK(check_table(stats.dc_freq, I965_JPEG_HUFFMAN_DC_SYMBOLS) <= I965_JPEG_HUFFMAN_MAX_LENGTH);
+    CHECK(check_table(stats.ac_freq, 256) <= I965_JPEG_HUFFMAN_MAX_LENGTH);
+}
+
+int
+main(void)
+{
+    test_empty();
+    test_uniform();
+    test_skewed();
+    test_random_histograms();
+    test_stats_complete();
+
+    if (test_failures) {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return 1;
+    }
+
+    return 0;
+}
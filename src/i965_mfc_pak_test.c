@@ -0,0 +1,350 @@
+/*
+ * i965_mfc_pak_test.c - checks the row PAK object emitter against the
+ *                       per-macroblock one
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Usage: i965_mfc_pak_test [dump...]
+ *
+ * Generates the PAK objects of each picture with
+ * intel_mfc_avc_pak_object_row() and with the per-macroblock emitter it
+ * replaced, for the whole picture as one slice and for random slice
+ * splits, and compares the dwords and the VME output left behind (the MVs
+ * are expanded in place). The pictures are read from VME output dumps
+ * recorded with VA_INTEL_VME_DUMP=<file>, see intel_mfc_pak.h, or are made
+ * of random VME records when no dump is given, as done by make check.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i965_defines.h"
+#include "intel_mfc_pak.h"
+
+/* The Gen8 emitter before the row one, with the same constants */
+#define AVC_INTRA_RDO_OFFSET    4
+#define AVC_INTER_RDO_OFFSET    10
+#define AVC_INTER_MSG_OFFSET    8
+#define AVC_INTER_MV_OFFSET     48
+#define AVC_RDO_MASK            0xFFFF
+#define MSG_MV_OFFSET           4
+#define INTER_MODE_MASK         0x03
+#define INTER_8X8               0x03
+#define INTER_16X8              0x01
+#define INTER_8X16              0x02
+#define SUBMB_SHAPE_MASK        0x00FF00
+#define INTER_MV8               (4 << 20)
+#define INTER_MV32              (6 << 20)
+#define INTRA_MSG_FLAG          (1 << 13)
+#define INTRA_MBTYPE_MASK       (0x1F0000)
+
+#define NUM_RANDOM_PICTURES     64
+#define NUM_SPLITS              8
+
+static int
+ref_pak_object_intra(unsigned int *cmd, int x, int y, int end_mb,
+                     int qp, unsigned int *msg)
+{
+    unsigned int intra_msg;
+
+    intra_msg = msg[0] & 0xC0FF;
+    intra_msg |= INTRA_MSG_FLAG;
+    intra_msg |= ((msg[0] & INTRA_MBTYPE_MASK) >> 8);
+    cmd[0] = MFC_AVC_PAK_OBJECT | (12 - 2);
+    cmd[1] = 0;
+    cmd[2] = 0;
+    cmd[3] = (1 << 19) | (1 << 18) | (1 << 17) | intra_msg;
+    cmd[4] = (0xFFFF << 16) | (y << 8) | x;
+    cmd[5] = 0x000F000F;
+    cmd[6] = (end_mb << 26) | qp;
+    cmd[7] = msg[1];
+    cmd[8] = msg[2];
+    cmd[9] = msg[3] & 0xFF;
+    cmd[10] = 0;
+    cmd[11] = 0;
+
+    return 12;
+}
+
+static int
+ref_pak_object_inter(unsigned int *cmd, int x, int y, int end_mb, int qp,
+                     unsigned int *msg, unsigned int offset,
+                     const unsigned int *ref_index_in_mb)
+{
+    unsigned int *mv_ptr = msg + MSG_MV_OFFSET;
+    unsigned int inter_msg;
+
+    if ((msg[0] & INTER_MODE_MASK) == INTER_8X16) {
+        mv_ptr[4] = mv_ptr[0];
+        mv_ptr[5] = mv_ptr[1];
+        mv_ptr[2] = mv_ptr[8];
+        mv_ptr[3] = mv_ptr[9];
+        mv_ptr[6] = mv_ptr[8];
+        mv_ptr[7] = mv_ptr[9];
+    } else if ((msg[0] & INTER_MODE_MASK) == INTER_16X8) {
+        mv_ptr[2] = mv_ptr[0];
+        mv_ptr[3] = mv_ptr[1];
+        mv_ptr[4] = mv_ptr[16];
+        mv_ptr[5] = mv_ptr[17];
+        mv_ptr[6] = mv_ptr[24];
+        mv_ptr[7] = mv_ptr[25];
+    } else if (((msg[0] & INTER_MODE_MASK) == INTER_8X8) &&
+               !(msg[1] & SUBMB_SHAPE_MASK)) {
+        mv_ptr[2] = mv_ptr[8];
+        mv_ptr[3] = mv_ptr[9];
+        mv_ptr[4] = mv_ptr[16];
+        mv_ptr[5] = mv_ptr[17];
+        mv_ptr[6] = mv_ptr[24];
+        mv_ptr[7] = mv_ptr[25];
+    }
+
+    cmd[0] = MFC_AVC_PAK_OBJECT | (12 - 2);
+
+    inter_msg = 32;
+    if ((msg[0] & INTER_MODE_MASK) == INTER_8X8) {
+        if (msg[1] & SUBMB_SHAPE_MASK)
+            inter_msg = 128;
+    }
+    cmd[1] = inter_msg;
+    cmd[2] = offset;
+    inter_msg = msg[0] & (0x1F00FFFF);
+    inter_msg |= INTER_MV8;
+    inter_msg |= ((1 << 19) | (1 << 18) | (1 << 17));
+    if (((msg[0] & INTER_MODE_MASK) == INTER_8X8) &&
+        (msg[1] & SUBMB_SHAPE_MASK))
+        inter_msg |= INTER_MV32;
+    cmd[3] = inter_msg;
+    cmd[4] = (0xFFFF << 16) | (y << 8) | x;
+    cmd[5] = 0x000F000F;
+    cmd[6] = (end_mb << 26) | qp;
+    cmd[7] = msg[1] >> 8;
+    cmd[8] = ref_index_in_mb[0];
+    cmd[9] = ref_index_in_mb[1];
+    cmd[10] = 0;
+    cmd[11] = 0;
+
+    return 12;
+}
+
+/* The loop of gen8_mfc_avc_pipeline_slice_programing() before */
+static int
+ref_slice(unsigned int *cmd, unsigned char *msg_ptr,
+          const struct intel_mfc_vme_dump_header *header,
+          int first_mb, int num_mbs)
+{
+    unsigned int *cmd_start = cmd, *msg;
+    int i, x, y, last_mb;
+
+    for (i = first_mb; i < first_mb + num_mbs; i++) {
+        last_mb = i == first_mb + num_mbs - 1;
+        x = i % header->width_in_mbs;
+        y = i / header->width_in_mbs;
+        msg = (unsigned int *)(msg_ptr + i * header->size_block);
+
+        if (header->is_intra ||
+            (msg[AVC_INTRA_RDO_OFFSET] & AVC_RDO_MASK) <
+            (msg[AVC_INTER_RDO_OFFSET] & AVC_RDO_MASK))
+            cmd += ref_pak_object_intra(cmd, x, y, last_mb, header->qp, msg);
+        else
+            cmd += ref_pak_object_inter(cmd, x, y, last_mb, header->qp,
+                                        msg + AVC_INTER_MSG_OFFSET,
+                                        i * header->size_block + AVC_INTER_MV_OFFSET,
+                                        header->ref_index_in_mb);
+    }
+
+    return cmd - cmd_start;
+}
+
+/* The loop of gen8_mfc_avc_pipeline_slice_programing() now */
+static int
+row_slice(unsigned int *cmd, unsigned char *msg_ptr,
+          const struct intel_mfc_vme_dump_header *header,
+          int first_mb, int num_mbs)
+{
+    unsigned int *cmd_start = cmd;
+    int i, x, end_mb = first_mb + num_mbs, row_mbs;
+
+    for (i = first_mb; i < end_mb; i += row_mbs) {
+        x = i % header->width_in_mbs;
+        row_mbs = header->width_in_mbs - x;
+        if (row_mbs > end_mb - i)
+            row_mbs = end_mb - i;
+
+        cmd += intel_mfc_avc_pak_object_row(cmd, msg_ptr, header->size_block,
+                                            x, i / header->width_in_mbs,
+                                            header->width_in_mbs,
+                                            row_mbs,
+                                            i + row_mbs == end_mb,
+                                            header->qp,
+                                            header->is_intra,
+                                            header->ref_index_in_mb);
+    }
+
+    return cmd - cmd_start;
+}
+
+/* Returns the number of mismatching slices */
+static int
+check_picture(const struct intel_mfc_vme_dump_header *header,
+              const unsigned char *vme_output, const char *name)
+{
+    int num_mbs = header->width_in_mbs * header->height_in_mbs;
+    size_t vme_size = (size_t)num_mbs * header->size_block;
+    unsigned char *vme_ref = malloc(vme_size), *vme_row = malloc(vme_size);
+    unsigned int *cmd_ref = malloc(num_mbs * INTEL_AVC_PAK_OBJECT_DWORDS * 4);
+    unsigned int *cmd_row = malloc(num_mbs * INTEL_AVC_PAK_OBJECT_DWORDS * 4);
+    int split, first_mb, slice_mbs, len_ref, len_row, failures = 0;
+
+    if (!vme_ref || !vme_row || !cmd_ref || !cmd_row) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for (split = 0; split < NUM_SPLITS; split++) {
+        memcpy(vme_ref, vme_output, vme_size);
+        memcpy(vme_row, vme_output, vme_size);
+
+        for (first_mb = 0; first_mb < num_mbs; first_mb += slice_mbs) {
+            /* the whole picture first, then random slices */
+            slice_mbs = split ? 1 + rand() % (2 * header->width_in_mbs + 1) : num_mbs;
+            if (slice_mbs > num_mbs - first_mb)
+                slice_mbs = num_mbs - first_mb;
+
+            len_ref = ref_slice(cmd_ref, vme_ref, header, first_mb, slice_mbs);
+            len_row = row_slice(cmd_row, vme_row, header, first_mb, slice_mbs);
+
+            if (len_ref != len_row ||
+                memcmp(cmd_ref, cmd_row, len_ref * 4)) {
+                fprintf(stderr, "%s: PAK objects differ for MBs %d-%d\n",
+                        name, first_mb, first_mb + slice_mbs - 1);
+                failures++;
+            }
+        }
+
+        if (memcmp(vme_ref, vme_row, vme_size)) {
+            fprintf(stderr, "%s: expanded MVs differ\n", name);
+            failures++;
+        }
+    }
+
+    free(vme_ref);
+    free(vme_row);
+    free(cmd_ref);
+    free(cmd_row);
+
+    return failures;
+}
+
+static void
+random_picture(struct intel_mfc_vme_dump_header *header, unsigned char **vme_output)
+{
+    unsigned int *msg;
+    size_t i, size;
+
+    header->width_in_mbs = 1 + rand() % 120;
+    header->height_in_mbs = 1 + rand() % 8;
+    header->is_intra = rand() % 4 == 0;
+    header->size_block = header->is_intra ? 32 : 384;
+    header->qp = rand() % 52;
+    header->ref_index_in_mb[0] = rand();
+    header->ref_index_in_mb[1] = rand();
+
+    size = (size_t)header->width_in_mbs * header->height_in_mbs * header->size_block;
+    *vme_output = malloc(size);
+    if (!*vme_output) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < size; i++)
+        (*vme_output)[i] = rand();
+
+    /* Only some of the 8x8 inter macroblocks have sub-MB shapes */
+    for (i = 0; i < size; i += header->size_block) {
+        msg = (unsigned int *)(*vme_output + i);
+
+        if (!header->is_intra && rand() % 2)
+            msg[AVC_INTER_MSG_OFFSET + 1] &= ~SUBMB_SHAPE_MASK;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct intel_mfc_vme_dump_header header;
+    unsigned char *vme_output;
+    char name[64];
+    size_t size;
+    FILE *fp;
+    int i, num_pictures = 0, failures = 0;
+
+    srand(1);
+
+    if (argc < 2) {
+        for (i = 0; i < NUM_RANDOM_PICTURES; i++) {
+            random_picture(&header, &vme_output);
+            sprintf(name, "random picture %d", i);
+            failures += check_picture(&header, vme_output, name);
+            free(vme_output);
+            num_pictures++;
+        }
+    }
+
+    for (i = 1; i < argc; i++) {
+        fp = fopen(argv[i], "rb");
+        if (!fp) {
+            fprintf(stderr, "Failed to open %s\n", argv[i]);
+            return 1;
+        }
+
+        while (fread(&header, sizeof(header), 1, fp) == 1) {
+            /* the row emitter relies on the MVs being within the record */
+            if (!header.width_in_mbs || !header.height_in_mbs ||
+                header.size_block < (header.is_intra ? 16 : 160)) {
+                fprintf(stderr, "%s: bad header\n", argv[i]);
+                return 1;
+            }
+
+            size = (size_t)header.width_in_mbs * header.height_in_mbs * header.size_block;
+            vme_output = malloc(size);
+            if (!vme_output || fread(vme_output, size, 1, fp) != 1) {
+                fprintf(stderr, "%s: truncated picture\n", argv[i]);
+                return 1;
+            }
+
+            snprintf(name, sizeof(name), "%s picture %d", argv[i], num_pictures);
+            failures += check_picture(&header, vme_output, name);
+            free(vme_output);
+            num_pictures++;
+        }
+
+        fclose(fp);
+    }
+
+    printf("%d pictures, %d mismatches\n", num_pictures, failures);
+
+    return failures ? 1 : 0;
+}
@@ -35,6 +35,32 @@ _i965UnlockMutex(_I965Mutex *m)
 #define _I965_DECLARE_MUTEX(m)                    \
     _I965Mutex m = _I965_MUTEX_INITIALIZER
 
+typedef pthread_cond_t _I965Cond;
+
+static INLINE void
+_i965InitCond(_I965Cond *c)
+{
+    pthread_cond_init(c, NULL);
+}
+
+static INLINE void
+_i965DestroyCond(_I965Cond *c)
+{
+    pthread_cond_destroy(c);
+}
+
+static INLINE void
+_i965WaitCond(_I965Cond *c, _I965Mutex *m)
+{
+    pthread_cond_wait(c, m);
+}
+
+static INLINE void
+_i965BroadcastCond(_I965Cond *c)
+{
+    pthread_cond_broadcast(c);
+}
+
 #else
 
 typedef int _I965Mutex;
@@ -47,6 +73,12 @@ static INLINE void _i965UnlockMutex(_I965Mutex *m) { (void) m; }
 #define _I965_DECLARE_MUTEX(m)                    \
     _I965Mutex m = _I965_MUTEX_INITIALIZER
 
+typedef int _I965Cond;
+static INLINE void _i965InitCond(_I965Cond *c) { (void) c; }
+static INLINE void _i965DestroyCond(_I965Cond *c) { (void) c; }
+static INLINE void _i965WaitCond(_I965Cond *c, _I965Mutex *m) { (void) c; (void) m; }
+static INLINE void _i965BroadcastCond(_I965Cond *c) { (void) c; }
+
 #endif
 
 #endif /* _I965_MUTEX_H_ */
@@ -37,8 +37,10 @@
 #include "i965_structs.h"
 #include "i965_drv_video.h"
 #include "i965_post_processing.h"
+#include "i965_gpe_utils.h"
 #include "i965_render.h"
 #include "intel_media.h"
+#include "i965_vpp_compose.h"
 
 extern VAStatus
 vpp_surface_convert(VADriverContextP ctx,
@@ -59,6 +61,8 @@ vpp_surface_convert(VADriverContextP ctx,
 
 #define VA_STATUS_SUCCESS_1                     0xFFFFFFFE
 
+#define I965_PROC_DEFERRED_MIN_SPACE            0x2000
+
 static const uint32_t pp_null_gen5[][4] = {
 #include "shaders/post_processing/gen5_6/null.g4b.gen5"
 };
@@ -4863,6 +4867,66 @@ i965_vpp_clear_surface(VADriverContextP ctx,
     intel_batchbuffer_end_atomic(batch);
 }
 
+/*
+ * Takes an idle post-processing context of the display, or makes a new one
+ * with its own batch when all of them are busy. A caller keeps it until
+ * i965_post_processing_context_put(), so concurrent callers don't share
+ * any state or batch.
+ */
+static struct i965_post_processing_context *
+i965_post_processing_context_get(VADriverContextP ctx)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_post_processing_context *pp_context;
+    struct intel_batchbuffer *batch;
+
+    _i965LockMutex(&i965->pp_mutex);
+    pp_context = i965->pp_free_list;
+
+    if (pp_context)
+        i965->pp_free_list = pp_context->next_free;
+
+    _i965UnlockMutex(&i965->pp_mutex);
+
+    if (pp_context)
+        return pp_context;
+
+    pp_context = calloc(1, sizeof(*pp_context));
+
+    if (!pp_context)
+        return NULL;
+
+    batch = intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0);
+
+    if (!batch) {
+        free(pp_context);
+        return NULL;
+    }
+
+    i965->codec_info->post_processing_context_init(ctx, pp_context, batch);
+
+    _i965LockMutex(&i965->pp_mutex);
+    i965->num_pp_contexts++;
+    _i965UnlockMutex(&i965->pp_mutex);
+
+    return pp_context;
+}
+
+static void
+i965_post_processing_context_put(VADriverContextP ctx,
+                                 struct i965_post_processing_context *pp_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+
+    /* an idle context may stay unused for long, submit what it holds */
+    intel_batchbuffer_flush(pp_context->batch);
+
+    _i965LockMutex(&i965->pp_mutex);
+    pp_context->next_free = i965->pp_free_list;
+    i965->pp_free_list = pp_context;
+    _i965UnlockMutex(&i965->pp_mutex);
+}
+
 VAStatus
 i965_scaling_processing(
     VADriverContextP   ctx,
@@ -4882,9 +4946,11 @@ i965_scaling_processing(
         struct i965_surface src_surface;
         struct i965_surface dst_surface;
         struct i965_post_processing_context *pp_context;
-        unsigned int filter_flags;
 
-         _i965LockMutex(&i965->pp_mutex);
+         pp_context = i965_post_processing_context_get(ctx);
+
+         if (!pp_context)
+             return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
          src_surface.base = (struct object_base *)src_surface_obj;
          src_surface.type = I965_SURFACE_TYPE_SURFACE;
@@ -4893,17 +4959,13 @@ i965_scaling_processing(
          dst_surface.type = I965_SURFACE_TYPE_SURFACE;
          dst_surface.flags = I965_SURFACE_FLAG_FRAME;
 
-         pp_context = i965->pp_context;
-         filter_flags = pp_context->filter_flags;
          pp_context->filter_flags = va_flags;
 
          va_status = i965_post_processing_internal(ctx, pp_context,
              &src_surface, src_rect, &dst_surface, dst_rect,
              avs_is_needed(va_flags) ? PP_NV12_AVS : PP_NV12_SCALING, NULL);
 
-         pp_context->filter_flags = filter_flags;
-
-         _i965UnlockMutex(&i965->pp_mutex);
+         i965_post_processing_context_put(ctx, pp_context);
     }
 
     return va_status;
@@ -4936,9 +4998,11 @@ i965_post_processing(
         if (obj_surface->fourcc != VA_FOURCC_NV12)
             return out_surface_id;
 
-        _i965LockMutex(&i965->pp_mutex);
+        pp_context = i965_post_processing_context_get(ctx);
+
+        if (!pp_context)
+            return out_surface_id;
 
-        pp_context = i965->pp_context;
         pp_context->filter_flags = va_flags;
         if (avs_is_needed(va_flags)) {
             VARectangle tmp_dst_rect;
@@ -4988,7 +5052,7 @@ i965_post_processing(
             calibrated_rect->height = dst_rect->height;
         }
 
-        _i965UnlockMutex(&i965->pp_mutex);
+        i965_post_processing_context_put(ctx, pp_context);
     }
 
     return out_surface_id;
@@ -4996,6 +5060,7 @@ i965_post_processing(
 
 static VAStatus
 i965_image_pl2_processing(VADriverContextP ctx,
+                          struct i965_post_processing_context *pp_context,
                           const struct i965_surface *src_surface,
                           const VARectangle *src_rect,
                           struct i965_surface *dst_surface,
@@ -5003,8 +5068,10 @@ i965_image_pl2_processing(VADriverContextP ctx,
 
 static VAStatus
 i965_image_plx_nv12_plx_processing(VADriverContextP ctx,
+                                   struct i965_post_processing_context *pp_context,
                                    VAStatus (*i965_image_plx_nv12_processing)(
                                        VADriverContextP,
+                                       struct i965_post_processing_context *,
                                        const struct i965_surface *,
                                        const VARectangle *,
                                        struct i965_surface *,
@@ -5038,6 +5105,7 @@ i965_image_plx_nv12_plx_processing(VADriverContextP ctx,
     tmp_surface.flags = I965_SURFACE_FLAG_FRAME;
 
     status = i965_image_plx_nv12_processing(ctx,
+                                            pp_context,
                                             src_surface,
                                             src_rect,
                                             &tmp_surface,
@@ -5045,6 +5113,7 @@ i965_image_plx_nv12_plx_processing(VADriverContextP ctx,
 
     if (status == VA_STATUS_SUCCESS)
         status = i965_image_pl2_processing(ctx,
+                                           pp_context,
                                            &tmp_surface,
                                            dst_rect,
                                            dst_surface,
@@ -5060,19 +5129,18 @@ i965_image_plx_nv12_plx_processing(VADriverContextP ctx,
 
 static VAStatus
 i965_image_pl1_rgbx_processing(VADriverContextP ctx,
+                               struct i965_post_processing_context *pp_context,
                                const struct i965_surface *src_surface,
                                const VARectangle *src_rect,
                                struct i965_surface *dst_surface,
                                const VARectangle *dst_rect)
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct i965_post_processing_context *pp_context = i965->pp_context;
     int fourcc = pp_get_surface_fourcc(ctx, dst_surface);
     VAStatus vaStatus;
 
     switch (fourcc) {
     case VA_FOURCC_NV12:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5084,6 +5152,7 @@ i965_image_pl1_rgbx_processing(VADriverContextP ctx,
 
     default:
         vaStatus = i965_image_plx_nv12_plx_processing(ctx,
+                                                      pp_context,
                                                       i965_image_pl1_rgbx_processing,
                                                       src_surface,
                                                       src_rect,
@@ -5097,19 +5166,18 @@ i965_image_pl1_rgbx_processing(VADriverContextP ctx,
 
 static VAStatus
 i965_image_pl3_processing(VADriverContextP ctx,
+                          struct i965_post_processing_context *pp_context,
                           const struct i965_surface *src_surface,
                           const VARectangle *src_rect,
                           struct i965_surface *dst_surface,
                           const VARectangle *dst_rect)
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct i965_post_processing_context *pp_context = i965->pp_context;
     int fourcc = pp_get_surface_fourcc(ctx, dst_surface);
     VAStatus vaStatus = VA_STATUS_ERROR_UNIMPLEMENTED;
 
     switch (fourcc) {
     case VA_FOURCC_NV12:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5123,7 +5191,7 @@ i965_image_pl3_processing(VADriverContextP ctx,
     case VA_FOURCC_IMC3:
     case VA_FOURCC_YV12:
     case VA_FOURCC_I420:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5135,7 +5203,7 @@ i965_image_pl3_processing(VADriverContextP ctx,
 
     case VA_FOURCC_YUY2:
     case VA_FOURCC_UYVY:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5147,6 +5215,7 @@ i965_image_pl3_processing(VADriverContextP ctx,
 
     default:
         vaStatus = i965_image_plx_nv12_plx_processing(ctx,
+                                                      pp_context,
                                                       i965_image_pl3_processing,
                                                       src_surface,
                                                       src_rect,
@@ -5160,19 +5229,18 @@ i965_image_pl3_processing(VADriverContextP ctx,
 
 static VAStatus
 i965_image_pl2_processing(VADriverContextP ctx,
+                          struct i965_post_processing_context *pp_context,
                           const struct i965_surface *src_surface,
                           const VARectangle *src_rect,
                           struct i965_surface *dst_surface,
                           const VARectangle *dst_rect)
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct i965_post_processing_context *pp_context = i965->pp_context;
     int fourcc = pp_get_surface_fourcc(ctx, dst_surface);
     VAStatus vaStatus = VA_STATUS_ERROR_UNIMPLEMENTED;
 
     switch (fourcc) {
     case VA_FOURCC_NV12:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5185,7 +5253,7 @@ i965_image_pl2_processing(VADriverContextP ctx,
     case VA_FOURCC_IMC3:
     case VA_FOURCC_YV12:
     case VA_FOURCC_I420:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5196,7 +5264,7 @@ i965_image_pl2_processing(VADriverContextP ctx,
 
     case VA_FOURCC_YUY2:
     case VA_FOURCC_UYVY:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5209,7 +5277,7 @@ i965_image_pl2_processing(VADriverContextP ctx,
     case VA_FOURCC_BGRA:
     case VA_FOURCC_RGBX:
     case VA_FOURCC_RGBA:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5229,19 +5297,18 @@ i965_image_pl2_processing(VADriverContextP ctx,
 
 static VAStatus
 i965_image_pl1_processing(VADriverContextP ctx,
+                          struct i965_post_processing_context *pp_context,
                           const struct i965_surface *src_surface,
                           const VARectangle *src_rect,
                           struct i965_surface *dst_surface,
                           const VARectangle *dst_rect)
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct i965_post_processing_context *pp_context = i965->pp_context;
     int fourcc = pp_get_surface_fourcc(ctx, dst_surface);
     VAStatus vaStatus;
 
     switch (fourcc) {
     case VA_FOURCC_NV12:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5252,7 +5319,7 @@ i965_image_pl1_processing(VADriverContextP ctx,
         break;
 
     case VA_FOURCC_YV12:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5264,7 +5331,7 @@ i965_image_pl1_processing(VADriverContextP ctx,
 
     case VA_FOURCC_YUY2:
     case VA_FOURCC_UYVY:
-        vaStatus = i965_post_processing_internal(ctx, i965->pp_context,
+        vaStatus = i965_post_processing_internal(ctx, pp_context,
                                                  src_surface,
                                                  src_rect,
                                                  dst_surface,
@@ -5276,6 +5343,7 @@ i965_image_pl1_processing(VADriverContextP ctx,
 
     default:
         vaStatus = i965_image_plx_nv12_plx_processing(ctx,
+                                                      pp_context,
                                                       i965_image_pl1_processing,
                                                       src_surface,
                                                       src_rect,
@@ -5287,20 +5355,28 @@ i965_image_pl1_processing(VADriverContextP ctx,
     return vaStatus;
 }
 
-VAStatus
-i965_image_processing(VADriverContextP ctx,
-                      const struct i965_surface *src_surface,
-                      const VARectangle *src_rect,
-                      struct i965_surface *dst_surface,
-                      const VARectangle *dst_rect)
+/* Converts and scales with the scaling mode of filter_flags */
+static VAStatus
+i965_image_processing_filter(VADriverContextP ctx,
+                             const struct i965_surface *src_surface,
+                             const VARectangle *src_rect,
+                             struct i965_surface *dst_surface,
+                             const VARectangle *dst_rect,
+                             unsigned int filter_flags)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     VAStatus status = VA_STATUS_ERROR_UNIMPLEMENTED;
 
     if (HAS_VPP(i965)) {
         int fourcc = pp_get_surface_fourcc(ctx, src_surface);
+        struct i965_post_processing_context *pp_context;
+
+        pp_context = i965_post_processing_context_get(ctx);
+
+        if (!pp_context)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
-        _i965LockMutex(&i965->pp_mutex);
+        pp_context->filter_flags = filter_flags;
 
         switch (fourcc) {
         case VA_FOURCC_YV12:
@@ -5313,6 +5389,7 @@ i965_image_processing(VADriverContextP ctx,
         case VA_FOURCC_444P:
         case VA_FOURCC_YV16:
             status = i965_image_pl3_processing(ctx,
+                                               pp_context,
                                                src_surface,
                                                src_rect,
                                                dst_surface,
@@ -5321,6 +5398,7 @@ i965_image_processing(VADriverContextP ctx,
 
         case  VA_FOURCC_NV12:
             status = i965_image_pl2_processing(ctx,
+                                               pp_context,
                                                src_surface,
                                                src_rect,
                                                dst_surface,
@@ -5329,6 +5407,7 @@ i965_image_processing(VADriverContextP ctx,
         case VA_FOURCC_YUY2:
         case VA_FOURCC_UYVY:
             status = i965_image_pl1_processing(ctx,
+                                               pp_context,
                                                src_surface,
                                                src_rect,
                                                dst_surface,
@@ -5339,6 +5418,7 @@ i965_image_processing(VADriverContextP ctx,
         case VA_FOURCC_RGBA:
         case VA_FOURCC_RGBX:
             status = i965_image_pl1_rgbx_processing(ctx,
+                                               pp_context,
                                                src_surface,
                                                src_rect,
                                                dst_surface,
@@ -5348,17 +5428,30 @@ i965_image_processing(VADriverContextP ctx,
             status = VA_STATUS_ERROR_UNIMPLEMENTED;
             break;
         }
-        
-        _i965UnlockMutex(&i965->pp_mutex);
+
+        i965_post_processing_context_put(ctx, pp_context);
     }
 
     return status;
-}       
+}
+
+VAStatus
+i965_image_processing(VADriverContextP ctx,
+                      const struct i965_surface *src_surface,
+                      const VARectangle *src_rect,
+                      struct i965_surface *dst_surface,
+                      const VARectangle *dst_rect)
+{
+    return i965_image_processing_filter(ctx, src_surface, src_rect,
+                                        dst_surface, dst_rect,
+                                        VA_FILTER_SCALING_DEFAULT);
+}
 
 static void
 i965_post_processing_context_finalize(VADriverContextP ctx,
     struct i965_post_processing_context *pp_context)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
     int i;
 
     dri_bo_unreference(pp_context->surface_state_binding_table.bo);
@@ -5393,7 +5486,7 @@ i965_post_processing_context_finalize(VADriverContextP ctx,
     for (i = 0; i < NUM_PP_MODULES; i++) {
         struct pp_module *pp_module = &pp_context->pp_modules[i];
 
-        dri_bo_unreference(pp_module->kernel.bo);
+        i965_kernel_cache_put(&i965->kernel_cache, pp_module->kernel.bo);
         pp_module->kernel.bo = NULL;
     }
 
@@ -5407,14 +5500,21 @@ void
 i965_post_processing_terminate(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct i965_post_processing_context *pp_context = i965->pp_context;
+    struct i965_post_processing_context *pp_context;
+
+    if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+        i965->num_pp_contexts > 1)
+        fprintf(stderr, "post-processing: %u contexts for concurrent callers\n",
+                i965->num_pp_contexts);
 
-    if (pp_context) {
+    while ((pp_context = i965->pp_free_list)) {
+        i965->pp_free_list = pp_context->next_free;
         pp_context->finalize(ctx, pp_context);
+        intel_batchbuffer_free(pp_context->batch);
         free(pp_context);
     }
 
-    i965->pp_context = NULL;
+    i965->num_pp_contexts = 0;
 }
 
 #define VPP_CURBE_ALLOCATION_SIZE	32
@@ -5468,14 +5568,12 @@ i965_post_processing_context_init(VADriverContextP ctx,
 
     for (i = 0; i < NUM_PP_MODULES; i++) {
         struct pp_module *pp_module = &pp_context->pp_modules[i];
-        dri_bo_unreference(pp_module->kernel.bo);
+        i965_kernel_cache_put(&i965->kernel_cache, pp_module->kernel.bo);
         if (pp_module->kernel.bin && pp_module->kernel.size) {
-            pp_module->kernel.bo = dri_bo_alloc(i965->intel.bufmgr,
-                                                pp_module->kernel.name,
-                                                pp_module->kernel.size,
-                                                4096);
+            struct i965_kernel *kernel = &pp_module->kernel;
+
+            pp_module->kernel.bo = i965_kernel_cache_get(ctx, &kernel, 1, NULL);
             assert(pp_module->kernel.bo);
-            dri_bo_subdata(pp_module->kernel.bo, 0, pp_module->kernel.size, pp_module->kernel.bin);
         } else {
             pp_module->kernel.bo = NULL;
         }
@@ -5502,17 +5600,17 @@ bool
 i965_post_processing_init(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct i965_post_processing_context *pp_context = i965->pp_context;
+    struct i965_post_processing_context *pp_context;
 
-    if (HAS_VPP(i965)) {
-        if (pp_context == NULL) {
-            pp_context = calloc(1, sizeof(*pp_context));
-            assert(pp_context);
-            i965->codec_info->post_processing_context_init(ctx, pp_context, i965->pp_batch);
-            i965->pp_context = pp_context;
-        }
+    /* the first context is made upfront, the others on demand */
+    if (HAS_VPP(i965) && i965->pp_free_list == NULL) {
+        pp_context = i965_post_processing_context_get(ctx);
+        assert(pp_context);
+        i965_post_processing_context_put(ctx, pp_context);
     }
 
+    i965->intel.flush_deferred = i965_proc_flush_deferred_batch;
+
     return true;
 }
 
@@ -5629,20 +5727,205 @@ pp_get_kernel_index(uint32_t src_fourcc, uint32_t dst_fourcc, uint32_t pp_ops,
     return pp_index;
 }
 
+static int
+rect_overlaps(const VARectangle *a, const VARectangle *b)
+{
+    return a->x < b->x + b->width && b->x < a->x + a->width &&
+        a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+/*
+ * Called with i965->deferred_proc_mutex held. The list is also read
+ * without the lock by the flush hooks, to check that it is empty
+ */
+static void
+i965_proc_deferred_submit(struct i965_driver_data *i965,
+                          struct i965_proc_context *proc_context)
+{
+    struct i965_proc_context **p;
+    int i;
+
+    if (proc_context->deferred.num_pending == 0)
+        return;
+
+    intel_batchbuffer_flush(proc_context->base.batch);
+
+    for (i = 0; i < proc_context->deferred.num_pending; i++) {
+        dri_bo_unreference(proc_context->deferred.pending[i].src_bo);
+        dri_bo_unreference(proc_context->deferred.pending[i].dst_bo);
+    }
+
+    proc_context->deferred.num_pending = 0;
+    proc_context->deferred.num_submissions++;
+
+    for (p = &i965->deferred_proc_list; *p; p = &(*p)->deferred.next) {
+        if (*p == proc_context) {
+            __atomic_store_n(p, proc_context->deferred.next, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+
+    proc_context->deferred.next = NULL;
+}
+
+/*
+ * Submits the queued operations which the new one depends on: reads of a
+ * pending destination, writes to a pending source and overlapping writes.
+ * Operations of other contexts are in another batch, so they are submitted
+ * as well in order to keep the execution order. Called with
+ * i965->deferred_proc_mutex held
+ */
+static void
+i965_proc_deferred_resolve(struct i965_driver_data *i965,
+                           struct i965_proc_context *proc_context,
+                           dri_bo *src_bo,
+                           dri_bo *dst_bo,
+                           const VARectangle *dst_rect)
+{
+    struct i965_proc_context *pending_context, *next_context;
+    int i;
+
+    for (pending_context = i965->deferred_proc_list;
+         pending_context;
+         pending_context = next_context) {
+        next_context = pending_context->deferred.next;
+
+        for (i = 0; i < pending_context->deferred.num_pending; i++) {
+            const struct i965_proc_deferred_op * const op =
+                &pending_context->deferred.pending[i];
+
+            if ((src_bo && op->dst_bo == src_bo) ||
+                (dst_bo && op->src_bo == dst_bo) ||
+                (dst_bo && op->dst_bo == dst_bo &&
+                 rect_overlaps(&op->dst_rect, dst_rect))) {
+                i965_proc_deferred_submit(i965, pending_context);
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Called with i965->deferred_proc_mutex held. The operation holds a
+ * reference on the BOs until it is submitted, in case the surfaces are
+ * destroyed in the meantime
+ */
+static void
+i965_proc_deferred_queue(struct i965_driver_data *i965,
+                         struct i965_proc_context *proc_context,
+                         dri_bo *src_bo,
+                         dri_bo *dst_bo,
+                         const VARectangle *dst_rect)
+{
+    struct i965_proc_deferred_op *op;
+
+    assert(proc_context->deferred.num_pending < I965_PROC_MAX_DEFERRED);
+
+    if (proc_context->deferred.num_pending == 0) {
+        proc_context->deferred.next = i965->deferred_proc_list;
+        __atomic_store_n(&i965->deferred_proc_list, proc_context, __ATOMIC_RELEASE);
+    }
+
+    if (src_bo)
+        dri_bo_reference(src_bo);
+
+    if (dst_bo)
+        dri_bo_reference(dst_bo);
+
+    op = &proc_context->deferred.pending[proc_context->deferred.num_pending++];
+    op->src_bo = src_bo;
+    op->dst_bo = dst_bo;
+    op->dst_rect = *dst_rect;
+}
+
+void
+i965_proc_flush_deferred(VADriverContextP ctx, dri_bo *bo)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_proc_context *proc_context, *next_context;
+    int i;
+
+    if (!__atomic_load_n(&i965->deferred_proc_list, __ATOMIC_ACQUIRE))
+        return;
+
+    _i965LockMutex(&i965->deferred_proc_mutex);
+
+    for (proc_context = i965->deferred_proc_list;
+         proc_context;
+         proc_context = next_context) {
+        next_context = proc_context->deferred.next;
+
+        for (i = 0; i < proc_context->deferred.num_pending; i++) {
+            if (!bo ||
+                proc_context->deferred.pending[i].src_bo == bo ||
+                proc_context->deferred.pending[i].dst_bo == bo) {
+                proc_context->deferred.num_frames++;
+                i965_proc_deferred_submit(i965, proc_context);
+                break;
+            }
+        }
+    }
+
+    _i965UnlockMutex(&i965->deferred_proc_mutex);
+}
+
+/*
+ * The intel_driver_data.flush_deferred hook: the decoders, the encoders,
+ * the rendering and the post-processing outside of the deferred contexts
+ * use their own batches, which must run after the queued operations on the
+ * same surfaces
+ */
+static void
+i965_proc_flush_deferred_batch(struct intel_driver_data *intel,
+                               struct intel_batchbuffer *batch)
+{
+    struct i965_driver_data *i965 = (struct i965_driver_data *)intel;
+    struct i965_proc_context *proc_context, *next_context;
+    int i;
+
+    /* Every batch flush gets here: skip the lock while nothing is queued */
+    if (!__atomic_load_n(&i965->deferred_proc_list, __ATOMIC_ACQUIRE))
+        return;
+
+    _i965LockMutex(&i965->deferred_proc_mutex);
+
+    for (proc_context = i965->deferred_proc_list;
+         proc_context;
+         proc_context = next_context) {
+        next_context = proc_context->deferred.next;
+
+        for (i = 0; i < proc_context->deferred.num_pending; i++) {
+            const struct i965_proc_deferred_op * const op =
+                &proc_context->deferred.pending[i];
+
+            if (drm_intel_bo_references(batch->buffer, op->src_bo) ||
+                drm_intel_bo_references(batch->buffer, op->dst_bo)) {
+                i965_proc_deferred_submit(i965, proc_context);
+                break;
+            }
+        }
+    }
+
+    _i965UnlockMutex(&i965->deferred_proc_mutex);
+}
+
 static VAStatus
 i965_proc_picture_fast(VADriverContextP ctx,
     struct i965_proc_context *proc_context, struct proc_state *proc_state)
 {
     struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct i965_post_processing_context * const pp_context =
+        &proc_context->pp_context;
     const VAProcPipelineParameterBuffer * const pipeline_param =
         (VAProcPipelineParameterBuffer *)proc_state->pipeline_param->buffer;
     struct object_surface *src_obj_surface, *dst_obj_surface;
-    struct i965_surface src_surface, dst_surface;
+    struct i965_surface src_surface;
+    struct i965_surface dst_surface[1 + I965_MAX_PROC_ADDITIONAL_OUTPUTS];
     const VAProcFilterParameterBufferDeinterlacing *deint_params = NULL;
-    VARectangle src_rect, dst_rect;
+    VARectangle src_rect, dst_rect[1 + I965_MAX_PROC_ADDITIONAL_OUTPUTS];
     VAStatus status;
-    uint32_t i, filter_flags = 0, pp_ops = 0;
-    int pp_index;
+    uint32_t i, num_outputs, filter_flags = 0, pp_ops = 0;
+    int pp_index[1 + I965_MAX_PROC_ADDITIONAL_OUTPUTS];
 
     /* Validate pipeline parameters */
     if (pipeline_param->num_filters > 0 && !pipeline_param->filters)
@@ -5709,39 +5992,7 @@ i965_proc_picture_fast(VADriverContextP ctx,
     if (pp_ops & PP_OP_DEINTERLACE) // XXX: no bob-deinterlacing optimization yet
         pp_ops |= PP_OP_COMPLEX;
 
-    /* Validate target surface */
-    dst_obj_surface = SURFACE(proc_state->current_render_target);
-    if (!dst_obj_surface)
-        return VA_STATUS_ERROR_INVALID_SURFACE;
-
-    if (dst_obj_surface->fourcc &&
-        dst_obj_surface->fourcc != src_obj_surface->fourcc)
-        pp_ops |= PP_OP_CHANGE_FORMAT;
-
-    if (pipeline_param->output_region) {
-        dst_rect.x = pipeline_param->output_region->x;
-        dst_rect.y = pipeline_param->output_region->y;
-        dst_rect.width = pipeline_param->output_region->width;
-        dst_rect.height = pipeline_param->output_region->height;
-    } else {
-        dst_rect.x = 0;
-        dst_rect.y = 0;
-        dst_rect.width = dst_obj_surface->orig_width;
-        dst_rect.height = dst_obj_surface->orig_height;
-    }
-
-    if (dst_rect.width != src_rect.width || dst_rect.height != src_rect.height)
-        pp_ops |= PP_OP_CHANGE_SIZE;
-
-    dst_surface.base  = &dst_obj_surface->base;
-    dst_surface.type  = I965_SURFACE_TYPE_SURFACE;
-    dst_surface.flags = I965_SURFACE_FLAG_FRAME;
-
     /* Validate "fast-path" processing capabilities */
-    if (!IS_GEN7(i965->intel.device_info)) {
-        if ((pp_ops & PP_OP_CHANGE_FORMAT) && (pp_ops & PP_OP_CHANGE_SIZE))
-            return VA_STATUS_ERROR_UNIMPLEMENTED; // temporary surface is needed
-    }
     if (pipeline_param->pipeline_flags & VA_PROC_PIPELINE_FAST) {
         filter_flags &= ~VA_FILTER_SCALING_MASK;
         filter_flags |= VA_FILTER_SCALING_FAST;
@@ -5753,27 +6004,117 @@ i965_proc_picture_fast(VADriverContextP ctx,
             return VA_STATUS_ERROR_UNIMPLEMENTED;
     }
 
-    pp_index = pp_get_kernel_index(src_obj_surface->fourcc,
-        dst_obj_surface->fourcc, pp_ops, filter_flags);
-    if (pp_index < 0)
-        return VA_STATUS_ERROR_UNIMPLEMENTED;
+    /* Validate target surfaces. The render target is output #0, the
+     * additional outputs always cover their whole surface */
+    if (pipeline_param->num_additional_outputs > I965_MAX_PROC_ADDITIONAL_OUTPUTS)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    if (pipeline_param->num_additional_outputs > 0 &&
+        !pipeline_param->additional_outputs)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    num_outputs = 1 + pipeline_param->num_additional_outputs;
+
+    for (i = 0; i < num_outputs; i++) {
+        uint32_t dst_pp_ops = pp_ops;
+
+        dst_obj_surface = SURFACE(i == 0 ? proc_state->current_render_target :
+                                  pipeline_param->additional_outputs[i - 1]);
+        if (!dst_obj_surface)
+            return VA_STATUS_ERROR_INVALID_SURFACE;
+
+        if (dst_obj_surface->fourcc &&
+            dst_obj_surface->fourcc != src_obj_surface->fourcc)
+            dst_pp_ops |= PP_OP_CHANGE_FORMAT;
+
+        if (i == 0 && pipeline_param->output_region) {
+            dst_rect[i].x = pipeline_param->output_region->x;
+            dst_rect[i].y = pipeline_param->output_region->y;
+            dst_rect[i].width = pipeline_param->output_region->width;
+            dst_rect[i].height = pipeline_param->output_region->height;
+        } else {
+            dst_rect[i].x = 0;
+            dst_rect[i].y = 0;
+            dst_rect[i].width = dst_obj_surface->orig_width;
+            dst_rect[i].height = dst_obj_surface->orig_height;
+        }
+
+        if (dst_rect[i].width != src_rect.width ||
+            dst_rect[i].height != src_rect.height)
+            dst_pp_ops |= PP_OP_CHANGE_SIZE;
+
+        if (!IS_GEN7(i965->intel.device_info)) {
+            if ((dst_pp_ops & PP_OP_CHANGE_FORMAT) &&
+                (dst_pp_ops & PP_OP_CHANGE_SIZE))
+                return VA_STATUS_ERROR_UNIMPLEMENTED; // temporary surface is needed
+        }
+
+        pp_index[i] = pp_get_kernel_index(src_obj_surface->fourcc,
+            dst_obj_surface->fourcc, dst_pp_ops, filter_flags);
+        if (pp_index[i] < 0)
+            return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+        dst_surface[i].base  = &dst_obj_surface->base;
+        dst_surface[i].type  = I965_SURFACE_TYPE_SURFACE;
+        dst_surface[i].flags = I965_SURFACE_FLAG_FRAME;
+    }
+
+    if (proc_context->deferred.enabled) {
+        if (proc_context->deferred.num_pending + num_outputs > I965_PROC_MAX_DEFERRED)
+            i965_proc_deferred_submit(i965, proc_context);
+
+        for (i = 0; i < num_outputs; i++) {
+            dst_obj_surface = (struct object_surface *)dst_surface[i].base;
+            i965_proc_deferred_resolve(i965, proc_context,
+                src_obj_surface->bo, dst_obj_surface->bo, &dst_rect[i]);
+        }
+    }
+
+    /* All the outputs are rendered back to back from the same source. On
+     * Gen8+ the MEDIA_OBJECT buffers are chained as second level batches
+     * so that the whole ladder goes out in a single submission */
+    pp_context->filter_flags = filter_flags;
+    pp_context->chain_object_walker =
+        (num_outputs > 1 || proc_context->deferred.enabled) &&
+        (IS_GEN8(i965->intel.device_info) || IS_GEN9(i965->intel.device_info));
+
+    status = VA_STATUS_SUCCESS;
+
+    for (i = 0; i < num_outputs && status == VA_STATUS_SUCCESS; i++)
+        status = i965_post_processing_internal(ctx, pp_context,
+            &src_surface, &src_rect, &dst_surface[i], &dst_rect[i],
+            pp_index[i], NULL);
+
+    pp_context->chain_object_walker = 0;
+
+    if (!proc_context->deferred.enabled) {
+        intel_batchbuffer_flush(pp_context->batch);
+        return status;
+    }
+
+    /* The destination BOs may have been allocated by the passes */
+    for (i = 0; i < num_outputs; i++) {
+        dst_obj_surface = (struct object_surface *)dst_surface[i].base;
+        i965_proc_deferred_queue(i965, proc_context,
+            src_obj_surface->bo, dst_obj_surface->bo, &dst_rect[i]);
+    }
+
+    proc_context->deferred.num_operations++;
+
+    if (status != VA_STATUS_SUCCESS ||
+        !intel_batchbuffer_check_free_space(pp_context->batch,
+                                            I965_PROC_DEFERRED_MIN_SPACE))
+        i965_proc_deferred_submit(i965, proc_context);
 
-    proc_context->pp_context.filter_flags = filter_flags;
-    status = i965_post_processing_internal(ctx, &proc_context->pp_context,
-        &src_surface, &src_rect, &dst_surface, &dst_rect, pp_index, NULL);
-    intel_batchbuffer_flush(proc_context->pp_context.batch);
     return status;
 }
 
-VAStatus 
-i965_proc_picture(VADriverContextP ctx, 
-                  VAProfile profile, 
-                  union codec_state *codec_state,
-                  struct hw_context *hw_context)
+static VAStatus
+i965_proc_picture_full(VADriverContextP ctx,
+    struct i965_proc_context *proc_context, struct proc_state *proc_state)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct i965_proc_context *proc_context = (struct i965_proc_context *)hw_context;
-    struct proc_state *proc_state = &codec_state->proc;
+    struct hw_context *hw_context = &proc_context->base;
     VAProcPipelineParameterBuffer *pipeline_param = (VAProcPipelineParameterBuffer *)proc_state->pipeline_param->buffer;
     struct object_surface *obj_surface;
     struct i965_surface src_surface, dst_surface;
@@ -5785,10 +6126,6 @@ i965_proc_picture(VADriverContextP ctx,
     unsigned int tiling = 0, swizzle = 0;
     int in_width, in_height;
 
-    status = i965_proc_picture_fast(ctx, proc_context, proc_state);
-    if (status != VA_STATUS_ERROR_UNIMPLEMENTED)
-        return status;
-
     if (pipeline_param->surface == VA_INVALID_ID ||
         proc_state->current_render_target == VA_INVALID_ID) {
         status = VA_STATUS_ERROR_INVALID_SURFACE;
@@ -5812,6 +6149,19 @@ i965_proc_picture(VADriverContextP ctx,
         goto error;
     }
 
+    if (pipeline_param->num_additional_outputs > I965_MAX_PROC_ADDITIONAL_OUTPUTS ||
+        (pipeline_param->num_additional_outputs && !pipeline_param->additional_outputs)) {
+        status = VA_STATUS_ERROR_INVALID_PARAMETER;
+        goto error;
+    }
+
+    for (i = 0; i < pipeline_param->num_additional_outputs; i++) {
+        if (!SURFACE(pipeline_param->additional_outputs[i])) {
+            status = VA_STATUS_ERROR_INVALID_SURFACE;
+            goto error;
+        }
+    }
+
     in_width = obj_surface->orig_width;
     in_height = obj_surface->orig_height;
     dri_bo_get_tiling(obj_surface->bo, &tiling, &swizzle);
@@ -5948,8 +6298,7 @@ i965_proc_picture(VADriverContextP ctx,
     if (IS_GEN7(i965->intel.device_info) ||
         IS_GEN8(i965->intel.device_info) ||
         IS_GEN9(i965->intel.device_info)) {
-        unsigned int saved_filter_flag;
-        struct i965_post_processing_context *i965pp_context = i965->pp_context;
+        unsigned int scaling_flags = pipeline_param->filter_flags & VA_FILTER_SCALING_MASK;
 
         if (obj_surface->fourcc == 0) {
             i965_check_alloc_surface_bo(ctx, obj_surface, 1,
@@ -5963,14 +6312,32 @@ i965_proc_picture(VADriverContextP ctx,
 
         intel_batchbuffer_flush(hw_context->batch);
 
-        saved_filter_flag = i965pp_context->filter_flags;
-        i965pp_context->filter_flags = (pipeline_param->filter_flags & VA_FILTER_SCALING_MASK);
-
         dst_surface.base = (struct object_base *)obj_surface;
         dst_surface.type = I965_SURFACE_TYPE_SURFACE;
-        i965_image_processing(ctx, &src_surface, &src_rect, &dst_surface, &dst_rect);
+        i965_image_processing_filter(ctx, &src_surface, &src_rect, &dst_surface, &dst_rect,
+                                     scaling_flags);
 
-        i965pp_context->filter_flags = saved_filter_flag;
+        /* The additional outputs are scaled from the same filtered source */
+        for (i = 0; i < pipeline_param->num_additional_outputs; i++) {
+            obj_surface = SURFACE(pipeline_param->additional_outputs[i]);
+
+            if (obj_surface->fourcc == 0) {
+                i965_check_alloc_surface_bo(ctx, obj_surface, 1,
+                                            VA_FOURCC_NV12,
+                                            SUBSAMPLE_YUV420);
+            }
+
+            dst_rect.x = 0;
+            dst_rect.y = 0;
+            dst_rect.width = obj_surface->orig_width;
+            dst_rect.height = obj_surface->orig_height;
+
+            dst_surface.base = (struct object_base *)obj_surface;
+            dst_surface.type = I965_SURFACE_TYPE_SURFACE;
+            dst_surface.flags = I965_SURFACE_FLAG_FRAME;
+            i965_image_processing_filter(ctx, &src_surface, &src_rect, &dst_surface, &dst_rect,
+                                         scaling_flags);
+        }
 
         if (num_tmp_surfaces)
             i965_DestroySurfaces(ctx,
@@ -5980,6 +6347,11 @@ i965_proc_picture(VADriverContextP ctx,
         return VA_STATUS_SUCCESS;
     }
 
+    if (pipeline_param->num_additional_outputs) {
+        status = VA_STATUS_ERROR_UNIMPLEMENTED;
+        goto error;
+    }
+
     int csc_needed = 0;
     if (obj_surface->fourcc && obj_surface->fourcc !=  VA_FOURCC_NV12){
         csc_needed = 1;
@@ -6055,11 +6427,358 @@ error:
     return status;
 }
 
+/*
+ * Blends a translucent layer into an NV12 output. The post-processing
+ * kernels can't blend, so the layer is scaled and converted into the
+ * scratch surface of the context on the GPU and blended on the CPU. The
+ * scratch surface only grows
+ */
+static VAStatus
+i965_proc_blend_layer(VADriverContextP ctx,
+    struct i965_proc_context *proc_context,
+    struct i965_surface *src_surface, const VPPLayer *layer,
+    struct object_surface *dst_obj_surface)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct object_surface *tmp_obj_surface = proc_context->blend_surface;
+    struct i965_surface tmp_surface;
+    VASurfaceID tmp_surface_id;
+    VPPLayer aligned_layer = *layer;
+    VARectangle tmp_rect;
+    unsigned int tiling, swizzle;
+    uint8_t *dst, *tmp;
+    VAStatus status;
+
+    vpp_layer_align_chroma(&aligned_layer);
+    tmp_rect.x = 0;
+    tmp_rect.y = 0;
+    tmp_rect.width = aligned_layer.dst_rect.width;
+    tmp_rect.height = aligned_layer.dst_rect.height;
+
+    if (tmp_obj_surface &&
+        (tmp_obj_surface->orig_width < tmp_rect.width ||
+         tmp_obj_surface->orig_height < tmp_rect.height)) {
+        tmp_rect.width = MAX(tmp_rect.width, tmp_obj_surface->orig_width);
+        tmp_rect.height = MAX(tmp_rect.height, tmp_obj_surface->orig_height);
+        tmp_surface_id = tmp_obj_surface->base.id;
+        i965_DestroySurfaces(ctx, &tmp_surface_id, 1);
+        tmp_obj_surface = proc_context->blend_surface = NULL;
+    }
+
+    if (!tmp_obj_surface) {
+        status = i965_CreateSurfaces(ctx, tmp_rect.width, tmp_rect.height,
+            VA_RT_FORMAT_YUV420, 1, &tmp_surface_id);
+        if (status != VA_STATUS_SUCCESS)
+            return status;
+
+        tmp_obj_surface = SURFACE(tmp_surface_id);
+        assert(tmp_obj_surface);
+        i965_check_alloc_surface_bo(ctx, tmp_obj_surface, 0, VA_FOURCC_NV12,
+            SUBSAMPLE_YUV420);
+        proc_context->blend_surface = tmp_obj_surface;
+    }
+
+    tmp_rect.width = aligned_layer.dst_rect.width;
+    tmp_rect.height = aligned_layer.dst_rect.height;
+
+    tmp_surface.base  = &tmp_obj_surface->base;
+    tmp_surface.type  = I965_SURFACE_TYPE_SURFACE;
+    tmp_surface.flags = I965_SURFACE_FLAG_FRAME;
+
+    status = i965_image_processing(ctx, src_surface,
+        &aligned_layer.src_rect, &tmp_surface, &tmp_rect);
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    /* The CPU access doesn't go through a batch */
+    i965_proc_flush_deferred(ctx, dst_obj_surface->bo);
+
+    dri_bo_get_tiling(dst_obj_surface->bo, &tiling, &swizzle);
+    if (tiling != I915_TILING_NONE)
+        drm_intel_gem_bo_map_gtt(dst_obj_surface->bo);
+    else
+        dri_bo_map(dst_obj_surface->bo, 1);
+    dri_bo_map(tmp_obj_surface->bo, 0);
+
+    dst = dst_obj_surface->bo->virtual;
+    tmp = tmp_obj_surface->bo->virtual;
+    if (!dst || !tmp)
+        status = VA_STATUS_ERROR_OPERATION_FAILED;
+    else {
+        const VARectangle * const dst_rect = &aligned_layer.dst_rect;
+
+        /* Y plane */
+        vpp_blend_plane(dst + dst_rect->y * dst_obj_surface->width + dst_rect->x,
+            dst_obj_surface->width, tmp, tmp_obj_surface->width,
+            dst_rect->width, dst_rect->height, layer->alpha);
+
+        /* UV plane */
+        dst += dst_obj_surface->y_cb_offset * dst_obj_surface->width;
+        tmp += tmp_obj_surface->y_cb_offset * tmp_obj_surface->width;
+        vpp_blend_plane(dst + dst_rect->y / 2 * dst_obj_surface->width + dst_rect->x,
+            dst_obj_surface->width, tmp, tmp_obj_surface->width,
+            dst_rect->width, dst_rect->height / 2, layer->alpha);
+    }
+
+    dri_bo_unmap(tmp_obj_surface->bo);
+    if (tiling != I915_TILING_NONE)
+        drm_intel_gem_bo_unmap_gtt(dst_obj_surface->bo);
+    else
+        dri_bo_unmap(dst_obj_surface->bo);
+
+    return status;
+}
+
+/*
+ * Composites all the pipeline parameters of the picture into the render
+ * target, bottom first. The opaque layers run back to back through the
+ * MEDIA_OBJECT walkers and, on Gen8+, go out in a single submission. A
+ * translucent layer first has the layers below submitted, then is blended
+ * over them on the CPU by i965_proc_blend_layer(), into NV12 outputs only
+ */
+static VAStatus
+i965_proc_picture_composite(VADriverContextP ctx,
+    struct i965_proc_context *proc_context, struct proc_state *proc_state)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct i965_post_processing_context * const pp_context =
+        &proc_context->pp_context;
+    const VAProcPipelineParameterBuffer *pipeline_param;
+    const VAProcPipelineParameterBuffer *layer_param[I965_MAX_PROC_LAYERS];
+    struct object_surface *src_obj_surface[I965_MAX_PROC_LAYERS];
+    struct object_surface *dst_obj_surface;
+    struct i965_surface src_surface, dst_surface;
+    VPPLayer layers[I965_MAX_PROC_LAYERS];
+    int visible_layers[I965_MAX_PROC_LAYERS];
+    int i, num_layers, num_visible_layers, num_chained = 0;
+    bool covers_output, can_chain;
+    VAStatus status;
+
+    if (!IS_GEN7(i965->intel.device_info) &&
+        !IS_GEN8(i965->intel.device_info) &&
+        !IS_GEN9(i965->intel.device_info))
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+    dst_obj_surface = SURFACE(proc_state->current_render_target);
+    if (!dst_obj_surface)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    num_layers = proc_state->num_pipeline_params;
+    assert(num_layers > 1 && num_layers <= I965_MAX_PROC_LAYERS);
+
+    for (i = 0; i < num_layers; i++) {
+        const struct buffer_store * const buffer_store = i == 0 ?
+            proc_state->pipeline_param : proc_state->layer_params[i - 1];
+        VPPLayer * const layer = &layers[i];
+
+        pipeline_param = (VAProcPipelineParameterBuffer *)buffer_store->buffer;
+        layer_param[i] = pipeline_param;
+
+        /* Only scaling and color conversion are supported per layer */
+        if (pipeline_param->num_filters > 0 ||
+            pipeline_param->num_additional_outputs > 0)
+            return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+        src_obj_surface[i] = SURFACE(pipeline_param->surface);
+        if (!src_obj_surface[i])
+            return VA_STATUS_ERROR_INVALID_SURFACE;
+
+        if (!src_obj_surface[i]->fourcc || !src_obj_surface[i]->bo)
+            return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+
+        layer->src_width = src_obj_surface[i]->orig_width;
+        layer->src_height = src_obj_surface[i]->orig_height;
+
+        if (pipeline_param->surface_region)
+            layer->src_rect = *pipeline_param->surface_region;
+        else {
+            layer->src_rect.x = 0;
+            layer->src_rect.y = 0;
+            layer->src_rect.width = layer->src_width;
+            layer->src_rect.height = layer->src_height;
+        }
+
+        if (pipeline_param->output_region)
+            layer->dst_rect = *pipeline_param->output_region;
+        else {
+            layer->dst_rect.x = 0;
+            layer->dst_rect.y = 0;
+            layer->dst_rect.width = dst_obj_surface->orig_width;
+            layer->dst_rect.height = dst_obj_surface->orig_height;
+        }
+
+        layer->alpha = 1.0f;
+        if (pipeline_param->blend_state) {
+            if (pipeline_param->blend_state->flags & ~VA_BLEND_GLOBAL_ALPHA)
+                return VA_STATUS_ERROR_UNIMPLEMENTED;
+            if (pipeline_param->blend_state->flags & VA_BLEND_GLOBAL_ALPHA)
+                layer->alpha = pipeline_param->blend_state->global_alpha;
+        }
+    }
+
+    status = vpp_compose_layout(layers, num_layers,
+        dst_obj_surface->orig_width, dst_obj_surface->orig_height,
+        visible_layers, &num_visible_layers, &covers_output);
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    if (dst_obj_surface->fourcc == 0) {
+        i965_check_alloc_surface_bo(ctx, dst_obj_surface, 1,
+                                    VA_FOURCC_NV12,
+                                    SUBSAMPLE_YUV420);
+    }
+
+    /* Translucent layers are blended into NV12 outputs only */
+    for (i = 0; i < num_visible_layers; i++) {
+        if (!vpp_layer_is_opaque(&layers[visible_layers[i]]) &&
+            dst_obj_surface->fourcc != VA_FOURCC_NV12)
+            return VA_STATUS_ERROR_UNIMPLEMENTED;
+    }
+
+    if (!covers_output) {
+        pipeline_param = layer_param[0];
+        i965_vpp_clear_surface(ctx, pp_context, dst_obj_surface,
+                               pipeline_param->output_background_color);
+        intel_batchbuffer_flush(pp_context->batch);
+    }
+
+    dst_surface.base  = &dst_obj_surface->base;
+    dst_surface.type  = I965_SURFACE_TYPE_SURFACE;
+    dst_surface.flags = I965_SURFACE_FLAG_FRAME;
+
+    can_chain = IS_GEN8(i965->intel.device_info) ||
+        IS_GEN9(i965->intel.device_info);
+
+    for (i = 0; i < num_visible_layers && status == VA_STATUS_SUCCESS; i++) {
+        const VPPLayer * const layer = &layers[visible_layers[i]];
+        uint32_t filter_flags, pp_ops = 0;
+        int pp_index;
+
+        pipeline_param = layer_param[visible_layers[i]];
+        filter_flags = pipeline_param->filter_flags & VA_FILTER_SCALING_MASK;
+        if (pipeline_param->pipeline_flags & VA_PROC_PIPELINE_FAST)
+            filter_flags = VA_FILTER_SCALING_FAST;
+
+        src_surface.base  = &src_obj_surface[visible_layers[i]]->base;
+        src_surface.type  = I965_SURFACE_TYPE_SURFACE;
+        src_surface.flags = I965_SURFACE_FLAG_FRAME;
+
+        /* The layers below are read back, so they must be submitted */
+        if (!vpp_layer_is_opaque(layer)) {
+            if (num_chained) {
+                intel_batchbuffer_flush(pp_context->batch);
+                num_chained = 0;
+            }
+
+            status = i965_proc_blend_layer(ctx, proc_context, &src_surface,
+                layer, dst_obj_surface);
+            continue;
+        }
+
+        if (src_obj_surface[visible_layers[i]]->fourcc != dst_obj_surface->fourcc)
+            pp_ops |= PP_OP_CHANGE_FORMAT;
+        if (layer->src_rect.width != layer->dst_rect.width ||
+            layer->src_rect.height != layer->dst_rect.height)
+            pp_ops |= PP_OP_CHANGE_SIZE;
+
+        pp_index = pp_get_kernel_index(src_obj_surface[visible_layers[i]]->fourcc,
+            dst_obj_surface->fourcc, pp_ops, filter_flags);
+        if (!IS_GEN7(i965->intel.device_info) &&
+            (pp_ops & PP_OP_CHANGE_FORMAT) && (pp_ops & PP_OP_CHANGE_SIZE))
+            pp_index = -1;
+
+        if (pp_index >= 0) {
+            pp_context->filter_flags = filter_flags;
+            pp_context->chain_object_walker = can_chain;
+            status = i965_post_processing_internal(ctx, pp_context,
+                &src_surface, &layer->src_rect, &dst_surface, &layer->dst_rect,
+                pp_index, NULL);
+            pp_context->chain_object_walker = 0;
+            num_chained++;
+            continue;
+        }
+
+        /* The generic path goes through another post-processing batch,
+         * so the layers queued so far must be submitted first */
+        if (num_chained) {
+            intel_batchbuffer_flush(pp_context->batch);
+            num_chained = 0;
+        }
+
+        status = i965_image_processing(ctx, &src_surface, &layer->src_rect,
+            &dst_surface, &layer->dst_rect);
+    }
+
+    intel_batchbuffer_flush(pp_context->batch);
+    return status;
+}
+
+VAStatus
+i965_proc_picture(VADriverContextP ctx,
+                  VAProfile profile,
+                  union codec_state *codec_state,
+                  struct hw_context *hw_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_proc_context *proc_context = (struct i965_proc_context *)hw_context;
+    struct proc_state *proc_state = &codec_state->proc;
+    VAStatus status;
+
+    if (proc_context->deferred.enabled)
+        _i965LockMutex(&i965->deferred_proc_mutex);
+
+    if (proc_state->num_pipeline_params > 1)
+        status = VA_STATUS_ERROR_UNIMPLEMENTED;
+    else
+        status = i965_proc_picture_fast(ctx, proc_context, proc_state);
+
+    /* The full pipeline goes through temporary surfaces and other
+     * post-processing batches, so nothing may stay queued. It runs without
+     * the lock, which i965_DestroySurfaces() and the batch flushes take */
+    if (status == VA_STATUS_ERROR_UNIMPLEMENTED && proc_context->deferred.enabled) {
+        while (i965->deferred_proc_list)
+            i965_proc_deferred_submit(i965, i965->deferred_proc_list);
+    }
+
+    if (proc_context->deferred.enabled)
+        _i965UnlockMutex(&i965->deferred_proc_mutex);
+
+    if (status == VA_STATUS_ERROR_UNIMPLEMENTED) {
+        if (proc_state->num_pipeline_params > 1)
+            status = i965_proc_picture_composite(ctx, proc_context, proc_state);
+        else
+            status = i965_proc_picture_full(ctx, proc_context, proc_state);
+    }
+
+    return status;
+}
+
 static void
 i965_proc_context_destroy(void *hw_context)
 {
     struct i965_proc_context * const proc_context = hw_context;
     VADriverContextP const ctx = proc_context->driver_context;
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+
+    if (proc_context->deferred.enabled) {
+        _i965LockMutex(&i965->deferred_proc_mutex);
+        i965_proc_deferred_submit(i965, proc_context);
+        _i965UnlockMutex(&i965->deferred_proc_mutex);
+
+        if ((g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH) &&
+            proc_context->deferred.num_frames)
+            fprintf(stderr, "VPP deferred submission: %u operations, "
+                    "%u submissions, %.2f submissions per frame\n",
+                    proc_context->deferred.num_operations,
+                    proc_context->deferred.num_submissions,
+                    (float)proc_context->deferred.num_submissions /
+                    proc_context->deferred.num_frames);
+    }
+
+    if (proc_context->blend_surface) {
+        VASurfaceID va_surface = proc_context->blend_surface->base.id;
+        i965_DestroySurfaces(ctx, &va_surface, 1);
+    }
 
     proc_context->pp_context.finalize(ctx, &proc_context->pp_context);
     intel_batchbuffer_free(proc_context->base.batch);
@@ -6072,6 +6791,7 @@ i965_proc_context_init(VADriverContextP ctx, struct object_config *obj_config)
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_driver_data *intel = intel_driver_data(ctx);
     struct i965_proc_context *proc_context = calloc(1, sizeof(struct i965_proc_context));
+    const char *env_str;
 
     if (!proc_context)
         return NULL;
@@ -6082,6 +6802,13 @@ i965_proc_context_init(VADriverContextP ctx, struct object_config *obj_config)
     proc_context->driver_context = ctx;
     i965->codec_info->post_processing_context_init(ctx, &proc_context->pp_context, proc_context->base.batch);
 
+    /* Deferred submission relies on chaining the MEDIA_OBJECT buffers */
+    if ((env_str = getenv("VA_INTEL_VPP_DEFERRED")) && atoi(env_str) &&
+        (IS_GEN8(i965->intel.device_info) || IS_GEN9(i965->intel.device_info))) {
+        proc_context->deferred.enabled = 1;
+        proc_context->base.batch->deferred = 1;
+    }
+
     return (struct hw_context *)proc_context;
 }
 
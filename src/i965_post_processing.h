@@ -525,11 +525,16 @@ struct i965_post_processing_context
     int (*pp_set_block_parameter)(struct i965_post_processing_context *pp_context, int x, int y);
 
     struct intel_batchbuffer *batch;
+    struct i965_post_processing_context *next_free; /* in i965->pp_free_list */
 
     unsigned int block_horizontal_mask_left:16;
     unsigned int block_horizontal_mask_right:16;
     unsigned int block_vertical_mask_bottom:8;
 
+    /* Call the MEDIA_OBJECT buffer as a second level batch instead of
+     * submitting the batch after each pass (Gen8+ only) */
+    unsigned int chain_object_walker:1;
+
     struct {
         dri_bo *bo;
         int bo_size;
@@ -565,11 +570,40 @@ struct i965_post_processing_context
         struct i965_post_processing_context *pp_context);
 };
 
+#define I965_PROC_MAX_DEFERRED          64
+
+struct i965_proc_deferred_op
+{
+    dri_bo *src_bo;
+    dri_bo *dst_bo;
+    VARectangle dst_rect;
+};
+
 struct i965_proc_context
 {
     struct hw_context base;
     void *driver_context;
     struct i965_post_processing_context pp_context;
+
+    /* NV12 scratch surface of the translucent layers, see
+     * i965_proc_blend_layer(), kept across the frames */
+    struct object_surface *blend_surface;
+
+    /*
+     * Deferred submission (VA_INTEL_VPP_DEFERRED, Gen8+): fast-path
+     * operations are accumulated into base.batch and only submitted on
+     * synchronization, on a dependency or when the batch is full
+     */
+    struct {
+        unsigned int enabled : 1;
+        int num_pending;
+        struct i965_proc_deferred_op pending[I965_PROC_MAX_DEFERRED];
+        struct i965_proc_context *next; /* in i965->deferred_proc_list */
+
+        unsigned int num_operations;
+        unsigned int num_submissions;
+        unsigned int num_frames;        /* external synchronization points */
+    } deferred;
 };
 
 VASurfaceID
@@ -606,6 +640,9 @@ bool
 i965_post_processing_init(VADriverContextP ctx);
 
 
+void
+i965_proc_flush_deferred(VADriverContextP ctx, dri_bo *bo);
+
 extern VAStatus
 i965_proc_picture(VADriverContextP ctx,
                   VAProfile profile,
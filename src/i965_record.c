@@ -0,0 +1,695 @@
+/*
+ * i965_record.c - recording of VA parameter streams
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+#include <pthread.h>
+
+#include <va/va_backend.h>
+
+#include "i965_record.h"
+
+static pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
+static VADriverContextP record_ctx = NULL;
+static FILE *record_fp = NULL;
+
+/* The entrypoints of the driver, called by the recording ones */
+static struct VADriverVTable record_vtable;
+
+/* Payload of the record being built */
+static uint32_t *record_fields = NULL;
+static unsigned int record_num_fields = 0;
+static unsigned int record_max_fields = 0;
+
+/* Buffers mapped by the application, their content is recorded at unmap */
+struct record_mapping {
+    VABufferID id;
+    void *data;                 /* NULL for a free entry */
+};
+
+static struct record_mapping *record_mapped = NULL;
+static unsigned int record_num_mapped = 0;
+static unsigned int record_max_mapped = 0;
+
+static void
+record_put(uint32_t value)
+{
+    uint32_t *fields;
+
+    if (record_num_fields == record_max_fields) {
+        fields = realloc(record_fields, (record_max_fields + 64) * sizeof(uint32_t));
+
+        if (!fields)
+            return;
+
+        record_fields = fields;
+        record_max_fields += 64;
+    }
+
+    record_fields[record_num_fields++] = value;
+}
+
+/* Writes the fields put since the last record, then size bytes of data */
+static void
+record_write(enum i965_record_call call, const void *data, uint32_t size)
+{
+    static const uint8_t record_padding[4];
+    struct i965_record_header header;
+
+    header.call = call;
+    header.size = record_num_fields * sizeof(uint32_t) + size;
+
+    if (record_fp) {
+        fwrite(&header, sizeof(header), 1, record_fp);
+        fwrite(record_fields, sizeof(uint32_t), record_num_fields, record_fp);
+
+        if (size)
+            fwrite(data, 1, size, record_fp);
+
+        /* keep the next record aligned */
+        if (size & 3)
+            fwrite(record_padding, 1, 4 - (size & 3), record_fp);
+    }
+
+    record_num_fields = 0;
+}
+
+static VAStatus
+record_CreateConfig(VADriverContextP ctx,
+                    VAProfile profile,
+                    VAEntrypoint entrypoint,
+                    VAConfigAttrib *attrib_list,
+                    int num_attribs,
+                    VAConfigID *config_id)
+{
+    VAStatus status;
+    int i;
+
+    status = record_vtable.vaCreateConfig(ctx, profile, entrypoint, attrib_list, num_attribs, config_id);
+
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(profile);
+    record_put(entrypoint);
+    record_put(num_attribs);
+
+    for (i = 0; i < num_attribs; i++) {
+        record_put(attrib_list[i].type);
+        record_put(attrib_list[i].value);
+    }
+
+    record_put(*config_id);
+    record_write(I965_RECORD_CREATE_CONFIG, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_DestroyConfig(VADriverContextP ctx, VAConfigID config_id)
+{
+    VAStatus status = record_vtable.vaDestroyConfig(ctx, config_id);
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(config_id);
+    record_write(I965_RECORD_DESTROY_CONFIG, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static void
+record_create_surfaces(unsigned int format,
+                       unsigned int width,
+                       unsigned int height,
+                       VASurfaceID *surfaces,
+                       unsigned int num_surfaces,
+                       VASurfaceAttrib *attrib_list,
+                       unsigned int num_attribs)
+{
+    unsigned int i, num_recorded = 0;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(format);
+    record_put(width);
+    record_put(height);
+    record_put(num_surfaces);
+
+    for (i = 0; i < num_surfaces; i++)
+        record_put(surfaces[i]);
+
+    /* the memory of external surfaces can't be recorded, they are replayed
+     * as surfaces of the driver */
+    for (i = 0; i < num_attribs; i++) {
+        if (attrib_list[i].value.type == VAGenericValueTypeInteger &&
+            attrib_list[i].type != VASurfaceAttribMemoryType)
+            num_recorded++;
+    }
+
+    record_put(num_recorded);
+
+    for (i = 0; i < num_attribs; i++) {
+        if (attrib_list[i].value.type == VAGenericValueTypeInteger &&
+            attrib_list[i].type != VASurfaceAttribMemoryType) {
+            record_put(attrib_list[i].type);
+            record_put(attrib_list[i].flags);
+            record_put(attrib_list[i].value.value.i);
+        }
+    }
+
+    record_write(I965_RECORD_CREATE_SURFACES, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+}
+
+static VAStatus
+record_CreateSurfaces(VADriverContextP ctx,
+                      int width,
+                      int height,
+                      int format,
+                      int num_surfaces,
+                      VASurfaceID *surfaces)
+{
+    VAStatus status;
+
+    status = record_vtable.vaCreateSurfaces(ctx, width, height, format, num_surfaces, surfaces);
+
+    if (status == VA_STATUS_SUCCESS)
+        record_create_surfaces(format, width, height, surfaces, num_surfaces, NULL, 0);
+
+    return status;
+}
+
+static VAStatus
+record_CreateSurfaces2(VADriverContextP ctx,
+                       unsigned int format,
+                       unsigned int width,
+                       unsigned int height,
+                       VASurfaceID *surfaces,
+                       unsigned int num_surfaces,
+                       VASurfaceAttrib *attrib_list,
+                       unsigned int num_attribs)
+{
+    VAStatus status;
+
+    status = record_vtable.vaCreateSurfaces2(ctx, format, width, height, surfaces, num_surfaces,
+                                             attrib_list, num_attribs);
+
+    if (status == VA_STATUS_SUCCESS)
+        record_create_surfaces(format, width, height, surfaces, num_surfaces, attrib_list, num_attribs);
+
+    return status;
+}
+
+static VAStatus
+record_DestroySurfaces(VADriverContextP ctx,
+                       VASurfaceID *surface_list,
+                       int num_surfaces)
+{
+    VAStatus status = record_vtable.vaDestroySurfaces(ctx, surface_list, num_surfaces);
+    int i;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(num_surfaces);
+
+    for (i = 0; i < num_surfaces; i++)
+        record_put(surface_list[i]);
+
+    record_write(I965_RECORD_DESTROY_SURFACES, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_CreateContext(VADriverContextP ctx,
+                     VAConfigID config_id,
+                     int picture_width,
+                     int picture_height,
+                     int flag,
+                     VASurfaceID *render_targets,
+                     int num_render_targets,
+                     VAContextID *context)
+{
+    VAStatus status;
+    int i;
+
+    status = record_vtable.vaCreateContext(ctx, config_id, picture_width, picture_height, flag,
+                                           render_targets, num_render_targets, context);
+
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(config_id);
+    record_put(picture_width);
+    record_put(picture_height);
+    record_put(flag);
+    record_put(num_render_targets);
+
+    for (i = 0; i < num_render_targets; i++)
+        record_put(render_targets[i]);
+
+    record_put(*context);
+    record_write(I965_RECORD_CREATE_CONTEXT, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_DestroyContext(VADriverContextP ctx, VAContextID context)
+{
+    VAStatus status = record_vtable.vaDestroyContext(ctx, context);
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(context);
+    record_write(I965_RECORD_DESTROY_CONTEXT, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_CreateBuffer(VADriverContextP ctx,
+                    VAContextID context,
+                    VABufferType type,
+                    unsigned int size,
+                    unsigned int num_elements,
+                    void *data,
+                    VABufferID *buf_id)
+{
+    VAStatus status;
+
+    status = record_vtable.vaCreateBuffer(ctx, context, type, size, num_elements, data, buf_id);
+
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(context);
+    record_put(type);
+    record_put(size);
+    record_put(num_elements);
+    record_put(*buf_id);
+    record_put(!!data);
+    record_write(I965_RECORD_CREATE_BUFFER, data, data ? size * num_elements : 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+#if VA_CHECK_VERSION(0,39,0)
+static VAStatus
+record_CreateBuffer2(VADriverContextP ctx,
+                     VAContextID context,
+                     VABufferType type,
+                     unsigned int width,
+                     unsigned int height,
+                     unsigned int *unit_size,
+                     unsigned int *pitch,
+                     VABufferID *buf_id)
+{
+    VAStatus status;
+
+    status = record_vtable.vaCreateBuffer2(ctx, context, type, width, height, unit_size, pitch, buf_id);
+
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(context);
+    record_put(type);
+    record_put(width);
+    record_put(height);
+    record_put(*unit_size);
+    record_put(*pitch);
+    record_put(*buf_id);
+    record_write(I965_RECORD_CREATE_BUFFER2, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+#endif
+
+static VAStatus
+record_BufferSetNumElements(VADriverContextP ctx,
+                            VABufferID buf_id,
+                            unsigned int num_elements)
+{
+    VAStatus status = record_vtable.vaBufferSetNumElements(ctx, buf_id, num_elements);
+
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(buf_id);
+    record_put(num_elements);
+    record_write(I965_RECORD_BUFFER_SET_NUM_ELEMENTS, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_MapBuffer(VADriverContextP ctx, VABufferID buf_id, void **pbuf)
+{
+    VAStatus status = record_vtable.vaMapBuffer(ctx, buf_id, pbuf);
+    struct record_mapping *mapped;
+    unsigned int i;
+
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    pthread_mutex_lock(&record_mutex);
+
+    for (i = 0; i < record_num_mapped; i++) {
+        if (!record_mapped[i].data)
+            break;
+    }
+
+    if (i == record_max_mapped) {
+        mapped = realloc(record_mapped, (record_max_mapped + 64) * sizeof(*mapped));
+
+        /* the content written to the buffer couldn't be recorded */
+        if (!mapped) {
+            pthread_mutex_unlock(&record_mutex);
+            fprintf(stderr, "Out of memory to record mapped buffer %#x\n", buf_id);
+            record_vtable.vaUnmapBuffer(ctx, buf_id);
+
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        }
+
+        record_mapped = mapped;
+        record_max_mapped += 64;
+    }
+
+    if (i == record_num_mapped)
+        record_num_mapped++;
+
+    record_mapped[i].id = buf_id;
+    record_mapped[i].data = *pbuf;
+
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_UnmapBuffer(VADriverContextP ctx, VABufferID buf_id)
+{
+    VABufferType type;
+    unsigned int size, num_elements;
+    unsigned int i;
+
+    pthread_mutex_lock(&record_mutex);
+
+    for (i = 0; i < record_num_mapped; i++) {
+        if (record_mapped[i].data && record_mapped[i].id == buf_id)
+            break;
+    }
+
+    /* the output of the driver isn't input to the replay */
+    if (i < record_num_mapped &&
+        record_vtable.vaBufferInfo(ctx, buf_id, &type, &size, &num_elements) == VA_STATUS_SUCCESS &&
+        type != VAEncCodedBufferType) {
+        record_put(buf_id);
+        record_put(size * num_elements);
+        record_write(I965_RECORD_BUFFER_DATA, record_mapped[i].data, size * num_elements);
+    }
+
+    if (i < record_num_mapped)
+        record_mapped[i].data = NULL;
+
+    pthread_mutex_unlock(&record_mutex);
+
+    return record_vtable.vaUnmapBuffer(ctx, buf_id);
+}
+
+static VAStatus
+record_DestroyBuffer(VADriverContextP ctx, VABufferID buffer_id)
+{
+    VAStatus status = record_vtable.vaDestroyBuffer(ctx, buffer_id);
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(buffer_id);
+    record_write(I965_RECORD_DESTROY_BUFFER, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_CreateImage(VADriverContextP ctx,
+                   VAImageFormat *format,
+                   int width,
+                   int height,
+                   VAImage *image)
+{
+    VAStatus status = record_vtable.vaCreateImage(ctx, format, width, height, image);
+
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(format->fourcc);
+    record_put(format->byte_order);
+    record_put(format->bits_per_pixel);
+    record_put(format->depth);
+    record_put(format->red_mask);
+    record_put(format->green_mask);
+    record_put(format->blue_mask);
+    record_put(format->alpha_mask);
+    record_put(width);
+    record_put(height);
+    record_put(image->image_id);
+    record_put(image->buf);
+    record_write(I965_RECORD_CREATE_IMAGE, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_DeriveImage(VADriverContextP ctx,
+                   VASurfaceID surface,
+                   VAImage *image)
+{
+    VAStatus status = record_vtable.vaDeriveImage(ctx, surface, image);
+
+    if (status != VA_STATUS_SUCCESS)
+        return status;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(surface);
+    record_put(image->image_id);
+    record_put(image->buf);
+    record_write(I965_RECORD_DERIVE_IMAGE, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_DestroyImage(VADriverContextP ctx, VAImageID image)
+{
+    VAStatus status = record_vtable.vaDestroyImage(ctx, image);
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(image);
+    record_write(I965_RECORD_DESTROY_IMAGE, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return status;
+}
+
+static VAStatus
+record_PutImage(VADriverContextP ctx,
+                VASurfaceID surface,
+                VAImageID image,
+                int src_x,
+                int src_y,
+                unsigned int src_width,
+                unsigned int src_height,
+                int dest_x,
+                int dest_y,
+                unsigned int dest_width,
+                unsigned int dest_height)
+{
+    pthread_mutex_lock(&record_mutex);
+    record_put(surface);
+    record_put(image);
+    record_put(src_x);
+    record_put(src_y);
+    record_put(src_width);
+    record_put(src_height);
+    record_put(dest_x);
+    record_put(dest_y);
+    record_put(dest_width);
+    record_put(dest_height);
+    record_write(I965_RECORD_PUT_IMAGE, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return record_vtable.vaPutImage(ctx, surface, image, src_x, src_y, src_width, src_height,
+                                    dest_x, dest_y, dest_width, dest_height);
+}
+
+static VAStatus
+record_BeginPicture(VADriverContextP ctx,
+                    VAContextID context,
+                    VASurfaceID render_target)
+{
+    pthread_mutex_lock(&record_mutex);
+    record_put(context);
+    record_put(render_target);
+    record_write(I965_RECORD_BEGIN_PICTURE, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return record_vtable.vaBeginPicture(ctx, context, render_target);
+}
+
+static VAStatus
+record_RenderPicture(VADriverContextP ctx,
+                     VAContextID context,
+                     VABufferID *buffers,
+                     int num_buffers)
+{
+    int i;
+
+    pthread_mutex_lock(&record_mutex);
+    record_put(context);
+    record_put(num_buffers);
+
+    for (i = 0; i < num_buffers; i++)
+        record_put(buffers[i]);
+
+    record_write(I965_RECORD_RENDER_PICTURE, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return record_vtable.vaRenderPicture(ctx, context, buffers, num_buffers);
+}
+
+static VAStatus
+record_EndPicture(VADriverContextP ctx, VAContextID context)
+{
+    pthread_mutex_lock(&record_mutex);
+    record_put(context);
+    record_write(I965_RECORD_END_PICTURE, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return record_vtable.vaEndPicture(ctx, context);
+}
+
+static VAStatus
+record_SyncSurface(VADriverContextP ctx, VASurfaceID render_target)
+{
+    pthread_mutex_lock(&record_mutex);
+    record_put(render_target);
+    record_write(I965_RECORD_SYNC_SURFACE, NULL, 0);
+    pthread_mutex_unlock(&record_mutex);
+
+    return record_vtable.vaSyncSurface(ctx, render_target);
+}
+
+void
+i965_record_init(VADriverContextP ctx)
+{
+    struct VADriverVTable * const vtable = ctx->vtable;
+    uint32_t version = I965_RECORD_VERSION;
+    char *env_str;
+
+    if (!(env_str = getenv("VA_INTEL_RECORD")) || !*env_str)
+        return;
+
+    pthread_mutex_lock(&record_mutex);
+
+    /* only one display is recorded */
+    if (record_ctx) {
+        pthread_mutex_unlock(&record_mutex);
+        return;
+    }
+
+    record_fp = fopen(env_str, "wb");
+
+    if (!record_fp) {
+        fprintf(stderr, "Failed to open %s for recording\n", env_str);
+        pthread_mutex_unlock(&record_mutex);
+        return;
+    }
+
+    fwrite(I965_RECORD_MAGIC, 1, 8, record_fp);
+    fwrite(&version, sizeof(version), 1, record_fp);
+
+    record_ctx = ctx;
+    record_vtable = *vtable;
+
+    vtable->vaCreateConfig = record_CreateConfig;
+    vtable->vaDestroyConfig = record_DestroyConfig;
+    vtable->vaCreateSurfaces = record_CreateSurfaces;
+    vtable->vaCreateSurfaces2 = record_CreateSurfaces2;
+    vtable->vaDestroySurfaces = record_DestroySurfaces;
+    vtable->vaCreateContext = record_CreateContext;
+    vtable->vaDestroyContext = record_DestroyContext;
+    vtable->vaCreateBuffer = record_CreateBuffer;
+#if VA_CHECK_VERSION(0,39,0)
+    if (vtable->vaCreateBuffer2)
+        vtable->vaCreateBuffer2 = record_CreateBuffer2;
+#endif
+    vtable->vaBufferSetNumElements = record_BufferSetNumElements;
+    vtable->vaMapBuffer = record_MapBuffer;
+    vtable->vaUnmapBuffer = record_UnmapBuffer;
+    vtable->vaDestroyBuffer = record_DestroyBuffer;
+    vtable->vaCreateImage = record_CreateImage;
+    vtable->vaDeriveImage = record_DeriveImage;
+    vtable->vaDestroyImage = record_DestroyImage;
+    vtable->vaPutImage = record_PutImage;
+    vtable->vaBeginPicture = record_BeginPicture;
+    vtable->vaRenderPicture = record_RenderPicture;
+    vtable->vaEndPicture = record_EndPicture;
+    vtable->vaSyncSurface = record_SyncSurface;
+
+    pthread_mutex_unlock(&record_mutex);
+}
+
+void
+i965_record_terminate(VADriverContextP ctx)
+{
+    pthread_mutex_lock(&record_mutex);
+
+    if (record_ctx == ctx) {
+        fclose(record_fp);
+        record_fp = NULL;
+        record_ctx = NULL;
+        free(record_fields);
+        record_fields = NULL;
+        record_num_fields = record_max_fields = 0;
+        free(record_mapped);
+        record_mapped = NULL;
+        record_num_mapped = record_max_mapped = 0;
+    }
+
+    pthread_mutex_unlock(&record_mutex);
+}
@@ -0,0 +1,110 @@
+/*
+ * i965_record.h - recording of VA parameter streams
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_RECORD_H
+#define I965_RECORD_H
+
+#include <stdint.h>
+
+/**
+ * VA_INTEL_RECORD=<file> writes the VA calls made on the first display, and
+ * the content of the buffers they pass, to a binary file. i965_replay runs
+ * the calls again, to measure the CPU cost of the driver on its own.
+ *
+ * The file starts with I965_RECORD_MAGIC and I965_RECORD_VERSION, followed
+ * by records of a struct i965_record_header and size bytes of payload,
+ * padded to 4 bytes. The payload is made of 32-bit fields in host order, as
+ * listed below; object IDs are the ones returned to the recorded application.
+ * The content of the image buffers is recorded as for the other buffers, it
+ * is the input of vaPutImage() and of the derived images.
+ */
+
+#define I965_RECORD_MAGIC       "I965REC"       /* 8 bytes with the NUL */
+#define I965_RECORD_VERSION     2
+
+enum i965_record_call {
+    /* profile, entrypoint, num_attribs, {type, value} * num_attribs, config_id */
+    I965_RECORD_CREATE_CONFIG = 1,
+    /* config_id */
+    I965_RECORD_DESTROY_CONFIG,
+    /* format, width, height, num_surfaces, surface_id * num_surfaces,
+     * num_attribs, {type, flags, value} * num_attribs (integer ones only) */
+    I965_RECORD_CREATE_SURFACES,
+    /* num_surfaces, surface_id * num_surfaces */
+    I965_RECORD_DESTROY_SURFACES,
+    /* config_id, width, height, flag, num_targets, surface_id * num_targets, context_id */
+    I965_RECORD_CREATE_CONTEXT,
+    /* context_id */
+    I965_RECORD_DESTROY_CONTEXT,
+    /* context_id, type, size, num_elements, buffer_id, has_data, data */
+    I965_RECORD_CREATE_BUFFER,
+    /* buffer_id, num_elements */
+    I965_RECORD_BUFFER_SET_NUM_ELEMENTS,
+    /* buffer_id, size, data: the content written through vaMapBuffer */
+    I965_RECORD_BUFFER_DATA,
+    /* buffer_id */
+    I965_RECORD_DESTROY_BUFFER,
+    /* context_id, surface_id */
+    I965_RECORD_BEGIN_PICTURE,
+    /* context_id, num_buffers, buffer_id * num_buffers */
+    I965_RECORD_RENDER_PICTURE,
+    /* context_id */
+    I965_RECORD_END_PICTURE,
+    /* surface_id */
+    I965_RECORD_SYNC_SURFACE,
+
+    /* Version 2 */
+
+    /* context_id, type, width, height, unit_size, pitch, buffer_id */
+    I965_RECORD_CREATE_BUFFER2,
+    /* fourcc, byte_order, bits_per_pixel, depth, red_mask, green_mask,
+     * blue_mask, alpha_mask, width, height, image_id, buffer_id */
+    I965_RECORD_CREATE_IMAGE,
+    /* surface_id, image_id, buffer_id */
+    I965_RECORD_DERIVE_IMAGE,
+    /* image_id */
+    I965_RECORD_DESTROY_IMAGE,
+    /* surface_id, image_id, src_x, src_y, src_width, src_height,
+     * dest_x, dest_y, dest_width, dest_height */
+    I965_RECORD_PUT_IMAGE,
+};
+
+struct i965_record_header {
+    uint32_t call;
+    uint32_t size;
+};
+
+struct VADriverContext;
+
+/** Starts recording the display if VA_INTEL_RECORD is set, wrapping its vtable */
+void
+i965_record_init(struct VADriverContext *ctx);
+
+/** Stops recording when ctx is the recorded display */
+void
+i965_record_terminate(struct VADriverContext *ctx);
+
+#endif /* I965_RECORD_H */
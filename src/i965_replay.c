@@ -0,0 +1,538 @@
+/*
+ * i965_replay.c - replays VA parameter streams recorded by the driver
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Usage: i965_replay [-d device] [-n loops] file
+ *
+ * Runs the VA calls of a file recorded with VA_INTEL_RECORD=<file> on the
+ * driver again, and reports the CPU time spent in each kind of call and per
+ * picture. The content of the coded buffers and surfaces isn't checked.
+ *
+ * To measure the driver alone, without a GPU, replay on the host-memory
+ * buffer manager of intel_mock_bufmgr.h:
+ *
+ *   LIBVA_DRIVER_NAME=i965 VA_INTEL_MOCK=0x1916 i965_replay -d /dev/null file
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <va/va.h>
+#include <va/va_drm.h>
+
+#include "i965_record.h"
+
+#define REPLAY_NUM_CALLS        (I965_RECORD_PUT_IMAGE + 1)
+
+#define ALIGN4(size)            (((size) + 3) & ~3)
+
+static const char *replay_call_names[REPLAY_NUM_CALLS] = {
+    [I965_RECORD_CREATE_CONFIG] = "vaCreateConfig",
+    [I965_RECORD_DESTROY_CONFIG] = "vaDestroyConfig",
+    [I965_RECORD_CREATE_SURFACES] = "vaCreateSurfaces",
+    [I965_RECORD_DESTROY_SURFACES] = "vaDestroySurfaces",
+    [I965_RECORD_CREATE_CONTEXT] = "vaCreateContext",
+    [I965_RECORD_DESTROY_CONTEXT] = "vaDestroyContext",
+    [I965_RECORD_CREATE_BUFFER] = "vaCreateBuffer",
+    [I965_RECORD_BUFFER_SET_NUM_ELEMENTS] = "vaBufferSetNumElements",
+    [I965_RECORD_BUFFER_DATA] = "vaMapBuffer+vaUnmapBuffer",
+    [I965_RECORD_DESTROY_BUFFER] = "vaDestroyBuffer",
+    [I965_RECORD_BEGIN_PICTURE] = "vaBeginPicture",
+    [I965_RECORD_RENDER_PICTURE] = "vaRenderPicture",
+    [I965_RECORD_END_PICTURE] = "vaEndPicture",
+    [I965_RECORD_SYNC_SURFACE] = "vaSyncSurface",
+    [I965_RECORD_CREATE_BUFFER2] = "vaCreateBuffer2",
+    [I965_RECORD_CREATE_IMAGE] = "vaCreateImage",
+    [I965_RECORD_DERIVE_IMAGE] = "vaDeriveImage",
+    [I965_RECORD_DESTROY_IMAGE] = "vaDestroyImage",
+    [I965_RECORD_PUT_IMAGE] = "vaPutImage",
+};
+
+static struct {
+    uint64_t count;
+    uint64_t total_ns;
+} replay_stats[REPLAY_NUM_CALLS];
+
+/* Recorded object IDs to the IDs of the replay, open addressing */
+struct replay_id {
+    uint32_t recorded;
+    uint32_t live;
+};
+
+static struct replay_id *replay_ids = NULL;
+static unsigned int replay_num_ids = 0;
+static unsigned int replay_max_ids = 0;        /* a power of 2 */
+
+static VADisplay replay_dpy;
+
+static void
+replay_set_id(uint32_t recorded, uint32_t live);
+
+static unsigned int
+replay_id_slot(uint32_t recorded)
+{
+    unsigned int slot = (recorded * 2654435761u) & (replay_max_ids - 1);
+
+    while (replay_ids[slot].recorded != VA_INVALID_ID &&
+           replay_ids[slot].recorded != recorded)
+        slot = (slot + 1) & (replay_max_ids - 1);
+
+    return slot;
+}
+
+static void
+replay_grow_ids(void)
+{
+    unsigned int i, old_max = replay_max_ids;
+    struct replay_id *old_ids = replay_ids;
+
+    replay_max_ids = old_max ? old_max * 2 : 1024;
+    replay_ids = malloc(replay_max_ids * sizeof(*replay_ids));
+
+    if (!replay_ids) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    memset(replay_ids, 0xff, replay_max_ids * sizeof(*replay_ids));
+    replay_num_ids = 0;
+
+    for (i = 0; i < old_max; i++) {
+        if (old_ids[i].recorded != VA_INVALID_ID)
+            replay_set_id(old_ids[i].recorded, old_ids[i].live);
+    }
+
+    free(old_ids);
+}
+
+static void
+replay_set_id(uint32_t recorded, uint32_t live)
+{
+    unsigned int slot;
+
+    if ((replay_num_ids + 1) * 2 > replay_max_ids)
+        replay_grow_ids();
+
+    slot = replay_id_slot(recorded);
+
+    if (replay_ids[slot].recorded == VA_INVALID_ID)
+        replay_num_ids++;
+
+    replay_ids[slot].recorded = recorded;
+    replay_ids[slot].live = live;
+}
+
+static uint32_t
+replay_get_id(uint32_t recorded)
+{
+    unsigned int slot;
+
+    if (recorded == VA_INVALID_ID || !replay_max_ids)
+        return recorded;
+
+    slot = replay_id_slot(recorded);
+
+    return replay_ids[slot].recorded == recorded ? replay_ids[slot].live : VA_INVALID_ID;
+}
+
+static uint64_t
+replay_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+replay_check(VAStatus status, uint32_t call)
+{
+    if (status != VA_STATUS_SUCCESS)
+        fprintf(stderr, "%s failed: %s\n", replay_call_names[call], vaErrorStr(status));
+}
+
+/* Runs one record, f points to its fields and size is its payload size */
+static void
+replay_record(uint32_t call, const uint32_t *f, uint32_t size)
+{
+    VAStatus status = VA_STATUS_SUCCESS;
+    uint32_t ids[64], *list = ids, i, n = 0, first = 0;
+    VAConfigAttrib *config_attribs = NULL;
+    VASurfaceAttrib *surface_attribs = NULL;
+    VAImageFormat image_format;
+    VAImage image;
+    VAGenericID id;
+    void *data;
+    uint64_t start;
+
+    if (!call || call >= REPLAY_NUM_CALLS) {
+        fprintf(stderr, "Unknown record %u\n", call);
+        return;
+    }
+
+    /* the ID lists of the calls are translated before the call is timed */
+    switch (call) {
+    case I965_RECORD_CREATE_CONFIG:
+        n = f[2];
+        config_attribs = calloc(n + 1, sizeof(*config_attribs));
+
+        for (i = 0; i < n; i++) {
+            config_attribs[i].type = f[3 + i * 2];
+            config_attribs[i].value = f[4 + i * 2];
+        }
+
+        break;
+
+    case I965_RECORD_CREATE_SURFACES:
+        n = f[4 + f[3]];
+        surface_attribs = calloc(n + 1, sizeof(*surface_attribs));
+
+        for (i = 0; i < n; i++) {
+            surface_attribs[i].type = f[5 + f[3] + i * 3];
+            surface_attribs[i].flags = f[6 + f[3] + i * 3];
+            surface_attribs[i].value.type = VAGenericValueTypeInteger;
+            surface_attribs[i].value.value.i = f[7 + f[3] + i * 3];
+        }
+
+        n = f[3];
+        break;
+
+    case I965_RECORD_DESTROY_SURFACES:
+        n = f[0];
+        first = 1;
+        break;
+
+    case I965_RECORD_CREATE_CONTEXT:
+        n = f[4];
+        first = 5;
+        break;
+
+    case I965_RECORD_RENDER_PICTURE:
+        n = f[1];
+        first = 2;
+        break;
+
+    default:
+        break;
+    }
+
+    if (n > 64 && (call == I965_RECORD_CREATE_SURFACES || first)) {
+        list = malloc(n * sizeof(uint32_t));
+
+        if (!list) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    for (i = 0; first && i < n; i++)
+        list[i] = replay_get_id(f[first + i]);
+
+    start = replay_cpu_ns();
+
+    switch (call) {
+    case I965_RECORD_CREATE_CONFIG:
+        status = vaCreateConfig(replay_dpy, f[0], f[1], config_attribs, n, &id);
+
+        if (status == VA_STATUS_SUCCESS)
+            replay_set_id(f[3 + n * 2], id);
+
+        break;
+
+    case I965_RECORD_DESTROY_CONFIG:
+        status = vaDestroyConfig(replay_dpy, replay_get_id(f[0]));
+        break;
+
+    case I965_RECORD_CREATE_SURFACES:
+        status = vaCreateSurfaces(replay_dpy, f[0], f[1], f[2], list, n,
+                                  surface_attribs, f[4 + n]);
+
+        for (i = 0; status == VA_STATUS_SUCCESS && i < n; i++)
+            replay_set_id(f[4 + i], list[i]);
+
+        break;
+
+    case I965_RECORD_DESTROY_SURFACES:
+        status = vaDestroySurfaces(replay_dpy, list, n);
+        break;
+
+    case I965_RECORD_CREATE_CONTEXT:
+        status = vaCreateContext(replay_dpy, replay_get_id(f[0]), f[1], f[2], f[3], list, n, &id);
+
+        if (status == VA_STATUS_SUCCESS)
+            replay_set_id(f[5 + n], id);
+
+        break;
+
+    case I965_RECORD_DESTROY_CONTEXT:
+        status = vaDestroyContext(replay_dpy, replay_get_id(f[0]));
+        break;
+
+    case I965_RECORD_CREATE_BUFFER:
+        status = vaCreateBuffer(replay_dpy, replay_get_id(f[0]), f[1], f[2], f[3],
+                                f[5] ? (void *)&f[6] : NULL, &id);
+
+        if (status == VA_STATUS_SUCCESS)
+            replay_set_id(f[4], id);
+
+        break;
+
+    case I965_RECORD_BUFFER_SET_NUM_ELEMENTS:
+        status = vaBufferSetNumElements(replay_dpy, replay_get_id(f[0]), f[1]);
+        break;
+
+    case I965_RECORD_BUFFER_DATA:
+        id = replay_get_id(f[0]);
+        status = vaMapBuffer(replay_dpy, id, &data);
+
+        if (status == VA_STATUS_SUCCESS) {
+            memcpy(data, &f[2], f[1]);
+            status = vaUnmapBuffer(replay_dpy, id);
+        }
+
+        break;
+
+    case I965_RECORD_DESTROY_BUFFER:
+        status = vaDestroyBuffer(replay_dpy, replay_get_id(f[0]));
+        break;
+
+    case I965_RECORD_BEGIN_PICTURE:
+        status = vaBeginPicture(replay_dpy, replay_get_id(f[0]), replay_get_id(f[1]));
+        break;
+
+    case I965_RECORD_RENDER_PICTURE:
+        status = vaRenderPicture(replay_dpy, replay_get_id(f[0]), list, n);
+        break;
+
+    case I965_RECORD_END_PICTURE:
+        status = vaEndPicture(replay_dpy, replay_get_id(f[0]));
+        break;
+
+    case I965_RECORD_SYNC_SURFACE:
+        status = vaSyncSurface(replay_dpy, replay_get_id(f[0]));
+        break;
+
+    case I965_RECORD_CREATE_BUFFER2:
+#if VA_CHECK_VERSION(0,39,0)
+    {
+        unsigned int unit_size, pitch;
+
+        status = vaCreateBuffer2(replay_dpy, replay_get_id(f[0]), f[1], f[2], f[3],
+                                 &unit_size, &pitch, &id);
+
+        if (status == VA_STATUS_SUCCESS)
+            replay_set_id(f[6], id);
+    }
+#else
+        status = VA_STATUS_ERROR_UNIMPLEMENTED;
+#endif
+        break;
+
+    case I965_RECORD_CREATE_IMAGE:
+        memset(&image_format, 0, sizeof(image_format));
+        image_format.fourcc = f[0];
+        image_format.byte_order = f[1];
+        image_format.bits_per_pixel = f[2];
+        image_format.depth = f[3];
+        image_format.red_mask = f[4];
+        image_format.green_mask = f[5];
+        image_format.blue_mask = f[6];
+        image_format.alpha_mask = f[7];
+        status = vaCreateImage(replay_dpy, &image_format, f[8], f[9], &image);
+
+        if (status == VA_STATUS_SUCCESS) {
+            replay_set_id(f[10], image.image_id);
+            replay_set_id(f[11], image.buf);
+        }
+
+        break;
+
+    case I965_RECORD_DERIVE_IMAGE:
+        status = vaDeriveImage(replay_dpy, replay_get_id(f[0]), &image);
+
+        if (status == VA_STATUS_SUCCESS) {
+            replay_set_id(f[1], image.image_id);
+            replay_set_id(f[2], image.buf);
+        }
+
+        break;
+
+    case I965_RECORD_DESTROY_IMAGE:
+        status = vaDestroyImage(replay_dpy, replay_get_id(f[0]));
+        break;
+
+    case I965_RECORD_PUT_IMAGE:
+        status = vaPutImage(replay_dpy, replay_get_id(f[0]), replay_get_id(f[1]),
+                            f[2], f[3], f[4], f[5], f[6], f[7], f[8], f[9]);
+        break;
+
+    default:
+        break;
+    }
+
+    replay_stats[call].total_ns += replay_cpu_ns() - start;
+    replay_stats[call].count++;
+    replay_check(status, call);
+
+    if (list != ids)
+        free(list);
+
+    free(config_attribs);
+    free(surface_attribs);
+}
+
+static void
+replay_report(void)
+{
+    uint64_t total_ns = 0, pictures = replay_stats[I965_RECORD_END_PICTURE].count;
+    int i;
+
+    printf("%-28s %10s %14s %12s\n", "call", "count", "cpu total ns", "cpu avg ns");
+
+    for (i = 1; i < REPLAY_NUM_CALLS; i++) {
+        if (!replay_stats[i].count)
+            continue;
+
+        printf("%-28s %10llu %14llu %12llu\n",
+               replay_call_names[i],
+               (unsigned long long)replay_stats[i].count,
+               (unsigned long long)replay_stats[i].total_ns,
+               (unsigned long long)(replay_stats[i].total_ns / replay_stats[i].count));
+        total_ns += replay_stats[i].total_ns;
+    }
+
+    if (pictures)
+        printf("%llu pictures, %llu ns of driver CPU time per picture\n",
+               (unsigned long long)pictures,
+               (unsigned long long)(total_ns / pictures));
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *device = "/dev/dri/renderD128";
+    const struct i965_record_header *header;
+    unsigned char *file_data;
+    uint32_t version;
+    long file_size, pos;
+    int opt, loops = 1, loop, fd, major, minor;
+    FILE *fp;
+    VAStatus status;
+
+    while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 'n':
+            loops = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d device] [-n loops] file\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-d device] [-n loops] file\n", argv[0]);
+        return 1;
+    }
+
+    fp = fopen(argv[optind], "rb");
+
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s\n", argv[optind]);
+        return 1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    file_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    file_data = malloc(file_size);
+
+    if (!file_data || fread(file_data, 1, file_size, fp) != (size_t)file_size) {
+        fprintf(stderr, "Failed to read %s\n", argv[optind]);
+        return 1;
+    }
+
+    fclose(fp);
+    memcpy(&version, file_data + 8, sizeof(version));
+
+    /* the later versions only add calls */
+    if (file_size < 12 || memcmp(file_data, I965_RECORD_MAGIC, 8) ||
+        version < 1 || version > I965_RECORD_VERSION) {
+        fprintf(stderr, "%s isn't a recording of this driver version\n", argv[optind]);
+        return 1;
+    }
+
+    fd = open(device, O_RDWR);
+
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s\n", device);
+        return 1;
+    }
+
+    replay_dpy = vaGetDisplayDRM(fd);
+    status = vaInitialize(replay_dpy, &major, &minor);
+
+    if (status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "vaInitialize failed: %s\n", vaErrorStr(status));
+        return 1;
+    }
+
+    for (loop = 0; loop < loops; loop++) {
+        for (pos = 12; pos + (long)sizeof(*header) <= file_size; pos += sizeof(*header) + ALIGN4(header->size)) {
+            header = (const struct i965_record_header *)(file_data + pos);
+
+            if (pos + (long)sizeof(*header) + header->size > file_size) {
+                fprintf(stderr, "Truncated recording\n");
+                break;
+            }
+
+            replay_record(header->call, (const uint32_t *)(header + 1), header->size);
+        }
+    }
+
+    replay_report();
+
+    vaTerminate(replay_dpy);
+    close(fd);
+    free(file_data);
+    free(replay_ids);
+
+    return 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * i965_stats.c - per-thread driver statistics
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "i965_stats.h"
+
+int i965_stats_enabled = 0;
+
+/* Per-thread statistics, linked while the thread runs */
+struct i965_stats_thread {
+    struct i965_stats stats;
+    struct i965_stats_thread *next;
+};
+
+static int stats_users = 0;                     /* initialized displays */
+static pthread_key_t stats_key;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct i965_stats_thread *stats_threads = NULL;
+static struct i965_stats stats_retired;         /* from the exited threads */
+static __thread struct i965_stats_thread *stats_self = NULL;
+
+static uint64_t stats_interval_ns = 0;
+static uint64_t stats_next_dump_ns = 0;
+
+static const char *stats_call_names[I965_STATS_NUM_CALLS] = {
+    "vaCreateSurfaces",
+    "vaDestroySurfaces",
+    "vaCreateContext",
+    "vaDestroyContext",
+    "vaCreateBuffer",
+    "vaDestroyBuffer",
+    "vaMapBuffer",
+    "vaUnmapBuffer",
+    "vaBeginPicture",
+    "vaRenderPicture",
+    "vaEndPicture",
+    "vaSyncSurface",
+    "vaQuerySurfaceStatus",
+    "vaPutSurface",
+    "vaDeriveImage",
+    "vaGetImage",
+    "vaPutImage",
+};
+
+static const char *stats_counter_names[I965_STATS_NUM_COUNTERS] = {
+    "batch bytes (render)",
+    "batch bytes (bsd)",
+    "batch bytes (blt)",
+    "batch bytes (vebox)",
+    "batch flushes",
+    "bo allocations",
+    "bo maps",
+    "bo unmaps",
+    "vme fill bytes",
+    "vme batch reuses",
+};
+
+static uint64_t
+stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+stats_add(struct i965_stats *dst, const struct i965_stats *src)
+{
+    int i, j;
+
+    for (i = 0; i < I965_STATS_NUM_CALLS; i++) {
+        dst->calls[i].count += src->calls[i].count;
+        dst->calls[i].total_ns += src->calls[i].total_ns;
+
+        if (dst->calls[i].max_ns < src->calls[i].max_ns)
+            dst->calls[i].max_ns = src->calls[i].max_ns;
+
+        for (j = 0; j < I965_STATS_HISTOGRAM_BUCKETS; j++)
+            dst->calls[i].histogram[j] += src->calls[i].histogram[j];
+    }
+
+    for (i = 0; i < I965_STATS_NUM_COUNTERS; i++)
+        dst->counters[i] += src->counters[i];
+}
+
+/* Thread exit: keep the counts, drop the per-thread block */
+static void
+stats_thread_exit(void *data)
+{
+    struct i965_stats_thread *thread = data, **p;
+
+    pthread_mutex_lock(&stats_mutex);
+
+    for (p = &stats_threads; *p; p = &(*p)->next) {
+        if (*p == thread) {
+            *p = thread->next;
+            break;
+        }
+    }
+
+    stats_add(&stats_retired, &thread->stats);
+    pthread_mutex_unlock(&stats_mutex);
+
+    free(thread);
+}
+
+int
+i965_stats_init(void)
+{
+    char *env_str;
+
+    pthread_mutex_lock(&stats_mutex);
+
+    if (stats_users++ == 0 &&
+        (env_str = getenv("VA_INTEL_STATS")) && atoi(env_str) &&
+        !pthread_key_create(&stats_key, stats_thread_exit)) {
+        if ((env_str = getenv("VA_INTEL_STATS_INTERVAL")) && atoi(env_str) > 0) {
+            stats_interval_ns = (uint64_t)atoi(env_str) * 1000000000ull;
+            stats_next_dump_ns = stats_now_ns() + stats_interval_ns;
+        }
+
+        i965_stats_enabled = 1;
+    }
+
+    pthread_mutex_unlock(&stats_mutex);
+
+    return i965_stats_enabled;
+}
+
+/*
+ * libva unloads the driver after the last vaTerminate, so the thread exit
+ * destructor must not stay registered. The per-thread blocks stay linked,
+ * a later i965_stats_init() in the same process keeps adding to them.
+ */
+void
+i965_stats_terminate(void)
+{
+    int enabled = i965_stats_enabled;
+
+    if (enabled)
+        i965_stats_dump(stderr);
+
+    pthread_mutex_lock(&stats_mutex);
+
+    if (--stats_users == 0 && enabled) {
+        i965_stats_enabled = 0;
+        stats_interval_ns = 0;
+        pthread_key_delete(stats_key);
+    }
+
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+struct i965_stats *
+i965_stats_thread(void)
+{
+    static struct i965_stats stats_lost;
+    struct i965_stats_thread *thread = stats_self;
+
+    if (thread)
+        return &thread->stats;
+
+    thread = calloc(1, sizeof(*thread));
+
+    /* still count somewhere, the numbers are only indicative anyway */
+    if (!thread)
+        return &stats_lost;
+
+    pthread_mutex_lock(&stats_mutex);
+    thread->next = stats_threads;
+    stats_threads = thread;
+    pthread_mutex_unlock(&stats_mutex);
+
+    if (i965_stats_enabled)
+        pthread_setspecific(stats_key, thread);
+
+    stats_self = thread;
+
+    return &thread->stats;
+}
+
+uint64_t
+i965_stats_begin(void)
+{
+    return i965_stats_enabled ? stats_now_ns() : 0;
+}
+
+void
+i965_stats_end(enum i965_stats_call call, uint64_t start)
+{
+    struct i965_stats_call_stats *call_stats;
+    uint64_t end, elapsed;
+    int bucket = 0;
+
+    if (!start)
+        return;
+
+    end = stats_now_ns();
+    elapsed = end - start;
+    call_stats = &i965_stats_thread()->calls[call];
+
+    while (bucket < I965_STATS_HISTOGRAM_BUCKETS - 1 && (elapsed >> (bucket + 1)))
+        bucket++;
+
+    call_stats->count++;
+    call_stats->total_ns += elapsed;
+    call_stats->histogram[bucket]++;
+
+    if (call_stats->max_ns < elapsed)
+        call_stats->max_ns = elapsed;
+
+    /* a racy read, the dump itself is serialized below */
+    if (stats_interval_ns && end >= stats_next_dump_ns) {
+        pthread_mutex_lock(&stats_mutex);
+
+        if (end < stats_next_dump_ns) {
+            pthread_mutex_unlock(&stats_mutex);
+            return;
+        }
+
+        stats_next_dump_ns = end + stats_interval_ns;
+        pthread_mutex_unlock(&stats_mutex);
+
+        i965_stats_dump(stderr);
+    }
+}
+
+/*
+ * The other threads keep updating their counters while they are summed up,
+ * without any synchronization, so the result is a close approximation
+ */
+void
+i965_stats_get(struct i965_stats *stats)
+{
+    struct i965_stats_thread *thread;
+
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&stats_mutex);
+    stats_add(stats, &stats_retired);
+
+    for (thread = stats_threads; thread; thread = thread->next)
+        stats_add(stats, &thread->stats);
+
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+void
+i965_stats_dump(FILE *fp)
+{
+    struct i965_stats stats;
+    int i, j, last;
+
+    i965_stats_get(&stats);
+
+    fprintf(fp, "i965 driver statistics\n");
+
+    for (i = 0; i < I965_STATS_NUM_CALLS; i++) {
+        struct i965_stats_call_stats *call_stats = &stats.calls[i];
+
+        if (!call_stats->count)
+            continue;
+
+        fprintf(fp, "  %-22s %10llu calls, avg %9llu ns, max %11llu ns\n",
+                stats_call_names[i],
+                (unsigned long long)call_stats->count,
+                (unsigned long long)(call_stats->total_ns / call_stats->count),
+                (unsigned long long)call_stats->max_ns);
+
+        for (last = I965_STATS_HISTOGRAM_BUCKETS - 1; last > 0 && !call_stats->histogram[last]; last--)
+            ;
+
+        for (j = 0; j <= last; j++) {
+            if (call_stats->histogram[j])
+                fprintf(fp, "    < %11llu ns: %llu\n",
+                        2ull << j,
+                        (unsigned long long)call_stats->histogram[j]);
+        }
+    }
+
+    for (i = 0; i < I965_STATS_NUM_COUNTERS; i++)
+        fprintf(fp, "  %-22s %10llu\n",
+                stats_counter_names[i],
+                (unsigned long long)stats.counters[i]);
+}
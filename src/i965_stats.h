@@ -0,0 +1,130 @@
+/*
+ * i965_stats.h - per-thread driver statistics
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_STATS_H
+#define I965_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "intel_compiler.h"
+
+/**
+ * Driver statistics, enabled with VA_INTEL_STATS=1. Every thread updates
+ * its own counters, without locks or atomics; they are summed up when the
+ * statistics are read. VA_INTEL_STATS_INTERVAL=n also dumps them to stderr
+ * every n seconds. When disabled, the cost is a test of i965_stats_enabled.
+ */
+
+/** VA entrypoints whose calls are timed */
+enum i965_stats_call {
+    I965_STATS_CREATE_SURFACES = 0,
+    I965_STATS_DESTROY_SURFACES,
+    I965_STATS_CREATE_CONTEXT,
+    I965_STATS_DESTROY_CONTEXT,
+    I965_STATS_CREATE_BUFFER,
+    I965_STATS_DESTROY_BUFFER,
+    I965_STATS_MAP_BUFFER,
+    I965_STATS_UNMAP_BUFFER,
+    I965_STATS_BEGIN_PICTURE,
+    I965_STATS_RENDER_PICTURE,
+    I965_STATS_END_PICTURE,
+    I965_STATS_SYNC_SURFACE,
+    I965_STATS_QUERY_SURFACE_STATUS,
+    I965_STATS_PUT_SURFACE,
+    I965_STATS_DERIVE_IMAGE,
+    I965_STATS_GET_IMAGE,
+    I965_STATS_PUT_IMAGE,
+    I965_STATS_NUM_CALLS
+};
+
+/** Event counters */
+enum i965_stats_counter {
+    I965_STATS_BATCH_BYTES_RENDER = 0,
+    I965_STATS_BATCH_BYTES_BSD,
+    I965_STATS_BATCH_BYTES_BLT,
+    I965_STATS_BATCH_BYTES_VEBOX,
+    I965_STATS_BATCH_FLUSHES,
+    I965_STATS_BO_ALLOCS,
+    I965_STATS_BO_MAPS,
+    I965_STATS_BO_UNMAPS,
+    I965_STATS_VME_FILL_BYTES,
+    I965_STATS_VME_REUSES,
+    I965_STATS_NUM_COUNTERS
+};
+
+/** Latency histogram bucket n counts the calls of [2^n, 2^(n+1)) ns */
+#define I965_STATS_HISTOGRAM_BUCKETS    32
+
+struct i965_stats_call_stats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t histogram[I965_STATS_HISTOGRAM_BUCKETS];
+};
+
+struct i965_stats {
+    struct i965_stats_call_stats calls[I965_STATS_NUM_CALLS];
+    uint64_t counters[I965_STATS_NUM_COUNTERS];
+};
+
+extern int i965_stats_enabled;
+
+/** Reads the environment on the first display. Returns i965_stats_enabled */
+int
+i965_stats_init(void);
+
+/** Prints the statistics, and stops collecting after the last display */
+void
+i965_stats_terminate(void);
+
+/** The statistics of the calling thread, allocated on first use */
+struct i965_stats *
+i965_stats_thread(void);
+
+static inline void
+i965_stats_count(enum i965_stats_counter counter, uint64_t value)
+{
+    if (i965_stats_enabled)
+        i965_stats_thread()->counters[counter] += value;
+}
+
+/** Start time of a timed call, 0 when disabled */
+uint64_t
+i965_stats_begin(void);
+
+void
+i965_stats_end(enum i965_stats_call call, uint64_t start);
+
+/** Sums up the statistics of all threads, past and present. Exported */
+DLL_EXPORT void
+i965_stats_get(struct i965_stats *stats);
+
+/** Prints the statistics of all threads. Exported */
+DLL_EXPORT void
+i965_stats_dump(FILE *fp);
+
+#endif /* I965_STATS_H */
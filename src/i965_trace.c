@@ -0,0 +1,364 @@
+/*
+ * i965_trace.c - event tracing in the Chrome trace format
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include "i965_trace.h"
+
+#define TRACE_DEFAULT_EVENTS    65536
+
+int i965_trace_enabled = 0;
+
+struct trace_event {
+    uint64_t ts_ns;
+    const char *name;
+    int arg;
+    char phase;
+};
+
+/*
+ * The ring buffer of a thread. Only the thread itself writes events and
+ * head, which is published with release semantics after the event. The
+ * ring of an exited thread stays in the list until its events are written
+ * out, and is then recycled for a new thread
+ */
+struct trace_thread {
+    struct trace_thread *next;
+    long tid;
+    int exited;
+    uint64_t head;
+    struct trace_event events[];
+};
+
+static int trace_users = 0;                     /* initialized displays */
+static char *trace_path = NULL;
+static unsigned int trace_capacity = 0;         /* a power of 2 */
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Serializes the writes of the file, taken before trace_mutex */
+static pthread_mutex_t trace_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The threads in i965_trace_event(), the rings are freed once it is 0 */
+static int trace_writers = 0;
+static struct trace_thread *trace_threads = NULL;
+static struct trace_thread *trace_free_threads = NULL;
+
+/* The thread exit destructor holds the ring, until the last vaTerminate */
+static pthread_key_t trace_key;
+static int trace_key_created = 0;
+
+/* The rings of a previous tracing session are gone, trace_self with them */
+static unsigned int trace_generation = 0;
+static __thread struct trace_thread *trace_self = NULL;
+static __thread unsigned int trace_self_generation = 0;
+
+static volatile sig_atomic_t trace_write_requested = 0;
+static struct sigaction trace_old_action;
+static int trace_signal_installed = 0;
+
+static uint64_t
+trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Only raise a flag, the trace is written by the next traced thread */
+static void
+trace_signal_handler(int signum)
+{
+    trace_write_requested = 1;
+}
+
+/* Called with trace_write_mutex held */
+static void
+trace_write(void)
+{
+    struct trace_thread *thread, **prev;
+    struct trace_event *event;
+    uint64_t head, i;
+    FILE *fp;
+    int first = 1;
+
+    fp = fopen(trace_path, "w");
+
+    if (!fp) {
+        fprintf(stderr, "Failed to write the trace to %s\n", trace_path);
+        return;
+    }
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&trace_mutex);
+
+    /* the oldest events may be overwritten by their thread meanwhile */
+    for (thread = trace_threads; thread; thread = thread->next) {
+        head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+        i = head > trace_capacity ? head - trace_capacity : 0;
+
+        for (; i < head; i++) {
+            event = &thread->events[i & (trace_capacity - 1)];
+
+            fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%ld",
+                    first ? "" : ",\n",
+                    event->name,
+                    event->phase,
+                    (unsigned long long)(event->ts_ns / 1000),
+                    (unsigned int)(event->ts_ns % 1000),
+                    (int)getpid(),
+                    thread->tid);
+
+            if (event->arg >= 0)
+                fprintf(fp, ",\"args\":{\"n\":%d}", event->arg);
+
+            fprintf(fp, "}");
+            first = 0;
+        }
+    }
+
+    /*
+     * The events of the exited threads are written out, recycle their
+     * rings. The later writes only have the events of the live threads
+     */
+    for (prev = &trace_threads; (thread = *prev); ) {
+        if (thread->exited) {
+            *prev = thread->next;
+            thread->next = trace_free_threads;
+            trace_free_threads = thread;
+        } else
+            prev = &thread->next;
+    }
+
+    pthread_mutex_unlock(&trace_mutex);
+
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(fp);
+}
+
+/* Called at the exit of a thread which recorded events */
+static void
+trace_thread_exit(void *data)
+{
+    struct trace_thread *thread = data;
+
+    pthread_mutex_lock(&trace_mutex);
+    thread->exited = 1;
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+static struct trace_thread *
+trace_thread_create(void)
+{
+    struct trace_thread *thread;
+
+    pthread_mutex_lock(&trace_mutex);
+
+    thread = trace_free_threads;
+
+    if (thread)
+        trace_free_threads = thread->next;
+    else
+        thread = malloc(sizeof(*thread) + trace_capacity * sizeof(struct trace_event));
+
+    if (!thread) {
+        pthread_mutex_unlock(&trace_mutex);
+        return NULL;
+    }
+
+    thread->tid = syscall(SYS_gettid);
+    thread->exited = 0;
+    thread->head = 0;
+    thread->next = trace_threads;
+    trace_threads = thread;
+
+    if (trace_key_created)
+        pthread_setspecific(trace_key, thread);
+
+    trace_self_generation = trace_generation;
+
+    pthread_mutex_unlock(&trace_mutex);
+
+    return thread;
+}
+
+/* Called with trace_mutex held, once tracing has stopped */
+static void
+trace_free_rings(void)
+{
+    struct trace_thread *thread;
+
+    while ((thread = trace_threads)) {
+        trace_threads = thread->next;
+        free(thread);
+    }
+
+    while ((thread = trace_free_threads)) {
+        trace_free_threads = thread->next;
+        free(thread);
+    }
+
+    /* the destructor must not run once the driver is unloaded */
+    if (trace_key_created) {
+        pthread_key_delete(trace_key);
+        trace_key_created = 0;
+    }
+
+    trace_generation++;
+}
+
+int
+i965_trace_init(void)
+{
+    struct sigaction action;
+    char *env_str;
+    unsigned int events = TRACE_DEFAULT_EVENTS;
+
+    /* wait for the end of a terminating session */
+    pthread_mutex_lock(&trace_write_mutex);
+    pthread_mutex_lock(&trace_mutex);
+
+    if (trace_users++ == 0 && (env_str = getenv("VA_INTEL_TRACE")) && *env_str) {
+        free(trace_path);
+        trace_path = strdup(env_str);
+
+        if ((env_str = getenv("VA_INTEL_TRACE_EVENTS")) && atoi(env_str) > 0)
+            events = atoi(env_str);
+
+        /* the rings of a previous session are all freed */
+        trace_capacity = 1;
+
+        while (trace_capacity < events)
+            trace_capacity <<= 1;
+
+        if (!trace_key_created)
+            trace_key_created = !pthread_key_create(&trace_key, trace_thread_exit);
+
+        /* don't take over a handler of the application */
+        if (sigaction(SIGUSR2, NULL, &trace_old_action) == 0 &&
+            trace_old_action.sa_handler == SIG_DFL) {
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = trace_signal_handler;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_RESTART;
+            trace_signal_installed = !sigaction(SIGUSR2, &action, NULL);
+        }
+
+        __atomic_store_n(&i965_trace_enabled, !!trace_path, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_mutex_unlock(&trace_mutex);
+    pthread_mutex_unlock(&trace_write_mutex);
+
+    return i965_trace_enabled;
+}
+
+void
+i965_trace_terminate(void)
+{
+    pthread_mutex_lock(&trace_write_mutex);
+    pthread_mutex_lock(&trace_mutex);
+
+    if (--trace_users == 0 && i965_trace_enabled) {
+        __atomic_store_n(&i965_trace_enabled, 0, __ATOMIC_SEQ_CST);
+
+        /* the driver is unloaded next, the handler must go */
+        if (trace_signal_installed) {
+            sigaction(SIGUSR2, &trace_old_action, NULL);
+            trace_signal_installed = 0;
+        }
+
+        pthread_mutex_unlock(&trace_mutex);
+
+        /*
+         * The threads which saw tracing enabled may still record events,
+         * and create rings. The new ones see it disabled and leave
+         */
+        while (__atomic_load_n(&trace_writers, __ATOMIC_SEQ_CST))
+            sched_yield();
+
+        trace_write();
+
+        pthread_mutex_lock(&trace_mutex);
+        trace_free_rings();
+    }
+
+    pthread_mutex_unlock(&trace_mutex);
+    pthread_mutex_unlock(&trace_write_mutex);
+}
+
+void
+i965_trace_event(const char *name, char phase, int arg)
+{
+    struct trace_thread *thread;
+    struct trace_event *event;
+
+    /* pairs with i965_trace_terminate(), which waits for trace_writers */
+    __atomic_fetch_add(&trace_writers, 1, __ATOMIC_SEQ_CST);
+
+    if (!__atomic_load_n(&i965_trace_enabled, __ATOMIC_SEQ_CST))
+        goto out;
+
+    thread = trace_self;
+
+    if (!thread || trace_self_generation != trace_generation) {
+        thread = trace_self = trace_thread_create();
+
+        if (!thread)
+            goto out;
+    }
+
+    event = &thread->events[thread->head & (trace_capacity - 1)];
+    event->ts_ns = trace_now_ns();
+    event->name = name;
+    event->arg = arg;
+    event->phase = phase;
+    __atomic_store_n(&thread->head, thread->head + 1, __ATOMIC_RELEASE);
+
+    /* during a write, the request is kept for a later event */
+    if (trace_write_requested &&
+        __atomic_exchange_n(&trace_write_requested, 0, __ATOMIC_ACQ_REL)) {
+        if (pthread_mutex_trylock(&trace_write_mutex) == 0) {
+            trace_write();
+            pthread_mutex_unlock(&trace_write_mutex);
+        } else
+            __atomic_store_n(&trace_write_requested, 1, __ATOMIC_RELEASE);
+    }
+
+out:
+    __atomic_fetch_sub(&trace_writers, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,68 @@
+/*
+ * i965_trace.h - event tracing in the Chrome trace format
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_TRACE_H
+#define I965_TRACE_H
+
+/**
+ * Event tracing, enabled with VA_INTEL_TRACE=<file>. Every thread records
+ * begin/end events in its own ring buffer of VA_INTEL_TRACE_EVENTS events
+ * (65536 by default), without locks. The last events of all threads are
+ * written to the file in the Chrome trace JSON format (chrome://tracing,
+ * Perfetto) at the last vaTerminate, and on SIGUSR2. The ring of an exited
+ * thread is recycled once it has been written out, so the later writes
+ * don't have its events any more.
+ *
+ * Event names must be string literals, only their address is recorded.
+ */
+
+extern int i965_trace_enabled;
+
+/** Reads the environment on the first display. Returns i965_trace_enabled */
+int
+i965_trace_init(void);
+
+/** Writes the trace, and stops tracing after the last display */
+void
+i965_trace_terminate(void);
+
+/** Records an event, phase is 'B' (begin) or 'E' (end), arg is shown unless < 0 */
+void
+i965_trace_event(const char *name, char phase, int arg);
+
+#define I965_TRACE_BEGIN_ARG(name, arg) do {            \
+        if (i965_trace_enabled)                         \
+            i965_trace_event(name, 'B', arg);           \
+    } while (0)
+
+#define I965_TRACE_BEGIN(name)  I965_TRACE_BEGIN_ARG(name, -1)
+
+#define I965_TRACE_END(name) do {                       \
+        if (i965_trace_enabled)                         \
+            i965_trace_event(name, 'E', -1);            \
+    } while (0)
+
+#endif /* I965_TRACE_H */
@@ -0,0 +1,292 @@
+/*
+ * i965_vpp_bench.c - measures how image conversions scale with threads
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Usage: i965_vpp_bench [-d device] [-t threads] [-n calls] [-s WxH] [-p]
+ *
+ * Runs calls (1000 by default) vaGetImage() calls, or vaPutImage() ones
+ * with -p, per thread on one display, with 1, 2, 4, ... up to threads
+ * threads (the number of CPUs by default). Each thread converts between
+ * its own NV12 surface and YV12 image, which goes through the post
+ * processing kernels. The calls/s of each run and the speedup over one
+ * thread are printed.
+ *
+ * To measure the CPU side only, run it on the host-memory buffer manager
+ * of intel_mock_bufmgr.h:
+ *
+ *   LIBVA_DRIVER_NAME=i965 VA_INTEL_MOCK=0x1916 i965_vpp_bench -d /dev/null
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <va/va.h>
+#include <va/va_drm.h>
+
+struct bench_thread {
+    pthread_t thread;
+    VASurfaceID surface;
+    VAImage image;
+    int failures;
+};
+
+static VADisplay bench_dpy;
+static int bench_width = 1920;
+static int bench_height = 1080;
+static int bench_calls = 1000;
+static int bench_put_image = 0;
+static pthread_barrier_t bench_barrier;
+
+static double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+bench_thread_run(void *data)
+{
+    struct bench_thread *thread = data;
+    VAStatus status;
+    int i;
+
+    pthread_barrier_wait(&bench_barrier);
+
+    for (i = 0; i < bench_calls; i++) {
+        if (bench_put_image)
+            status = vaPutImage(bench_dpy, thread->surface, thread->image.image_id,
+                                0, 0, bench_width, bench_height,
+                                0, 0, bench_width, bench_height);
+        else
+            status = vaGetImage(bench_dpy, thread->surface,
+                                0, 0, bench_width, bench_height,
+                                thread->image.image_id);
+
+        if (status != VA_STATUS_SUCCESS)
+            thread->failures++;
+    }
+
+    pthread_barrier_wait(&bench_barrier);
+
+    return NULL;
+}
+
+/* Returns the calls/s of all the threads, or 0 on failure */
+static double
+bench_run(struct bench_thread *threads, int num_threads)
+{
+    double start, elapsed;
+    int i, failures = 0;
+
+    pthread_barrier_init(&bench_barrier, NULL, num_threads + 1);
+
+    for (i = 0; i < num_threads; i++) {
+        threads[i].failures = 0;
+        pthread_create(&threads[i].thread, NULL, bench_thread_run, &threads[i]);
+    }
+
+    pthread_barrier_wait(&bench_barrier);
+    start = bench_now();
+    pthread_barrier_wait(&bench_barrier);
+    elapsed = bench_now() - start;
+
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        failures += threads[i].failures;
+    }
+
+    pthread_barrier_destroy(&bench_barrier);
+
+    if (failures) {
+        fprintf(stderr, "%d calls failed with %d threads\n", failures, num_threads);
+        return 0;
+    }
+
+    return (double)bench_calls * num_threads / elapsed;
+}
+
+static int
+bench_setup(struct bench_thread *thread)
+{
+    VAImageFormat format;
+    VAStatus status;
+    void *data;
+
+    status = vaCreateSurfaces(bench_dpy, VA_RT_FORMAT_YUV420,
+                              bench_width, bench_height,
+                              &thread->surface, 1, NULL, 0);
+
+    if (status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "vaCreateSurfaces failed: %s\n", vaErrorStr(status));
+        return -1;
+    }
+
+    memset(&format, 0, sizeof(format));
+    format.fourcc = VA_FOURCC_YV12;
+    format.byte_order = VA_LSB_FIRST;
+    format.bits_per_pixel = 12;
+    status = vaCreateImage(bench_dpy, &format, bench_width, bench_height, &thread->image);
+
+    if (status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "vaCreateImage failed: %s\n", vaErrorStr(status));
+        return -1;
+    }
+
+    /* mid grey, the surface storage is allocated by the first vaPutImage() */
+    if (vaMapBuffer(bench_dpy, thread->image.buf, &data) == VA_STATUS_SUCCESS) {
+        memset(data, 0x80, thread->image.data_size);
+        vaUnmapBuffer(bench_dpy, thread->image.buf);
+    }
+
+    status = vaPutImage(bench_dpy, thread->surface, thread->image.image_id,
+                        0, 0, bench_width, bench_height,
+                        0, 0, bench_width, bench_height);
+
+    if (status == VA_STATUS_SUCCESS)
+        status = vaSyncSurface(bench_dpy, thread->surface);
+
+    if (status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "vaPutImage failed: %s\n", vaErrorStr(status));
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *device = "/dev/dri/renderD128";
+    struct bench_thread *threads;
+    int opt, fd, major, minor, i, num_threads;
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double rate, base_rate = 0;
+    VAStatus status;
+
+    while ((opt = getopt(argc, argv, "d:t:n:s:p")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            bench_calls = atoi(optarg);
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &bench_width, &bench_height) != 2)
+                bench_width = 0;
+            break;
+        case 'p':
+            bench_put_image = 1;
+            break;
+        default:
+            bench_width = 0;
+            break;
+        }
+    }
+
+    if (max_threads < 1 || bench_calls < 1 || bench_width <= 0 || bench_height <= 0) {
+        fprintf(stderr, "Usage: %s [-d device] [-t threads] [-n calls] [-s WxH] [-p]\n", argv[0]);
+        return 1;
+    }
+
+    fd = open(device, O_RDWR);
+
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s\n", device);
+        return 1;
+    }
+
+    bench_dpy = vaGetDisplayDRM(fd);
+    status = vaInitialize(bench_dpy, &major, &minor);
+
+    if (status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "vaInitialize failed: %s\n", vaErrorStr(status));
+        return 1;
+    }
+
+    threads = calloc(max_threads, sizeof(*threads));
+
+    if (!threads)
+        return 1;
+
+    for (i = 0; i < max_threads; i++) {
+        if (bench_setup(&threads[i]))
+            return 1;
+    }
+
+    printf("%s %dx%d NV12 <-> YV12, %d calls per thread\n",
+           bench_put_image ? "vaPutImage" : "vaGetImage",
+           bench_width, bench_height, bench_calls);
+    printf("%8s %12s %8s %11s\n", "threads", "calls/s", "speedup", "efficiency");
+
+    for (num_threads = 1; ; num_threads *= 2) {
+        if (num_threads > max_threads)
+            num_threads = max_threads;
+
+        rate = bench_run(threads, num_threads);
+
+        if (!rate)
+            break;
+
+        if (num_threads == 1)
+            base_rate = rate;
+
+        printf("%8d %12.0f %7.2fx %10.0f%%\n",
+               num_threads, rate, rate / base_rate,
+               100.0 * rate / base_rate / num_threads);
+
+        if (num_threads == max_threads)
+            break;
+    }
+
+    for (i = 0; i < max_threads; i++) {
+        vaDestroyImage(bench_dpy, threads[i].image.image_id);
+        vaDestroySurfaces(bench_dpy, &threads[i].surface, 1);
+    }
+
+    free(threads);
+    vaTerminate(bench_dpy);
+    close(fd);
+
+    return 0;
+}
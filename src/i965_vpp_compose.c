@@ -0,0 +1,191 @@
+/*
+ * i965_vpp_compose.c - Layout of composited VPP layers
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sysdeps.h"
+#include "i965_vpp_compose.h"
+
+/* Checks whether rectangle b lies within rectangle a */
+static bool
+rect_contains(const VARectangle *a, const VARectangle *b)
+{
+    return b->x >= a->x && b->y >= a->y &&
+        b->x + b->width <= a->x + a->width &&
+        b->y + b->height <= a->y + a->height;
+}
+
+/* Maps the clipped destination span [d0, d1) back to the source span */
+static void
+clip_span(int *src_start, int *src_size, int dst_start, int dst_size,
+    int d0, int d1)
+{
+    const int64_t s = *src_start, n = *src_size;
+    int s0, s1;
+
+    s0 = s + ((int64_t)(d0 - dst_start) * n) / dst_size;
+    s1 = s + ((int64_t)(d1 - dst_start) * n + dst_size - 1) / dst_size;
+    if (s1 > s + n)
+        s1 = s + n;
+    if (s1 <= s0)
+        s1 = s0 + 1;
+
+    *src_start = s0;
+    *src_size = s1 - s0;
+}
+
+/* Clips the layer to the output surface. Returns false if nothing is left */
+static bool
+vpp_layer_clip(VPPLayer *layer, int dst_width, int dst_height)
+{
+    VARectangle * const src_rect = &layer->src_rect;
+    VARectangle * const dst_rect = &layer->dst_rect;
+    int x0, y0, x1, y1, src_start, src_size;
+
+    x0 = dst_rect->x > 0 ? dst_rect->x : 0;
+    y0 = dst_rect->y > 0 ? dst_rect->y : 0;
+    x1 = dst_rect->x + dst_rect->width;
+    if (x1 > dst_width)
+        x1 = dst_width;
+    y1 = dst_rect->y + dst_rect->height;
+    if (y1 > dst_height)
+        y1 = dst_height;
+    if (x1 <= x0 || y1 <= y0)
+        return false;
+
+    src_start = src_rect->x;
+    src_size = src_rect->width;
+    clip_span(&src_start, &src_size, dst_rect->x, dst_rect->width, x0, x1);
+    src_rect->x = src_start;
+    src_rect->width = src_size;
+
+    src_start = src_rect->y;
+    src_size = src_rect->height;
+    clip_span(&src_start, &src_size, dst_rect->y, dst_rect->height, y0, y1);
+    src_rect->y = src_start;
+    src_rect->height = src_size;
+
+    dst_rect->x = x0;
+    dst_rect->y = y0;
+    dst_rect->width = x1 - x0;
+    dst_rect->height = y1 - y0;
+    return true;
+}
+
+VAStatus
+vpp_compose_layout(VPPLayer *layers, int num_layers,
+    unsigned int dst_width, unsigned int dst_height,
+    int *visible_layers, int *num_visible_layers_ptr,
+    bool *covers_output_ptr)
+{
+    const VARectangle output_rect = { 0, 0, dst_width, dst_height };
+    int i, j, num_visible_layers = 0;
+    bool covers_output = false;
+
+    if (num_layers <= 0 || dst_width == 0 || dst_height == 0)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    for (i = 0; i < num_layers; i++) {
+        const VPPLayer * const layer = &layers[i];
+        const VARectangle * const src_rect = &layer->src_rect;
+
+        if (src_rect->x < 0 || src_rect->y < 0 ||
+            src_rect->width == 0 || src_rect->height == 0 ||
+            (unsigned int)src_rect->x + src_rect->width > layer->src_width ||
+            (unsigned int)src_rect->y + src_rect->height > layer->src_height)
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+        if (layer->dst_rect.width == 0 || layer->dst_rect.height == 0)
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+        if (!(layer->alpha >= 0.0f && layer->alpha <= 1.0f))
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    /* Walk from the top so that the hidden layers are known early */
+    for (i = num_layers - 1; i >= 0; i--) {
+        VPPLayer * const layer = &layers[i];
+
+        if (covers_output || layer->alpha <= 0.0f)
+            continue;
+        if (!vpp_layer_clip(layer, dst_width, dst_height))
+            continue;
+
+        for (j = 0; j < num_visible_layers; j++) {
+            const VPPLayer * const above = &layers[visible_layers[j]];
+
+            if (vpp_layer_is_opaque(above) &&
+                rect_contains(&above->dst_rect, &layer->dst_rect))
+                break;
+        }
+        if (j < num_visible_layers)
+            continue;
+
+        visible_layers[num_visible_layers++] = i;
+        if (vpp_layer_is_opaque(layer) &&
+            rect_contains(&layer->dst_rect, &output_rect))
+            covers_output = true;
+    }
+
+    /* Restore the bottom to top order */
+    for (i = 0, j = num_visible_layers - 1; i < j; i++, j--) {
+        const int tmp = visible_layers[i];
+        visible_layers[i] = visible_layers[j];
+        visible_layers[j] = tmp;
+    }
+
+    *num_visible_layers_ptr = num_visible_layers;
+    *covers_output_ptr = covers_output;
+    return VA_STATUS_SUCCESS;
+}
+
+void
+vpp_blend_plane(uint8_t *dst, unsigned int dst_pitch,
+    const uint8_t *src, unsigned int src_pitch,
+    unsigned int width, unsigned int height, float alpha)
+{
+    const unsigned int a = (unsigned int)(alpha * 256.0f + 0.5f);
+    unsigned int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            dst[x] = (src[x] * a + dst[x] * (256 - a) + 128) >> 8;
+
+        dst += dst_pitch;
+        src += src_pitch;
+    }
+}
+
+void
+vpp_layer_align_chroma(VPPLayer *layer)
+{
+    VARectangle * const dst_rect = &layer->dst_rect;
+    const int x1 = dst_rect->x + dst_rect->width;
+    const int y1 = dst_rect->y + dst_rect->height;
+
+    dst_rect->x &= ~1;
+    dst_rect->y &= ~1;
+    dst_rect->width = ((x1 + 1) & ~1) - dst_rect->x;
+    dst_rect->height = ((y1 + 1) & ~1) - dst_rect->y;
+}
@@ -0,0 +1,87 @@
+/*
+ * i965_vpp_compose.h - Layout of composited VPP layers
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef I965_VPP_COMPOSE_H
+#define I965_VPP_COMPOSE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <va/va.h>
+
+typedef struct vpp_layer                VPPLayer;
+
+/** One input of a composition, in z-order (bottom first) */
+struct vpp_layer {
+    /** Width of the source surface */
+    unsigned int src_width;
+    /** Height of the source surface */
+    unsigned int src_height;
+    /** Source rectangle, clipped along with the destination rectangle */
+    VARectangle src_rect;
+    /** Destination rectangle, clipped to the output surface */
+    VARectangle dst_rect;
+    /** Global alpha, from 0.0 (transparent) to 1.0 (opaque) */
+    float alpha;
+};
+
+/**
+ * Validates the layers and clips them to the output surface. The indices
+ * of the layers that remain visible, i.e. that are neither transparent,
+ * off-screen nor hidden below an opaque layer, are stored in bottom to
+ * top order into visible_layers. covers_output is set if an opaque layer
+ * covers the whole output surface, in which case no background is visible
+ */
+VAStatus
+vpp_compose_layout(VPPLayer *layers, int num_layers,
+    unsigned int dst_width, unsigned int dst_height,
+    int *visible_layers, int *num_visible_layers_ptr,
+    bool *covers_output_ptr);
+
+/**
+ * Blends height rows of width bytes of src over dst with the global alpha
+ * of a layer: dst = src * alpha + dst * (1 - alpha). This applies as is to
+ * the luma and the interleaved chroma planes of NV12 surfaces
+ */
+void
+vpp_blend_plane(uint8_t *dst, unsigned int dst_pitch,
+    const uint8_t *src, unsigned int src_pitch,
+    unsigned int width, unsigned int height, float alpha);
+
+/**
+ * Extends the destination rectangle of a layer to even coordinates, so
+ * that it covers whole chroma samples of 4:2:0 surfaces
+ */
+void
+vpp_layer_align_chroma(VPPLayer *layer);
+
+/** Checks whether the layer fully replaces the pixels below it */
+static inline bool
+vpp_layer_is_opaque(const VPPLayer *layer)
+{
+    return layer->alpha >= 1.0f;
+}
+
+#endif /* I965_VPP_COMPOSE_H */
@@ -0,0 +1,255 @@
+/*
+ * i965_vpp_compose_test.c - CPU tests of the VPP composition layout
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the layer visibility, the clipping and the blending of
+ * i965_vpp_compose.c, which don't need a GPU. Run by make check.
+ */
+
+#include "sysdeps.h"
+#include "i965_vpp_compose.h"
+
+#define MAX_LAYERS      8
+
+static int test_failures = 0;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+static void
+set_layer(VPPLayer *layer, int dst_x, int dst_y, int width, int height,
+    float alpha)
+{
+    memset(layer, 0, sizeof(*layer));
+    layer->src_width = width;
+    layer->src_height = height;
+    layer->src_rect.width = width;
+    layer->src_rect.height = height;
+    layer->dst_rect.x = dst_x;
+    layer->dst_rect.y = dst_y;
+    layer->dst_rect.width = width;
+    layer->dst_rect.height = height;
+    layer->alpha = alpha;
+}
+
+static void
+test_visibility(void)
+{
+    VPPLayer layers[MAX_LAYERS];
+    int visible[MAX_LAYERS], num_visible;
+    bool covers_output;
+    VAStatus status;
+
+    /* A full screen opaque layer hides the ones below and the background */
+    set_layer(&layers[0], 10, 10, 20, 20, 1.0f);
+    set_layer(&layers[1], 0, 0, 100, 100, 1.0f);
+    set_layer(&layers[2], 40, 40, 20, 20, 0.5f);
+    status = vpp_compose_layout(layers, 3, 100, 100, visible, &num_visible,
+        &covers_output);
+    CHECK(status == VA_STATUS_SUCCESS);
+    CHECK(num_visible == 2);
+    CHECK(visible[0] == 1 && visible[1] == 2);
+    CHECK(covers_output);
+
+    /* A translucent layer hides nothing, a transparent one is dropped */
+    set_layer(&layers[0], 10, 10, 20, 20, 1.0f);
+    set_layer(&layers[1], 0, 0, 100, 100, 0.5f);
+    set_layer(&layers[2], 0, 0, 100, 100, 0.0f);
+    status = vpp_compose_layout(layers, 3, 100, 100, visible, &num_visible,
+        &covers_output);
+    CHECK(status == VA_STATUS_SUCCESS);
+    CHECK(num_visible == 2);
+    CHECK(visible[0] == 0 && visible[1] == 1);
+    CHECK(!covers_output);
+
+    /* Only a full cover hides a layer */
+    set_layer(&layers[0], 10, 10, 20, 20, 1.0f);
+    set_layer(&layers[1], 15, 15, 20, 20, 1.0f);
+    status = vpp_compose_layout(layers, 2, 100, 100, visible, &num_visible,
+        &covers_output);
+    CHECK(status == VA_STATUS_SUCCESS);
+    CHECK(num_visible == 2);
+
+    set_layer(&layers[0], 10, 10, 20, 20, 1.0f);
+    set_layer(&layers[1], 10, 10, 20, 20, 1.0f);
+    status = vpp_compose_layout(layers, 2, 100, 100, visible, &num_visible,
+        &covers_output);
+    CHECK(status == VA_STATUS_SUCCESS);
+    CHECK(num_visible == 1 && visible[0] == 1);
+
+    /* Off-screen layers are dropped */
+    set_layer(&layers[0], 100, 0, 20, 20, 1.0f);
+    set_layer(&layers[1], -20, -20, 20, 20, 1.0f);
+    status = vpp_compose_layout(layers, 2, 100, 100, visible, &num_visible,
+        &covers_output);
+    CHECK(status == VA_STATUS_SUCCESS);
+    CHECK(num_visible == 0);
+    CHECK(!covers_output);
+}
+
+static void
+test_clipping(void)
+{
+    VPPLayer layer;
+    int visible[1], num_visible;
+    bool covers_output;
+    VAStatus status;
+
+    /* Half off the left edge, 2x upscaled: the right half of the source
+     * ends up in the output */
+    set_layer(&layer, -100, 0, 100, 50, 1.0f);
+    layer.dst_rect.width = 200;
+    layer.dst_rect.height = 100;
+    status = vpp_compose_layout(&layer, 1, 100, 100, visible, &num_visible,
+        &covers_output);
+    CHECK(status == VA_STATUS_SUCCESS);
+    CHECK(num_visible == 1);
+    CHECK(layer.dst_rect.x == 0 && layer.dst_rect.width == 100);
+    CHECK(layer.dst_rect.y == 0 && layer.dst_rect.height == 100);
+    CHECK(layer.src_rect.x == 50 && layer.src_rect.width == 50);
+    CHECK(layer.src_rect.y == 0 && layer.src_rect.height == 50);
+    CHECK(covers_output);
+
+    /* Past the bottom right corner, 1:1 */
+    set_layer(&layer, 60, 70, 80, 80, 1.0f);
+    status = vpp_compose_layout(&layer, 1, 100, 100, visible, &num_visible,
+        &covers_output);
+    CHECK(status == VA_STATUS_SUCCESS);
+    CHECK(num_visible == 1);
+    CHECK(layer.dst_rect.width == 40 && layer.dst_rect.height == 30);
+    CHECK(layer.src_rect.x == 0 && layer.src_rect.width == 40);
+    CHECK(layer.src_rect.y == 0 && layer.src_rect.height == 30);
+
+    /* Downscaled by 3, the source span is rounded outwards */
+    set_layer(&layer, -10, 0, 90, 90, 1.0f);
+    layer.dst_rect.width = 30;
+    layer.dst_rect.height = 30;
+    status = vpp_compose_layout(&layer, 1, 100, 100, visible, &num_visible,
+        &covers_output);
+    CHECK(status == VA_STATUS_SUCCESS);
+    CHECK(layer.dst_rect.x == 0 && layer.dst_rect.width == 20);
+    CHECK(layer.src_rect.x == 30 && layer.src_rect.width == 60);
+}
+
+static void
+test_invalid(void)
+{
+    VPPLayer layer;
+    int visible[1], num_visible;
+    bool covers_output;
+
+    /* Source rectangle outside of its surface */
+    set_layer(&layer, 0, 0, 20, 20, 1.0f);
+    layer.src_rect.x = 10;
+    CHECK(vpp_compose_layout(&layer, 1, 100, 100, visible, &num_visible,
+        &covers_output) == VA_STATUS_ERROR_INVALID_PARAMETER);
+
+    set_layer(&layer, 0, 0, 20, 20, 1.0f);
+    layer.dst_rect.width = 0;
+    CHECK(vpp_compose_layout(&layer, 1, 100, 100, visible, &num_visible,
+        &covers_output) == VA_STATUS_ERROR_INVALID_PARAMETER);
+
+    set_layer(&layer, 0, 0, 20, 20, 1.5f);
+    CHECK(vpp_compose_layout(&layer, 1, 100, 100, visible, &num_visible,
+        &covers_output) == VA_STATUS_ERROR_INVALID_PARAMETER);
+
+    set_layer(&layer, 0, 0, 20, 20, 1.0f);
+    CHECK(vpp_compose_layout(&layer, 0, 100, 100, visible, &num_visible,
+        &covers_output) == VA_STATUS_ERROR_INVALID_PARAMETER);
+    CHECK(vpp_compose_layout(&layer, 1, 0, 100, visible, &num_visible,
+        &covers_output) == VA_STATUS_ERROR_INVALID_PARAMETER);
+}
+
+static void
+test_blend(void)
+{
+    uint8_t dst[4 * 3], src[2 * 3];
+    int i;
+
+    /* 2x2 blended into a 4 byte pitch, the third row left alone */
+    memset(dst, 100, sizeof(dst));
+    memset(src, 200, sizeof(src));
+    vpp_blend_plane(dst, 4, src, 2, 2, 2, 0.5f);
+    CHECK(dst[0] == 150 && dst[1] == 150 && dst[2] == 100 && dst[3] == 100);
+    CHECK(dst[4] == 150 && dst[5] == 150 && dst[6] == 100);
+    CHECK(dst[8] == 100);
+
+    memset(dst, 100, sizeof(dst));
+    vpp_blend_plane(dst, 4, src, 2, 2, 3, 1.0f);
+    for (i = 0; i < 3; i++)
+        CHECK(dst[i * 4] == 200 && dst[i * 4 + 1] == 200);
+
+    memset(dst, 100, sizeof(dst));
+    vpp_blend_plane(dst, 4, src, 2, 2, 3, 0.0f);
+    for (i = 0; i < (int)sizeof(dst); i++)
+        CHECK(dst[i] == 100);
+
+    /* No overflow at the extremes */
+    memset(dst, 0, sizeof(dst));
+    memset(src, 255, sizeof(src));
+    vpp_blend_plane(dst, 4, src, 2, 2, 1, 0.25f);
+    CHECK(dst[0] == 64);
+    memset(dst, 255, sizeof(dst));
+    vpp_blend_plane(dst, 4, src, 2, 2, 1, 0.75f);
+    CHECK(dst[0] == 255);
+}
+
+static void
+test_align_chroma(void)
+{
+    VPPLayer layer;
+
+    set_layer(&layer, 3, 5, 10, 7, 0.5f);
+    vpp_layer_align_chroma(&layer);
+    CHECK(layer.dst_rect.x == 2 && layer.dst_rect.y == 4);
+    CHECK(layer.dst_rect.width == 12 && layer.dst_rect.height == 8);
+
+    set_layer(&layer, 4, 6, 10, 8, 0.5f);
+    vpp_layer_align_chroma(&layer);
+    CHECK(layer.dst_rect.x == 4 && layer.dst_rect.y == 6);
+    CHECK(layer.dst_rect.width == 10 && layer.dst_rect.height == 8);
+}
+
+int
+main(void)
+{
+    test_visibility();
+    test_clipping();
+    test_invalid();
+    test_blend();
+    test_align_chroma();
+
+    if (test_failures) {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -25,9 +25,11 @@
  *                                                                                                                                                           
  **************************************************************************/      
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "intel_batchbuffer.h"
 
@@ -39,6 +41,185 @@
 #define LOCAL_I915_EXEC_BSD_RING0		(1<<13)
 #define LOCAL_I915_EXEC_BSD_RING1		(2<<13)
 
+int intel_batch_capture_enabled = 0;
+
+static int capture_users = 0;                   /* initialized displays */
+static FILE *capture_fp = NULL;
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int
+intel_batchbuffer_capture_init(void)
+{
+    uint32_t version = INTEL_BATCH_CAPTURE_VERSION;
+    char *env_str;
+
+    pthread_mutex_lock(&capture_mutex);
+
+    if (capture_users++ == 0 &&
+        (env_str = getenv("VA_INTEL_BATCH_CAPTURE")) &&
+        (capture_fp = fopen(env_str, "wb"))) {
+        fwrite(INTEL_BATCH_CAPTURE_MAGIC, sizeof(INTEL_BATCH_CAPTURE_MAGIC), 1, capture_fp);
+        fwrite(&version, sizeof(version), 1, capture_fp);
+        intel_batch_capture_enabled = 1;
+    }
+
+    pthread_mutex_unlock(&capture_mutex);
+
+    return intel_batch_capture_enabled;
+}
+
+void
+intel_batchbuffer_capture_terminate(void)
+{
+    pthread_mutex_lock(&capture_mutex);
+
+    if (--capture_users == 0 && capture_fp) {
+        intel_batch_capture_enabled = 0;
+        fclose(capture_fp);
+        capture_fp = NULL;
+    }
+
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+static void
+intel_batchbuffer_capture_write(const struct intel_batch_capture_header *header,
+                                const struct intel_batch_reloc *relocs,
+                                const unsigned int *data)
+{
+    pthread_mutex_lock(&capture_mutex);
+
+    if (capture_fp) {
+        fwrite(header, sizeof(*header), 1, capture_fp);
+
+        if (header->num_relocs)
+            fwrite(relocs, sizeof(*relocs), header->num_relocs, capture_fp);
+
+        if (header->num_dwords)
+            fwrite(data, sizeof(*data), header->num_dwords, capture_fp);
+
+        fflush(capture_fp);
+    }
+
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+void
+intel_batchbuffer_capture_frame(void)
+{
+    struct intel_batch_capture_header header;
+
+    memset(&header, 0, sizeof(header));
+    header.type = INTEL_BATCH_CAPTURE_FRAME;
+    intel_batchbuffer_capture_write(&header, NULL, NULL);
+}
+
+static void
+intel_batchbuffer_capture_reloc(struct intel_batchbuffer *batch, dri_bo *bo,
+                                unsigned int offset, uint32_t delta,
+                                uint32_t flags)
+{
+    struct intel_batch_reloc *reloc;
+
+    if (batch->num_relocs == batch->max_relocs) {
+        int max_relocs = batch->max_relocs ? batch->max_relocs * 2 : 256;
+        struct intel_batch_reloc *relocs;
+        dri_bo **reloc_bos;
+
+        relocs = realloc(batch->relocs, max_relocs * sizeof(*relocs));
+
+        if (!relocs)
+            return;
+
+        batch->relocs = relocs;
+        reloc_bos = realloc(batch->reloc_bos, max_relocs * sizeof(*reloc_bos));
+
+        if (!reloc_bos)
+            return;
+
+        batch->reloc_bos = reloc_bos;
+        batch->max_relocs = max_relocs;
+    }
+
+    reloc = &batch->relocs[batch->num_relocs];
+    reloc->index = offset / 4;
+    reloc->delta = delta;
+    reloc->flags = flags;
+    batch->reloc_bos[batch->num_relocs++] = bo;
+}
+
+/*
+ * A second level batch is written by the CPU before the batch starting it is
+ * flushed, so it is complete here. It ends with its MI_BATCH_BUFFER_END, its
+ * own relocations aren't known.
+ */
+static void
+intel_batchbuffer_capture_second_level(struct intel_batchbuffer *batch,
+                                       dri_bo *bo, uint32_t delta)
+{
+    struct intel_batch_capture_header header;
+    struct intel_batch_decode decode;
+    const unsigned int *data;
+    const char *name;
+    unsigned int index = 0, count;
+
+    if ((delta & 3) || delta >= bo->size || dri_bo_map(bo, 0))
+        return;
+
+    data = (const unsigned int *)((const char *)bo->virtual + delta);
+    count = (bo->size - delta) / 4;
+
+    memset(&decode, 0, sizeof(decode));
+    decode.gen = batch->intel->device_info->gen;
+    decode.ring = batch->flag & I915_EXEC_RING_MASK;
+
+    while (index < count) {
+        if ((data[index] >> SHIFT_MI_OPCODE) == OPCODE_MI_BATCH_BUFFER_END) {
+            index++;
+            break;
+        }
+
+        index += intel_batchbuffer_decode(&decode, data + index, &name);
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.type = INTEL_BATCH_CAPTURE_BATCH;
+    header.gen = decode.gen;
+    header.ring = decode.ring;
+    header.level = 2;
+    header.num_dwords = index < count ? index : count;
+    intel_batchbuffer_capture_write(&header, NULL, data);
+
+    dri_bo_unmap(bo);
+}
+
+static void
+intel_batchbuffer_capture(struct intel_batchbuffer *batch, unsigned int used)
+{
+    struct intel_batch_capture_header header;
+    const unsigned int *data = (const unsigned int *)batch->map;
+    int i;
+
+    memset(&header, 0, sizeof(header));
+    header.type = INTEL_BATCH_CAPTURE_BATCH;
+    header.gen = batch->intel->device_info->gen;
+    header.ring = batch->flag & I915_EXEC_RING_MASK;
+    header.level = 1;
+    header.num_relocs = batch->num_relocs;
+    header.num_dwords = used / 4;
+    intel_batchbuffer_capture_write(&header, batch->relocs, data);
+
+    for (i = 0; i < batch->num_relocs; i++) {
+        unsigned int index = batch->relocs[i].index;
+
+        if (index > 0 &&
+            (data[index - 1] >> SHIFT_MI_OPCODE) == OPCODE_MI_BATCH_BUFFER_START)
+            intel_batchbuffer_capture_second_level(batch,
+                                                   batch->reloc_bos[i],
+                                                   batch->relocs[i].delta);
+    }
+}
+
 static void 
 intel_batchbuffer_reset(struct intel_batchbuffer *batch, int buffer_size)
 {
@@ -65,12 +246,7 @@ intel_batchbuffer_reset(struct intel_batchbuffer *batch, int buffer_size)
     batch->size = batch_size;
     batch->ptr = batch->map;
     batch->atomic = 0;
-}
-
-static unsigned int
-intel_batchbuffer_space(struct intel_batchbuffer *batch)
-{
-    return (batch->size - BATCH_RESERVED) - (batch->ptr - batch->map);
+    batch->num_relocs = 0;
 }
 
 
@@ -98,7 +274,7 @@ intel_batchbuffer_new(struct intel_driver_data *intel, int flag, int buffer_size
     assert(batch);
     batch->intel = intel;
     batch->flag = flag;
-    batch->run = drm_intel_bo_mrb_exec;
+    batch->run = intel_bufmgr_backend ? intel_bufmgr_backend->bo_exec : drm_intel_bo_mrb_exec;
 
     if (IS_GEN6(intel->device_info) &&
         flag == I915_EXEC_RENDER)
@@ -114,8 +290,116 @@ intel_batchbuffer_new(struct intel_driver_data *intel, int flag, int buffer_size
     return batch;
 }
 
+struct intel_batchbuffer *
+intel_batchbuffer_new_cpu(struct intel_driver_data *intel, int flag, int buffer_size)
+{
+    struct intel_batchbuffer *batch = calloc(1, sizeof(*batch));
+
+    assert(batch);
+
+    if (buffer_size < BATCH_SIZE)
+        buffer_size = BATCH_SIZE;
+
+    batch->intel = intel;
+    batch->flag = flag;
+    batch->cpu = 1;
+    batch->map = malloc(buffer_size);
+    assert(batch->map);
+    batch->size = buffer_size;
+    batch->ptr = batch->map;
+
+    return batch;
+}
+
+static void
+intel_batchbuffer_cpu_grow(struct intel_batchbuffer *batch, unsigned int size)
+{
+    unsigned int used = batch->ptr - batch->map;
+    unsigned int new_size = batch->size;
+    unsigned char *map;
+
+    while (new_size - BATCH_RESERVED - used < size)
+        new_size *= 2;
+
+    map = realloc(batch->map, new_size);
+    assert(map);
+
+    /* intel_batchbuffer_data() may grow the batch within a command */
+    if (batch->emit_start)
+        batch->emit_start = map + (batch->emit_start - batch->map);
+
+    batch->map = map;
+    batch->ptr = map + used;
+    batch->size = new_size;
+}
+
+static void
+intel_batchbuffer_cpu_reloc(struct intel_batchbuffer *batch, dri_bo *bo,
+                            uint32_t read_domains, uint32_t write_domain,
+                            uint32_t delta, int is_64)
+{
+    struct intel_batch_cpu_reloc *reloc;
+
+    if (batch->num_cpu_relocs == batch->max_cpu_relocs) {
+        batch->max_cpu_relocs = batch->max_cpu_relocs ? batch->max_cpu_relocs * 2 : 64;
+        batch->cpu_relocs = realloc(batch->cpu_relocs,
+                                    batch->max_cpu_relocs * sizeof(*batch->cpu_relocs));
+        assert(batch->cpu_relocs);
+    }
+
+    reloc = &batch->cpu_relocs[batch->num_cpu_relocs++];
+    reloc->bo = bo;
+    reloc->offset = batch->ptr - batch->map;
+    reloc->read_domains = read_domains;
+    reloc->write_domain = write_domain;
+    reloc->delta = delta;
+    reloc->is_64 = is_64;
+}
+
+void
+intel_batchbuffer_append(struct intel_batchbuffer *batch,
+                         struct intel_batchbuffer *cpu_batch)
+{
+    unsigned int used = cpu_batch->ptr - cpu_batch->map;
+    unsigned int base;
+    int i;
+
+    assert(cpu_batch->cpu && !batch->cpu);
+
+    if (used == 0)
+        return;
+
+    intel_batchbuffer_require_space(batch, used);
+    base = batch->ptr - batch->map;
+
+    for (i = 0; i < cpu_batch->num_cpu_relocs; i++) {
+        const struct intel_batch_cpu_reloc * const reloc = &cpu_batch->cpu_relocs[i];
+
+        dri_bo_emit_reloc(batch->buffer, reloc->read_domains, reloc->write_domain,
+                          reloc->delta, base + reloc->offset, reloc->bo);
+
+        if (intel_batch_capture_enabled)
+            intel_batchbuffer_capture_reloc(batch, reloc->bo, base + reloc->offset,
+                                            reloc->delta,
+                                            reloc->is_64 ? INTEL_BATCH_RELOC_64 : 0);
+    }
+
+    memcpy(batch->ptr, cpu_batch->map, used);
+    batch->ptr += used;
+
+    cpu_batch->ptr = cpu_batch->map;
+    cpu_batch->num_cpu_relocs = 0;
+}
+
 void intel_batchbuffer_free(struct intel_batchbuffer *batch)
 {
+    if (batch->cpu) {
+        free(batch->map);
+        free(batch->cpu_relocs);
+        free(batch);
+        return;
+    }
+
     if (batch->map) {
         dri_bo_unmap(batch->buffer);
         batch->map = NULL;
@@ -123,6 +407,8 @@ void intel_batchbuffer_free(struct intel_batchbuffer *batch)
 
     dri_bo_unreference(batch->buffer);
     dri_bo_unreference(batch->wa_render_bo);
+    free(batch->relocs);
+    free(batch->reloc_bos);
     free(batch);
 }
 
@@ -131,6 +417,9 @@ intel_batchbuffer_flush(struct intel_batchbuffer *batch)
 {
     unsigned int used = batch->ptr - batch->map;
 
+    /* CPU batches grow instead, and are appended to real ones */
+    assert(!batch->cpu);
+
     if (used == 0) {
         return;
     }
@@ -142,18 +431,48 @@ intel_batchbuffer_flush(struct intel_batchbuffer *batch)
 
     *(unsigned int*)batch->ptr = MI_BATCH_BUFFER_END;
     batch->ptr += 4;
-    dri_bo_unmap(batch->buffer);
     used = batch->ptr - batch->map;
-    batch->run(batch->buffer, used, 0, 0, 0, batch->flag);
-    intel_batchbuffer_reset(batch, batch->size);
-}
 
-void 
-intel_batchbuffer_emit_dword(struct intel_batchbuffer *batch, unsigned int x)
-{
-    assert(intel_batchbuffer_space(batch) >= 4);
-    *(unsigned int *)batch->ptr = x;
-    batch->ptr += 4;
+    if (batch->intel->flush_deferred && !batch->deferred)
+        batch->intel->flush_deferred(batch->intel, batch);
+
+    if (intel_batch_capture_enabled)
+        intel_batchbuffer_capture(batch, used);
+
+    dri_bo_unmap(batch->buffer);
+
+    if (i965_trace_enabled) {
+        static const char *ring_names[] = {
+            "flush render", "flush render", "flush bsd", "flush blt", "flush vebox",
+            "flush", "flush", "flush"
+        };
+        const char *name = ring_names[batch->flag & I915_EXEC_RING_MASK];
+
+        i965_trace_event(name, 'B', -1);
+        batch->run(batch->buffer, used, 0, 0, 0, batch->flag);
+        i965_trace_event(name, 'E', -1);
+    } else
+        batch->run(batch->buffer, used, 0, 0, 0, batch->flag);
+
+    if (i965_stats_enabled) {
+        switch (batch->flag & I915_EXEC_RING_MASK) {
+        case I915_EXEC_BSD:
+            i965_stats_count(I965_STATS_BATCH_BYTES_BSD, used);
+            break;
+        case I915_EXEC_BLT:
+            i965_stats_count(I965_STATS_BATCH_BYTES_BLT, used);
+            break;
+        case I915_EXEC_VEBOX:
+            i965_stats_count(I965_STATS_BATCH_BYTES_VEBOX, used);
+            break;
+        default:
+            i965_stats_count(I965_STATS_BATCH_BYTES_RENDER, used);
+            break;
+        }
+
+        i965_stats_count(I965_STATS_BATCH_FLUSHES, 1);
+    }
+    intel_batchbuffer_reset(batch, batch->size);
 }
 
 void 
@@ -162,8 +481,19 @@ intel_batchbuffer_emit_reloc(struct intel_batchbuffer *batch, dri_bo *bo,
                                 uint32_t delta)
 {
     assert(batch->ptr - batch->map < batch->size);
-    dri_bo_emit_reloc(batch->buffer, read_domains, write_domains,
-                      delta, batch->ptr - batch->map, bo);
+
+    if (batch->cpu)
+        intel_batchbuffer_cpu_reloc(batch, bo, read_domains, write_domains,
+                                    delta, 0);
+    else {
+        dri_bo_emit_reloc(batch->buffer, read_domains, write_domains,
+                          delta, batch->ptr - batch->map, bo);
+
+        if (intel_batch_capture_enabled)
+            intel_batchbuffer_capture_reloc(batch, bo, batch->ptr - batch->map,
+                                            delta, 0);
+    }
+
     intel_batchbuffer_emit_dword(batch, bo->offset + delta);
 }
 
@@ -173,8 +503,18 @@ intel_batchbuffer_emit_reloc64(struct intel_batchbuffer *batch, dri_bo *bo,
                                 uint32_t delta)
 {
     assert(batch->ptr - batch->map < batch->size);
-    dri_bo_emit_reloc(batch->buffer, read_domains, write_domains,
-                      delta, batch->ptr - batch->map, bo);
+
+    if (batch->cpu)
+        intel_batchbuffer_cpu_reloc(batch, bo, read_domains, write_domains,
+                                    delta, 1);
+    else {
+        dri_bo_emit_reloc(batch->buffer, read_domains, write_domains,
+                          delta, batch->ptr - batch->map, bo);
+
+        if (intel_batch_capture_enabled)
+            intel_batchbuffer_capture_reloc(batch, bo, batch->ptr - batch->map,
+                                            delta, INTEL_BATCH_RELOC_64);
+    }
 
    /* Using the old buffer offset, write in what the right data would be, in
     * case the buffer doesn't move and we can short-circuit the relocation
@@ -189,6 +529,12 @@ void
 intel_batchbuffer_require_space(struct intel_batchbuffer *batch,
                                    unsigned int size)
 {
+    if (batch->cpu) {
+        if (intel_batchbuffer_space(batch) < size)
+            intel_batchbuffer_cpu_grow(batch, size);
+        return;
+    }
+
     assert(size < batch->size - 8);
 
     if (intel_batchbuffer_space(batch) < size) {
@@ -320,19 +666,6 @@ intel_batchbuffer_emit_mi_flush(struct intel_batchbuffer *batch)
     }
 }
 
-void
-intel_batchbuffer_begin_batch(struct intel_batchbuffer *batch, int total)
-{
-    batch->emit_total = total * 4;
-    batch->emit_start = batch->ptr;
-}
-
-void
-intel_batchbuffer_advance_batch(struct intel_batchbuffer *batch)
-{
-    assert(batch->emit_total == (batch->ptr - batch->emit_start));
-}
-
 void
 intel_batchbuffer_check_batchbuffer_flag(struct intel_batchbuffer *batch, int flag)
 {
@@ -1,12 +1,25 @@
 #ifndef _INTEL_BATCHBUFFER_H_
 #define _INTEL_BATCHBUFFER_H_
 
+#include <assert.h>
 #include <xf86drm.h>
 #include <drm.h>
 #include <i915_drm.h>
 #include <intel_bufmgr.h>
 
 #include "intel_driver.h"
+#include "intel_batchbuffer_dump.h"
+
+/* A relocation of a CPU batch, emitted when the batch is appended */
+struct intel_batch_cpu_reloc
+{
+    dri_bo *bo;
+    unsigned int offset;
+    uint32_t read_domains;
+    uint32_t write_domain;
+    uint32_t delta;
+    int is_64;
+};
 
 struct intel_batchbuffer 
 {
@@ -17,6 +30,7 @@ struct intel_batchbuffer
     unsigned char *ptr;
     int atomic;
     int flag;
+    int deferred;                       /* see intel_driver_data.flush_deferred */
 
     int emit_total;
     unsigned char *emit_start;
@@ -27,16 +41,44 @@ struct intel_batchbuffer
 
     /* Used for Sandybdrige workaround */
     dri_bo *wa_render_bo;
+
+    /* The relocations of the current batch, kept for VA_INTEL_BATCH_CAPTURE */
+    struct intel_batch_reloc *relocs;
+    dri_bo **reloc_bos;
+    int num_relocs;
+    int max_relocs;
+
+    /* CPU batches only, see intel_batchbuffer_new_cpu() */
+    int cpu;
+    struct intel_batch_cpu_reloc *cpu_relocs;
+    int num_cpu_relocs;
+    int max_cpu_relocs;
 };
 
+extern int intel_batch_capture_enabled;
+
+/* Opens VA_INTEL_BATCH_CAPTURE on the first display. Returns intel_batch_capture_enabled */
+int intel_batchbuffer_capture_init(void);
+void intel_batchbuffer_capture_terminate(void);
+/* Marks the end of a picture in the capture */
+void intel_batchbuffer_capture_frame(void);
+
 struct intel_batchbuffer *intel_batchbuffer_new(struct intel_driver_data *intel, int flag, int buffer_size);
+/*
+ * A CPU batch lives in malloc()ed memory: it grows instead of being flushed
+ * and keeps its relocations, so it can be written on any thread. Its
+ * content is copied into a real batch by intel_batchbuffer_append(), which
+ * emits the relocations there. The relocation targets aren't referenced.
+ */
+struct intel_batchbuffer *intel_batchbuffer_new_cpu(struct intel_driver_data *intel, int flag, int buffer_size);
+/* Appends a CPU batch to batch and empties it */
+void intel_batchbuffer_append(struct intel_batchbuffer *batch, struct intel_batchbuffer *cpu_batch);
 void intel_batchbuffer_free(struct intel_batchbuffer *batch);
 void intel_batchbuffer_start_atomic(struct intel_batchbuffer *batch, unsigned int size);
 void intel_batchbuffer_start_atomic_bcs(struct intel_batchbuffer *batch, unsigned int size);
 void intel_batchbuffer_start_atomic_blt(struct intel_batchbuffer *batch, unsigned int size);
 void intel_batchbuffer_start_atomic_veb(struct intel_batchbuffer *batch, unsigned int size);
 void intel_batchbuffer_end_atomic(struct intel_batchbuffer *batch);
-void intel_batchbuffer_emit_dword(struct intel_batchbuffer *batch, unsigned int x);
 void intel_batchbuffer_emit_reloc(struct intel_batchbuffer *batch, dri_bo *bo, 
                                   uint32_t read_domains, uint32_t write_domains, 
                                   uint32_t delta);
@@ -47,8 +89,6 @@ void intel_batchbuffer_require_space(struct intel_batchbuffer *batch, unsigned i
 void intel_batchbuffer_data(struct intel_batchbuffer *batch, void *data, unsigned int size);
 void intel_batchbuffer_emit_mi_flush(struct intel_batchbuffer *batch);
 void intel_batchbuffer_flush(struct intel_batchbuffer *batch);
-void intel_batchbuffer_begin_batch(struct intel_batchbuffer *batch, int total);
-void intel_batchbuffer_advance_batch(struct intel_batchbuffer *batch);
 void intel_batchbuffer_check_batchbuffer_flag(struct intel_batchbuffer *batch, int flag);
 int intel_batchbuffer_check_free_space(struct intel_batchbuffer *batch, int size);
 int intel_batchbuffer_used_size(struct intel_batchbuffer *batch);
@@ -63,9 +103,56 @@ typedef enum {
 void intel_batchbuffer_start_atomic_bcs_override(struct intel_batchbuffer *batch, unsigned int size,
                                                  bsd_ring_flag override_flag);
 
+static INLINE unsigned int
+intel_batchbuffer_space(struct intel_batchbuffer *batch)
+{
+    return (batch->size - BATCH_RESERVED) - (batch->ptr - batch->map);
+}
+
+static INLINE void
+intel_batchbuffer_emit_dword(struct intel_batchbuffer *batch, unsigned int x)
+{
+    assert(intel_batchbuffer_space(batch) >= 4);
+    *(unsigned int *)batch->ptr = x;
+    batch->ptr += 4;
+}
+
+static INLINE void
+intel_batchbuffer_begin_batch(struct intel_batchbuffer *batch, int total)
+{
+    batch->emit_total = total * 4;
+    batch->emit_start = batch->ptr;
+}
+
+static INLINE void
+intel_batchbuffer_advance_batch(struct intel_batchbuffer *batch)
+{
+    assert(batch->emit_total == (batch->ptr - batch->emit_start));
+}
+
+/*
+ * Reserve-then-write emission for the commands issued per macroblock or per
+ * block: after BEGIN_*BATCH(batch, n), the n dwords are written through the
+ * pointer returned by intel_batchbuffer_dwords() and committed by passing
+ * the end of the written dwords to intel_batchbuffer_advance_dwords(), which
+ * replaces ADVANCE_*BATCH. The count is only checked by assertions.
+ */
+static INLINE unsigned int *
+intel_batchbuffer_dwords(struct intel_batchbuffer *batch)
+{
+    return (unsigned int *)batch->ptr;
+}
+
+static INLINE void
+intel_batchbuffer_advance_dwords(struct intel_batchbuffer *batch, unsigned int *end)
+{
+    assert((unsigned char *)end - batch->emit_start == batch->emit_total);
+    batch->ptr = (unsigned char *)end;
+}
+
+/* The ring of a batch only changes in intel_batchbuffer_start_atomic*() */
 #define __BEGIN_BATCH(batch, n, f) do {                         \
-        assert(f == (batch->flag & I915_EXEC_RING_MASK));                               \
-        intel_batchbuffer_check_batchbuffer_flag(batch, batch->flag);     \
+        assert(f == (batch->flag & I915_EXEC_RING_MASK));       \
         intel_batchbuffer_require_space(batch, (n) * 4);        \
         intel_batchbuffer_begin_batch(batch, (n));              \
     } while (0)
@@ -3,100 +3,86 @@
 #include <string.h>
 #include <inttypes.h>
 
-#include "intel_driver.h"
+#include <i915_drm.h>
+
+#include "i965_defines.h"
 #include "intel_batchbuffer_dump.h"
 
-#ifdef I965_DEBUG
+#define ARRAY_ELEMS(a) (sizeof(a) / sizeof((a)[0]))
+
+#define RING_RENDER     (1 << I915_EXEC_RENDER)
+#define RING_BSD        (1 << I915_EXEC_BSD)
+#define RING_BLT        (1 << I915_EXEC_BLT)
+#define RING_VEBOX      (1 << I915_EXEC_VEBOX)
+#define RING_ANY        (RING_RENDER | RING_BSD | RING_BLT | RING_VEBOX)
 
-#define BUFFER_FAIL(_count, _len, _name) do {			\
-    fprintf(gout, "Buffer size too small in %s (%d < %d)\n",	\
-	    (_name), (_count), (_len));				\
-    (*failures)++;						\
-    return count;						\
-} while (0)
+#define MI(opcode)              ((opcode) << SHIFT_MI_OPCODE)
+#define BLT(opcode)             ((CMD_TYPE_BLT << SHIFT_CMD_TYPE) | (opcode) << 22)
+#define GFXPIPE(subtype, opcode, subopcode)     \
+    ((CMD_TYPE_GFXPIPE << SHIFT_CMD_TYPE) |     \
+     (subtype) << SHIFT_GFXPIPE_SUBTYPE |       \
+     (opcode) << SHIFT_GFXPIPE_OPCODE |         \
+     (subopcode) << SHIFT_GFXPIPE_SUBOPCODE)
 
 static FILE *gout;
 
-static void
-instr_out(unsigned int *data, unsigned int offset, unsigned int index, char *fmt, ...)
-{
-    va_list va;
+/* The batch being dumped, and the current command with its last printed dword */
+static const struct intel_batch_decode *gdecode;
+static unsigned int glength;
+static unsigned int glast_index;
 
-    fprintf(gout, "0x%08x: 0x%08x:%s ", offset + index * 4, data[index],
-	    index == 0 ? "" : "  ");
-    va_start(va, fmt);
-    vfprintf(gout, fmt, va);
-    va_end(va);
-}
+static const struct intel_batch_reloc *
+find_reloc(unsigned int index)
+{
+    int low = 0, high = gdecode->num_relocs - 1;
 
+    while (low <= high) {
+        int mid = (low + high) / 2;
 
-static int
-dump_mi(unsigned int *data, unsigned int offset, int count, unsigned int device, int *failures)
-{
-    unsigned int opcode;
-    int length, i;
-
-    struct {
-	unsigned int opcode;
-	int mask_length;
-	int min_len;
-	int max_len;
-	char *name;
-    } mi_commands[] = {
-	{ 0x00, 0, 1, 1, "MI_NOOP" },
-	{ 0x04, 0, 1, 1, "MI_FLUSH" },
-	{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
-	{ 0x26, 0x3f, 4, 5, "MI_FLUSH_DW" },
-    };
-
-    opcode = ((data[0] & MASK_MI_OPCODE) >> SHIFT_MI_OPCODE);
-
-    for (i = 0; i < sizeof(mi_commands) / sizeof(mi_commands[0]); i++) {
-        if (opcode == mi_commands[i].opcode) {
-            int index;
-
-            length = 1;
-	    instr_out(data, offset, 0, "%s\n", mi_commands[i].name);
-
-	    if (mi_commands[i].max_len > 1) {
-                length = (data[0] & mi_commands[i].mask_length) + 2;
-
-                if (length < mi_commands[i].min_len ||
-                    length > mi_commands[i].max_len) {
-		    fprintf(gout, "Bad length (%d) in %s, [%d, %d]\n",
-			    length, mi_commands[i].name,
-			    mi_commands[i].min_len,
-			    mi_commands[i].max_len);
-		}
-	    }
-
-            for (index = 1; index < length; index++) {
-                if (index >= count)
-		    BUFFER_FAIL(count, length, mi_commands[i].name);
-
-		instr_out(data, offset, index, "dword %d\n", index);
-	    }
-
-	    return length;
-	}
+        if (gdecode->relocs[mid].index < index)
+            low = mid + 1;
+        else if (gdecode->relocs[mid].index > index)
+            high = mid - 1;
+        else
+            return &gdecode->relocs[mid];
     }
 
-    instr_out(data, offset, 0, "UNKNOWN MI COMMAND\n");
-    (*failures)++;
-    return 1;
+    return NULL;
 }
 
-static int
-dump_gfxpipe_3d(unsigned int *data, unsigned int offset, int count, unsigned int device, int *failures)
+static void
+instr_out(const unsigned int *data, unsigned int offset, unsigned int index, char *fmt, ...)
 {
-    instr_out(data, offset, 0, "UNKNOWN 3D COMMAND\n");
-    (*failures)++;
+    const struct intel_batch_reloc *reloc;
+    unsigned int batch_index = offset / 4 + index;
+    va_list va;
+
+    /* the fixed layouts of the details may be longer than the command */
+    if (index >= glength)
+        return;
+
+    if ((reloc = find_reloc(batch_index)))
+        fprintf(gout, "0x%08x: reloc+0x%-5x:%s ", offset + index * 4, reloc->delta,
+                index == 0 ? "" : "  ");
+    else if (batch_index > 0 &&
+             (reloc = find_reloc(batch_index - 1)) &&
+             (reloc->flags & INTEL_BATCH_RELOC_64))
+        fprintf(gout, "0x%08x: reloc hi   :%s ", offset + index * 4,
+                index == 0 ? "" : "  ");
+    else
+        fprintf(gout, "0x%08x: 0x%08x:%s ", offset + index * 4, data[index],
+                index == 0 ? "" : "  ");
+
+    va_start(va, fmt);
+    vfprintf(gout, fmt, va);
+    va_end(va);
 
-    return 1;
+    if (index > glast_index)
+        glast_index = index;
 }
 
 static void
-dump_avc_bsd_img_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_avc_bsd_img_state(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
     int img_struct = ((data[3] >> 8) & 0x3);
 
@@ -140,7 +126,7 @@ dump_avc_bsd_img_state(unsigned int *data, unsigned int offset, unsigned int dev
 }
 
 static void
-dump_avc_bsd_qm_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_avc_bsd_qm_state(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
     unsigned int length = ((data[0] & MASK_GFXPIPE_LENGTH) >> SHIFT_GFXPIPE_LENGTH) + 2;
     int i;
@@ -154,13 +140,7 @@ dump_avc_bsd_qm_state(unsigned int *data, unsigned int offset, unsigned int devi
 }
 
 static void
-dump_avc_bsd_slice_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-
-}
-
-static void
-dump_avc_bsd_buf_base_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_avc_bsd_buf_base_state(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
     int i;
 
@@ -184,14 +164,14 @@ dump_avc_bsd_buf_base_state(unsigned int *data, unsigned int offset, unsigned in
 }
 
 static void
-dump_bsd_ind_obj_base_addr(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_bsd_ind_obj_base_addr(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
     instr_out(data, offset, 1, "AVC indirect object base address\n");
     instr_out(data, offset, 2, "AVC Indirect Object Access Upper Bound\n");
 }
 
 static void 
-dump_ironlake_avc_bsd_object(unsigned int *data, unsigned int offset, int *failures)
+dump_ironlake_avc_bsd_object(const unsigned int *data, unsigned int offset, int *failures)
 {
     int slice_type = data[3] & 0xf;
     int i, is_phantom = ((data[1] & 0x3fffff) == 0);
@@ -261,100 +241,22 @@ dump_ironlake_avc_bsd_object(unsigned int *data, unsigned int offset, int *failu
 }
 
 static void 
-dump_g4x_avc_bsd_object(unsigned int *data, unsigned int offset, int *failures)
+dump_g4x_avc_bsd_object(const unsigned int *data, unsigned int offset, int *failures)
 {
 
 }
 
 static void 
-dump_avc_bsd_object(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_avc_bsd_object(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
-    if (IS_IRONLAKE(device))
+    if (gen == 5)
         dump_ironlake_avc_bsd_object(data, offset, failures);
     else
         dump_g4x_avc_bsd_object(data, offset, failures);
 }
 
-static int
-dump_bsd_avc(unsigned int *data, unsigned int offset, int count, unsigned int device, int *failures)
-{
-    unsigned int subopcode;
-    int length, i;
-
-    struct {
-	unsigned int subopcode;
-	int min_len;
-	int max_len;
-	char *name;
-        void (*detail)(unsigned int *data, unsigned int offset, unsigned int device, int  *failures);
-    } avc_commands[] = {
-        { 0x00, 0x06, 0x06, "AVC_BSD_IMG_STATE", dump_avc_bsd_img_state },
-        { 0x01, 0x02, 0x3a, "AVC_BSD_QM_STATE", dump_avc_bsd_qm_state },
-        { 0x02, 0x02, 0xd2, "AVC_BSD_SLICE_STATE", NULL },
-        { 0x03, 0x4a, 0x4a, "AVC_BSD_BUF_BASE_STATE", dump_avc_bsd_buf_base_state },
-        { 0x04, 0x03, 0x03, "BSD_IND_OBJ_BASE_ADDR", dump_bsd_ind_obj_base_addr },
-        { 0x08, 0x08, 0x10, "AVC_BSD_OBJECT", dump_avc_bsd_object },
-    };
-
-    subopcode = ((data[0] & MASK_GFXPIPE_SUBOPCODE) >> SHIFT_GFXPIPE_SUBOPCODE);
-
-    for (i = 0; i < sizeof(avc_commands) / sizeof(avc_commands[0]); i++) {
-        if (subopcode == avc_commands[i].subopcode) {
-            unsigned int index;
-
-            length = (data[0] & MASK_GFXPIPE_LENGTH) >> SHIFT_GFXPIPE_LENGTH;
-            length += 2;
-            instr_out(data, offset, 0, "%s\n", avc_commands[i].name);
-
-            if (length < avc_commands[i].min_len || 
-                length > avc_commands[i].max_len) {
-                fprintf(gout, "Bad length(%d) in %s [%d, %d]\n", 
-                        length, avc_commands[i].name,
-                        avc_commands[i].min_len,
-                        avc_commands[i].max_len);
-            }
-
-            if (length - 1 >= count)
-                BUFFER_FAIL(count, length, avc_commands[i].name);
-
-            if (avc_commands[i].detail)
-                avc_commands[i].detail(data, offset, device, failures);
-            else {
-                for (index = 1; index < length; index++)
-                    instr_out(data, offset, index, "dword %d\n", index);
-            }
-
-	    return length;
-	}
-    }
-
-    instr_out(data, offset, 0, "UNKNOWN AVC COMMAND\n");
-    (*failures)++;
-    return 1;
-}
-
-static int
-dump_gfxpipe_bsd(unsigned int *data, unsigned int offset, int count, unsigned int device, int *failures)
-{
-    int length;
-
-    switch ((data[0] & MASK_GFXPIPE_OPCODE) >> SHIFT_GFXPIPE_OPCODE) {
-    case OPCODE_BSD_AVC:
-        length = dump_bsd_avc(data, offset, count, device, failures);
-        break;
-
-    default:
-        length = 1;
-        (*failures)++;
-        instr_out(data, offset, 0, "UNKNOWN BSD OPCODE\n");
-        break;
-    }
-
-    return length;
-}
-
 static void
-dump_mfx_mode_select(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_mfx_mode_select(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
     instr_out(data, offset, 1, 
               "decoder mode: %d(%s),"
@@ -375,161 +277,7 @@ dump_mfx_mode_select(unsigned int *data, unsigned int offset, unsigned int devic
 }
 
 static void
-dump_mfx_surface_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-    instr_out(data, offset, 1, "dword 01\n");
-    instr_out(data, offset, 2, "dword 02\n");
-    instr_out(data, offset, 3, "dword 03\n");
-    instr_out(data, offset, 4, "dword 04\n");
-    instr_out(data, offset, 5, "dword 05\n");
-}
-
-static void
-dump_mfx_pipe_buf_addr_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-    instr_out(data, offset, 1, "dword 01\n");
-    instr_out(data, offset, 2, "dword 02\n");
-    instr_out(data, offset, 3, "dword 03\n");
-    instr_out(data, offset, 4, "dword 04\n");
-    instr_out(data, offset, 5, "dword 05\n");
-    instr_out(data, offset, 6, "dword 06\n");
-    instr_out(data, offset, 7, "dword 07\n");
-    instr_out(data, offset, 8, "dword 08\n");
-    instr_out(data, offset, 9, "dword 09\n");
-    instr_out(data, offset, 10, "dword 10\n");
-    instr_out(data, offset, 11, "dword 11\n");
-    instr_out(data, offset, 12, "dword 12\n");
-    instr_out(data, offset, 13, "dword 13\n");
-    instr_out(data, offset, 14, "dword 14\n");
-    instr_out(data, offset, 15, "dword 15\n");
-    instr_out(data, offset, 16, "dword 16\n");
-    instr_out(data, offset, 17, "dword 17\n");
-    instr_out(data, offset, 18, "dword 18\n");
-    instr_out(data, offset, 19, "dword 19\n");
-    instr_out(data, offset, 20, "dword 20\n");
-    instr_out(data, offset, 21, "dword 21\n");
-    instr_out(data, offset, 22, "dword 22\n");
-    instr_out(data, offset, 24, "dword 23\n");
-}
-
-static void
-dump_mfx_ind_obj_base_addr_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-    instr_out(data, offset, 1, "dword 01\n");
-    instr_out(data, offset, 2, "dword 02\n");
-    instr_out(data, offset, 3, "dword 03\n");
-    instr_out(data, offset, 4, "dword 04\n");
-    instr_out(data, offset, 5, "dword 05\n");
-    instr_out(data, offset, 6, "dword 06\n");
-    instr_out(data, offset, 7, "dword 07\n");
-    instr_out(data, offset, 8, "dword 08\n");
-    instr_out(data, offset, 9, "dword 09\n");
-    instr_out(data, offset, 10, "dword 10\n");
-}
-
-static void
-dump_mfx_bsp_buf_base_addr_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-    instr_out(data, offset, 1, "dword 01\n");
-    instr_out(data, offset, 2, "dword 02\n");
-    instr_out(data, offset, 3, "dword 03\n");
-}
-
-static void
-dump_mfx_aes_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-    instr_out(data, offset, 1, "dword 01\n");
-    instr_out(data, offset, 2, "dword 02\n");
-    instr_out(data, offset, 3, "dword 03\n");
-    instr_out(data, offset, 4, "dword 04\n");
-    instr_out(data, offset, 5, "dword 05\n");
-    instr_out(data, offset, 6, "dword 06\n");
-}
-
-static void
-dump_mfx_state_pointer(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-    instr_out(data, offset, 1, "dword 01\n");
-}
-
-static int
-dump_mfx_common(unsigned int *data, unsigned int offset, int count, unsigned int device, int *failures)
-{
-    unsigned int subopcode;
-    int length, i;
-
-    struct {
-	unsigned int subopcode;
-	int min_len;
-	int max_len;
-	char *name;
-        void (*detail)(unsigned int *data, unsigned int offset, unsigned int device, int  *failures);
-    } mfx_common_commands[] = {
-        { SUBOPCODE_MFX(0, 0), 0x04, 0x04, "MFX_PIPE_MODE_SELECT", dump_mfx_mode_select },
-        { SUBOPCODE_MFX(0, 1), 0x06, 0x06, "MFX_SURFACE_STATE", dump_mfx_surface_state },
-        { SUBOPCODE_MFX(0, 2), 0x18, 0x18, "MFX_PIPE_BUF_ADDR_STATE", dump_mfx_pipe_buf_addr_state },
-        { SUBOPCODE_MFX(0, 3), 0x0b, 0x0b, "MFX_IND_OBJ_BASE_ADDR_STATE", dump_mfx_ind_obj_base_addr_state },
-        { SUBOPCODE_MFX(0, 4), 0x04, 0x04, "MFX_BSP_BUF_BASE_ADDR_STATE", dump_mfx_bsp_buf_base_addr_state },
-        { SUBOPCODE_MFX(0, 5), 0x07, 0x07, "MFX_AES_STATE", dump_mfx_aes_state },
-        { SUBOPCODE_MFX(0, 6), 0x00, 0x00, "MFX_STATE_POINTER", dump_mfx_state_pointer },
-    };
-
-    subopcode = ((data[0] & MASK_GFXPIPE_SUBOPCODE) >> SHIFT_GFXPIPE_SUBOPCODE);
-
-    for (i = 0; i < ARRAY_ELEMS(mfx_common_commands); i++) {
-        if (subopcode == mfx_common_commands[i].subopcode) {
-            unsigned int index;
-
-            length = (data[0] & MASK_GFXPIPE_LENGTH) >> SHIFT_GFXPIPE_LENGTH;
-            length += 2;
-            instr_out(data, offset, 0, "%s\n", mfx_common_commands[i].name);
-
-            if (length < mfx_common_commands[i].min_len || 
-                length > mfx_common_commands[i].max_len) {
-                fprintf(gout, "Bad length(%d) in %s [%d, %d]\n", 
-                        length, mfx_common_commands[i].name,
-                        mfx_common_commands[i].min_len,
-                        mfx_common_commands[i].max_len);
-            }
-
-            if (length - 1 >= count)
-                BUFFER_FAIL(count, length, mfx_common_commands[i].name);
-
-            if (mfx_common_commands[i].detail)
-                mfx_common_commands[i].detail(data, offset, device, failures);
-            else {
-                for (index = 1; index < length; index++)
-                    instr_out(data, offset, index, "dword %d\n", index);
-            }
-
-	    return length;
-	}
-    }
-
-    instr_out(data, offset, 0, "UNKNOWN MFX COMMON COMMAND\n");
-    (*failures)++;
-    return 1;
-}
-
-static void
-dump_mfx_avc_img_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-    instr_out(data, offset, 1, "dword 01\n");
-    instr_out(data, offset, 2, "dword 02\n");
-    instr_out(data, offset, 3, "dword 03\n");
-    instr_out(data, offset, 4, "dword 04\n");
-    instr_out(data, offset, 5, "dword 05\n");
-    instr_out(data, offset, 6, "dword 06\n");
-    instr_out(data, offset, 7, "dword 07\n");
-    instr_out(data, offset, 8, "dword 08\n");
-    instr_out(data, offset, 9, "dword 09\n");
-    instr_out(data, offset, 10, "dword 10\n");
-    instr_out(data, offset, 11, "dword 11\n");
-    instr_out(data, offset, 12, "dword 12\n");
-}
-
-static void
-dump_mfx_avc_qm_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_mfx_avc_qm_state(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
     unsigned int length = ((data[0] & MASK_GFXPIPE_LENGTH) >> SHIFT_GFXPIPE_LENGTH) + 2;
     int i;
@@ -543,7 +291,7 @@ dump_mfx_avc_qm_state(unsigned int *data, unsigned int offset, unsigned int devi
 }
 
 static void
-dump_mfx_avc_directmode_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_mfx_avc_directmode_state(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
     int i;
 
@@ -561,35 +309,7 @@ dump_mfx_avc_directmode_state(unsigned int *data, unsigned int offset, unsigned
 }
 
 static void
-dump_mfx_avc_slice_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-    instr_out(data, offset, 1, "dword 01\n");
-    instr_out(data, offset, 2, "dword 02\n");
-    instr_out(data, offset, 3, "dword 03\n");
-    instr_out(data, offset, 4, "dword 04\n");
-    instr_out(data, offset, 5, "dword 05\n");
-    instr_out(data, offset, 6, "dword 06\n");
-    instr_out(data, offset, 7, "dword 07\n");
-    instr_out(data, offset, 8, "dword 08\n");
-    instr_out(data, offset, 9, "dword 09\n");
-}
-
-static void
-dump_mfx_avc_ref_idx_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
-{
-    instr_out(data, offset, 1, "dword 01\n");
-    instr_out(data, offset, 2, "dword 02\n");
-    instr_out(data, offset, 3, "dword 03\n");
-    instr_out(data, offset, 4, "dword 04\n");
-    instr_out(data, offset, 5, "dword 05\n");
-    instr_out(data, offset, 6, "dword 06\n");
-    instr_out(data, offset, 7, "dword 07\n");
-    instr_out(data, offset, 8, "dword 08\n");
-    instr_out(data, offset, 9, "dword 09\n");
-}
-
-static void
-dump_mfx_avc_weightoffset_state(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_mfx_avc_weightoffset_state(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
     int i;
 
@@ -603,7 +323,7 @@ dump_mfx_avc_weightoffset_state(unsigned int *data, unsigned int offset, unsigne
 }
 
 static void
-dump_mfd_bsd_object(unsigned int *data, unsigned int offset, unsigned int device, int *failures)
+dump_mfd_bsd_object(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
     int is_phantom_slice = ((data[1] & 0x3fffff) == 0);
 
@@ -627,149 +347,417 @@ dump_mfd_bsd_object(unsigned int *data, unsigned int offset, unsigned int device
     }
 }
 
-static int
-dump_mfx_avc(unsigned int *data, unsigned int offset, int count, unsigned int device, int *failures)
+static void
+dump_mi_batch_buffer_start(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
-    unsigned int subopcode;
-    int length, i;
-
-    struct {
-	unsigned int subopcode;
-	int min_len;
-	int max_len;
-	char *name;
-        void (*detail)(unsigned int *data, unsigned int offset, unsigned int device, int  *failures);
-    } mfx_avc_commands[] = {
-        { SUBOPCODE_MFX(0, 0), 0x0d, 0x0d, "MFX_AVC_IMG_STATE", dump_mfx_avc_img_state },
-        { SUBOPCODE_MFX(0, 1), 0x02, 0x3a, "MFX_AVC_QM_STATE", dump_mfx_avc_qm_state },
-        { SUBOPCODE_MFX(0, 2), 0x45, 0x45, "MFX_AVC_DIRECTMODE_STATE", dump_mfx_avc_directmode_state },
-        { SUBOPCODE_MFX(0, 3), 0x0b, 0x0b, "MFX_AVC_SLICE_STATE", dump_mfx_avc_slice_state },
-        { SUBOPCODE_MFX(0, 4), 0x0a, 0x0a, "MFX_AVC_REF_IDX_STATE", dump_mfx_avc_ref_idx_state },
-        { SUBOPCODE_MFX(0, 5), 0x32, 0x32, "MFX_AVC_WEIGHTOFFSET_STATE", dump_mfx_avc_weightoffset_state },
-        { SUBOPCODE_MFX(1, 8), 0x06, 0x06, "MFD_AVC_BSD_OBJECT", dump_mfd_bsd_object },
-    };
-
-    subopcode = ((data[0] & MASK_GFXPIPE_SUBOPCODE) >> SHIFT_GFXPIPE_SUBOPCODE);
-
-    for (i = 0; i < ARRAY_ELEMS(mfx_avc_commands); i++) {
-        if (subopcode == mfx_avc_commands[i].subopcode) {
-            unsigned int index;
-
-            length = (data[0] & MASK_GFXPIPE_LENGTH) >> SHIFT_GFXPIPE_LENGTH;
-            length += 2;
-            instr_out(data, offset, 0, "%s\n", mfx_avc_commands[i].name);
-
-            if (length < mfx_avc_commands[i].min_len || 
-                length > mfx_avc_commands[i].max_len) {
-                fprintf(gout, "Bad length(%d) in %s [%d, %d]\n", 
-                        length, mfx_avc_commands[i].name,
-                        mfx_avc_commands[i].min_len,
-                        mfx_avc_commands[i].max_len);
-            }
-
-            if (length - 1 >= count)
-                BUFFER_FAIL(count, length, mfx_avc_commands[i].name);
-
-            if (mfx_avc_commands[i].detail)
-                mfx_avc_commands[i].detail(data, offset, device, failures);
-            else {
-                for (index = 1; index < length; index++)
-                    instr_out(data, offset, index, "dword %d\n", index);
-            }
-
-	    return length;
-	}
-    }
+    instr_out(data, offset, 1, "%s level batch buffer address\n",
+              (data[0] & (1 << 22)) ? "second" : "first");
+}
 
-    instr_out(data, offset, 0, "UNKNOWN MFX AVC COMMAND\n");
-    (*failures)++;
-    return 1;
+static void
+dump_mfx_surface_state(const unsigned int *data, unsigned int offset, int gen, int *failures)
+{
+    instr_out(data, offset, 1, "surface id: %d\n", data[1] & 0xf);
+    instr_out(data, offset, 2, "height: %d, width: %d\n",
+              ((data[2] >> 18) & 0x3fff) + 1,
+              ((data[2] >> 4) & 0x3fff) + 1);
+    instr_out(data, offset, 3,
+              "format: %d,"
+              "interleave chroma: %d,"
+              "pitch: %d,"
+              "tiled: %d,"
+              "tile walk: %s"
+              "\n",
+              (data[3] >> 28) & 0xf,
+              (data[3] >> 27) & 0x1,
+              ((data[3] >> 3) & 0x1ffff) + 1,
+              (data[3] >> 1) & 0x1,
+              (data[3] & 0x1) ? "Y" : "X");
+    instr_out(data, offset, 4, "Cb x offset: %d, Cb y offset: %d\n",
+              (data[4] >> 16) & 0x7fff, data[4] & 0x7fff);
+    instr_out(data, offset, 5, "Cr x offset: %d, Cr y offset: %d\n",
+              (data[5] >> 16) & 0x7fff, data[5] & 0x7fff);
 }
 
-static int
-dump_gfxpipe_mfx(unsigned int *data, unsigned int offset, int count, unsigned int device, int *failures)
+static void
+dump_veb_surface_state(const unsigned int *data, unsigned int offset, int gen, int *failures)
+{
+    instr_out(data, offset, 1, "%s surface\n", (data[1] & 0x1) ? "output" : "input");
+    instr_out(data, offset, 2, "height: %d, width: %d\n",
+              ((data[2] >> 18) & 0x3fff) + 1,
+              ((data[2] >> 4) & 0x3fff) + 1);
+    instr_out(data, offset, 3,
+              "format: %d,"
+              "interleave chroma: %d,"
+              "pitch: %d,"
+              "tiled: %d,"
+              "tile walk: %s"
+              "\n",
+              (data[3] >> 28) & 0xf,
+              (data[3] >> 27) & 0x1,
+              ((data[3] >> 3) & 0x1ffff) + 1,
+              (data[3] >> 1) & 0x1,
+              (data[3] & 0x1) ? "Y" : "X");
+}
+
+static void
+dump_hcp_pipe_mode_select(const unsigned int *data, unsigned int offset, int gen, int *failures)
 {
-    int length;
+    instr_out(data, offset, 1, "codec: %d(%s), %s\n",
+              (data[1] >> 5) & 0x3, ((data[1] >> 5) & 0x3) == 0 ? "HEVC" : "Reserved",
+              (data[1] & 0x1) ? "Encode" : "Decode");
+}
 
-    switch ((data[0] & MASK_GFXPIPE_OPCODE) >> SHIFT_GFXPIPE_OPCODE) {
-    case OPCODE_MFX_COMMON:
-        length = dump_mfx_common(data, offset, count, device, failures);
-        break;
+static void
+dump_hcp_surface_state(const unsigned int *data, unsigned int offset, int gen, int *failures)
+{
+    instr_out(data, offset, 1, "surface id: %d, pitch: %d\n",
+              (data[1] >> 28) & 0xf, (data[1] & 0x1ffff) + 1);
+    instr_out(data, offset, 2, "format: %d, Cb y offset: %d\n",
+              (data[2] >> 28) & 0xf, data[2] & 0x7fff);
+}
 
-    case OPCODE_MFX_AVC:
-        length = dump_mfx_avc(data, offset, count, device, failures);
-        break;
+/*
+ * The headers are compared with their length and flags masked, see
+ * command_opcode(). The same header may be used for several commands,
+ * on different rings or generations, the first matching entry wins.
+ */
+static const struct dump_command {
+    unsigned int opcode;
+    unsigned int rings;
+    int min_gen;
+    int max_gen;
+    int length;                 /* fixed length, 0 to read it from the header */
+    char *name;
+    void (*detail)(const unsigned int *data, unsigned int offset, int gen, int *failures);
+} dump_commands[] = {
+    /* MI */
+    { MI(0x00), RING_ANY, 4, 9, 1, "MI_NOOP", NULL },
+    { MI(0x02), RING_ANY, 4, 9, 1, "MI_USER_INTERRUPT", NULL },
+    { MI(0x03), RING_ANY, 4, 9, 1, "MI_WAIT_FOR_EVENT", NULL },
+    { MI(0x04), RING_ANY, 4, 9, 1, "MI_FLUSH", NULL },
+    { MI(0x05), RING_ANY, 4, 9, 1, "MI_ARB_CHECK", NULL },
+    { MI(0x07), RING_ANY, 4, 9, 1, "MI_REPORT_HEAD", NULL },
+    { MI(0x08), RING_ANY, 4, 9, 1, "MI_ARB_ON_OFF", NULL },
+    { MI(0x0a), RING_ANY, 4, 9, 1, "MI_BATCH_BUFFER_END", NULL },
+    { MI(0x0b), RING_ANY, 4, 9, 1, "MI_SUSPEND_FLUSH", NULL },
+    { MI(0x16), RING_ANY, 6, 9, 0, "MI_SEMAPHORE_MBOX", NULL },
+    { MI(0x1a), RING_ANY, 8, 9, 0, "MI_MATH", NULL },
+    { MI(0x20), RING_ANY, 4, 9, 0, "MI_STORE_DATA_IMM", NULL },
+    { MI(0x21), RING_ANY, 4, 9, 0, "MI_STORE_DATA_INDEX", NULL },
+    { MI(0x22), RING_ANY, 4, 9, 0, "MI_LOAD_REGISTER_IMM", NULL },
+    { MI(0x24), RING_ANY, 4, 9, 0, "MI_STORE_REGISTER_MEM", NULL },
+    { MI(0x26), RING_ANY, 6, 9, 0, "MI_FLUSH_DW", NULL },
+    { MI(0x29), RING_ANY, 7, 9, 0, "MI_LOAD_REGISTER_MEM", NULL },
+    { MI(0x2a), RING_ANY, 8, 9, 0, "MI_LOAD_REGISTER_REG", NULL },
+    { MI(0x31), RING_ANY, 4, 9, 0, "MI_BATCH_BUFFER_START", dump_mi_batch_buffer_start },
+    { MI(0x36), RING_ANY, 6, 9, 0, "MI_CONDITIONAL_BATCH_BUFFER_END", NULL },
+
+    /* BLT */
+    { BLT(0x01), RING_RENDER | RING_BLT, 4, 9, 0, "XY_SETUP_BLT", NULL },
+    { BLT(0x40), RING_RENDER | RING_BLT, 4, 9, 0, "COLOR_BLT", NULL },
+    { BLT(0x42), RING_BLT, 9, 9, 0, "XY_FAST_COPY_BLT", NULL },
+    { BLT(0x43), RING_RENDER | RING_BLT, 4, 9, 0, "SRC_COPY_BLT", NULL },
+    { BLT(0x50), RING_RENDER | RING_BLT, 4, 9, 0, "XY_COLOR_BLT", NULL },
+    { BLT(0x53), RING_RENDER | RING_BLT, 4, 9, 0, "XY_SRC_COPY_BLT", NULL },
+
+    /* common */
+    { CMD_URB_FENCE, RING_RENDER, 4, 5, 0, "URB_FENCE", NULL },
+    { CMD_CS_URB_STATE, RING_RENDER, 4, 5, 0, "CS_URB_STATE", NULL },
+    { CMD_CONSTANT_BUFFER, RING_RENDER, 4, 5, 0, "CONSTANT_BUFFER", NULL },
+    { CMD_STATE_PREFETCH, RING_RENDER, 4, 5, 0, "STATE_PREFETCH", NULL },
+    { CMD_STATE_BASE_ADDRESS, RING_RENDER, 4, 9, 0, "STATE_BASE_ADDRESS", NULL },
+    { CMD_STATE_SIP, RING_RENDER, 4, 9, 0, "STATE_SIP", NULL },
+    { CMD_PIPELINE_SELECT, RING_RENDER, 4, 9, 1, "PIPELINE_SELECT", NULL },
+
+    /* media */
+    { CMD_MEDIA_STATE_POINTERS, RING_RENDER, 4, 5, 0, "MEDIA_STATE_POINTERS", NULL },
+    { CMD_MEDIA_VFE_STATE, RING_RENDER, 6, 9, 0, "MEDIA_VFE_STATE", NULL },
+    { CMD_MEDIA_CURBE_LOAD, RING_RENDER, 6, 9, 0, "MEDIA_CURBE_LOAD", NULL },
+    { CMD_MEDIA_INTERFACE_DESCRIPTOR_LOAD, RING_RENDER, 6, 9, 0, "MEDIA_INTERFACE_DESCRIPTOR_LOAD", NULL },
+    { CMD_MEDIA_GATEWAY_STATE, RING_RENDER, 6, 9, 0, "MEDIA_GATEWAY_STATE", NULL },
+    { CMD_MEDIA_STATE_FLUSH, RING_RENDER, 6, 9, 0, "MEDIA_STATE_FLUSH", NULL },
+    { CMD_MEDIA_OBJECT, RING_RENDER, 4, 9, 0, "MEDIA_OBJECT", NULL },
+    { CMD_MEDIA_OBJECT_EX, RING_RENDER, 4, 5, 0, "MEDIA_OBJECT_EX", NULL },
+    { CMD_MEDIA_OBJECT_WALKER, RING_RENDER, 6, 9, 0, "MEDIA_OBJECT_WALKER", NULL },
+
+    /* 3D */
+    { CMD_PIPELINED_POINTERS, RING_RENDER, 4, 5, 0, "PIPELINED_POINTERS", NULL },
+    { CMD_BINDING_TABLE_POINTERS, RING_RENDER, 4, 6, 0, "BINDING_TABLE_POINTERS", NULL },
+    { GEN6_3DSTATE_SAMPLER_STATE_POINTERS, RING_RENDER, 6, 6, 0, "3DSTATE_SAMPLER_STATE_POINTERS", NULL },
+    { GEN7_3DSTATE_CLEAR_PARAMS, RING_RENDER, 7, 9, 0, "3DSTATE_CLEAR_PARAMS", NULL },
+    { GEN6_3DSTATE_URB, RING_RENDER, 6, 6, 0, "3DSTATE_URB", NULL },
+    { GEN7_3DSTATE_DEPTH_BUFFER, RING_RENDER, 7, 9, 0, "3DSTATE_DEPTH_BUFFER", NULL },
+    { GEN7_3DSTATE_STENCIL_BUFFER, RING_RENDER, 7, 9, 0, "3DSTATE_STENCIL_BUFFER", NULL },
+    { GEN7_3DSTATE_HIER_DEPTH_BUFFER, RING_RENDER, 7, 9, 0, "3DSTATE_HIER_DEPTH_BUFFER", NULL },
+    { CMD_VERTEX_BUFFERS, RING_RENDER, 4, 9, 0, "3DSTATE_VERTEX_BUFFERS", NULL },
+    { CMD_VERTEX_ELEMENTS, RING_RENDER, 4, 9, 0, "3DSTATE_VERTEX_ELEMENTS", NULL },
+    { GEN7_3DSTATE_VF, RING_RENDER, 7, 9, 0, "3DSTATE_VF", NULL },
+    { GEN6_3DSTATE_VIEWPORT_STATE_POINTERS, RING_RENDER, 6, 6, 0, "3DSTATE_VIEWPORT_STATE_POINTERS", NULL },
+    { GEN8_3DSTATE_MULTISAMPLE, RING_RENDER, 8, 9, 0, "3DSTATE_MULTISAMPLE", NULL },
+    { GEN6_3DSTATE_CC_STATE_POINTERS, RING_RENDER, 6, 9, 0, "3DSTATE_CC_STATE_POINTERS", NULL },
+    { GEN6_3DSTATE_VS, RING_RENDER, 6, 9, 0, "3DSTATE_VS", NULL },
+    { GEN6_3DSTATE_GS, RING_RENDER, 6, 9, 0, "3DSTATE_GS", NULL },
+    { GEN6_3DSTATE_CLIP, RING_RENDER, 6, 9, 0, "3DSTATE_CLIP", NULL },
+    { GEN6_3DSTATE_SF, RING_RENDER, 6, 9, 0, "3DSTATE_SF", NULL },
+    { GEN6_3DSTATE_WM, RING_RENDER, 6, 9, 0, "3DSTATE_WM", NULL },
+    { GEN6_3DSTATE_CONSTANT_VS, RING_RENDER, 6, 9, 0, "3DSTATE_CONSTANT_VS", NULL },
+    { GEN6_3DSTATE_CONSTANT_GS, RING_RENDER, 6, 9, 0, "3DSTATE_CONSTANT_GS", NULL },
+    { GEN6_3DSTATE_CONSTANT_PS, RING_RENDER, 6, 9, 0, "3DSTATE_CONSTANT_PS", NULL },
+    { GEN6_3DSTATE_SAMPLE_MASK, RING_RENDER, 6, 9, 0, "3DSTATE_SAMPLE_MASK", NULL },
+    { GEN7_3DSTATE_CONSTANT_HS, RING_RENDER, 7, 9, 0, "3DSTATE_CONSTANT_HS", NULL },
+    { GEN7_3DSTATE_CONSTANT_DS, RING_RENDER, 7, 9, 0, "3DSTATE_CONSTANT_DS", NULL },
+    { GEN7_3DSTATE_HS, RING_RENDER, 7, 9, 0, "3DSTATE_HS", NULL },
+    { GEN7_3DSTATE_TE, RING_RENDER, 7, 9, 0, "3DSTATE_TE", NULL },
+    { GEN7_3DSTATE_DS, RING_RENDER, 7, 9, 0, "3DSTATE_DS", NULL },
+    { GEN7_3DSTATE_STREAMOUT, RING_RENDER, 7, 9, 0, "3DSTATE_STREAMOUT", NULL },
+    { GEN7_3DSTATE_SBE, RING_RENDER, 7, 9, 0, "3DSTATE_SBE", NULL },
+    { GEN7_3DSTATE_PS, RING_RENDER, 7, 9, 0, "3DSTATE_PS", NULL },
+    { GEN7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CL, RING_RENDER, 7, 9, 0, "3DSTATE_VIEWPORT_STATE_POINTERS_SF_CL", NULL },
+    { GEN7_3DSTATE_VIEWPORT_STATE_POINTERS_CC, RING_RENDER, 7, 9, 0, "3DSTATE_VIEWPORT_STATE_POINTERS_CC", NULL },
+    { GEN7_3DSTATE_BLEND_STATE_POINTERS, RING_RENDER, 7, 9, 0, "3DSTATE_BLEND_STATE_POINTERS", NULL },
+    { GEN7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS, RING_RENDER, 7, 9, 0, "3DSTATE_DEPTH_STENCIL_STATE_POINTERS", NULL },
+    { GEN7_3DSTATE_BINDING_TABLE_POINTERS_VS, RING_RENDER, 7, 9, 0, "3DSTATE_BINDING_TABLE_POINTERS_VS", NULL },
+    { GEN7_3DSTATE_BINDING_TABLE_POINTERS_HS, RING_RENDER, 7, 9, 0, "3DSTATE_BINDING_TABLE_POINTERS_HS", NULL },
+    { GEN7_3DSTATE_BINDING_TABLE_POINTERS_DS, RING_RENDER, 7, 9, 0, "3DSTATE_BINDING_TABLE_POINTERS_DS", NULL },
+    { GEN7_3DSTATE_BINDING_TABLE_POINTERS_GS, RING_RENDER, 7, 9, 0, "3DSTATE_BINDING_TABLE_POINTERS_GS", NULL },
+    { GEN7_3DSTATE_BINDING_TABLE_POINTERS_PS, RING_RENDER, 7, 9, 0, "3DSTATE_BINDING_TABLE_POINTERS_PS", NULL },
+    { GEN7_3DSTATE_SAMPLER_STATE_POINTERS_VS, RING_RENDER, 7, 9, 0, "3DSTATE_SAMPLER_STATE_POINTERS_VS", NULL },
+    { GEN7_3DSTATE_SAMPLER_STATE_POINTERS_HS, RING_RENDER, 7, 9, 0, "3DSTATE_SAMPLER_STATE_POINTERS_HS", NULL },
+    { GEN7_3DSTATE_SAMPLER_STATE_POINTERS_DS, RING_RENDER, 7, 9, 0, "3DSTATE_SAMPLER_STATE_POINTERS_DS", NULL },
+    { GEN7_3DSTATE_SAMPLER_STATE_POINTERS_GS, RING_RENDER, 7, 9, 0, "3DSTATE_SAMPLER_STATE_POINTERS_GS", NULL },
+    { GEN7_3DSTATE_SAMPLER_STATE_POINTERS_PS, RING_RENDER, 7, 9, 0, "3DSTATE_SAMPLER_STATE_POINTERS_PS", NULL },
+    { GEN7_3DSTATE_URB_VS, RING_RENDER, 7, 9, 0, "3DSTATE_URB_VS", NULL },
+    { GEN7_3DSTATE_URB_HS, RING_RENDER, 7, 9, 0, "3DSTATE_URB_HS", NULL },
+    { GEN7_3DSTATE_URB_DS, RING_RENDER, 7, 9, 0, "3DSTATE_URB_DS", NULL },
+    { GEN7_3DSTATE_URB_GS, RING_RENDER, 7, 9, 0, "3DSTATE_URB_GS", NULL },
+    { GEN8_3DSTATE_VF_INSTANCING, RING_RENDER, 8, 9, 0, "3DSTATE_VF_INSTANCING", NULL },
+    { GEN8_3DSTATE_VF_SGVS, RING_RENDER, 8, 9, 0, "3DSTATE_VF_SGVS", NULL },
+    { GEN8_3DSTATE_VF_TOPOLOGY, RING_RENDER, 8, 9, 0, "3DSTATE_VF_TOPOLOGY", NULL },
+    { GEN8_3DSTATE_PSBLEND, RING_RENDER, 8, 9, 0, "3DSTATE_PS_BLEND", NULL },
+    { GEN8_3DSTATE_WM_DEPTH_STENCIL, RING_RENDER, 8, 9, 0, "3DSTATE_WM_DEPTH_STENCIL", NULL },
+    { GEN8_3DSTATE_PSEXTRA, RING_RENDER, 8, 9, 0, "3DSTATE_PS_EXTRA", NULL },
+    { GEN8_3DSTATE_RASTER, RING_RENDER, 8, 9, 0, "3DSTATE_RASTER", NULL },
+    { GEN8_3DSTATE_SBE_SWIZ, RING_RENDER, 8, 9, 0, "3DSTATE_SBE_SWIZ", NULL },
+    { GEN8_3DSTATE_WM_HZ_OP, RING_RENDER, 8, 9, 0, "3DSTATE_WM_HZ_OP", NULL },
+    { CMD_DRAWING_RECTANGLE, RING_RENDER, 4, 9, 0, "3DSTATE_DRAWING_RECTANGLE", NULL },
+    { CMD_CONSTANT_COLOR, RING_RENDER, 4, 5, 0, "3DSTATE_CONSTANT_COLOR", NULL },
+    { CMD_SAMPLER_PALETTE_LOAD, RING_RENDER, 4, 9, 0, "3DSTATE_SAMPLER_PALETTE_LOAD", NULL },
+    { CMD_DEPTH_BUFFER, RING_RENDER, 4, 6, 0, "3DSTATE_DEPTH_BUFFER", NULL },
+    { GEN6_3DSTATE_MULTISAMPLE, RING_RENDER, 6, 7, 0, "3DSTATE_MULTISAMPLE", NULL },
+    { CMD_CLEAR_PARAMS, RING_RENDER, 5, 6, 0, "3DSTATE_CLEAR_PARAMS", NULL },
+    { GEN7_3DSTATE_PUSH_CONSTANT_ALLOC_VS, RING_RENDER, 7, 9, 0, "3DSTATE_PUSH_CONSTANT_ALLOC_VS", NULL },
+    { GEN7_3DSTATE_PUSH_CONSTANT_ALLOC_HS, RING_RENDER, 7, 9, 0, "3DSTATE_PUSH_CONSTANT_ALLOC_HS", NULL },
+    { GEN7_3DSTATE_PUSH_CONSTANT_ALLOC_DS, RING_RENDER, 7, 9, 0, "3DSTATE_PUSH_CONSTANT_ALLOC_DS", NULL },
+    { GEN7_3DSTATE_PUSH_CONSTANT_ALLOC_GS, RING_RENDER, 7, 9, 0, "3DSTATE_PUSH_CONSTANT_ALLOC_GS", NULL },
+    { GEN7_3DSTATE_PUSH_CONSTANT_ALLOC_PS, RING_RENDER, 7, 9, 0, "3DSTATE_PUSH_CONSTANT_ALLOC_PS", NULL },
+    { GEN8_3DSTATE_SAMPLE_PATTERN, RING_RENDER, 8, 9, 0, "3DSTATE_SAMPLE_PATTERN", NULL },
+    { GFXPIPE(GFXPIPE_3D, 2, 0), RING_RENDER, 4, 9, 0, "PIPE_CONTROL", NULL },
+    { CMD_3DPRIMITIVE, RING_RENDER, 4, 9, 0, "3DPRIMITIVE", NULL },
+
+    /* AVC BSD, Ironlake and G4x */
+    { CMD_AVC_BSD_IMG_STATE, RING_BSD, 4, 5, 0, "AVC_BSD_IMG_STATE", dump_avc_bsd_img_state },
+    { CMD_AVC_BSD_QM_STATE, RING_BSD, 4, 5, 0, "AVC_BSD_QM_STATE", dump_avc_bsd_qm_state },
+    { CMD_AVC_BSD_SLICE_STATE, RING_BSD, 4, 5, 0, "AVC_BSD_SLICE_STATE", NULL },
+    { CMD_AVC_BSD_BUF_BASE_STATE, RING_BSD, 4, 5, 0, "AVC_BSD_BUF_BASE_STATE", dump_avc_bsd_buf_base_state },
+    { CMD_BSD_IND_OBJ_BASE_ADDR, RING_BSD, 4, 5, 0, "BSD_IND_OBJ_BASE_ADDR", dump_bsd_ind_obj_base_addr },
+    { CMD_AVC_BSD_OBJECT, RING_BSD, 4, 5, 0, "AVC_BSD_OBJECT", dump_avc_bsd_object },
+
+    /* MFX */
+    { MFX_WAIT, RING_BSD, 6, 9, 1, "MFX_WAIT", NULL },
+    { MFX_PIPE_MODE_SELECT, RING_BSD, 6, 9, 0, "MFX_PIPE_MODE_SELECT", dump_mfx_mode_select },
+    { MFX_SURFACE_STATE, RING_BSD, 6, 9, 0, "MFX_SURFACE_STATE", dump_mfx_surface_state },
+    { MFX_PIPE_BUF_ADDR_STATE, RING_BSD, 6, 9, 0, "MFX_PIPE_BUF_ADDR_STATE", NULL },
+    { MFX_IND_OBJ_BASE_ADDR_STATE, RING_BSD, 6, 9, 0, "MFX_IND_OBJ_BASE_ADDR_STATE", NULL },
+    { MFX_BSP_BUF_BASE_ADDR_STATE, RING_BSD, 6, 9, 0, "MFX_BSP_BUF_BASE_ADDR_STATE", NULL },
+    { MFX_AES_STATE, RING_BSD, 6, 9, 0, "MFX_AES_STATE", NULL },
+    { MFX_STATE_POINTER, RING_BSD, 7, 9, 0, "MFX_STATE_POINTER", NULL },
+    { MFX_QM_STATE, RING_BSD, 7, 9, 0, "MFX_QM_STATE", NULL },
+    { MFX_FQM_STATE, RING_BSD, 7, 9, 0, "MFX_FQM_STATE", NULL },
+    { MFX_INSERT_OBJECT, RING_BSD, 7, 9, 0, "MFX_INSERT_OBJECT", NULL },
+
+    { MFX_AVC_IMG_STATE, RING_BSD, 6, 9, 0, "MFX_AVC_IMG_STATE", NULL },
+    { MFX_AVC_QM_STATE, RING_BSD, 6, 6, 0, "MFX_AVC_QM_STATE", dump_mfx_avc_qm_state },
+    { MFX_AVC_DIRECTMODE_STATE, RING_BSD, 6, 7, 0, "MFX_AVC_DIRECTMODE_STATE", dump_mfx_avc_directmode_state },
+    { MFX_AVC_DIRECTMODE_STATE, RING_BSD, 8, 9, 0, "MFX_AVC_DIRECTMODE_STATE", NULL },
+    { MFX_AVC_SLICE_STATE, RING_BSD, 6, 9, 0, "MFX_AVC_SLICE_STATE", NULL },
+    { MFX_AVC_REF_IDX_STATE, RING_BSD, 6, 9, 0, "MFX_AVC_REF_IDX_STATE", NULL },
+    { MFX_AVC_WEIGHTOFFSET_STATE, RING_BSD, 6, 9, 0, "MFX_AVC_WEIGHTOFFSET_STATE", dump_mfx_avc_weightoffset_state },
+    { MFD_AVC_PICID_STATE, RING_BSD, 7, 9, 0, "MFD_AVC_PICID_STATE", NULL },
+    { MFD_AVC_BSD_OBJECT, RING_BSD, 6, 9, 0, "MFD_AVC_BSD_OBJECT", dump_mfd_bsd_object },
+    { MFC_AVC_FQM_STATE, RING_BSD, 6, 6, 0, "MFC_AVC_FQM_STATE", NULL },
+    { MFC_AVC_INSERT_OBJECT, RING_BSD, 6, 6, 0, "MFC_AVC_INSERT_OBJECT", NULL },
+    { MFC_AVC_PAK_OBJECT, RING_BSD, 6, 9, 0, "MFC_AVC_PAK_OBJECT", NULL },
+
+    { MFX_MPEG2_PIC_STATE, RING_BSD, 6, 9, 0, "MFX_MPEG2_PIC_STATE", NULL },
+    { MFX_MPEG2_QM_STATE, RING_BSD, 6, 6, 0, "MFX_MPEG2_QM_STATE", NULL },
+    { MFD_MPEG2_BSD_OBJECT, RING_BSD, 6, 9, 0, "MFD_MPEG2_BSD_OBJECT", NULL },
+    { MFC_MPEG2_SLICEGROUP_STATE, RING_BSD, 7, 9, 0, "MFC_MPEG2_SLICEGROUP_STATE", NULL },
+    { MFC_MPEG2_PAK_OBJECT, RING_BSD, 7, 9, 0, "MFC_MPEG2_PAK_OBJECT", NULL },
+
+    { MFX_VC1_PIC_STATE, RING_BSD, 6, 6, 0, "MFX_VC1_PIC_STATE", NULL },
+    { MFX_VC1_PRED_PIPE_STATE, RING_BSD, 6, 9, 0, "MFX_VC1_PRED_PIPE_STATE", NULL },
+    { MFX_VC1_DIRECTMODE_STATE, RING_BSD, 6, 9, 0, "MFX_VC1_DIRECTMODE_STATE", NULL },
+    { MFD_VC1_SHORT_PIC_STATE, RING_BSD, 7, 9, 0, "MFD_VC1_SHORT_PIC_STATE", NULL },
+    { MFD_VC1_LONG_PIC_STATE, RING_BSD, 7, 9, 0, "MFD_VC1_LONG_PIC_STATE", NULL },
+    { MFD_VC1_BSD_OBJECT, RING_BSD, 6, 9, 0, "MFD_VC1_BSD_OBJECT", NULL },
+
+    { MFX_JPEG_PIC_STATE, RING_BSD, 7, 9, 0, "MFX_JPEG_PIC_STATE", NULL },
+    { MFX_JPEG_HUFF_TABLE_STATE, RING_BSD, 7, 9, 0, "MFX_JPEG_HUFF_TABLE_STATE", NULL },
+    { MFC_JPEG_HUFF_TABLE_STATE, RING_BSD, 8, 9, 0, "MFC_JPEG_HUFF_TABLE_STATE", NULL },
+    { MFC_JPEG_SCAN_OBJECT, RING_BSD, 8, 9, 0, "MFC_JPEG_SCAN_OBJECT", NULL },
+    { MFD_JPEG_BSD_OBJECT, RING_BSD, 7, 9, 0, "MFD_JPEG_BSD_OBJECT", NULL },
+
+    { MFX_VP8_PIC_STATE, RING_BSD, 8, 9, 0, "MFX_VP8_PIC_STATE", NULL },
+    { MFD_VP8_BSD_OBJECT, RING_BSD, 8, 9, 0, "MFD_VP8_BSD_OBJECT", NULL },
+    { MFX_VP8_ENCODER_CFG, RING_BSD, 8, 9, 0, "MFX_VP8_ENCODER_CFG", NULL },
+    { MFX_VP8_BSP_BUF_BASE_ADDR_STATE, RING_BSD, 8, 9, 0, "MFX_VP8_BSP_BUF_BASE_ADDR_STATE", NULL },
+    { MFX_VP8_PAK_OBJECT, RING_BSD, 8, 9, 0, "MFX_VP8_PAK_OBJECT", NULL },
+
+    /* HCP */
+    { HCP_PIPE_MODE_SELECT, RING_BSD, 9, 9, 0, "HCP_PIPE_MODE_SELECT", dump_hcp_pipe_mode_select },
+    { HCP_SURFACE_STATE, RING_BSD, 9, 9, 0, "HCP_SURFACE_STATE", dump_hcp_surface_state },
+    { HCP_PIPE_BUF_ADDR_STATE, RING_BSD, 9, 9, 0, "HCP_PIPE_BUF_ADDR_STATE", NULL },
+    { HCP_IND_OBJ_BASE_ADDR_STATE, RING_BSD, 9, 9, 0, "HCP_IND_OBJ_BASE_ADDR_STATE", NULL },
+    { HCP_QM_STATE, RING_BSD, 9, 9, 0, "HCP_QM_STATE", NULL },
+    { HCP_FQM_STATE, RING_BSD, 9, 9, 0, "HCP_FQM_STATE", NULL },
+    { HCP_PIC_STATE, RING_BSD, 9, 9, 0, "HCP_PIC_STATE", NULL },
+    { HCP_TILE_STATE, RING_BSD, 9, 9, 0, "HCP_TILE_STATE", NULL },
+    { HCP_REF_IDX_STATE, RING_BSD, 9, 9, 0, "HCP_REF_IDX_STATE", NULL },
+    { HCP_WEIGHTOFFSET, RING_BSD, 9, 9, 0, "HCP_WEIGHTOFFSET", NULL },
+    { HCP_SLICE_STATE, RING_BSD, 9, 9, 0, "HCP_SLICE_STATE", NULL },
+    { HCP_BSD_OBJECT, RING_BSD, 9, 9, 0, "HCP_BSD_OBJECT", NULL },
+    { HCP_PAK_OBJECT, RING_BSD, 9, 9, 0, "HCP_PAK_OBJECT", NULL },
+    { HCP_INSERT_PAK_OBJECT, RING_BSD, 9, 9, 0, "HCP_INSERT_PAK_OBJECT", NULL },
+
+    /* VEBOX */
+    { VEB_SURFACE_STATE, RING_VEBOX, 7, 9, 0, "VEB_SURFACE_STATE", dump_veb_surface_state },
+    { VEB_STATE, RING_VEBOX, 7, 9, 0, "VEB_STATE", NULL },
+    { VEB_DNDI_IECP_STATE, RING_VEBOX, 7, 9, 0, "VEB_DNDI_IECP_STATE", NULL },
+};
+
+static unsigned int
+command_opcode(unsigned int header)
+{
+    switch ((header & MASK_CMD_TYPE) >> SHIFT_CMD_TYPE) {
+    case CMD_TYPE_MI:
+        return header & (MASK_CMD_TYPE | MASK_MI_OPCODE);
+
+    case CMD_TYPE_BLT:
+        return header & (MASK_CMD_TYPE | MASK_BLT_OPCODE);
+
+    case CMD_TYPE_GFXPIPE:
+        return header & (MASK_CMD_TYPE | MASK_GFXPIPE_SUBTYPE | MASK_GFXPIPE_OPCODE | MASK_GFXPIPE_SUBOPCODE);
 
     default:
-        length = 1;
-        (*failures)++;
-        instr_out(data, offset, 0, "UNKNOWN MFX OPCODE\n");
-        break;
+        return ~0;
     }
+}
+
+static const struct dump_command *
+lookup_command(const struct intel_batch_decode *decode, unsigned int header)
+{
+    unsigned int opcode = command_opcode(header);
+    unsigned int rings = decode->ring ? (1 << decode->ring) : RING_ANY;
+    int i;
 
-    return length;
+    for (i = 0; i < ARRAY_ELEMS(dump_commands); i++) {
+        const struct dump_command *command = &dump_commands[i];
+
+        if (command->opcode == opcode &&
+            (command->rings & rings) &&
+            (!decode->gen ||
+             (decode->gen >= command->min_gen && decode->gen <= command->max_gen)))
+            return command;
+    }
+
+    return NULL;
 }
 
 static int
-dump_gfxpipe(unsigned int *data, unsigned int offset, int count, unsigned int device, int *failures)
+command_length(const struct dump_command *command, unsigned int header)
 {
-    int length;
-
-    switch ((data[0] & MASK_GFXPIPE_SUBTYPE) >> SHIFT_GFXPIPE_SUBTYPE) {
-    case GFXPIPE_3D:
-        length = dump_gfxpipe_3d(data, offset, count, device, failures);
-        break;
+    if (command->length)
+        return command->length;
 
-    case GFXPIPE_BSD:
-        if (IS_GEN6(device))
-            length = dump_gfxpipe_mfx(data, offset, count, device, failures);
-        else
-            length = dump_gfxpipe_bsd(data, offset, count, device, failures);
+    switch ((header & MASK_CMD_TYPE) >> SHIFT_CMD_TYPE) {
+    case CMD_TYPE_MI:
+        return (header & 0x3f) + 2;
 
-        break;
+    case CMD_TYPE_BLT:
+        return (header & 0xff) + 2;
 
     default:
-        length = 1;
-        (*failures)++;
-        instr_out(data, offset, 0, "UNKNOWN GFXPIPE COMMAND\n");
-        break;
+        /* only the media and video commands use the whole length field */
+        if (((header & MASK_GFXPIPE_SUBTYPE) >> SHIFT_GFXPIPE_SUBTYPE) == GFXPIPE_BSD)
+            return ((header & MASK_GFXPIPE_LENGTH) >> SHIFT_GFXPIPE_LENGTH) + 2;
+
+        return (header & 0xff) + 2;
     }
+}
+
+int
+intel_batchbuffer_decode(const struct intel_batch_decode *decode,
+                         const unsigned int *data, const char **name)
+{
+    const struct dump_command *command = lookup_command(decode, data[0]);
 
-    return length;
+    if (!command) {
+        *name = NULL;
+        return 1;
+    }
+
+    *name = command->name;
+
+    return command_length(command, data[0]);
 }
 
-int intel_batchbuffer_dump(unsigned int *data, unsigned int offset, int count, unsigned int device)
+int
+intel_batchbuffer_dump(FILE *fp, const struct intel_batch_decode *decode,
+                       const unsigned int *data, int count)
 {
-    int index = 0;
-    int failures = 0;
+    const struct dump_command *command;
+    int index = 0, failures = 0;
+    unsigned int i;
 
-    gout = fopen("/tmp/bsd_command_dump.txt", "w+");
+    gout = fp;
+    gdecode = decode;
 
     while (index < count) {
-	switch ((data[index] & MASK_CMD_TYPE) >> SHIFT_CMD_TYPE) {
-	case CMD_TYPE_MI:
-	    index += dump_mi(data + index, offset + index * 4,
-                             count - index, device, &failures);
-	    break;
-
-	case CMD_TYPE_GFXPIPE:
-            index += dump_gfxpipe(data + index, offset + index * 4,
-                                  count - index, device, &failures);
-	    break;
-
-	default:
-	    instr_out(data, offset, index, "UNKNOWN COMMAND\n");
-	    failures++;
-	    index++;
-	    break;
-	}
-
-	fflush(gout);
-    }
+        unsigned int offset = index * 4;
 
-    fclose(gout);
+        command = lookup_command(decode, data[index]);
+        glast_index = 0;
+
+        if (!command) {
+            glength = 1;
+            instr_out(data + index, offset, 0, "UNKNOWN COMMAND\n");
+            failures++;
+            index++;
+            continue;
+        }
+
+        glength = command_length(command, data[index]);
+
+        if (glength > count - index) {
+            glength = count - index;
+            instr_out(data + index, offset, 0, "%s\n", command->name);
+            fprintf(gout, "Buffer size too small in %s (%d dwords left, %d needed)\n",
+                    command->name, count - index, command_length(command, data[index]));
+            failures++;
+            break;
+        }
+
+        instr_out(data + index, offset, 0, "%s\n", command->name);
+
+        if (command->detail)
+            command->detail(data + index, offset, decode->gen, &failures);
+
+        for (i = glast_index + 1; i < glength; i++)
+            instr_out(data + index, offset, i, "dword %d\n", i);
+
+        index += glength;
+    }
 
     return failures;
 }
-
-#endif
@@ -1,6 +1,9 @@
 #ifndef _INTEL_BATCHBUFFER_DUMP_H_
 #define _INTEL_BATCHBUFFER_DUMP_H_
 
+#include <stdio.h>
+#include <stdint.h>
+
 #define MASK_CMD_TYPE           0xE0000000
 
 #define SHIFT_CMD_TYPE          29
@@ -49,11 +52,66 @@
 
 #define OPCODE_MI_FLUSH                 0x04
 #define OPCODE_MI_BATCH_BUFFER_END      0x0A
-
-#ifdef I965_DEBUG
-
-int intel_batchbuffer_dump(unsigned int *data, unsigned int offset, int count, unsigned int device);
-
-#endif
+#define OPCODE_MI_BATCH_BUFFER_START    0x31
+
+/* BLT */
+#define MASK_BLT_OPCODE         0x1FC00000
+
+/*
+ * Batch capture file, written when VA_INTEL_BATCH_CAPTURE=<file> is set and
+ * read by i965_batch_analyze. It starts with INTEL_BATCH_CAPTURE_MAGIC and
+ * INTEL_BATCH_CAPTURE_VERSION, followed by records made of a struct
+ * intel_batch_capture_header, then for a batch its relocations and dwords.
+ * All the fields are in host order.
+ */
+#define INTEL_BATCH_CAPTURE_MAGIC       "I965BAT"       /* 8 bytes with the NUL */
+#define INTEL_BATCH_CAPTURE_VERSION     1
+
+enum intel_batch_capture_type {
+    INTEL_BATCH_CAPTURE_BATCH = 1,
+    INTEL_BATCH_CAPTURE_FRAME,          /* after each vaEndPicture() */
+};
+
+struct intel_batch_capture_header {
+    uint32_t type;
+    uint32_t gen;                       /* the fields below are for batches */
+    uint32_t ring;                      /* I915_EXEC_RENDER, ... */
+    uint32_t level;                     /* 2 for a second level batch */
+    uint32_t num_relocs;
+    uint32_t num_dwords;
+};
+
+#define INTEL_BATCH_RELOC_64    (1 << 0)
+
+/* A relocated dword, followed by the high one for INTEL_BATCH_RELOC_64 */
+struct intel_batch_reloc {
+    uint32_t index;
+    uint32_t delta;
+    uint32_t flags;
+};
+
+struct intel_batch_decode {
+    int gen;
+    int ring;                           /* 0 when unknown */
+    const struct intel_batch_reloc *relocs;     /* sorted by index */
+    int num_relocs;
+};
+
+/*
+ * Returns the length in dwords of the command at data, or 1 if it isn't
+ * known, and sets name to its name or NULL.
+ */
+int
+intel_batchbuffer_decode(const struct intel_batch_decode *decode,
+                         const unsigned int *data, const char **name);
+
+/*
+ * Prints the count dwords of a batch, one line per dword, with relocated
+ * dwords shown by their delta so that batches can be compared. Returns the
+ * number of unknown or truncated commands.
+ */
+int
+intel_batchbuffer_dump(FILE *fp, const struct intel_batch_decode *decode,
+                       const unsigned int *data, int count);
 
 #endif /* _INTEL_BATCHBUFFER_DUMP_H_ */
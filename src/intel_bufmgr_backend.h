@@ -0,0 +1,301 @@
+/*
+ * intel_bufmgr_backend.h - pluggable buffer manager
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _INTEL_BUFMGR_BACKEND_H_
+#define _INTEL_BUFMGR_BACKEND_H_
+
+#include <stdint.h>
+#include <intel_bufmgr.h>
+
+#include "intel_compiler.h"
+#include "i965_stats.h"
+
+struct drm_clip_rect;
+
+/**
+ * The driver calls the dri_bo_* and drm_intel_* buffer functions as usual.
+ * They resolve to the intel_bo_* functions below, which go to libdrm_intel
+ * unless intel_bufmgr_backend is set by intel_memman_init(), e.g. to the
+ * host-memory buffer manager of intel_mock_bufmgr.h. The backend is chosen
+ * from the environment, so it is process wide as well.
+ */
+struct intel_bufmgr_backend
+{
+    dri_bo *(*bo_alloc)(dri_bufmgr *bufmgr, const char *name,
+                        unsigned long size, unsigned int alignment);
+    dri_bo *(*bo_alloc_tiled)(dri_bufmgr *bufmgr, const char *name,
+                              int x, int y, int cpp, uint32_t *tiling_mode,
+                              unsigned long *pitch, unsigned long flags);
+    dri_bo *(*bo_create_from_name)(dri_bufmgr *bufmgr, const char *name,
+                                   unsigned int handle);
+    dri_bo *(*bo_create_from_prime)(dri_bufmgr *bufmgr, int prime_fd, int size);
+    void (*bo_reference)(dri_bo *bo);
+    void (*bo_unreference)(dri_bo *bo);
+    int (*bo_map)(dri_bo *bo, int write_enable);
+    int (*bo_unmap)(dri_bo *bo);
+    int (*bo_subdata)(dri_bo *bo, unsigned long offset,
+                      unsigned long size, const void *data);
+    int (*bo_get_subdata)(dri_bo *bo, unsigned long offset,
+                          unsigned long size, void *data);
+    void (*bo_wait_rendering)(dri_bo *bo);
+    int (*bo_busy)(dri_bo *bo);
+    int (*bo_emit_reloc)(dri_bo *bo, uint32_t offset,
+                         dri_bo *target_bo, uint32_t target_offset,
+                         uint32_t read_domains, uint32_t write_domain);
+    int (*bo_references)(dri_bo *bo, dri_bo *target_bo);
+    int (*bo_get_tiling)(dri_bo *bo, uint32_t *tiling_mode, uint32_t *swizzle_mode);
+    int (*bo_flink)(dri_bo *bo, uint32_t *name);
+    int (*bo_export_to_prime)(dri_bo *bo, int *prime_fd);
+    /* the type of intel_batchbuffer.run */
+    int (*bo_exec)(dri_bo *bo, int used,
+                   struct drm_clip_rect *cliprects, int num_cliprects,
+                   int DR4, unsigned int ring_flag);
+    void (*destroy)(dri_bufmgr *bufmgr);
+};
+
+/* NULL for libdrm_intel */
+extern const struct intel_bufmgr_backend *intel_bufmgr_backend;
+
+static INLINE dri_bo *
+intel_bo_alloc(dri_bufmgr *bufmgr, const char *name,
+               unsigned long size, unsigned int alignment)
+{
+    i965_stats_count(I965_STATS_BO_ALLOCS, 1);
+
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_alloc(bufmgr, name, size, alignment);
+
+    return drm_intel_bo_alloc(bufmgr, name, size, alignment);
+}
+
+static INLINE dri_bo *
+intel_bo_alloc_tiled(dri_bufmgr *bufmgr, const char *name,
+                     int x, int y, int cpp, uint32_t *tiling_mode,
+                     unsigned long *pitch, unsigned long flags)
+{
+    i965_stats_count(I965_STATS_BO_ALLOCS, 1);
+
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_alloc_tiled(bufmgr, name, x, y, cpp,
+                                                    tiling_mode, pitch, flags);
+
+    return drm_intel_bo_alloc_tiled(bufmgr, name, x, y, cpp,
+                                    tiling_mode, pitch, flags);
+}
+
+static INLINE dri_bo *
+intel_bo_create_from_name(dri_bufmgr *bufmgr, const char *name, unsigned int handle)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_create_from_name(bufmgr, name, handle);
+
+    return drm_intel_bo_gem_create_from_name(bufmgr, name, handle);
+}
+
+static INLINE dri_bo *
+intel_bo_create_from_prime(dri_bufmgr *bufmgr, int prime_fd, int size)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_create_from_prime(bufmgr, prime_fd, size);
+
+    return drm_intel_bo_gem_create_from_prime(bufmgr, prime_fd, size);
+}
+
+static INLINE void
+intel_bo_reference(dri_bo *bo)
+{
+    if (intel_bufmgr_backend)
+        intel_bufmgr_backend->bo_reference(bo);
+    else
+        drm_intel_bo_reference(bo);
+}
+
+static INLINE void
+intel_bo_unreference(dri_bo *bo)
+{
+    if (intel_bufmgr_backend)
+        intel_bufmgr_backend->bo_unreference(bo);
+    else
+        drm_intel_bo_unreference(bo);
+}
+
+static INLINE int
+intel_bo_map(dri_bo *bo, int write_enable)
+{
+    i965_stats_count(I965_STATS_BO_MAPS, 1);
+
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_map(bo, write_enable);
+
+    return drm_intel_bo_map(bo, write_enable);
+}
+
+static INLINE int
+intel_bo_unmap(dri_bo *bo)
+{
+    i965_stats_count(I965_STATS_BO_UNMAPS, 1);
+
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_unmap(bo);
+
+    return drm_intel_bo_unmap(bo);
+}
+
+/* host memory has no GTT, a CPU mapping stands for it */
+static INLINE int
+intel_bo_map_gtt(dri_bo *bo)
+{
+    i965_stats_count(I965_STATS_BO_MAPS, 1);
+
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_map(bo, 1);
+
+    return drm_intel_gem_bo_map_gtt(bo);
+}
+
+static INLINE int
+intel_bo_unmap_gtt(dri_bo *bo)
+{
+    i965_stats_count(I965_STATS_BO_UNMAPS, 1);
+
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_unmap(bo);
+
+    return drm_intel_gem_bo_unmap_gtt(bo);
+}
+
+static INLINE int
+intel_bo_subdata(dri_bo *bo, unsigned long offset,
+                 unsigned long size, const void *data)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_subdata(bo, offset, size, data);
+
+    return drm_intel_bo_subdata(bo, offset, size, data);
+}
+
+static INLINE int
+intel_bo_get_subdata(dri_bo *bo, unsigned long offset,
+                     unsigned long size, void *data)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_get_subdata(bo, offset, size, data);
+
+    return drm_intel_bo_get_subdata(bo, offset, size, data);
+}
+
+static INLINE void
+intel_bo_wait_rendering(dri_bo *bo)
+{
+    if (intel_bufmgr_backend)
+        intel_bufmgr_backend->bo_wait_rendering(bo);
+    else
+        drm_intel_bo_wait_rendering(bo);
+}
+
+static INLINE int
+intel_bo_busy(dri_bo *bo)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_busy(bo);
+
+    return drm_intel_bo_busy(bo);
+}
+
+static INLINE int
+intel_bo_emit_reloc(dri_bo *bo, uint32_t offset,
+                    dri_bo *target_bo, uint32_t target_offset,
+                    uint32_t read_domains, uint32_t write_domain)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_emit_reloc(bo, offset, target_bo, target_offset,
+                                                   read_domains, write_domain);
+
+    return drm_intel_bo_emit_reloc(bo, offset, target_bo, target_offset,
+                                   read_domains, write_domain);
+}
+
+static INLINE int
+intel_bo_references(dri_bo *bo, dri_bo *target_bo)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_references(bo, target_bo);
+
+    return drm_intel_bo_references(bo, target_bo);
+}
+
+static INLINE int
+intel_bo_get_tiling(dri_bo *bo, uint32_t *tiling_mode, uint32_t *swizzle_mode)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_get_tiling(bo, tiling_mode, swizzle_mode);
+
+    return drm_intel_bo_get_tiling(bo, tiling_mode, swizzle_mode);
+}
+
+static INLINE int
+intel_bo_flink(dri_bo *bo, uint32_t *name)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_flink(bo, name);
+
+    return drm_intel_bo_flink(bo, name);
+}
+
+static INLINE int
+intel_bo_export_to_prime(dri_bo *bo, int *prime_fd)
+{
+    if (intel_bufmgr_backend)
+        return intel_bufmgr_backend->bo_export_to_prime(bo, prime_fd);
+
+    return drm_intel_bo_gem_export_to_prime(bo, prime_fd);
+}
+
+/*
+ * Route the libdrm_intel names used through the driver, and the dri_bo_*
+ * compatibility names that expand to them, to the functions above.
+ */
+#define drm_intel_bo_alloc                      intel_bo_alloc
+#define drm_intel_bo_alloc_tiled                intel_bo_alloc_tiled
+#define drm_intel_bo_gem_create_from_name       intel_bo_create_from_name
+#define drm_intel_bo_gem_create_from_prime      intel_bo_create_from_prime
+#define drm_intel_bo_reference                  intel_bo_reference
+#define drm_intel_bo_unreference                intel_bo_unreference
+#define drm_intel_bo_map                        intel_bo_map
+#define drm_intel_bo_unmap                      intel_bo_unmap
+#define drm_intel_gem_bo_map_gtt                intel_bo_map_gtt
+#define drm_intel_gem_bo_unmap_gtt              intel_bo_unmap_gtt
+#define drm_intel_bo_subdata                    intel_bo_subdata
+#define drm_intel_bo_get_subdata                intel_bo_get_subdata
+#define drm_intel_bo_wait_rendering             intel_bo_wait_rendering
+#define drm_intel_bo_busy                       intel_bo_busy
+#define drm_intel_bo_emit_reloc                 intel_bo_emit_reloc
+#define drm_intel_bo_references                 intel_bo_references
+#define drm_intel_bo_get_tiling                 intel_bo_get_tiling
+#define drm_intel_bo_flink                      intel_bo_flink
+#define drm_intel_bo_gem_export_to_prime        intel_bo_export_to_prime
+
+#endif /* _INTEL_BUFMGR_BACKEND_H_ */
@@ -78,6 +78,33 @@ static void intel_driver_get_revid(struct intel_driver_data *intel, int *value)
 
 extern const struct intel_device_info *i965_get_device_info(int devid);
 
+/* No kernel to ask, assume the rings of the emulated device */
+static bool
+intel_driver_init_mock(struct intel_driver_data *intel)
+{
+    intel->fd = -1;
+    intel->dri2Enabled = 1;
+    intel->locked = 0;
+    pthread_mutex_init(&intel->ctxmutex, NULL);
+
+    intel->device_id = intel->mock_device_id;
+    intel->device_info = i965_get_device_info(intel->device_id);
+
+    if (!intel->device_info)
+        return false;
+
+    intel_memman_init(intel);
+
+    intel->has_exec2 = 1;
+    intel->has_bsd = 1;
+    intel->has_blt = 1;
+    intel->has_vebox = intel->device_info->gen >= 8 || IS_HASWELL(intel->device_info);
+    intel->has_bsd2 = 0;
+    intel->revision = 2;
+
+    return true;
+}
+
 bool 
 intel_driver_init(VADriverContextP ctx)
 {
@@ -94,6 +121,13 @@ intel_driver_init(VADriverContextP ctx)
     if (g_intel_debug_option_flags)
         fprintf(stderr, "g_intel_debug_option_flags:%x\n", g_intel_debug_option_flags);
 
+    intel->mock_device_id = 0;
+    if ((env_str = getenv("VA_INTEL_MOCK")))
+        intel->mock_device_id = strtol(env_str, NULL, 0);
+
+    if (intel->mock_device_id)
+        return intel_driver_init_mock(intel);
+
     assert(drm_state);
     assert(VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_DRI1) ||
            VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_DRI2) ||
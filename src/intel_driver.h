@@ -14,6 +14,11 @@
 #include "va_backend_compat.h"
 
 #include "intel_compiler.h"
+#include "i965_stats.h"
+#include "i965_trace.h"
+#include "intel_bufmgr_backend.h"
+
+struct intel_batchbuffer;
 
 #define BATCH_SIZE      0x80000
 #define BATCH_RESERVED  0x10
@@ -26,6 +31,7 @@
 
 #define MI_BATCH_BUFFER_END                     (CMD_MI | (0xA << 23))
 #define MI_BATCH_BUFFER_START                   (CMD_MI | (0x31 << 23))
+#define   MI_BATCH_BUFFER_START_SECOND_LEVEL            (0x1 << 22)
 
 #define MI_FLUSH                                (CMD_MI | (0x4 << 23))
 #define   MI_FLUSH_STATE_INSTRUCTION_CACHE_INVALIDATE   (0x1 << 0)
@@ -151,6 +157,7 @@ struct intel_driver_data
     int locked;
 
     dri_bufmgr *bufmgr;
+    int mock_device_id;                 /* VA_INTEL_MOCK, see intel_mock_bufmgr.h */
 
     unsigned int has_exec2  : 1; /* Flag: has execbuffer2? */
     unsigned int has_bsd    : 1; /* Flag: has bitstream decoder for H.264? */
@@ -159,6 +166,13 @@ struct intel_driver_data
     unsigned int has_bsd2   : 1; /* Flag: has the second BSD video ring unit */
 
     const struct intel_device_info *device_info;
+
+    /*
+     * Called by intel_batchbuffer_flush() before a batch which doesn't hold
+     * deferred work itself is submitted, to submit first the deferred work
+     * on the buffers it uses
+     */
+    void (*flush_deferred)(struct intel_driver_data *intel, struct intel_batchbuffer *batch);
 };
 
 bool intel_driver_init(VADriverContextP ctx);
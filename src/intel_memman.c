@@ -30,10 +30,22 @@
 #include <assert.h>
 
 #include "intel_driver.h"
+#include "intel_mock_bufmgr.h"
+
+/* Set once for the process, the buffers of all displays go through it */
+const struct intel_bufmgr_backend *intel_bufmgr_backend = NULL;
 
 Bool 
 intel_memman_init(struct intel_driver_data *intel)
 {
+    if (intel->mock_device_id) {
+        intel->bufmgr = intel_mock_bufmgr_init(intel->device_info->gen);
+        assert(intel->bufmgr);
+        intel_bufmgr_backend = &intel_mock_bufmgr_backend;
+
+        return True;
+    }
+
     intel->bufmgr = intel_bufmgr_gem_init(intel->fd, BATCH_SIZE);
     assert(intel->bufmgr);
     intel_bufmgr_gem_enable_reuse(intel->bufmgr);
@@ -50,6 +62,10 @@ intel_memman_init(struct intel_driver_data *intel)
 Bool 
 intel_memman_terminate(struct intel_driver_data *intel)
 {
-    drm_intel_bufmgr_destroy(intel->bufmgr);
+    if (intel_bufmgr_backend)
+        intel_bufmgr_backend->destroy(intel->bufmgr);
+    else
+        drm_intel_bufmgr_destroy(intel->bufmgr);
+
     return True;
 }
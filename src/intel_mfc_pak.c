@@ -0,0 +1,170 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Software generation of the AVC PAK objects from the VME output. It has no
+ * dependency on the rest of the driver, so that it can be checked against
+ * recorded VME output by i965_mfc_pak_test.
+ */
+
+#include "i965_defines.h"
+#include "intel_mfc_pak.h"
+
+#define		AVC_PAK_INTRA_RDO_OFFSET	4
+#define		AVC_PAK_INTER_RDO_OFFSET	10
+#define		AVC_PAK_INTER_MSG_OFFSET	8
+#define		AVC_PAK_INTER_MV_OFFSET		48
+#define		AVC_PAK_MSG_MV_OFFSET		4
+#define		AVC_PAK_RDO_MASK		0xFFFF
+
+#define		AVC_PAK_INTER_MODE_MASK		0x03
+#define		AVC_PAK_INTER_8X8		0x03
+#define		AVC_PAK_INTER_16X8		0x01
+#define		AVC_PAK_INTER_8X16		0x02
+#define		AVC_PAK_SUBMB_SHAPE_MASK	0x00FF00
+
+#define		AVC_PAK_INTER_MV8		(4 << 20)
+#define		AVC_PAK_INTER_MV32		(6 << 20)
+
+#define		AVC_PAK_INTRA_MSG_FLAG		(1 << 13)
+#define		AVC_PAK_INTRA_MBTYPE_MASK	(0x1F0000)
+
+/* CbpDcY, CbpDcU and CbpDcV */
+#define		AVC_PAK_CBP_DC			((1 << 19) | (1 << 18) | (1 << 17))
+
+/*
+ * Fills the MFC_AVC_PAK_OBJECT commands (Gen8+ layout) of num_mbs
+ * consecutive macroblocks of one row, starting at (x, y), straight from the
+ * VME output. It produces the same dwords as emitting the macroblocks one
+ * by one, but doesn't touch the batchbuffer, so the result can be checked
+ * against recorded VME output. As before, the MVs of the inter macroblocks
+ * are expanded in place since the PAK object fetches them from there.
+ * Returns the number of dwords written
+ */
+int
+intel_mfc_avc_pak_object_row(unsigned int *cmd,
+                             unsigned char *vme_output,
+                             int size_block,
+                             int x, int y, int width_in_mbs,
+                             int num_mbs,
+                             int end_of_slice,
+                             int qp,
+                             int is_intra,
+                             const unsigned int *ref_index_in_mb)
+{
+    const unsigned int cmd_header = MFC_AVC_PAK_OBJECT | (INTEL_AVC_PAK_OBJECT_DWORDS - 2);
+    const unsigned int qp_dw = qp;
+    unsigned int * const cmd_start = cmd;
+    unsigned int offset = (y * width_in_mbs + x) * size_block;
+    unsigned int *msg, *mv_ptr, mode, inter_msg;
+    int i;
+
+    for (i = 0; i < num_mbs; i++, x++, offset += size_block) {
+        msg = (unsigned int *)(vme_output + offset);
+
+        if (is_intra ||
+            (msg[AVC_PAK_INTRA_RDO_OFFSET] & AVC_PAK_RDO_MASK) <
+            (msg[AVC_PAK_INTER_RDO_OFFSET] & AVC_PAK_RDO_MASK)) {
+            cmd[0] = cmd_header;
+            cmd[1] = 0;
+            cmd[2] = 0;
+            cmd[3] = AVC_PAK_CBP_DC |
+                (msg[0] & 0xC0FF) |
+                AVC_PAK_INTRA_MSG_FLAG |
+                ((msg[0] & AVC_PAK_INTRA_MBTYPE_MASK) >> 8);
+            cmd[4] = (0xFFFF << 16) | (y << 8) | x;     /* Code Block Pattern for Y */
+            cmd[5] = 0x000F000F;                        /* Code Block Pattern */
+            cmd[6] = qp_dw;
+            cmd[7] = msg[1];                            /* Intra16x16, no 4x4 predmode */
+            cmd[8] = msg[2];
+            cmd[9] = msg[3] & 0xFF;
+            cmd[10] = 0;                                /* MaxSizeInWord and TargetSizeInWord */
+            cmd[11] = 0;
+            cmd += INTEL_AVC_PAK_OBJECT_DWORDS;
+            continue;
+        }
+
+        msg += AVC_PAK_INTER_MSG_OFFSET;
+        mv_ptr = msg + AVC_PAK_MSG_MV_OFFSET;
+        mode = msg[0] & AVC_PAK_INTER_MODE_MASK;
+
+        /* MV of VME output is based on 16 sub-blocks. So it is necessary
+         * to convert them to be compatible with the format of AVC_PAK
+         * command.
+         */
+        if (mode == AVC_PAK_INTER_8X16) {
+            /* MV[0] and MV[2] are replicated */
+            mv_ptr[4] = mv_ptr[0];
+            mv_ptr[5] = mv_ptr[1];
+            mv_ptr[2] = mv_ptr[8];
+            mv_ptr[3] = mv_ptr[9];
+            mv_ptr[6] = mv_ptr[8];
+            mv_ptr[7] = mv_ptr[9];
+        } else if (mode == AVC_PAK_INTER_16X8) {
+            /* MV[0] and MV[1] are replicated */
+            mv_ptr[2] = mv_ptr[0];
+            mv_ptr[3] = mv_ptr[1];
+            mv_ptr[4] = mv_ptr[16];
+            mv_ptr[5] = mv_ptr[17];
+            mv_ptr[6] = mv_ptr[24];
+            mv_ptr[7] = mv_ptr[25];
+        } else if (mode == AVC_PAK_INTER_8X8 &&
+                   !(msg[1] & AVC_PAK_SUBMB_SHAPE_MASK)) {
+            /* Don't touch MV[0] or MV[1] */
+            mv_ptr[2] = mv_ptr[8];
+            mv_ptr[3] = mv_ptr[9];
+            mv_ptr[4] = mv_ptr[16];
+            mv_ptr[5] = mv_ptr[17];
+            mv_ptr[6] = mv_ptr[24];
+            mv_ptr[7] = mv_ptr[25];
+        }
+
+        inter_msg = (msg[0] & 0x1F00FFFF) | AVC_PAK_INTER_MV8 | AVC_PAK_CBP_DC;
+
+        if (mode == AVC_PAK_INTER_8X8 && (msg[1] & AVC_PAK_SUBMB_SHAPE_MASK)) {
+            cmd[1] = 128;                               /* 128 MVs */
+            inter_msg |= AVC_PAK_INTER_MV32;
+        } else
+            cmd[1] = 32;                                /* 32 MVs */
+
+        cmd[0] = cmd_header;
+        cmd[2] = offset + AVC_PAK_INTER_MV_OFFSET;
+        cmd[3] = inter_msg;
+        cmd[4] = (0xFFFF << 16) | (y << 8) | x;         /* Code Block Pattern for Y */
+        cmd[5] = 0x000F000F;                            /* Code Block Pattern */
+        cmd[6] = qp_dw;
+        cmd[7] = msg[1] >> 8;
+        cmd[8] = ref_index_in_mb[0];
+        cmd[9] = ref_index_in_mb[1];
+        cmd[10] = 0;                                    /* MaxSizeInWord and TargetSizeInWord */
+        cmd[11] = 0;
+        cmd += INTEL_AVC_PAK_OBJECT_DWORDS;
+    }
+
+    /* Last MB */
+    if (end_of_slice && num_mbs > 0)
+        cmd[6 - INTEL_AVC_PAK_OBJECT_DWORDS] |= (1 << 26);
+
+    return cmd - cmd_start;
+}
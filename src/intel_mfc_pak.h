@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _INTEL_MFC_PAK_H_
+#define _INTEL_MFC_PAK_H_
+
+#include <stdint.h>
+
+/* Length of the Gen8+ MFC_AVC_PAK_OBJECT command */
+#define INTEL_AVC_PAK_OBJECT_DWORDS     12
+
+/*
+ * VME output dump, written when VA_INTEL_VME_DUMP=<file> is set and read
+ * by i965_mfc_pak_test. Each picture is a struct intel_mfc_vme_dump_header
+ * followed by width_in_mbs * height_in_mbs records of size_block bytes, as
+ * output by the VME stage before the PAK objects are generated. All the
+ * fields are in host order.
+ */
+struct intel_mfc_vme_dump_header {
+    uint32_t width_in_mbs;
+    uint32_t height_in_mbs;
+    uint32_t size_block;
+    uint32_t is_intra;
+    uint32_t qp;
+    uint32_t ref_index_in_mb[2];
+};
+
+extern int
+intel_mfc_avc_pak_object_row(unsigned int *cmd,
+                             unsigned char *vme_output,
+                             int size_block,
+                             int x, int y, int width_in_mbs,
+                             int num_mbs,
+                             int end_of_slice,
+                             int qp,
+                             int is_intra,
+                             const unsigned int *ref_index_in_mb);
+
+#endif /* _INTEL_MFC_PAK_H_ */
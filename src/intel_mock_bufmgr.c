@@ -0,0 +1,551 @@
+/*
+ * intel_mock_bufmgr.c - host-memory buffer manager
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "intel_driver.h"
+#include "intel_mock_bufmgr.h"
+#include "intel_batchbuffer_dump.h"
+
+/* Fake graphics addresses, handed out in turn and wrapped at 4GB */
+#define MOCK_OFFSET_START       0x10000
+#define MOCK_OFFSET_END         0x100000000ULL
+
+/* Indexed by I915_EXEC_RING_MASK */
+#define MOCK_NUM_RINGS          8
+
+struct intel_mock_bufmgr_stats
+{
+    unsigned int num_bos;
+    unsigned int max_bos;
+    unsigned long long bytes;
+    unsigned long long max_bytes;
+    unsigned long long num_relocs;
+    unsigned long long num_execs;
+    unsigned long long exec_bytes;
+};
+
+struct intel_mock_bufmgr
+{
+    int gen;
+    int dump;
+    /* time each batch keeps its ring busy, 0 for none */
+    uint64_t ring_latency_ns;
+    /* when each ring is done with the batches submitted so far */
+    uint64_t ring_idle_ns[MOCK_NUM_RINGS];
+    pthread_mutex_t lock;
+    uint64_t next_offset;
+    unsigned int next_handle;
+    struct intel_mock_bufmgr_stats stats;
+};
+
+struct intel_mock_reloc
+{
+    uint32_t offset;
+    dri_bo *target_bo;
+    uint32_t target_offset;
+    uint32_t read_domains;
+    uint32_t write_domain;
+};
+
+struct intel_mock_bo
+{
+    dri_bo base;
+    int refcount;
+    int map_count;
+    uint32_t tiling_mode;
+    void *mem;
+    struct intel_mock_reloc *relocs;
+    int num_relocs;
+    int max_relocs;
+    /* when the last batch using the buffer is done, under the bufmgr lock */
+    uint64_t busy_until_ns;
+};
+
+static inline struct intel_mock_bufmgr *
+mock_bufmgr(dri_bufmgr *bufmgr)
+{
+    return (struct intel_mock_bufmgr *)bufmgr;
+}
+
+static inline struct intel_mock_bo *
+mock_bo(dri_bo *bo)
+{
+    return (struct intel_mock_bo *)bo;
+}
+
+static dri_bo *
+mock_bo_alloc(dri_bufmgr *bufmgr, const char *name,
+              unsigned long size, unsigned int alignment)
+{
+    struct intel_mock_bufmgr *mgr = mock_bufmgr(bufmgr);
+    struct intel_mock_bo *bo;
+
+    size = ALIGN(size, 4096);
+    bo = calloc(1, sizeof(*bo));
+
+    if (!bo)
+        return NULL;
+
+    if (posix_memalign(&bo->mem, 4096, size)) {
+        free(bo);
+        return NULL;
+    }
+
+    /* like GEM, a new buffer reads back zeroes */
+    memset(bo->mem, 0, size);
+    bo->refcount = 1;
+    bo->base.size = size;
+    bo->base.align = alignment;
+    bo->base.bufmgr = bufmgr;
+
+    if (alignment < 4096)
+        alignment = 4096;
+
+    pthread_mutex_lock(&mgr->lock);
+
+    mgr->next_offset = ALIGN(mgr->next_offset, (uint64_t)alignment);
+
+    if (mgr->next_offset + size > MOCK_OFFSET_END)
+        mgr->next_offset = MOCK_OFFSET_START;
+
+    bo->base.offset = mgr->next_offset;
+    bo->base.offset64 = mgr->next_offset;
+    bo->base.handle = ++mgr->next_handle;
+    mgr->next_offset += size;
+
+    mgr->stats.num_bos++;
+    mgr->stats.max_bos = MAX(mgr->stats.max_bos, mgr->stats.num_bos);
+    mgr->stats.bytes += size;
+    mgr->stats.max_bytes = MAX(mgr->stats.max_bytes, mgr->stats.bytes);
+
+    pthread_mutex_unlock(&mgr->lock);
+
+    return &bo->base;
+}
+
+/* Same layout as libdrm_intel for the tiling modes the driver asks for */
+static dri_bo *
+mock_bo_alloc_tiled(dri_bufmgr *bufmgr, const char *name,
+                    int x, int y, int cpp, uint32_t *tiling_mode,
+                    unsigned long *pitch, unsigned long flags)
+{
+    unsigned long stride = x * cpp;
+    dri_bo *bo;
+
+    switch (*tiling_mode) {
+    case I915_TILING_X:
+        stride = ALIGN(stride, 512);
+        y = ALIGN(y, 8);
+        break;
+
+    case I915_TILING_Y:
+        stride = ALIGN(stride, 128);
+        y = ALIGN(y, 32);
+        break;
+
+    default:
+        *tiling_mode = I915_TILING_NONE;
+        stride = ALIGN(stride, 64);
+        y = ALIGN(y, 2);
+        break;
+    }
+
+    bo = mock_bo_alloc(bufmgr, name, stride * y, 4096);
+
+    if (bo) {
+        mock_bo(bo)->tiling_mode = *tiling_mode;
+        *pitch = stride;
+    }
+
+    return bo;
+}
+
+/* There is no other process to share buffers with */
+static dri_bo *
+mock_bo_create_from_name(dri_bufmgr *bufmgr, const char *name, unsigned int handle)
+{
+    return NULL;
+}
+
+static dri_bo *
+mock_bo_create_from_prime(dri_bufmgr *bufmgr, int prime_fd, int size)
+{
+    return NULL;
+}
+
+static void
+mock_bo_reference(dri_bo *bo)
+{
+    __atomic_add_fetch(&mock_bo(bo)->refcount, 1, __ATOMIC_RELAXED);
+}
+
+static void
+mock_bo_unreference(dri_bo *bo)
+{
+    struct intel_mock_bo *mbo = mock_bo(bo);
+    struct intel_mock_bufmgr *mgr;
+    int i;
+
+    if (!bo)
+        return;
+
+    if (__atomic_sub_fetch(&mbo->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    for (i = 0; i < mbo->num_relocs; i++)
+        mock_bo_unreference(mbo->relocs[i].target_bo);
+
+    mgr = mock_bufmgr(bo->bufmgr);
+    pthread_mutex_lock(&mgr->lock);
+    mgr->stats.num_bos--;
+    mgr->stats.bytes -= bo->size;
+    pthread_mutex_unlock(&mgr->lock);
+
+    free(mbo->relocs);
+    free(mbo->mem);
+    free(mbo);
+}
+
+static uint64_t
+mock_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t
+mock_bo_busy_until(dri_bo *bo)
+{
+    struct intel_mock_bufmgr *mgr = mock_bufmgr(bo->bufmgr);
+    uint64_t busy_until_ns;
+
+    pthread_mutex_lock(&mgr->lock);
+    busy_until_ns = mock_bo(bo)->busy_until_ns;
+    pthread_mutex_unlock(&mgr->lock);
+
+    return busy_until_ns;
+}
+
+static void
+mock_bo_wait_rendering(dri_bo *bo)
+{
+    uint64_t busy_until_ns = mock_bo_busy_until(bo);
+    uint64_t now_ns = mock_now_ns();
+    struct timespec ts;
+
+    if (busy_until_ns <= now_ns)
+        return;
+
+    ts.tv_sec = (busy_until_ns - now_ns) / 1000000000ull;
+    ts.tv_nsec = (busy_until_ns - now_ns) % 1000000000ull;
+    while (nanosleep(&ts, &ts))
+        ;
+}
+
+static int
+mock_bo_busy(dri_bo *bo)
+{
+    return mock_bo_busy_until(bo) > mock_now_ns();
+}
+
+static int
+mock_bo_map(dri_bo *bo, int write_enable)
+{
+    struct intel_mock_bo *mbo = mock_bo(bo);
+
+    /* like GEM, mapping waits for the GPU */
+    mock_bo_wait_rendering(bo);
+    mbo->map_count++;
+    bo->virtual = mbo->mem;
+
+    return 0;
+}
+
+static int
+mock_bo_unmap(dri_bo *bo)
+{
+    struct intel_mock_bo *mbo = mock_bo(bo);
+
+    if (mbo->map_count > 0 && --mbo->map_count == 0)
+        bo->virtual = NULL;
+
+    return 0;
+}
+
+static int
+mock_bo_subdata(dri_bo *bo, unsigned long offset,
+                unsigned long size, const void *data)
+{
+    assert(offset + size <= bo->size);
+    memcpy((char *)mock_bo(bo)->mem + offset, data, size);
+
+    return 0;
+}
+
+static int
+mock_bo_get_subdata(dri_bo *bo, unsigned long offset,
+                    unsigned long size, void *data)
+{
+    assert(offset + size <= bo->size);
+    memcpy(data, (char *)mock_bo(bo)->mem + offset, size);
+
+    return 0;
+}
+
+static int
+mock_bo_emit_reloc(dri_bo *bo, uint32_t offset,
+                   dri_bo *target_bo, uint32_t target_offset,
+                   uint32_t read_domains, uint32_t write_domain)
+{
+    struct intel_mock_bo *mbo = mock_bo(bo);
+    struct intel_mock_bufmgr *mgr = mock_bufmgr(bo->bufmgr);
+    struct intel_mock_reloc *reloc;
+
+    assert(offset + 4 <= bo->size);
+
+    if (mbo->num_relocs == mbo->max_relocs) {
+        int max_relocs = mbo->max_relocs ? mbo->max_relocs * 2 : 64;
+        struct intel_mock_reloc *relocs = realloc(mbo->relocs,
+                                                  max_relocs * sizeof(*relocs));
+
+        if (!relocs)
+            return -1;
+
+        mbo->relocs = relocs;
+        mbo->max_relocs = max_relocs;
+    }
+
+    reloc = &mbo->relocs[mbo->num_relocs++];
+    reloc->offset = offset;
+    reloc->target_bo = target_bo;
+    reloc->target_offset = target_offset;
+    reloc->read_domains = read_domains;
+    reloc->write_domain = write_domain;
+    mock_bo_reference(target_bo);
+
+    pthread_mutex_lock(&mgr->lock);
+    mgr->stats.num_relocs++;
+    pthread_mutex_unlock(&mgr->lock);
+
+    return 0;
+}
+
+static int
+mock_bo_references(dri_bo *bo, dri_bo *target_bo)
+{
+    struct intel_mock_bo *mbo = mock_bo(bo);
+    int i;
+
+    for (i = 0; i < mbo->num_relocs; i++) {
+        if (mbo->relocs[i].target_bo == target_bo ||
+            mock_bo_references(mbo->relocs[i].target_bo, target_bo))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+mock_bo_get_tiling(dri_bo *bo, uint32_t *tiling_mode, uint32_t *swizzle_mode)
+{
+    *tiling_mode = mock_bo(bo)->tiling_mode;
+    *swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+
+    return 0;
+}
+
+static int
+mock_bo_flink(dri_bo *bo, uint32_t *name)
+{
+    *name = bo->handle;
+
+    return 0;
+}
+
+static int
+mock_bo_export_to_prime(dri_bo *bo, int *prime_fd)
+{
+    return -1;
+}
+
+static void
+mock_bo_dump(dri_bo *bo, int used, int ring)
+{
+    struct intel_mock_bo *mbo = mock_bo(bo);
+    struct intel_batch_decode decode;
+    struct intel_batch_reloc *relocs;
+    int i;
+
+    relocs = calloc(mbo->num_relocs + 1, sizeof(*relocs));
+
+    if (!relocs)
+        return;
+
+    for (i = 0; i < mbo->num_relocs; i++) {
+        relocs[i].index = mbo->relocs[i].offset / 4;
+        relocs[i].delta = mbo->relocs[i].target_offset;
+    }
+
+    decode.gen = mock_bufmgr(bo->bufmgr)->gen;
+    decode.ring = ring;
+    decode.relocs = relocs;
+    decode.num_relocs = mbo->num_relocs;
+
+    fprintf(stderr, "i965 mock bufmgr: batch %u, %d bytes\n", bo->handle, used);
+    intel_batchbuffer_dump(stderr, &decode, mbo->mem, used / 4);
+    free(relocs);
+}
+
+/* Called with the bufmgr lock held */
+static uint64_t
+mock_bo_max_busy_until(dri_bo *bo)
+{
+    struct intel_mock_bo *mbo = mock_bo(bo);
+    uint64_t busy_until_ns = mbo->busy_until_ns;
+    int i;
+
+    for (i = 0; i < mbo->num_relocs; i++)
+        busy_until_ns = MAX(busy_until_ns, mock_bo_max_busy_until(mbo->relocs[i].target_bo));
+
+    return busy_until_ns;
+}
+
+/* Called with the bufmgr lock held */
+static void
+mock_bo_set_busy_until(dri_bo *bo, uint64_t busy_until_ns)
+{
+    struct intel_mock_bo *mbo = mock_bo(bo);
+    int i;
+
+    mbo->busy_until_ns = busy_until_ns;
+
+    for (i = 0; i < mbo->num_relocs; i++)
+        mock_bo_set_busy_until(mbo->relocs[i].target_bo, busy_until_ns);
+}
+
+/*
+ * With a ring latency, a batch starts once its ring is idle and the batches
+ * of the other rings using its buffers are done (the kernel's implicit
+ * synchronisation), and keeps its buffers busy for the latency
+ */
+static int
+mock_bo_exec(dri_bo *bo, int used,
+             struct drm_clip_rect *cliprects, int num_cliprects,
+             int DR4, unsigned int ring_flag)
+{
+    struct intel_mock_bufmgr *mgr = mock_bufmgr(bo->bufmgr);
+
+    assert(used > 0 && used <= bo->size);
+
+    pthread_mutex_lock(&mgr->lock);
+    mgr->stats.num_execs++;
+    mgr->stats.exec_bytes += used;
+
+    if (mgr->ring_latency_ns) {
+        uint64_t *ring_idle_ns = &mgr->ring_idle_ns[ring_flag & I915_EXEC_RING_MASK & (MOCK_NUM_RINGS - 1)];
+        uint64_t start_ns = MAX(mock_now_ns(), *ring_idle_ns);
+
+        start_ns = MAX(start_ns, mock_bo_max_busy_until(bo));
+        *ring_idle_ns = start_ns + mgr->ring_latency_ns;
+        mock_bo_set_busy_until(bo, *ring_idle_ns);
+    }
+
+    pthread_mutex_unlock(&mgr->lock);
+
+    if (mgr->dump)
+        mock_bo_dump(bo, used, ring_flag & I915_EXEC_RING_MASK);
+
+    return 0;
+}
+
+static void
+mock_bufmgr_destroy(dri_bufmgr *bufmgr)
+{
+    struct intel_mock_bufmgr *mgr = mock_bufmgr(bufmgr);
+    struct intel_mock_bufmgr_stats *stats = &mgr->stats;
+
+    fprintf(stderr,
+            "i965 mock bufmgr: %llu batches (%llu bytes), %llu relocations, "
+            "peak %u buffers (%llu bytes), %u buffers (%llu bytes) still allocated\n",
+            stats->num_execs, stats->exec_bytes, stats->num_relocs,
+            stats->max_bos, stats->max_bytes, stats->num_bos, stats->bytes);
+
+    pthread_mutex_destroy(&mgr->lock);
+    free(mgr);
+}
+
+const struct intel_bufmgr_backend intel_mock_bufmgr_backend = {
+    mock_bo_alloc,
+    mock_bo_alloc_tiled,
+    mock_bo_create_from_name,
+    mock_bo_create_from_prime,
+    mock_bo_reference,
+    mock_bo_unreference,
+    mock_bo_map,
+    mock_bo_unmap,
+    mock_bo_subdata,
+    mock_bo_get_subdata,
+    mock_bo_wait_rendering,
+    mock_bo_busy,
+    mock_bo_emit_reloc,
+    mock_bo_references,
+    mock_bo_get_tiling,
+    mock_bo_flink,
+    mock_bo_export_to_prime,
+    mock_bo_exec,
+    mock_bufmgr_destroy,
+};
+
+dri_bufmgr *
+intel_mock_bufmgr_init(int gen)
+{
+    struct intel_mock_bufmgr *mgr = calloc(1, sizeof(*mgr));
+    char *env_str = NULL;
+
+    if (!mgr)
+        return NULL;
+
+    mgr->gen = gen;
+    mgr->next_offset = MOCK_OFFSET_START;
+    pthread_mutex_init(&mgr->lock, NULL);
+
+    if ((env_str = getenv("VA_INTEL_MOCK_DUMP")))
+        mgr->dump = atoi(env_str);
+
+    if ((env_str = getenv("VA_INTEL_MOCK_RING_LATENCY")))
+        mgr->ring_latency_ns = strtoull(env_str, NULL, 0) * 1000;
+
+    return (dri_bufmgr *)mgr;
+}
@@ -0,0 +1,56 @@
+/*
+ * intel_mock_bufmgr.h - host-memory buffer manager
+ *
+ * Copyright (C) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _INTEL_MOCK_BUFMGR_H_
+#define _INTEL_MOCK_BUFMGR_H_
+
+#include "intel_bufmgr_backend.h"
+
+/**
+ * Buffer manager for running the driver on a machine without an Intel GPU.
+ * VA_INTEL_MOCK=<PCI device id> makes intel_driver_init() use it in place of
+ * libdrm_intel and the kernel: buffer objects live in host memory, the
+ * relocations are kept on their buffer and the batches are accepted but
+ * not executed. All the CPU side of decoding, encoding and processing runs
+ * as usual; the GPU written surfaces keep their previous content.
+ *
+ * The totals are printed to stderr when the display is terminated.
+ * VA_INTEL_MOCK_DUMP=1 also decodes every submitted batch to stderr with
+ * intel_batchbuffer_dump(), for the generation gen.
+ *
+ * VA_INTEL_MOCK_RING_LATENCY=<us> models the time each batch takes on its
+ * ring: a batch waits for the previous batch of its ring and for those of
+ * the other rings sharing its buffers, then keeps its buffers busy for that
+ * long. Mapping or waiting on a busy buffer sleeps until it is done, so the
+ * overlap between the rings shows in the wall clock time.
+ */
+
+extern const struct intel_bufmgr_backend intel_mock_bufmgr_backend;
+
+dri_bufmgr *
+intel_mock_bufmgr_init(int gen);
+
+#endif /* _INTEL_MOCK_BUFMGR_H_ */